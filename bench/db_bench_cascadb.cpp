@@ -61,6 +61,17 @@ static bool FLAGS_histogram = false;
 // Zero means use default setings.
 static size_t FLAGS_cache_size = 0;
 
+// Number of background threads cascading buffers.
+// Zero means writers cascade buffers by themselves.
+static size_t FLAGS_cascade_threads = 0;
+
+// Number of staging buffers in front of root.
+// Zero means writes go into root directly.
+static size_t FLAGS_staging_buffers = 0;
+
+// Order clean nodes're evicted from cache, "lru" or "2q".
+static Eviction FLAGS_eviction = kLRUEviction;
+
 // If true, do not destroy the existing database.  If you set this
 // flag and also specify a benchmark that wants a fresh database, that
 // benchmark will fail.
@@ -326,6 +337,14 @@ private:
                   fprintf(stdout,
                           "Compression: Quicklz\n");
                   break;
+              case kZstdCompress:
+                  fprintf(stdout,
+                          "Compression: Zstd\n");
+                  break;
+              case kLZ4Compress:
+                  fprintf(stdout,
+                          "Compression: LZ4\n");
+                  break;
               default:break;
           }
       } else 
@@ -550,10 +569,13 @@ private:
     Options opts;
     opts.dir = directory_;
     opts.comparator = comparator_;
-    opts.compress = kSnappyCompress;
+    opts.compress = FLAGS_method;
     if (FLAGS_cache_size) {
         opts.cache_limit = FLAGS_cache_size;
     }
+    opts.cascade_threads = FLAGS_cascade_threads;
+    opts.root_staging_buffers = FLAGS_staging_buffers;
+    opts.cache_eviction = FLAGS_eviction;
 
     char file_name[100];
     db_num_++;
@@ -663,6 +685,15 @@ int main(int argc, char** argv)
           FLAGS_use_existing_db = n;
         } else if(sscanf(argv[i], "--cache_size=%ld%c", &n, &junk) == 1) {
             FLAGS_cache_size = n;
+        } else if(sscanf(argv[i], "--cascade_threads=%ld%c", &n, &junk) == 1) {
+            FLAGS_cascade_threads = n;
+        } else if(sscanf(argv[i], "--staging_buffers=%ld%c", &n, &junk) == 1) {
+            FLAGS_staging_buffers = n;
+        } else if(strncmp(argv[i], "--eviction=", 11) == 0) {
+            if (strcmp(argv[i] + strlen("--eviction="), "2q") == 0)
+                FLAGS_eviction = k2QEviction;
+            else if (strcmp(argv[i] + strlen("--eviction="), "lru") == 0)
+                FLAGS_eviction = kLRUEviction;
         } else if(sscanf(argv[i], "--num=%ld%c", &n, &junk) == 1) {
             FLAGS_num = n;
         } else if (sscanf(argv[i], "--reads=%ld%c", &n, &junk) == 1) {
@@ -678,6 +709,10 @@ int main(int argc, char** argv)
                 FLAGS_method = kSnappyCompress;
             else if (strcmp(argv[i] + strlen("--rowformat="), "quicklz") == 0)
                 FLAGS_method = kQuicklzCompress;
+            else if (strcmp(argv[i] + strlen("--rowformat="), "zstd") == 0)
+                FLAGS_method = kZstdCompress;
+            else if (strcmp(argv[i] + strlen("--rowformat="), "lz4") == 0)
+                FLAGS_method = kLZ4Compress;
             else if (strcmp(argv[i] + strlen("--rowformat="), "no") == 0)
                 FLAGS_method = kNoCompress;
         } else {
@@ -6,13 +6,30 @@
 #define CASCADB_COMPARATOR_H_
 
 #include <assert.h>
+#include <typeinfo>
 #include "slice.h"
 
 namespace cascadb {
 
+// Comparators known to the tree, keys compared by them
+// can be compared inline inside hot loops without virtual calls
+enum ComparatorKind {
+    kCustomComparator,      // user defined, always call compare()
+    kLexicalComparator,     // ordered by memcmp
+    kInt32Comparator,       // native 32-bit signed integer
+    kUInt32Comparator,      // native 32-bit unsigned integer
+    kInt64Comparator,       // native 64-bit signed integer
+    kUInt64Comparator       // native 64-bit unsigned integer
+};
+
 class Comparator {
 public:
     virtual int compare(const Slice & s1, const Slice & s2) const = 0;
+
+    // Custom comparators should NOT override this,
+    // subclasses of built-in comparators're treated as custom ones
+    virtual ComparatorKind kind() const { return kCustomComparator; }
+
     virtual ~Comparator(){}
 };
 
@@ -22,6 +39,40 @@ public:
     {
         return s1.compare(s2);
     }
+
+    ComparatorKind kind() const
+    {
+        // subclass may override compare()
+        if (typeid(*this) != typeid(LexicalComparator)) {
+            return kCustomComparator;
+        }
+        return kLexicalComparator;
+    }
+};
+
+template<typename NumericType>
+struct NumericComparatorKind {
+    static const ComparatorKind value = kCustomComparator;
+};
+
+template<>
+struct NumericComparatorKind<int32_t> {
+    static const ComparatorKind value = kInt32Comparator;
+};
+
+template<>
+struct NumericComparatorKind<uint32_t> {
+    static const ComparatorKind value = kUInt32Comparator;
+};
+
+template<>
+struct NumericComparatorKind<int64_t> {
+    static const ComparatorKind value = kInt64Comparator;
+};
+
+template<>
+struct NumericComparatorKind<uint64_t> {
+    static const ComparatorKind value = kUInt64Comparator;
 };
 
 template<typename NumericType>
@@ -31,9 +82,20 @@ public:
     {
         assert(s1.size() == sizeof(NumericType) &&
                s2.size() == sizeof(NumericType));
-        NumericType *n1 = (NumericType*)s1.data();
-        NumericType *n2 = (NumericType*)s2.data();
-        return *n1 - *n2;
+        NumericType n1, n2;
+        memcpy(&n1, s1.data(), sizeof(NumericType));
+        memcpy(&n2, s2.data(), sizeof(NumericType));
+        // do not subtract, it overflows
+        return (n1 < n2) ? -1 : ((n1 > n2) ? 1 : 0);
+    }
+
+    ComparatorKind kind() const
+    {
+        // subclass may override compare()
+        if (typeid(*this) != typeid(NumericComparator<NumericType>)) {
+            return kCustomComparator;
+        }
+        return NumericComparatorKind<NumericType>::value;
     }
 };
 
@@ -6,6 +6,7 @@
 #define CASCADB_DB_H_
 
 #include <ostream>
+#include <vector>
 
 #include "slice.h"
 #include "comparator.h"
@@ -14,6 +15,27 @@
 
 namespace cascadb {
 
+// Invoked when an asynchronous get completes, value is valid only if
+// found is set, and should be destroyed by callee
+typedef void (*get_callback_t)(void* context, bool found, Slice value);
+
+// Invoked when an asynchronous write completes
+typedef void (*write_callback_t)(void* context, bool succ);
+
+// Build a database from records sorted by key, see DB::new_bulk_loader()
+class BulkLoader {
+public:
+    virtual ~BulkLoader() {}
+
+    // Append a record, keys must be added in strictly ascending order
+    virtual bool add(Slice key, Slice value) = 0;
+
+    // Write out nodes left and replace the empty tree with the one built,
+    // records're durable on return. Fails if database has been written
+    // since the loader was created
+    virtual bool finish() = 0;
+};
+
 class DB {
 public:
     virtual ~DB() {}
@@ -37,8 +59,43 @@ public:
         return true;
     }
 
+    // Get values of a batch of keys, keys're sorted and looked up in
+    // a single descent, and disk reads of leaves're issued in parallel.
+    // found[i] tells whether keys[i] exists, and values[i] holds its
+    // value, which should be destroyed by caller.
+    // Return the number of keys found
+    virtual size_t multi_get(const std::vector<Slice>& keys,
+                             std::vector<Slice>& values,
+                             std::vector<bool>& found) = 0;
+
+    // Asynchronous versions of get/put/del, they return immediately and
+    // callback is invoked with context after the operation completes,
+    // see Options::async_threads. Keys and values're copied, and
+    // operations on the same key complete in the order they're issued.
+    // They block when too many're queued, see Options::async_queue_limit.
+    // Callbacks of writes can be NULL
+    virtual void async_get(Slice key, get_callback_t cb, void* context) = 0;
+
+    virtual void async_put(Slice key, Slice value,
+                           write_callback_t cb, void* context) = 0;
+
+    virtual void async_del(Slice key, write_callback_t cb, void* context) = 0;
+
+    // Create a loader building the tree bottom-up, nodes're written
+    // sequentially without cascading through root buffers.
+    // Database must be empty and mustn't be written until the loader
+    // finishes, return NULL otherwise. Loader should be deleted by caller
+    virtual BulkLoader* new_bulk_loader() = 0;
+
     virtual void flush() = 0;
 
+    // Write a consistent copy of database into dest, which is opened as
+    // a database of the same name. Dirty nodes're flushed first, then
+    // blocks of the checkpoint're copied while reads and writes go on,
+    // see Options::checkpoint_rate. dest shouldn't be Options::dir.
+    // Return true if the copy is complete
+    virtual bool checkpoint(Directory* dest) = 0;
+
     virtual void debug_print(std::ostream& out) = 0;
 };
 
@@ -5,6 +5,8 @@
 #ifndef CASCADB_FILE_H_
 #define CASCADB_FILE_H_
 
+#include <vector>
+
 #include "slice.h"
 
 namespace cascadb {
@@ -76,8 +78,18 @@ public:
     // The context parameter will be passed back into callback
     virtual void async_write(uint64_t offset, Slice buf, void* context, aio_callback_t cb) = 0;
 
+    // prepare to write buffers back to back to file at specified offset,
+    // Callback will be invoked once after all buffers're written,
+    // The default implementation issues an async_write per buffer
+    virtual void async_writev(uint64_t offset, const std::vector<Slice>& bufs,
+                              void* context, aio_callback_t cb);
+
     virtual void truncate(uint64_t offset) {}
 
+    // block until all bytes written're durable, return true if
+    // succeeded, files not backed by disk have nothing to do
+    virtual bool sync() { return true; }
+
     virtual void close() = 0;
 
 private:
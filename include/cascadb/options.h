@@ -16,7 +16,17 @@ class Comparator;
 enum Compress {
     kNoCompress,      // No compression
     kSnappyCompress,  // Google's Snappy, used in leveldb
-    kQuicklzCompress  // Quicklz 1.5 final
+    kQuicklzCompress, // Quicklz 1.5 final
+    kZstdCompress,    // Zstandard, better ratio at compress_level
+    kLZ4Compress,     // LZ4 block format, faster than Snappy
+    kInheritCompress  // Same as Options::compress, for inner_node_compress
+                      // and leaf_node_compress only
+};
+
+enum Eviction {
+    kLRUEviction,     // Least recently used nodes first
+    k2QEviction       // Nodes read only once first, then leaves before
+                      // inner nodes, resists full scans
 };
 
 class Options {
@@ -40,16 +50,41 @@ public:
                                             // you should NOT use it
         leaf_node_record_count = -1;        // unlimited by default, leaved for writing unit test,
                                             // you should NOT use it
+        cascade_threads = 0;                // cascade inside writer threads by default
+        cascade_hard_limit = 200;           // 200%
+        root_staging_buffers = 0;           // write into root directly by default
+        root_staging_buffer_size = 64<<10;  // 64K
+        optimistic_read = false;            // read lock inner nodes by default
+        async_threads = 0;                  // async operations complete in caller threads by default
+        async_queue_limit = 1024;           // operations queued for each async thread
         cache_limit = 512 << 20;            // 512M, it's best to be set twice of the total size of inner nodes
         cache_dirty_high_watermark = 30;    // 30%
+        cache_dirty_stall_watermark = 60;   // 60%
+        cache_write_delay_max = 1000;       // 1ms
         cache_dirty_expire = 60000;         // 1 minute
         cache_writeback_ratio = 1;          // 1%
         cache_writeback_interval = 100;     // 100ms
         cache_evict_ratio = 1;              // 1%
         cache_evict_high_watermark = 95;    //95%
+        cache_eviction = kLRUEviction;
+        cache_secondary_limit = 0;          // no secondary cache by default
+        cache_warmup = false;
 
         compress = kNoCompress;
+        inner_node_compress = kInheritCompress; // same as compress by default
+        leaf_node_compress = kInheritCompress;  // same as compress by default
+        compress_level = 3;                 // zstd's default level
+        compress_bypass_ratio = 90;         // 90%
+        compress_dict_size = 0;             // no dictionary by default
+        compress_threads = 0;               // compress inside flushing and loading threads by default
+        compress_parallel_threshold = 1<<20; // 1M
         check_crc = false;
+        io_buffer_pool_size = 64<<20;       // 64M
+        io_buffer_huge_pages = false;
+        vectored_write_threshold = 1<<20;   // 1M
+        keep_compressed_subblocks = false;
+        index_delta_ratio = 25;
+        checkpoint_rate = 64<<20;   // 64M per second
     }
 
     /******************************
@@ -86,6 +121,44 @@ public:
     // For writing testcase
     size_t leaf_node_record_count;
 
+    // Number of background threads cascading full buffers of inner nodes
+    // down to children. If it's 0, the writer filling up a buffer
+    // cascades it by itself.
+    size_t cascade_threads;
+
+    // When buffered messages in an inner node exceeds this level
+    // before background threads catch up, writers start to cascade
+    // by themselves, in percentage of inner_node_page_size and
+    // inner_node_msg_count
+    unsigned int cascade_hard_limit;
+
+    // Number of staging buffers in front of root node. Writes're sharded
+    // among them by key so concurrent writers rarely contend, and
+    // they're merged into root in batches. If it's 0, writes go
+    // into root directly.
+    size_t root_staging_buffers;
+
+    // When a staging buffer grows larger than this, it's merged into root,
+    // in bytes
+    size_t root_staging_buffer_size;
+
+    // If true, readers don't lock inner nodes, they validate node versions
+    // instead, and lock nodes only after conflicts with writers.
+    // Upper levels of tree're read by every reader, this saves them
+    // from contending on latches.
+    bool optimistic_read;
+
+    // Number of background threads serving async_get/async_put/async_del,
+    // disk reads and write throttling block them rather than callers.
+    // Operations on the same key're served one at a time in order, those
+    // queued behind a blocked one're taken by idle threads.
+    // If it's 0, they complete inside caller threads.
+    size_t async_threads;
+
+    // Maximum number of operations queued for each async thread, callers
+    // issuing more're blocked until they're taken, 0 for no limit
+    size_t async_queue_limit;
+
     /******************************
              Cache Parameters
     ******************************/
@@ -97,6 +170,16 @@ public:
     // in percentage * 100
     unsigned int cache_dirty_high_watermark;
 
+    // When dirty nodes grow between cache_dirty_high_watermark and this
+    // level, writes're delayed gradually to let writeback catch up;
+    // beyond it, writes're stopped until dirty nodes drop below,
+    // in percentage * 100
+    unsigned int cache_dirty_stall_watermark;
+
+    // Delay of a write when dirty nodes're right below
+    // cache_dirty_stall_watermark, in microseconds
+    unsigned int cache_write_delay_max;
+
     // When dirty node is elder than this, start writeback,
     // in milliseconds
     unsigned int cache_dirty_expire;
@@ -117,13 +200,108 @@ public:
     // in percentage * 100
     unsigned int cache_evict_high_watermark;
 
+    // Order clean nodes're evicted, k2QEviction keeps inner nodes and
+    // nodes read repeatedly in cache while leaves're read by full scans
+    Eviction cache_eviction;
+
+    // Maximum size of serialized clean nodes kept after they're
+    // evicted, a miss in cache is served from them rather than disk,
+    // 0 to disable, in bytes. When it's enabled, cached nodes keep
+    // a copy of the blocks they're read from or written to, which
+    // is counted against cache_limit
+    size_t cache_secondary_limit;
+
+    // Record ids of cached nodes when database is flushed or closed,
+    // and load them into cache in background when it's opened again
+    bool cache_warmup;
+
     /********************************
             Layout Parameters
     ********************************/
 
+    // Compression method of message buffers in inner nodes and
+    // buckets in leaves, blocks're tagged with the method they're
+    // compressed by, so it can be changed when database is reopened
     Compress compress;
 
+    // Override compress for inner nodes or leaves unless it's
+    // kInheritCompress, e.g. a fast codec for inner nodes which're
+    // rewritten often, and a strong one for cold leaves.
+    // kNoCompress keeps them uncompressed
+    Compress inner_node_compress;
+    Compress leaf_node_compress;
+
+    // Level of kZstdCompress, higher for better ratio but slower
+    int compress_level;
+
+    // Message buffers and buckets not compressed below this level are
+    // stored raw, so reading them doesn't pay for uncompression.
+    // A table producing incompressible blocks in a row stops trying
+    // except for a sample of blocks. In percentage of uncompressed size,
+    // 0 to keep compressed output regardless of ratio.
+    unsigned int compress_bypass_ratio;
+
+    // Size of the dictionary trained from message buffers and buckets
+    // compressed by kZstdCompress, in bytes. Small blocks compress much
+    // better with a dictionary, so buckets can be shrunk for point reads.
+    // It's trained once per table and stored in the data file,
+    // 0 to compress without dictionary.
+    size_t compress_dict_size;
+
+    // Number of threads shared by all nodes to compress and uncompress
+    // message buffers and buckets, which're independent of each other.
+    // Sub-blocks of a node larger than compress_parallel_threshold
+    // are processed in parallel when it's flushed or fully loaded.
+    // If it's 0, a node is processed by the thread flushing or loading it.
+    size_t compress_threads;
+
+    // Minimum size of a node to compress its sub-blocks in parallel,
+    // in bytes
+    size_t compress_parallel_threshold;
+
     bool check_crc;
+
+    // Freed buffers of block reads and writes're kept for reuse until
+    // they take up this size, 0 to free them at once, in bytes
+    size_t io_buffer_pool_size;
+
+    // Advise buffers of huge nodes to be backed by transparent
+    // huge pages, saves page faults and TLB misses of big flushes
+    bool io_buffer_huge_pages;
+
+    // Minimum size of a node to serialize its skeleton and sub-blocks
+    // into separate buffers, written out with a single vectored write
+    // rather than copied into one buffer. Each sub-block starts at a page
+    // boundary on disk, which costs less than a page per sub-block.
+    // Sub-blocks unchanged since the node was last written're left
+    // where they're on disk while they outweigh those written, so only
+    // the skeleton and changed sub-blocks're written out then.
+    // 0 to always write nodes from a single buffer, in bytes
+    size_t vectored_write_threshold;
+
+    // Keep compressed bytes of message buffers and buckets of nodes
+    // written by vectored write, those unchanged since are copied out
+    // rather than serialized and compressed again when the node is
+    // written as a whole the next time. It saves CPU only, as sub-blocks
+    // left on disk aren't compressed anyway. Compressed bytes kept
+    // aren't counted against cache_limit, enable it only when there's
+    // memory to spare beyond the cache.
+    bool keep_compressed_subblocks;
+
+    // Checkpoints write only block index entries changed since the
+    // last full index, the full index is written again when changes
+    // grow over this ratio of it. In percentage * 100, 0 to write the
+    // full index at each checkpoint.
+    // On open, only the header of the full index and the delta're
+    // read, the ratio bounds the delta read. Pages of the full index
+    // and their crcs're read on demand by lookups, and by a background
+    // loader which finds holes as well
+    unsigned int index_delta_ratio;
+
+    // Maximum speed DB::checkpoint copies blocks to another directory,
+    // so foreground reads and writes aren't starved of disk bandwidth.
+    // In bytes per second, 0 for no limit
+    size_t checkpoint_rate;
 };
 
 }
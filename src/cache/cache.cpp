@@ -6,6 +6,8 @@
 #include <sstream>
 #include <set>
 
+#include <string.h>
+
 #include "util/logger.h"
 #include "cache.h"
 
@@ -19,14 +21,6 @@ static void* flusher_main(void *arg)
     return NULL;
 }
 
-class LRUComparator {
-public:
-    bool operator() (Node* x, Node* y)
-    {
-        return x->get_last_used_timestamp() < y->get_last_used_timestamp();
-    }
-};
-
 class FirstWriteComparator {
 public:
     bool operator() (Node* x, Node* y)
@@ -38,18 +32,33 @@ public:
 Cache::Cache(const Options& options)
 : options_(options), 
   size_(0),
+  dirty_size_(0),
+  written_count_(0),
+  vectored_count_(0),
+  based_count_(0),
+  policy_(new_eviction_policy(options)),
+  secondary_(NULL),
   alive_(false),
   flusher_(NULL)
 {
+    if (options_.cache_secondary_limit) {
+        secondary_ = new SecondaryCache(options_.cache_secondary_limit);
+    }
 }
 
 Cache::~Cache()
 {
+    while (prefetches_.size()) {
+        stop_prefetch(prefetches_.begin()->first);
+    }
+
     alive_ = false;
     if (flusher_) {
         flusher_->join();
         delete flusher_;
     }
+    delete policy_;
+    delete secondary_;
 }
 
 bool Cache::init()
@@ -100,27 +109,61 @@ void Cache::flush_table(const std::string& tbn)
 
     ScopedMutex global_lock(&global_mtx_);
 
-    nodes_lock_.write_lock();
-    for(map<CacheKey, Node*>::iterator it = nodes_.begin();
-        it != nodes_.end(); it++ ) {
-        if (it->first.tbn  == tbn) {
-            Node *node = it->second;
-            if (node->is_dead()) {
-                zombies.push_back(node);
-                nodes_.erase(it);
-            } else {
-                size_t sz = node->size();
-                // TODO: flush all node
-                if (node->is_dirty() && !node->is_flushing() && node->pin() == 0) {
-                    node->write_lock();
-                    node->set_flushing(true);
-                    dirty_nodes.push_back(node);
-                    dirty_size += sz;
+    // dirty nodes're all locked at once, so that they're written as
+    // a consistent cut of the tree while it's being written.
+    // Writers may hold a node while waiting for nodes map, so nodes
+    // are only tried, and all of them're released to start over
+    // if any is busy or still being written
+    while (true) {
+        Node *busy = NULL;
+
+        nodes_lock_.write_lock();
+        for(map<CacheKey, Node*>::iterator it = nodes_.begin();
+            it != nodes_.end(); ) {
+            if (it->first.tbn  == tbn) {
+                Node *node = it->second;
+                if (node->is_dead()) {
+                    zombies.push_back(node);
+                    nodes_.erase(it++);
+                    continue;
+                } else if (node->is_dirty() && node->pin() == 0) {
+                    if (!node->is_flushing() && node->try_write_lock()) {
+                        dirty_nodes.push_back(node);
+                        dirty_size += node->size();
+                    } else {
+                        busy = node;
+                        busy->inc_ref();
+                        break;
+                    }
                 }
             }
+            it++;
+        }
+        nodes_lock_.unlock();
+
+        if (busy == NULL) {
+            break;
+        }
+
+        for (size_t i = 0; i < dirty_nodes.size(); i++) {
+            dirty_nodes[i]->unlock();
+        }
+        dirty_nodes.clear();
+        dirty_size = 0;
+
+        // wait for the busy one without holding anything
+        if (busy->is_flushing()) {
+            cascadb::usleep(1000);
+        } else {
+            busy->write_lock();
+            busy->unlock();
         }
+        busy->dec_ref();
+    }
+
+    for (size_t i = 0; i < dirty_nodes.size(); i++) {
+        dirty_nodes[i]->set_flushing(true);
     }
-    nodes_lock_.unlock();
 
     if (dirty_nodes.size()) {
         LOG_INFO("flush table " << tbn << ", write " << dirty_nodes.size() << " nodes, "
@@ -140,6 +183,8 @@ void Cache::flush_table(const std::string& tbn)
 
 void Cache::del_table(const std::string& tbn, bool flush)
 {
+    stop_prefetch(tbn);
+
     if(flush) {
         flush_table(tbn);
     }
@@ -160,18 +205,24 @@ void Cache::del_table(const std::string& tbn, bool flush)
     nodes_lock_.write_lock();
     // TODO: improve me
     for(map<CacheKey, Node*>::iterator it = nodes_.begin();
-        it != nodes_.end(); it++ ) {
+        it != nodes_.end(); ) {
         if (it->first.tbn  == tbn) {
             Node *node = it->second;
             assert(node->ref() == 0);
             delete node;
             
-            nodes_.erase(it);
+            nodes_.erase(it++);
             total_count ++;
+        } else {
+            it++;
         }
     }
     nodes_lock_.unlock();
 
+    if (secondary_) {
+        secondary_->erase_table(tbn);
+    }
+
     global_lock.unlock();
 
     LOG_INFO("release " << total_count << " nodes in table " << tbn);
@@ -200,6 +251,7 @@ void Cache::put(const std::string& tbn, bid_t nid, Node* node)
     nodes_lock_.write_lock();
     assert(nodes_.find(key) == nodes_.end());
     nodes_[key] = node;
+    policy_->on_insert(node);
     node->inc_ref();
     nodes_lock_.unlock();
 }
@@ -234,15 +286,19 @@ Node* Cache::get(const std::string& tbn, bid_t nid, bool skeleton_only)
         }
     }
     
-    Block* block = tbs.layout->read(nid, skeleton_only);
-    if (block == NULL) return NULL;
+    node = load_secondary(tbn, nid, tbs);
+    if (node == NULL) {
+        Block* block = tbs.layout->read(nid, skeleton_only);
+        if (block == NULL) return NULL;
     
-    node = tbs.factory->new_node(nid);
-    BlockReader reader(block);
-    if (!node->read_from(reader, skeleton_only)) {
-        assert(false);
+        node = tbs.factory->new_node(nid);
+        BlockReader reader(block);
+        if (!node->read_from(reader, skeleton_only)) {
+            assert(false);
+        }
+        keep_image(node, block, skeleton_only);
+        tbs.layout->destroy(block);
     }
-    tbs.layout->destroy(block);
     
     nodes_lock_.write_lock();
     it = nodes_.find(key);
@@ -252,6 +308,7 @@ Node* Cache::get(const std::string& tbn, bid_t nid, bool skeleton_only)
         node = it->second;
     } else {
         nodes_[key] = node;
+        policy_->on_insert(node);
     }
     node->inc_ref();
     nodes_lock_.unlock();
@@ -313,6 +370,9 @@ void Cache::evict()
     size_t flushing_size = 0;
     size_t flushing_count = 0;
 
+    // dirty nodes and those being written
+    size_t unwritten_size = 0;
+
     size_t clean_size = 0;
     size_t clean_count = 0;
 
@@ -322,7 +382,7 @@ void Cache::evict()
     nodes_lock_.write_lock();
 
     for(map<CacheKey, Node*>::iterator it = nodes_.begin();
-        it != nodes_.end(); it++ ) {
+        it != nodes_.end(); ) {
 
         Node *node = it->second;
         assert(node->nid() == it->first.nid);
@@ -330,16 +390,19 @@ void Cache::evict()
         if (node->is_dead()) {
             if (node->ref() == 0) {
                 zombies.push_back(node);
-                nodes_.erase(it);
+                nodes_.erase(it++);
+                continue;
             }
         } else {
+            // images count against cache_limit, not as dirty data
             size_t size = node->size();
+            size_t cached = node->cached_size();
 
-            total_size += size;
+            total_size += cached;
             total_count ++;
 
             if (node->ref()) {
-                active_size += size;
+                active_size += cached;
                 active_count ++;
             }
 
@@ -353,27 +416,35 @@ void Cache::evict()
                 flushing_count ++;
             }
 
+            if (node->is_dirty() || node->is_flushing()) {
+                unwritten_size += size;
+            }
+
             // check everything again after ensure reference is 0
             if (node->ref() == 0 && !node->is_dead() 
                     && !node->is_dirty() && !node->is_flushing()) {
-                clean_size += size;
+                clean_size += cached;
                 clean_count ++;
                 clean_nodes.push_back(node);
             }
         }
+        it++;
     }
 
     ScopedMutex size_lock(&size_mtx_);
-    // update size
+    // update size, nodes being written're released on completion
     size_ = total_size;
+    dirty_size_ = unwritten_size;
     size_lock.unlock();
     
-    LRUComparator comp;
-    sort(clean_nodes.begin(), clean_nodes.end(), comp);
+    policy_->sort(clean_nodes);
 
     size_t goal = (options_.cache_limit * options_.cache_evict_ratio)/100;
     size_t evicted_size = 0;
     size_t evicted_count = 0;
+    vector<Node*> evicted_nodes;
+    vector<Layout*> evicted_layouts;
+    vector<uint64_t> evicted_offsets;
     
     for(size_t i = 0; i < clean_nodes.size(); i++) {
         if (evicted_size >= goal) break;
@@ -390,9 +461,24 @@ void Cache::evict()
             assert(false);
         }
 
-        evicted_size += node->size();
+        policy_->on_evict(node);
+        if (secondary_) {
+            // offset of the block the image's the same as, it's taken
+            // while nodes map is locked, as nodes're only rewritten
+            // while they're cached
+            TableSettings tbs;
+            tbs.layout = NULL;
+            uint64_t offset = 0;
+            if (get_table_settings(node->table_name(), tbs)) {
+                // offset 0 is superblock, for nodes never written
+                tbs.layout->get_block_offset(node->nid(), offset);
+            }
+            evicted_layouts.push_back(tbs.layout);
+            evicted_offsets.push_back(offset);
+        }
+        evicted_size += node->cached_size();
         evicted_count ++;
-        delete node;
+        evicted_nodes.push_back(node);
     }
 
     size_lock.lock();
@@ -403,6 +489,15 @@ void Cache::evict()
 
     nodes_lock_.unlock();
 
+    // nodes evicted're out of reach of anyone else now
+    for (size_t i = 0; i < evicted_nodes.size(); i++) {
+        if (secondary_) {
+            keep_secondary(evicted_nodes[i], evicted_layouts[i],
+                           evicted_offsets[i]);
+        }
+        delete evicted_nodes[i];
+    }
+
     // clear zombies
     if (zombies.size()) {
         delete_nodes(zombies);
@@ -428,7 +523,7 @@ void Cache::evict()
 void Cache::write_back()
 {
     while(alive_) {
-        Time current = now();
+        uint64_t current = coarse_now_micros();
         FirstWriteComparator comparator;
         size_t goal = (options_.cache_limit * 
             options_.cache_writeback_ratio)/100;
@@ -441,10 +536,15 @@ void Cache::write_back()
 
         size_t dirty_size = 0;
         size_t dirty_count = 0;
+        // dirty nodes and those being written
+        size_t unwritten_size = 0;
 
         vector<Node*> expired_nodes;
         size_t expired_size = 0;
 
+        // tables may be flushed or deleted meanwhile
+        ScopedMutex global_lock(&global_mtx_);
+
         nodes_lock_.read_lock();
         for(map<CacheKey, Node*>::iterator it = nodes_.begin();
             it != nodes_.end(); it++ ) {
@@ -452,20 +552,26 @@ void Cache::write_back()
 
             if (!node->is_dead()) {
                 size_t sz = node->size();
+                size_t cached = node->cached_size();
 
-                total_size += sz;
+                total_size += cached;
                 total_count ++;
                 if (node->ref()) {
-                    active_size += sz;
+                    active_size += cached;
                     active_count ++;
                 }
 
+                if (node->is_dirty() || node->is_flushing()) {
+                    unwritten_size += sz;
+                }
+
                 if (node->is_dirty()) {
                     dirty_size += sz;
                     dirty_count ++;
 
-                    bool expired = interval_us(node->get_first_write_timestamp(),
-                        current) > options_.cache_dirty_expire * 1000;
+                    uint64_t first_write = node->get_first_write_timestamp();
+                    bool expired = current > first_write && current - first_write >
+                        (uint64_t)options_.cache_dirty_expire * 1000;
 
                     // do not write node until last write is completed
                     if ( expired && !node->is_flushing() && node->pin() == 0) {
@@ -479,6 +585,7 @@ void Cache::write_back()
         ScopedMutex size_lock(&size_mtx_);
         // update size
         size_ = total_size;
+        dirty_size_ = unwritten_size;
         size_lock.unlock();
 
         nodes_lock_.unlock();
@@ -550,6 +657,8 @@ void Cache::write_back()
             flush_nodes(flushed_nodes);
         }
 
+        global_lock.unlock();
+
 #ifdef DEBUG_CACHE        
         LOG_TRACE("Total " << total_count << " nodes (" 
             << total_size << " bytes), " 
@@ -568,6 +677,326 @@ void Cache::write_back()
     }
 }
 
+void Cache::throttle()
+{
+    size_t high = (options_.cache_limit * 
+        options_.cache_dirty_high_watermark) / 100;
+    size_t stall = (options_.cache_limit * 
+        options_.cache_dirty_stall_watermark) / 100;
+
+    ScopedMutex size_lock(&size_mtx_);
+    if (dirty_size_ <= high) {
+        return;
+    }
+
+    if (dirty_size_ < stall) {
+        USecond delay = (USecond)(options_.cache_write_delay_max *
+            (double)(dirty_size_ - high) / (stall - high));
+        stall_stats_.delayed_count ++;
+        stall_stats_.delayed_us += delay;
+        size_lock.unlock();
+
+        usleep(delay);
+        return;
+    }
+
+    // dirty nodes're far beyond writeback, stop until it catches up
+    Time start = now();
+    while (alive_ && dirty_size_ >= stall) {
+        size_lock.unlock();
+        usleep(1000); // give up 1 millisecond
+        size_lock.lock();
+    }
+
+    USecond duration = interval_us(start, now());
+    stall_stats_.stopped_count ++;
+    stall_stats_.stopped_us += duration;
+    size_lock.unlock();
+
+    if (duration > 1000000) {
+        LOG_WARN("write stopped " << duration << " us waiting for writeback");
+    }
+}
+
+WriteStallStats Cache::write_stall_stats()
+{
+    ScopedMutex size_lock(&size_mtx_);
+    return stall_stats_;
+}
+
+class HeatComparator {
+public:
+    // hot nodes, inner nodes, and then recently used nodes first
+    bool operator() (Node* x, Node* y)
+    {
+        if (x->is_hot() != y->is_hot()) {
+            return x->is_hot();
+        }
+        if (IS_LEAF(x->nid()) != IS_LEAF(y->nid())) {
+            return !IS_LEAF(x->nid());
+        }
+        return x->get_last_used_timestamp() > y->get_last_used_timestamp();
+    }
+};
+
+void Cache::hot_nodes(const std::string& tbn, std::vector<bid_t>& nids)
+{
+    vector<Node*> nodes;
+
+    nodes_lock_.read_lock();
+    for (map<CacheKey, Node*>::iterator it = nodes_.begin();
+        it != nodes_.end(); it++) {
+        if (it->first.tbn == tbn && !it->second->is_dead()) {
+            nodes.push_back(it->second);
+        }
+    }
+
+    HeatComparator comp;
+    sort(nodes.begin(), nodes.end(), comp);
+    for (size_t i = 0; i < nodes.size(); i++) {
+        nids.push_back(nodes[i]->nid());
+    }
+    nodes_lock_.unlock();
+}
+
+void Cache::prefetch(const std::string& tbn, const std::vector<bid_t>& nids)
+{
+    stop_prefetch(tbn);
+
+    PrefetchTask *task = new PrefetchTask();
+    task->cache = this;
+    task->tbn = tbn;
+    task->nids = nids;
+    task->stop = false;
+    task->thread = new Thread(prefetch_main);
+
+    ScopedMutex lock(&prefetch_mtx_);
+    prefetches_[tbn] = task;
+    task->thread->start(task);
+}
+
+void Cache::stop_prefetch(const std::string& tbn)
+{
+    ScopedMutex lock(&prefetch_mtx_);
+    map<string, PrefetchTask*>::iterator it = prefetches_.find(tbn);
+    if (it == prefetches_.end()) {
+        return;
+    }
+    PrefetchTask *task = it->second;
+    prefetches_.erase(it);
+    lock.unlock();
+
+    atomic_store(&task->stop, true);
+    task->thread->join();
+    delete task->thread;
+    delete task;
+}
+
+void* Cache::prefetch_main(void *arg)
+{
+    PrefetchTask *task = (PrefetchTask*) arg;
+    task->cache->run_prefetch(task);
+    return NULL;
+}
+
+// number of reads issued together
+#define PREFETCH_BATCH_SIZE 16
+
+void Cache::run_prefetch(PrefetchTask *task)
+{
+    TableSettings tbs;
+    if (!get_table_settings(task->tbn, tbs)) {
+        return;
+    }
+
+    // read sequentially
+    vector<pair<uint64_t, bid_t> > blocks;
+    for (size_t i = 0; i < task->nids.size(); i++) {
+        uint64_t offset;
+        if (tbs.layout->get_block_offset(task->nids[i], offset)) {
+            blocks.push_back(make_pair(offset, task->nids[i]));
+        }
+    }
+    sort(blocks.begin(), blocks.end());
+
+    size_t count = 0;
+    size_t i = 0;
+    while (i < blocks.size() && !atomic_load(&task->stop) && !need_evict()) {
+        PrefetchBatch batch;
+        vector<PrefetchRead> reads;
+        reads.reserve(PREFETCH_BATCH_SIZE);
+
+        nodes_lock_.read_lock();
+        for (; i < blocks.size() && reads.size() < PREFETCH_BATCH_SIZE; i++) {
+            bid_t nid = blocks[i].second;
+            if (nodes_.find(CacheKey(task->tbn, nid)) == nodes_.end()) {
+                PrefetchRead read;
+                read.batch = &batch;
+                read.nid = nid;
+                read.block = NULL;
+                read.succ = false;
+                reads.push_back(read);
+            }
+        }
+        nodes_lock_.unlock();
+
+        batch.pending = reads.size();
+        for (size_t j = 0; j < reads.size(); j++) {
+            if (!tbs.layout->get_block_offset(reads[j].nid, reads[j].offset)) {
+                // deleted meanwhile
+                ScopedMutex lock(&batch.mtx);
+                batch.pending --;
+                continue;
+            }
+            Callback *cb = new Callback(this, &Cache::prefetch_complete, &reads[j]);
+            tbs.layout->async_read(reads[j].nid, &reads[j].block, cb);
+        }
+
+        ScopedMutex lock(&batch.mtx);
+        while (batch.pending) {
+            batch.cond.wait();
+        }
+        lock.unlock();
+
+        for (size_t j = 0; j < reads.size(); j++) {
+            if (!reads[j].succ) {
+                continue;
+            }
+
+            Node *node = tbs.factory->new_node(reads[j].nid);
+            BlockReader reader(reads[j].block);
+            bool ok = node->read_from(reader, false);
+            if (ok) {
+                keep_image(node, reads[j].block, false);
+            }
+            tbs.layout->destroy(reads[j].block);
+            if (!ok) {
+                LOG_ERROR("prefetch node error, nid " << reads[j].nid);
+                delete node;
+                continue;
+            }
+
+            // loaded meanwhile, or loaded, written and evicted meanwhile,
+            // the image read is stale if the block has been moved.
+            // Nodes're only rewritten while they're cached, so the check
+            // holds as long as nodes map is locked
+            nodes_lock_.write_lock();
+            CacheKey key(task->tbn, reads[j].nid);
+            uint64_t offset;
+            if (nodes_.find(key) == nodes_.end() &&
+                tbs.layout->get_block_offset(reads[j].nid, offset) &&
+                offset == reads[j].offset) {
+                nodes_[key] = node;
+                policy_->on_insert(node);
+
+                ScopedMutex size_lock(&size_mtx_);
+                size_ += node->cached_size();
+                size_lock.unlock();
+                count ++;
+            } else {
+                delete node;
+            }
+            nodes_lock_.unlock();
+        }
+    }
+
+    LOG_INFO("prefetch " << count << " nodes in table " << task->tbn);
+}
+
+void Cache::prefetch_complete(PrefetchRead *read, bool succ)
+{
+    read->succ = succ;
+
+    ScopedMutex lock(&read->batch->mtx);
+    read->batch->pending --;
+    read->batch->cond.notify();
+}
+
+void Cache::keep_image(Node *node, Block *block, bool skeleton)
+{
+    if (secondary_ == NULL) {
+        return;
+    }
+
+    Slice image = Slice::alloc(block->size());
+    memcpy((char*)image.data(), block->start(), block->size());
+    node->set_image(image, skeleton);
+}
+
+void Cache::keep_image(Node *node, const vector<Block*>& blocks)
+{
+    if (secondary_ == NULL) {
+        return;
+    }
+
+    // the same as blocks're laid out on disk, paddings included
+    size_t total = 0;
+    for (size_t i = 0; i + 1 < blocks.size(); i++) {
+        total += PAGE_ROUND_UP(blocks[i]->size());
+    }
+    total += blocks.back()->size();
+
+    Slice image = Slice::alloc(total);
+    memset((char*)image.data(), 0, total);
+    size_t pos = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        memcpy((char*)image.data() + pos, blocks[i]->start(), blocks[i]->size());
+        pos += PAGE_ROUND_UP(blocks[i]->size());
+    }
+    node->set_image(image, false);
+}
+
+void Cache::keep_secondary(Node *node, Layout *layout, uint64_t offset)
+{
+    bool skeleton;
+    Slice image = node->release_image(skeleton);
+    if (image.size() == 0) {
+        return;
+    }
+
+    // table may be deleted meanwhile, its images're erased after
+    // it's removed from tables, so mustn't be put back after that
+    tables_lock_.read_lock();
+    map<string, TableSettings>::iterator it = tables_.find(node->table_name());
+    if (it != tables_.end() && it->second.layout == layout) {
+        secondary_->put(node->table_name(), node->nid(), image, offset, skeleton);
+    } else {
+        image.destroy();
+    }
+    tables_lock_.unlock();
+}
+
+Node* Cache::load_secondary(const std::string& tbn, bid_t nid, TableSettings& tbs)
+{
+    if (secondary_ == NULL) {
+        return NULL;
+    }
+
+    uint64_t offset = 0;
+    tbs.layout->get_block_offset(nid, offset);
+
+    Slice data;
+    bool skeleton;
+    if (!secondary_->take(tbn, nid, offset, data, skeleton)) {
+        return NULL;
+    }
+
+    // node loaded from a skeleton image is skeleton loaded
+    // even if it's asked to be fully loaded, as it's read from disk
+    // when it's found in cache skeleton loaded
+    Node *node = tbs.factory->new_node(nid);
+    Block block(data, 0, data.size());
+    BlockReader reader(&block);
+    if (!node->read_from(reader, skeleton)) {
+        LOG_ERROR("deserialize node error, nid " << nid);
+        delete node;
+        data.destroy();
+        return NULL;
+    }
+    node->set_image(data, skeleton);
+    return node;
+}
+
 void Cache::flush_nodes(vector<Node*>& nodes)
 {
     LOG_TRACE("flush " << nodes.size() << " nodes");
@@ -586,18 +1015,36 @@ void Cache::flush_nodes(vector<Node*>& nodes)
         Layout *layout = tbs.layout;
         assert(layout);
 
-        size_t estimated_buffer_size = node->estimated_buffer_size();
-        Block *block = layout->create(estimated_buffer_size);
-        assert(block);
-        
         size_t skeleton_size;
-        BlockWriter writer(block);
-        if (!node->write_to(writer, skeleton_size)) {
-            assert(false);
+        std::vector<Block*> blocks;
+        BlockBase base = kNoBase;
+        bool vectored = node->write_vectored();
+        if (vectored) {
+            if (!node->write_to(layout, blocks, skeleton_size, base)) {
+                assert(false);
+            }
+        } else {
+            size_t estimated_buffer_size = node->estimated_buffer_size();
+            Block *block = layout->create(estimated_buffer_size);
+            assert(block);
+
+            BlockWriter writer(block);
+            if (!node->write_to(writer, skeleton_size)) {
+                assert(false);
+            }
+            assert(estimated_buffer_size >= block->size());
+            blocks.push_back(block);
+        }
+        for (size_t j = 0; j < blocks.size(); j++) {
+            blocks[j]->buffer().resize(PAGE_ROUND_UP(blocks[j]->size()));
+        }
+        if (vectored) {
+            keep_image(node, blocks);
+        } else {
+            keep_image(node, blocks[0], false);
         }
-        assert(estimated_buffer_size >= block->size());
-        block->buffer().resize(PAGE_ROUND_UP(block->size()));
         node->set_dirty(false);
+        size_t sz = node->size();
 
         // unlock node
         node->unlock();
@@ -605,11 +1052,21 @@ void Cache::flush_nodes(vector<Node*>& nodes)
         WriteCompleteContext *context = new WriteCompleteContext();
         context->node = node;
         context->layout = layout;
-        context->block = block;
+        context->blocks = blocks;
+        context->size = sz;
         Callback *cb = new Callback(this, &Cache::write_complete, context);
-        layout->async_write(nid, block, skeleton_size, cb);
-
+        // node may be evicted once it's written
         tables.insert(node->table_name());
+        atomic_add_fetch(&written_count_, (uint64_t)1);
+        if (vectored) {
+            atomic_add_fetch(&vectored_count_, (uint64_t)1);
+            if (base != kNoBase) {
+                atomic_add_fetch(&based_count_, (uint64_t)1);
+            }
+            layout->async_write(nid, blocks, skeleton_size, base, cb);
+        } else {
+            layout->async_write(nid, blocks[0], skeleton_size, cb);
+        }
     }
 
     Time current = now();
@@ -635,8 +1092,6 @@ void Cache::write_complete(WriteCompleteContext* context, bool succ)
     assert(node);
     Layout *layout = context->layout;
     assert(layout);
-    Block *block = context->block;
-    assert(block);
 
     if (succ) {
         LOG_TRACE("write node table " << node->table_name() << ", nid " << node->nid() << " ok" );
@@ -645,8 +1100,16 @@ void Cache::write_complete(WriteCompleteContext* context, bool succ)
         // TODO: handle the error
     }
 
+    // release throttled writers before the flusher scans again
+    ScopedMutex size_lock(&size_mtx_);
+    size_t sz = context->size;
+    dirty_size_ = dirty_size_ > sz ? dirty_size_ - sz : 0;
+    size_lock.unlock();
+
     node->set_flushing(false);
-    layout->destroy(block);
+    for (size_t i = 0; i < context->blocks.size(); i++) {
+        layout->destroy(context->blocks[i]);
+    }
     delete context;
 }
 
@@ -697,11 +1160,12 @@ void Cache::debug_print(std::ostream& out)
         Node *node = it->second;
         if (!node->is_dead()) {
             size_t size = node->size();
+            size_t cached = node->cached_size();
 
-            total_size += size;
+            total_size += cached;
             total_count ++;
             if (node->ref()) {
-                active_size += size;
+                active_size += cached;
                 active_count ++;
             }
 
@@ -712,7 +1176,7 @@ void Cache::debug_print(std::ostream& out)
                 flushing_size += size;
                 flushing_count ++;
             } else {
-                clean_size += size;
+                clean_size += cached;
                 clean_count ++;
             }
         }
@@ -732,4 +1196,23 @@ void Cache::debug_print(std::ostream& out)
         << clean_count << " clean nodes ("
         << clean_size << " bytes), "
         << endl;
+
+    WriteStallStats stats = write_stall_stats();
+    out << "Write delayed " << stats.delayed_count << " times ("
+        << stats.delayed_us << " us), "
+        << "stopped " << stats.stopped_count << " times ("
+        << stats.stopped_us << " us)"
+        << endl;
+
+    out << "Written " << atomic_load(&written_count_) << " nodes, "
+        << atomic_load(&vectored_count_) << " vectored, "
+        << atomic_load(&based_count_) << " with base"
+        << endl;
+
+    if (secondary_) {
+        out << "Secondary cache " << secondary_->size() << " bytes, "
+            << secondary_->hits() << " hits, "
+            << secondary_->misses() << " misses"
+            << endl;
+    }
 }
@@ -10,6 +10,8 @@
 #include "serialize/block.h"
 #include "serialize/layout.h"
 #include "sys/sys.h"
+#include "eviction.h"
+#include "secondary_cache.h"
 
 #include <map>
 #include <vector>
@@ -22,12 +24,30 @@ public:
     virtual ~NodeFactory(){}
 };
 
+// Statistics of writes delayed or stopped by Cache::throttle()
+struct WriteStallStats {
+    WriteStallStats()
+    : delayed_count(0), delayed_us(0),
+      stopped_count(0), stopped_us(0)
+    {
+    }
+
+    uint64_t    delayed_count;
+    uint64_t    delayed_us;
+    uint64_t    stopped_count;
+    uint64_t    stopped_us;
+};
+
 // Node cache of fixed size
 // When the percentage of dirty nodes reaches the high watermark, or get expired,
 // they're flushed out in the order of timestamp node is modified for the first time.
 // A reference count is maintained for each node, When cache is getting almost full,
 // clean nodes would be evicted if their reference count drops to 0.
-// Nodes're evicted in LRU order.
+// Nodes're evicted in the order decided by an EvictionPolicy,
+// LRU order by default. Evicted nodes're kept serialized in the
+// SecondaryCache if it's enabled.
+// Writers're throttled when dirty nodes grow faster than they can be
+// written back, rather than stalled abruptly when the cache is full.
 // Cache can be shared among multiple tables.
 
 class Cache {
@@ -58,6 +78,21 @@ public:
     // Sweep out dead nodes
     void write_back();
 
+    // Called before each write, delay it in proportion to how far dirty
+    // nodes exceed cache_dirty_high_watermark, and block it while dirty
+    // nodes exceed cache_dirty_stall_watermark
+    void throttle();
+
+    WriteStallStats write_stall_stats();
+
+    // Collect ids of nodes cached in a table, the hottest come first
+    void hot_nodes(const std::string& tbn, std::vector<bid_t>& nids);
+
+    // Load nodes of a table into cache in a background thread,
+    // batches of async reads're issued in the order of offsets in file,
+    // it stops when cache grows larger than high watermark
+    void prefetch(const std::string& tbn, const std::vector<bid_t>& nids);
+
     void debug_print(std::ostream& out);
 
 protected:
@@ -76,7 +111,7 @@ protected:
     // Test whether the cache grows larger than high watermark
     bool need_evict();
 
-    // Evict least recently used clean nodes to make room
+    // Evict clean nodes to make room
     void evict();
 
     void flush_nodes(std::vector<Node*>& nodes);
@@ -84,12 +119,63 @@ protected:
     struct WriteCompleteContext {
         Node            *node;
         Layout          *layout;
-        Block           *block;
+        std::vector<Block*> blocks;
+        // size of node when it's written
+        size_t          size;
     };
 
     void write_complete(WriteCompleteContext* context, bool succ);
 
     void delete_nodes(std::vector<Node*>& nodes);
+
+    struct PrefetchTask {
+        Cache                   *cache;
+        std::string             tbn;
+        std::vector<bid_t>      nids;
+        bool                    stop;
+        Thread                  *thread;
+    };
+
+    static void* prefetch_main(void *arg);
+
+    void run_prefetch(PrefetchTask *task);
+
+    // Stop prefetching nodes of a table and wait
+    void stop_prefetch(const std::string& tbn);
+
+    // Reads of a batch issued together
+    struct PrefetchBatch {
+        PrefetchBatch() : cond(&mtx), pending(0) {}
+
+        Mutex                   mtx;
+        CondVar                 cond;
+        size_t                  pending;
+    };
+
+    struct PrefetchRead {
+        PrefetchBatch           *batch;
+        bid_t                   nid;
+        // offset of the block when it's read
+        uint64_t                offset;
+        Block                   *block;
+        bool                    succ;
+    };
+
+    void prefetch_complete(PrefetchRead *read, bool succ);
+
+    // Keep a copy of block read or written for node as its image,
+    // only when secondary cache is enabled
+    void keep_image(Node *node, Block *block, bool skeleton);
+
+    void keep_image(Node *node, const std::vector<Block*>& blocks);
+
+    // Keep the image of a clean node evicted in secondary cache,
+    // offset is where its block was in layout when it's evicted
+    void keep_secondary(Node *node, Layout *layout, uint64_t offset);
+
+    // Load node from the image kept in secondary cache,
+    // return NULL if there is not any or it's stale
+    Node* load_secondary(const std::string& tbn, bid_t nid, TableSettings& tbs);
     
 private:
     Options options_;
@@ -103,6 +189,19 @@ private:
     // updated everytime the flusher thread runs
     size_t size_;   
 
+    // memory size occupied by dirty nodes and nodes being written,
+    // updated everytime the flusher thread runs and decreased when
+    // writes of nodes complete
+    size_t dirty_size_;
+
+    WriteStallStats stall_stats_;
+
+    // nodes written out, those of them written vectored, and those
+    // referencing sub-blocks of base, only shown by debug_print
+    uint64_t written_count_;
+    uint64_t vectored_count_;
+    uint64_t based_count_;
+
     class CacheKey {
     public:
         CacheKey(const std::string& t, bid_t n): tbn(t), nid(n) {}
@@ -122,6 +221,15 @@ private:
 
     std::map<CacheKey, Node*> nodes_;
 
+    // protected by nodes_lock_
+    EvictionPolicy *policy_;
+
+    // NULL if not enabled
+    SecondaryCache *secondary_;
+
+    Mutex prefetch_mtx_;
+    std::map<std::string, PrefetchTask*> prefetches_;
+
     // ensure there is only one thread is doing evict/flush
     Mutex global_mtx_;
     
@@ -0,0 +1,107 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <algorithm>
+
+#include "eviction.h"
+
+using namespace std;
+using namespace cascadb;
+
+class LRUComparator {
+public:
+    bool operator() (Node* x, Node* y)
+    {
+        return x->get_last_used_timestamp() < y->get_last_used_timestamp();
+    }
+};
+
+void LRUPolicy::sort(vector<Node*>& nodes)
+{
+    LRUComparator comp;
+    std::sort(nodes.begin(), nodes.end(), comp);
+}
+
+// cold leaves < cold inner nodes < hot leaves < hot inner nodes < schema
+static int node_rank(Node *node)
+{
+    if (node->nid() == NID_SCHEMA) {
+        return 4;
+    }
+    int rank = IS_LEAF(node->nid()) ? 0 : 1;
+    if (node->is_hot()) {
+        rank += 2;
+    }
+    return rank;
+}
+
+class RankComparator {
+public:
+    bool operator() (Node* x, Node* y)
+    {
+        int rx = node_rank(x);
+        int ry = node_rank(y);
+        if (rx != ry) {
+            return rx < ry;
+        }
+        return x->get_last_used_timestamp() < y->get_last_used_timestamp();
+    }
+};
+
+TwoQueuePolicy::TwoQueuePolicy(size_t ghost_capacity)
+: ghost_capacity_(ghost_capacity)
+{
+}
+
+void TwoQueuePolicy::on_insert(Node *node)
+{
+    GhostKey key(node->table_name(), node->nid());
+    if (ghosts_.erase(key)) {
+        // left in ghost queue, skipped when it's popped out
+        node->set_hot(true);
+    }
+}
+
+void TwoQueuePolicy::on_evict(Node *node)
+{
+    if (node->is_hot()) {
+        return;
+    }
+
+    GhostKey key(node->table_name(), node->nid());
+    if (ghosts_.insert(key).second) {
+        ghost_queue_.push_back(key);
+    }
+
+    // forget the eldest, keys already promoted're popped as well
+    while (ghost_queue_.size() > ghost_capacity_) {
+        ghosts_.erase(ghost_queue_.front());
+        ghost_queue_.pop_front();
+    }
+}
+
+void TwoQueuePolicy::sort(vector<Node*>& nodes)
+{
+    RankComparator comp;
+    std::sort(nodes.begin(), nodes.end(), comp);
+}
+
+namespace cascadb {
+
+EvictionPolicy* new_eviction_policy(const Options& options)
+{
+    switch (options.cache_eviction) {
+    case k2QEviction: {
+        // remember as many nodes as the cache could hold
+        size_t page_size = min(options.inner_node_page_size,
+                               options.leaf_node_page_size);
+        size_t capacity = options.cache_limit / max(page_size, (size_t)1);
+        return new TwoQueuePolicy(max(capacity, (size_t)64));
+    }
+    default:
+        return new LRUPolicy();
+    }
+}
+
+}
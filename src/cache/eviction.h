@@ -0,0 +1,73 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef CASCADB_CACHE_EVICTION_H_
+#define CASCADB_CACHE_EVICTION_H_
+
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "cascadb/options.h"
+#include "tree/node.h"
+
+namespace cascadb {
+
+// Decide the order clean nodes're evicted from cache.
+// All methods're called by Cache with nodes map locked exclusively,
+// so policies needn't be thread safe.
+class EvictionPolicy {
+public:
+    virtual ~EvictionPolicy() {}
+
+    // A node is put into cache, either created or loaded from layout
+    virtual void on_insert(Node *node) {}
+
+    // A node is about to be evicted from cache
+    virtual void on_evict(Node *node) {}
+
+    // Sort clean nodes, those to be evicted first come first
+    virtual void sort(std::vector<Node*>& nodes) = 0;
+};
+
+// Evict least recently used nodes first
+class LRUPolicy : public EvictionPolicy {
+public:
+    void sort(std::vector<Node*>& nodes);
+};
+
+// Simplified 2Q, nodes're admitted into a probationary queue, a node
+// evicted from there is remembered in a ghost queue, and is promoted
+// to hot if it's loaded again before forgotten. Nodes touched only once
+// by a full scan never become hot, so they're evicted first.
+// Among nodes of the same temperature, leaves're evicted before inner
+// nodes, and the schema node comes last.
+class TwoQueuePolicy : public EvictionPolicy {
+public:
+    // ghost_capacity is the number of nodes remembered after evicted
+    TwoQueuePolicy(size_t ghost_capacity);
+
+    void on_insert(Node *node);
+
+    void on_evict(Node *node);
+
+    void sort(std::vector<Node*>& nodes);
+
+private:
+    typedef std::pair<std::string, bid_t> GhostKey;
+
+    size_t                  ghost_capacity_;
+
+    // nodes recently evicted from the probationary queue, in FIFO order
+    std::deque<GhostKey>    ghost_queue_;
+
+    std::set<GhostKey>      ghosts_;
+};
+
+EvictionPolicy* new_eviction_policy(const Options& options);
+
+}
+
+#endif
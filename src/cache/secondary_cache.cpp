@@ -0,0 +1,113 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "secondary_cache.h"
+
+using namespace std;
+using namespace cascadb;
+
+SecondaryCache::SecondaryCache(size_t limit)
+: limit_(limit),
+  size_(0),
+  hits_(0),
+  misses_(0)
+{
+}
+
+SecondaryCache::~SecondaryCache()
+{
+    while (entries_.size()) {
+        erase(entries_.begin());
+    }
+}
+
+void SecondaryCache::put(const std::string& tbn, bid_t nid, Slice data,
+                         uint64_t offset, bool skeleton)
+{
+    ScopedMutex lock(&mtx_);
+
+    Key key(tbn, nid);
+    map<Key, Entry>::iterator it = entries_.find(key);
+    if (it != entries_.end()) {
+        erase(it);
+    }
+
+    if (data.size() > limit_) {
+        data.destroy();
+        return;
+    }
+
+    while (size_ + data.size() > limit_) {
+        erase(entries_.find(lru_.front()));
+    }
+
+    Entry& entry = entries_[key];
+    entry.data = data;
+    entry.offset = offset;
+    entry.skeleton = skeleton;
+    entry.lru = lru_.insert(lru_.end(), key);
+    size_ += data.size();
+}
+
+bool SecondaryCache::take(const std::string& tbn, bid_t nid, uint64_t offset,
+                          Slice& data, bool& skeleton)
+{
+    ScopedMutex lock(&mtx_);
+
+    map<Key, Entry>::iterator it = entries_.find(Key(tbn, nid));
+    if (it == entries_.end()) {
+        misses_ ++;
+        return false;
+    }
+    if (it->second.offset != offset) {
+        // node has been loaded from disk and written meanwhile
+        erase(it);
+        misses_ ++;
+        return false;
+    }
+    hits_ ++;
+
+    data = it->second.data;
+    skeleton = it->second.skeleton;
+    size_ -= data.size();
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+    return true;
+}
+
+void SecondaryCache::erase_table(const std::string& tbn)
+{
+    ScopedMutex lock(&mtx_);
+
+    map<Key, Entry>::iterator it = entries_.lower_bound(Key(tbn, 0));
+    while (it != entries_.end() && it->first.first == tbn) {
+        erase(it++);
+    }
+}
+
+size_t SecondaryCache::size()
+{
+    ScopedMutex lock(&mtx_);
+    return size_;
+}
+
+uint64_t SecondaryCache::hits()
+{
+    ScopedMutex lock(&mtx_);
+    return hits_;
+}
+
+uint64_t SecondaryCache::misses()
+{
+    ScopedMutex lock(&mtx_);
+    return misses_;
+}
+
+void SecondaryCache::erase(map<Key, Entry>::iterator it)
+{
+    size_ -= it->second.data.size();
+    it->second.data.destroy();
+    lru_.erase(it->second.lru);
+    entries_.erase(it);
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef CASCADB_CACHE_SECONDARY_CACHE_H_
+#define CASCADB_CACHE_SECONDARY_CACHE_H_
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "cascadb/slice.h"
+#include "serialize/block.h"
+#include "sys/sys.h"
+
+namespace cascadb {
+
+// Second tier of Cache, keeps serialized images of clean nodes evicted,
+// which're the same as blocks read from Layout, so a miss in Cache is
+// a deserialization rather than a disk read. Messages and records
+// inside images're compressed when compression is enabled, so several
+// times more nodes fit into the same memory.
+// Images're dropped in LRU order when the limit is exceeded.
+// Each image records the offset of the block it's the same as, images
+// of blocks moved since're stale and dropped when they're taken.
+class SecondaryCache {
+public:
+    SecondaryCache(size_t limit);
+
+    ~SecondaryCache();
+
+    // Keep the image of a node, data is owned by secondary cache,
+    // image of the same node is replaced. offset is where the block
+    // of node is in layout, skeleton is set if data is the skeleton only
+    void put(const std::string& tbn, bid_t nid, Slice data,
+             uint64_t offset, bool skeleton);
+
+    // Remove the image of a node and hand it over to caller, return
+    // false if not found or it's not of the block at offset any more
+    bool take(const std::string& tbn, bid_t nid, uint64_t offset,
+              Slice& data, bool& skeleton);
+
+    // Drop all images of a table
+    void erase_table(const std::string& tbn);
+
+    // Memory taken by images, in bytes
+    size_t size();
+
+    uint64_t hits();
+
+    uint64_t misses();
+
+private:
+    typedef std::pair<std::string, bid_t> Key;
+
+    struct Entry {
+        Slice                       data;
+        uint64_t                    offset;
+        bool                        skeleton;
+        std::list<Key>::iterator    lru;
+    };
+
+    void erase(std::map<Key, Entry>::iterator it);
+
+    Mutex                   mtx_;
+
+    size_t                  limit_;
+
+    size_t                  size_;
+
+    std::map<Key, Entry>    entries_;
+
+    // least recently put images come first
+    std::list<Key>          lru_;
+
+    uint64_t                hits_;
+
+    uint64_t                misses_;
+};
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "util/logger.h"
+#include "util/crc.h"
 #include "store/ram_directory.h"
 #include "sys/linux/linux_fs_directory.h"
 #include "db_impl.h"
@@ -11,9 +12,19 @@ using namespace std;
 using namespace cascadb;
     
 #define DAT_FILE_SUFFIX "cdb"
+#define HOT_FILE_SUFFIX "hot"
 
 DBImpl::~DBImpl()
 {
+    // async operations queued're finished first
+    if (workers_) {
+        workers_->stop();
+        delete workers_;
+    }
+
+    if (tree_ && options_.cache_warmup) {
+        save_hot_nodes();
+    }
     delete tree_;
     delete cache_;
     delete layout_;
@@ -58,16 +69,31 @@ bool DBImpl::init()
         return false;
     }
 
+    if (options_.cache_warmup && !create) {
+        load_hot_nodes();
+    }
+
+    if (options_.async_threads) {
+        workers_ = new WorkerPool(options_.async_threads,
+                                  options_.async_queue_limit);
+        if (!workers_->init()) {
+            LOG_ERROR("init async workers error");
+            return false;
+        }
+    }
+
     return true;
 }
 
 bool DBImpl::put(Slice key, Slice value)
 {
+    cache_->throttle();
     return tree_->put(key, value);
 }
 
 bool DBImpl::del(Slice key)
 {
+    cache_->throttle();
     return tree_->del(key);
 }
 
@@ -76,14 +102,242 @@ bool DBImpl::get(Slice key, Slice& value)
     return tree_->get(key, value);
 }
 
+size_t DBImpl::multi_get(const std::vector<Slice>& keys,
+                         std::vector<Slice>& values,
+                         std::vector<bool>& found)
+{
+    return tree_->multi_get(keys, values, found);
+}
+
+void DBImpl::async_get(Slice key, get_callback_t cb, void* context)
+{
+    assert(cb);
+    AsyncRequest *req = new AsyncRequest();
+    req->type = kAsyncGet;
+    req->key = key.clone();
+    req->get_cb = cb;
+    req->write_cb = NULL;
+    req->context = context;
+    submit(req);
+}
+
+void DBImpl::async_put(Slice key, Slice value, write_callback_t cb, void* context)
+{
+    AsyncRequest *req = new AsyncRequest();
+    req->type = kAsyncPut;
+    req->key = key.clone();
+    req->value = value.clone();
+    req->get_cb = NULL;
+    req->write_cb = cb;
+    req->context = context;
+    submit(req);
+}
+
+void DBImpl::async_del(Slice key, write_callback_t cb, void* context)
+{
+    AsyncRequest *req = new AsyncRequest();
+    req->type = kAsyncDel;
+    req->key = key.clone();
+    req->get_cb = NULL;
+    req->write_cb = cb;
+    req->context = context;
+    submit(req);
+}
+
+void DBImpl::submit(AsyncRequest *req)
+{
+    Callback *task = new Callback(this, &DBImpl::run_async, req);
+    if (workers_) {
+        // operations with the same hint're kept in order
+        workers_->submit(crc32(req->key.data(), req->key.size()), task);
+    } else {
+        task->exec(true);
+        delete task;
+    }
+}
+
+void DBImpl::run_async(AsyncRequest *req, bool succ)
+{
+    switch (req->type) {
+    case kAsyncGet: {
+        Slice value;
+        bool found = get(req->key, value);
+        req->get_cb(req->context, found, value);
+        break;
+    }
+    case kAsyncPut:
+        succ = put(req->key, req->value);
+        if (req->write_cb) {
+            req->write_cb(req->context, succ);
+        }
+        break;
+    case kAsyncDel:
+        succ = del(req->key);
+        if (req->write_cb) {
+            req->write_cb(req->context, succ);
+        }
+        break;
+    }
+
+    req->key.destroy();
+    if (req->value.size()) {
+        req->value.destroy();
+    }
+    delete req;
+}
+
+BulkLoader* DBImpl::new_bulk_loader()
+{
+    return tree_->new_bulk_loader();
+}
+
 void DBImpl::flush()
 {
+    tree_->merge_staging();
     cache_->flush_table(name_);
+
+    if (options_.cache_warmup) {
+        save_hot_nodes();
+    }
+}
+
+bool DBImpl::checkpoint(Directory* dest)
+{
+    if (dest == NULL || dest == options_.dir) {
+        LOG_ERROR("checkpoint should be written into another directory");
+        return false;
+    }
+
+    flush();
+
+    // replace the old one after completely written
+    string filename = name_ + "." + DAT_FILE_SUFFIX;
+    string tmpname = filename + ".tmp";
+    if (dest->file_exists(tmpname)) {
+        dest->delete_file(tmpname);
+    }
+    AIOFile *file = dest->open_aio_file(tmpname);
+    if (file == NULL) {
+        LOG_ERROR("open checkpoint file " << tmpname << " error");
+        return false;
+    }
+    bool ret = layout_->export_checkpoint(file);
+    file->close();
+    delete file;
+
+    if (!ret) {
+        LOG_ERROR("write checkpoint into " << dest->to_string() << " error");
+        dest->delete_file(tmpname);
+        return false;
+    }
+    if (dest->file_exists(filename)) {
+        dest->delete_file(filename);
+    }
+    dest->rename_file(tmpname, filename);
+
+    LOG_INFO("checkpoint table " << name_ << " into " << dest->to_string());
+    return true;
+}
+
+// Warmup file:
+//   number of nodes, uint32
+//   node ids, uint64 each
+//   crc of the above, uint32
+void DBImpl::save_hot_nodes()
+{
+    vector<bid_t> nids;
+    cache_->hot_nodes(name_, nids);
+
+    Slice buffer = Slice::alloc(4 + 8 * nids.size() + 4);
+    Block block(buffer, 0, 0);
+    BlockWriter writer(&block);
+    writer.writeUInt32(nids.size());
+    for (size_t i = 0; i < nids.size(); i++) {
+        writer.writeUInt64(nids[i]);
+    }
+    writer.writeUInt32(crc32(buffer.data(), block.size()));
+
+    // replace the old one after completely written
+    string filename = name_ + "." + HOT_FILE_SUFFIX;
+    string tmpname = filename + ".tmp";
+    Directory *dir = options_.dir;
+    if (dir->file_exists(tmpname)) {
+        dir->delete_file(tmpname);
+    }
+    SequenceFileWriter *file = dir->open_sequence_file_writer(tmpname);
+    if (file == NULL) {
+        LOG_ERROR("open warmup file " << tmpname << " error");
+        buffer.destroy();
+        return;
+    }
+    bool ret = file->append(Slice(buffer.data(), block.size())) && file->flush();
+    file->close();
+    delete file;
+    buffer.destroy();
+
+    if (!ret) {
+        LOG_ERROR("write warmup file " << tmpname << " error");
+        dir->delete_file(tmpname);
+        return;
+    }
+    if (dir->file_exists(filename)) {
+        dir->delete_file(filename);
+    }
+    dir->rename_file(tmpname, filename);
+}
+
+void DBImpl::load_hot_nodes()
+{
+    string filename = name_ + "." + HOT_FILE_SUFFIX;
+    Directory *dir = options_.dir;
+    if (!dir->file_exists(filename)) {
+        return;
+    }
+
+    size_t length = dir->file_length(filename);
+    if (length < 8) {
+        LOG_WARN("warmup file " << filename << " is truncated");
+        return;
+    }
+
+    SequenceFileReader *file = dir->open_sequence_file_reader(filename);
+    if (file == NULL) {
+        LOG_ERROR("open warmup file " << filename << " error");
+        return;
+    }
+    Slice buffer = Slice::alloc(length);
+    size_t n = file->read(buffer);
+    file->close();
+    delete file;
+
+    vector<bid_t> nids;
+    Block block(buffer, 0, n);
+    BlockReader reader(&block);
+    uint32_t count = 0;
+    uint32_t crc = 0;
+    bool ret = n == length && reader.readUInt32(&count) && 
+        length == 4 + 8 * (size_t)count + 4;
+    for (uint32_t i = 0; ret && i < count; i++) {
+        uint64_t nid;
+        ret = reader.readUInt64(&nid);
+        nids.push_back(nid);
+    }
+    ret = ret && reader.readUInt32(&crc) && crc == crc32(buffer.data(), length - 4);
+    buffer.destroy();
+
+    if (!ret) {
+        LOG_WARN("warmup file " << filename << " is corrupted, ignored");
+        return;
+    }
+
+    LOG_INFO("warmup " << nids.size() << " nodes in table " << name_);
+    cache_->prefetch(name_, nids);
 }
 
 void DBImpl::debug_print(std::ostream& out)
 {
     cache_->debug_print(out);
+    tree_->debug_print(out);
 }
 
 DB* cascadb::DB::open(const std::string& name, const Options& options)
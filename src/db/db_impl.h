@@ -9,6 +9,7 @@
 #include "serialize/layout.h"
 #include "cache/cache.h"
 #include "tree/tree.h"
+#include "util/worker_pool.h"
 
 namespace cascadb {
 
@@ -19,7 +20,7 @@ public:
     DBImpl(const std::string& name, const Options& options)
     : name_(name), options_(options),
       file_(NULL), layout_(NULL),
-      cache_(NULL), tree_(NULL)
+      cache_(NULL), tree_(NULL), workers_(NULL)
     {
     }
     
@@ -33,11 +34,54 @@ public:
     
     bool get(Slice key, Slice& value);
 
+    size_t multi_get(const std::vector<Slice>& keys,
+                     std::vector<Slice>& values,
+                     std::vector<bool>& found);
+
+    void async_get(Slice key, get_callback_t cb, void* context);
+
+    void async_put(Slice key, Slice value, write_callback_t cb, void* context);
+
+    void async_del(Slice key, write_callback_t cb, void* context);
+
+    BulkLoader* new_bulk_loader();
+
     void flush();
 
+    bool checkpoint(Directory* dest);
+
     void debug_print(std::ostream& out);
 
 private:
+    enum AsyncType {
+        kAsyncGet,
+        kAsyncPut,
+        kAsyncDel
+    };
+
+    // Context of an async operation
+    struct AsyncRequest {
+        AsyncType           type;
+        Slice               key;
+        Slice               value;
+        get_callback_t      get_cb;
+        write_callback_t    write_cb;
+        void                *context;
+    };
+
+    // Queue request to async workers, or run it inline
+    void submit(AsyncRequest *req);
+
+    // called by async workers
+    void run_async(AsyncRequest *req, bool succ);
+
+    // Write ids of nodes cached into the warmup file
+    void save_hot_nodes();
+
+    // Read ids of nodes from the warmup file,
+    // and prefetch them into cache
+    void load_hot_nodes();
+
     std::string name_;
     Options options_;
     
@@ -45,6 +89,9 @@ private:
     Layout *layout_;
     Cache *cache_;
     Tree* tree_;
+
+    // NULL if async_threads is 0
+    WorkerPool *workers_;
 };
 
 }
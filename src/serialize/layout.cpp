@@ -3,6 +3,7 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <malloc.h>
+#include <algorithm>
 
 // to get inner/leaf node information
 #include "tree/node.h"
@@ -15,6 +16,10 @@
 using namespace std;
 using namespace cascadb;
 
+// blocks back to back in file're copied by a checkpoint
+// in I/O of this size at most
+#define CHECKPOINT_IO_SIZE (1<<20)
+
 static void aio_complete_handler(void *context, AIOStatus status)
 {
     Callback *cb = (Callback *)context;
@@ -23,14 +28,37 @@ static void aio_complete_handler(void *context, AIOStatus status)
     delete cb;
 }
 
+// Turn metadata of block into the one of its base extent,
+// so sub-blocks inside base're read the same way
+static bool to_base_extent(BlockMeta& meta)
+{
+    if (meta.base_size == 0) {
+        return false;
+    }
+    meta.offset = meta.base_offset;
+    meta.skeleton_size = 0;
+    meta.total_size = meta.base_size;
+    meta.crc = meta.base_crc;
+    meta.skeleton_crc = 0;
+    meta.base_offset = 0;
+    meta.base_size = 0;
+    meta.base_crc = 0;
+    return true;
+}
+
 Layout::Layout(AIOFile* aio_file, 
                size_t length,
                const Options& options)
 : aio_file_(aio_file),
   length_(length),
   options_(options),
+  buffer_pool_(options.io_buffer_pool_size, options.io_buffer_huge_pages),
   offset_(0),
   superblock_(new SuperBlock),
+  index_entries_(0),
+  index_full_needed_(false),
+  pinned_(0),
+  loader_(NULL),
   fly_writes_(0),
   fly_reads_(0)
 {
@@ -38,6 +66,17 @@ Layout::Layout(AIOFile* aio_file,
 
 Layout::~Layout()
 {
+    if (loader_ && loader_->thread) {
+        ScopedMutex block_index_lock(&block_index_mtx_);
+        loader_->stop = true;
+        block_index_lock.unlock();
+
+        // entries not loaded yet're still searched in place
+        loader_->thread->join();
+        delete loader_->thread;
+        loader_->thread = NULL;
+    }
+
     if (!flush()) {
         assert(false);
     }
@@ -48,11 +87,17 @@ Layout::~Layout()
         delete it->second;
     }
     block_index_.clear();
-    block_offset_index_.clear();
+    if (loader_) {
+        for (map<uint32_t, Block*>::iterator it = loader_->pages.begin();
+            it != loader_->pages.end(); it++) {
+            destroy(it->second);
+        }
+        delete loader_;
+        loader_ = NULL;
+    }
     block_index_lock.unlock();
 
-    delete superblock_->index_block_meta;
-    delete superblock_;
+    free_superblock(superblock_);
 }
 
 bool Layout::init(bool create)
@@ -74,22 +119,50 @@ bool Layout::init(bool create)
             LOG_ERROR("data file is too short");
             return false;
         }
-        if (!load_superblock()) {
+
+        // the newer valid copy is used. The older one is only the fallback
+        // of a torn superblock write, it's never used when the index of
+        // the newer one is broken, since holes released after the newer
+        // one was written may have been overwritten already
+        SuperBlock *copies[2];
+        copies[0] = load_superblock(0);
+        copies[1] = load_superblock(SUPER_BLOCK_SIZE);
+        if (copies[0] == NULL ||
+            (copies[1] && copies[1]->generation > copies[0]->generation)) {
+            swap(copies[0], copies[1]);
+        }
+        if (copies[1]) {
+            free_superblock(copies[1]);
+        }
+        if (copies[0] == NULL) {
             LOG_ERROR("read superblock error during init");
             return false;
         }
-        if (superblock_->index_block_meta) {
-            if (!load_index()) {
-                LOG_ERROR("load index error");
-                return false;
-            }
+        free_superblock(superblock_);
+        superblock_ = copies[0];
+
+        loader_ = new IndexLoader();
+        loader_->thread = NULL;
+        loader_->stop = false;
+        loader_->loading = false;
+        loader_->next_page = 0;
+        loader_->entries = 0;
+
+        if (superblock_->index_block_meta && !load_index()) {
+            LOG_ERROR("load index of superblock generation "
+                << superblock_->generation << " error");
+            return false;
         }
-        init_block_offset_index();
-        init_holes();
-        print_index_info();
+        LOG_TRACE("use superblock generation " << superblock_->generation);
 
-        ScopedMutex block_index_lock(&block_index_mtx_);
-        LOG_INFO(block_index_.size() << " blocks found");
+        // blocks're appended to file end until holes're found
+        ScopedMutex lock(&mtx_);
+        offset_ = PAGE_ROUND_UP(length_);
+        length_ = offset_;
+        lock.unlock();
+
+        start_loader();
+        LOG_INFO(loader_->entries << " blocks found");
     }
 
     truncate();
@@ -157,6 +230,13 @@ Block* Layout::read(bid_t bid, uint32_t offset, uint32_t size, uint32_t subblock
         return NULL;
     }
 
+    if ((offset & SUBBLOCK_IN_BASE) && !to_base_extent(meta)) {
+        LOG_ERROR("read subblock error, bid " << hex << bid << dec
+                  << " has no base extent");
+        return NULL;
+    }
+    offset &= ~SUBBLOCK_IN_BASE;
+
     assert(offset <= meta.total_size);
     assert(offset + size <= meta.total_size);
 
@@ -187,12 +267,48 @@ Block* Layout::read(bid_t bid, uint32_t offset, uint32_t size, uint32_t subblock
     return block;
 }
 
+Block* Layout::read_base(bid_t bid)
+{
+    BlockMeta meta;
+    if (!get_block_meta(bid, meta)) {
+        LOG_INFO("read base error, cannot find block bid " << hex << bid << dec);
+        return NULL;
+    }
+
+    if (!to_base_extent(meta)) {
+        LOG_ERROR("read base error, bid " << hex << bid << dec
+                  << " has no base extent");
+        return NULL;
+    }
+
+    Block *block;
+    if (!read_block(meta, &block)) {
+        LOG_ERROR("read base error, bid " << hex << bid << dec
+                  << ", offset " << meta.offset
+                  << ", size " << meta.total_size);
+        return NULL;
+    }
+
+    // crc covers the padding as the base was written as a block
+    uint32_t actual_crc = crc32(block->buffer().data(), block->buffer().size());
+    if (actual_crc != meta.crc && meta.crc != 0) {
+        LOG_ERROR("base crc error, bid " << hex << bid << dec
+                << ", offset " << meta.offset
+                << ", expected_crc " << meta.crc
+                << ", actual_crc " << actual_crc);
+        destroy(block);
+        return NULL;
+    }
+    return block;
+}
+
 void Layout::async_read(bid_t bid, Block **block, Callback *cb)
 {
     BlockMeta meta;
     if (!get_block_meta(bid, meta)) {
         LOG_INFO("Read Block failed, cannot find block bid " << hex << bid << dec);
         cb->exec(false);
+        delete cb;
         return;
     }
 
@@ -200,6 +316,7 @@ void Layout::async_read(bid_t bid, Block **block, Callback *cb)
     if (!buffer.size()) {
         LOG_ERROR("alloc_aligned_buffer fail, size " << meta.total_size);
         cb->exec(false);
+        delete cb;
         return;
     }
 
@@ -209,6 +326,10 @@ void Layout::async_read(bid_t bid, Block **block, Callback *cb)
     req->block = block;
     req->buffer = buffer;
     req->meta = meta;
+    req->subblock = false;
+    req->offset = 0;
+    req->size = meta.total_size;
+    req->subblock_crc = 0;
 
     Callback *ncb = new Callback(this, &Layout::handle_async_read, req);
 
@@ -219,6 +340,59 @@ void Layout::async_read(bid_t bid, Block **block, Callback *cb)
     aio_file_->async_read(meta.offset, buffer, ncb, aio_complete_handler);
 }
 
+void Layout::async_read(bid_t bid, uint32_t offset, uint32_t size,
+                        uint32_t subblock_crc, Block **block, Callback *cb)
+{
+    BlockMeta meta;
+    if (!get_block_meta(bid, meta)) {
+        LOG_INFO("Read Block failed, cannot find block bid " << hex << bid << dec);
+        cb->exec(false);
+        delete cb;
+        return;
+    }
+
+    if ((offset & SUBBLOCK_IN_BASE) && !to_base_extent(meta)) {
+        LOG_ERROR("Read subblock failed, bid " << hex << bid << dec
+                  << " has no base extent");
+        cb->exec(false);
+        delete cb;
+        return;
+    }
+    offset &= ~SUBBLOCK_IN_BASE;
+
+    assert(offset <= meta.total_size);
+    assert(offset + size <= meta.total_size);
+
+    // read from the page boundary, see read_block()
+    uint32_t offset1 = PAGE_ROUND_DOWN(offset);
+    Slice buffer = alloc_aligned_buffer(offset - offset1 + size);
+    if (!buffer.size()) {
+        LOG_ERROR("alloc_aligned_buffer fail, size " << (offset - offset1 + size));
+        cb->exec(false);
+        delete cb;
+        return;
+    }
+
+    AsyncReadReq *req = new AsyncReadReq();
+    req->bid = bid;
+    req->cb = cb;
+    req->block = block;
+    req->buffer = buffer;
+    req->meta = meta;
+    req->subblock = true;
+    req->offset = offset;
+    req->size = size;
+    req->subblock_crc = subblock_crc;
+
+    Callback *ncb = new Callback(this, &Layout::handle_async_read, req);
+
+    ScopedMutex lock(&mtx_);
+    fly_reads_ ++;
+    lock.unlock();
+
+    aio_file_->async_read(meta.offset + offset1, buffer, ncb, aio_complete_handler);
+}
+
 void Layout::handle_async_read(AsyncReadReq *req, AIOStatus status)
 {
     ScopedMutex lock(&mtx_);
@@ -230,11 +404,20 @@ void Layout::handle_async_read(AsyncReadReq *req, AIOStatus status)
                   << " at offset " << req->meta.offset << " ok");
 
         uint32_t crc;
+        uint32_t expected_crc;
 
-        *(req->block) = new Block(req->buffer, 0, req->meta.total_size);
-        crc = crc32(req->buffer.data(), req->buffer.size());
+        if (req->subblock) {
+            uint32_t start = req->offset - PAGE_ROUND_DOWN(req->offset);
+            *(req->block) = new Block(req->buffer, start, req->size);
+            crc = crc32((*req->block)->start(), req->size);
+            expected_crc = req->subblock_crc;
+        } else {
+            *(req->block) = new Block(req->buffer, 0, req->meta.total_size);
+            crc = crc32(req->buffer.data(), req->buffer.size());
+            expected_crc = req->meta.crc;
+        }
 
-        if (crc == req->meta.crc) {
+        if (crc == expected_crc) {
             req->cb->exec(true);
         } else {
             LOG_ERROR("read block crc" << hex << req->bid << dec << req->meta.crc << " error");
@@ -256,6 +439,10 @@ void Layout::async_write(bid_t bid, Block *block, uint32_t skeleton_size, Callba
     // assumpt buffer inside block is aligned
     assert(block->capacity() == PAGE_ROUND_UP(block->size()));
 
+    // zero padding rather than the whole buffer when it's created
+    char *end = (char *)block->start() + block->size();
+    memset(end, 0, block->capacity() - block->size());
+
     AsyncWriteReq *req = new AsyncWriteReq();
     req->bid = bid;
     req->cb = cb;
@@ -265,6 +452,9 @@ void Layout::async_write(bid_t bid, Block *block, uint32_t skeleton_size, Callba
     req->meta.offset = get_offset(req->buffer.size());
     req->meta.crc = crc32(req->buffer.data(), req->buffer.size());
     req->meta.skeleton_crc = crc32(block->start(), skeleton_size);
+    req->meta.base_offset = 0;
+    req->meta.base_size = 0;
+    req->meta.base_crc = 0;
 
     Callback *ncb = new Callback(this, &Layout::handle_async_write, req);
 
@@ -275,6 +465,76 @@ void Layout::async_write(bid_t bid, Block *block, uint32_t skeleton_size, Callba
     aio_file_->async_write(req->meta.offset, req->buffer, ncb, aio_complete_handler);
 }
 
+void Layout::async_write(bid_t bid, const std::vector<Block*>& blocks,
+                         uint32_t skeleton_size, BlockBase base, Callback *cb)
+{
+    assert(blocks.size());
+    assert(skeleton_size <= blocks[0]->size());
+
+    // base is resolved against the block replaced, the next block
+    // of a node isn't written until the last one is done
+    BlockMeta replaced;
+    bool found = get_block_meta(bid, replaced);
+    if ((base == kKeepBase && !(found && replaced.base_size)) ||
+        (base == kReplacedAsBase && !(found && replaced.base_size == 0))) {
+        LOG_ERROR("write block error, bid " << hex << bid << dec
+                  << " doesn't have the base it references");
+        cb->exec(false);
+        delete cb;
+        return;
+    }
+
+    AsyncWriteReq *req = new AsyncWriteReq();
+    req->bid = bid;
+    req->cb = cb;
+    req->meta.skeleton_size = skeleton_size;
+    req->meta.base_offset = 0;
+    req->meta.base_size = 0;
+    req->meta.base_crc = 0;
+    if (base == kKeepBase) {
+        req->meta.base_offset = replaced.base_offset;
+        req->meta.base_size = replaced.base_size;
+        req->meta.base_crc = replaced.base_crc;
+    } else if (base == kReplacedAsBase) {
+        req->meta.base_offset = replaced.offset;
+        req->meta.base_size = replaced.total_size;
+        req->meta.base_crc = replaced.crc;
+    }
+
+    // crc covers paddings between blocks as they're read back as a whole
+    std::vector<Slice> bufs;
+    size_t total = 0;
+    uint32_t crc = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        Block *block = blocks[i];
+        assert(block->capacity() == PAGE_ROUND_UP(block->size()));
+
+        char *end = (char *)block->start() + block->size();
+        memset(end, 0, block->capacity() - block->size());
+
+        if (i == 0) {
+            crc = crc32(block->buffer().data(), block->capacity());
+        } else {
+            crc = crc32_extend(crc, block->buffer().data(), block->capacity());
+        }
+        req->meta.total_size = total + block->size();
+        total += block->capacity();
+        bufs.push_back(block->buffer());
+    }
+
+    req->meta.offset = get_offset(total);
+    req->meta.crc = crc;
+    req->meta.skeleton_crc = crc32(blocks[0]->start(), skeleton_size);
+
+    Callback *ncb = new Callback(this, &Layout::handle_async_write, req);
+
+    ScopedMutex lock(&mtx_);
+    fly_writes_ ++;
+    lock.unlock();
+
+    aio_file_->async_writev(req->meta.offset, bufs, ncb, aio_complete_handler);
+}
+
 void Layout::handle_async_write(AsyncWriteReq *req, AIOStatus status)
 {
     ScopedMutex lock(&mtx_);
@@ -321,11 +581,15 @@ bool Layout::flush()
     if (!flush_meta()) return false;
 
     truncate();
-    return true;
+
+    // the second superblock copy is made durable at the next
+    // checkpoint otherwise
+    return aio_file_->sync();
 }
 
 bool Layout::flush_meta()
 {
+    ScopedMutex checkpoint_lock(&checkpoint_mtx_);
     size_t fly_hole_size;
 
     ScopedMutex lock(&fly_hole_list_mtx_);
@@ -333,77 +597,246 @@ bool Layout::flush_meta()
     lock.unlock();
 
     if (!flush_index()) return false;
+
+    // blocks and index should be durable before superblock points to
+    // them, a single sync covers all of them written since last time
+    if (!aio_file_->sync()) {
+        LOG_ERROR("sync blocks and index error");
+        return false;
+    }
     if (!flush_superblock()) return false;
 
-    // add fly holes to hole list
-    flush_fly_holes(fly_hole_size);
+    // add fly holes to hole list, unless a checkpoint being exported
+    // still references them
+    if (!pinned_) {
+        flush_fly_holes(fly_hole_size);
+    }
 
     return true;
 }
 
-void Layout::truncate()
+bool Layout::export_checkpoint(AIOFile *dest)
 {
-    ScopedMutex lock(&mtx_);
-    if (offset_ < length_) {
-        aio_file_->truncate(offset_);
-        length_ = offset_;
-    }
+    // the checkpoint is pinned before its metadata is taken, so any
+    // later checkpoint cannot free its blocks
+    ScopedMutex checkpoint_lock(&checkpoint_mtx_);
+    pinned_ ++;
+
+    BlockMeta index, delta, dict;
+    ScopedMutex block_index_lock(&block_index_mtx_);
+    uint8_t version = superblock_->index_version;
+    bool has_index = superblock_->index_block_meta != NULL;
+    bool has_delta = superblock_->delta_block_meta != NULL;
+    bool has_dict = superblock_->dict_block_meta != NULL;
+    if (has_index) index = *superblock_->index_block_meta;
+    if (has_delta) delta = *superblock_->delta_block_meta;
+    if (has_dict) dict = *superblock_->dict_block_meta;
+    block_index_lock.unlock();
+    checkpoint_lock.unlock();
+
+    bool ret = copy_checkpoint(dest, has_index ? &index : NULL,
+        has_delta ? &delta : NULL, has_dict ? &dict : NULL, version);
+
+    checkpoint_lock.lock();
+    pinned_ --;
+    return ret;
 }
 
-bool Layout::load_superblock()
+// Space taken up in file by a block or a base extent,
+// offset points into the metadata to be updated
+struct CopyExtent {
+    uint64_t    *offset;
+    uint32_t    size;
+};
+
+bool Layout::copy_checkpoint(AIOFile *dest, const BlockMeta *index,
+                             const BlockMeta *delta, const BlockMeta *dict,
+                             uint8_t version)
 {
-    Slice buffer = alloc_aligned_buffer(SUPER_BLOCK_SIZE);
-    if (!buffer.size()) {
-        LOG_ERROR("alloc_aligned_buffer error, size " << SUPER_BLOCK_SIZE);
+    map<bid_t, BlockMeta> blocks;
+    if (index && !read_checkpoint_index(*index, delta, version, blocks)) {
         return false;
     }
-    memset((void*)buffer.data(), 0, buffer.size());
+    BlockMeta dict_meta;
+    if (dict) {
+        dict_meta = *dict;
+    }
 
-    if (!read_data(0, buffer)) {
-        LOG_ERROR("try to read 1st superblock error");
-        return load_2nd_superblock();
+    // blocks and base extents're copied in the order of offset,
+    // and offsets inside metadata're updated to the ones in dest
+    map<uint64_t, CopyExtent> extents;
+    for (map<bid_t, BlockMeta>::iterator it = blocks.begin();
+        it != blocks.end(); it++) {
+        CopyExtent extent = {&it->second.offset, it->second.total_size};
+        extents[it->second.offset] = extent;
+        if (it->second.base_size) {
+            CopyExtent base = {&it->second.base_offset, it->second.base_size};
+            extents[it->second.base_offset] = base;
+        }
+    }
+    if (dict) {
+        CopyExtent extent = {&dict_meta.offset, dict_meta.total_size};
+        extents[dict_meta.offset] = extent;
     }
 
-    LOG_TRACE("read 1st superblock ok");
-    Block block(buffer, 0, SUPER_BLOCK_SIZE);
-    BlockReader reader(&block);
-    if (!read_superblock(reader)) {
-        LOG_ERROR("1st superblock is invalid");
+    Layout copy(dest, 0, options_);
+    if (!copy.init(true)) {
+        LOG_ERROR("init layout of checkpoint error");
+        return false;
+    }
+
+    Time start = now();
+    uint64_t copied = 0;
+    map<uint64_t, CopyExtent>::iterator it = extents.begin();
+    while (it != extents.end()) {
+        uint64_t offset = it->first;
+        size_t size = 0;
+        vector<uint64_t*> run;
+        do {
+            run.push_back(it->second.offset);
+            size += PAGE_ROUND_UP(it->second.size);
+            it++;
+        } while (it != extents.end() && it->first == offset + size &&
+                 size + PAGE_ROUND_UP(it->second.size) <= CHECKPOINT_IO_SIZE);
+
+        Slice buffer = alloc_aligned_buffer(size);
+        if (!buffer.size()) {
+            LOG_ERROR("alloc_aligned_buffer fail, size " << size);
+            return false;
+        }
+        Slice data(buffer.data(), size);
+        if (!read_data(offset, data)) {
+            LOG_ERROR("read blocks of checkpoint error, offset " << offset
+                << ", size " << size);
+            free_buffer(buffer);
+            return false;
+        }
+        uint64_t dest_offset = copy.get_offset(size);
+        if (!copy.write_data(dest_offset, data)) {
+            LOG_ERROR("write blocks of checkpoint error, offset " << dest_offset
+                << ", size " << size);
+            free_buffer(buffer);
+            return false;
+        }
         free_buffer(buffer);
-        return load_2nd_superblock();
+
+        for (size_t i = 0; i < run.size(); i++) {
+            *run[i] = dest_offset + (*run[i] - offset);
+        }
+
+        copied += size;
+        if (options_.checkpoint_rate) {
+            USecond expected = copied * 1000000.0 / options_.checkpoint_rate;
+            USecond elapsed = interval_us(start, now());
+            if (expected > elapsed) {
+                cascadb::usleep(expected - elapsed);
+            }
+        }
     }
 
-    LOG_TRACE("load 1st superblock ok");
-    free_buffer(buffer);
+    for (map<bid_t, BlockMeta>::iterator it = blocks.begin();
+        it != blocks.end(); it++) {
+        copy.set_block_meta(it->first, it->second);
+    }
+    if (dict) {
+        copy.superblock_->dict_block_meta = new BlockMeta(dict_meta);
+    }
+
+    LOG_INFO("export checkpoint of " << blocks.size() << " blocks, "
+        << copied << " bytes");
+    return copy.flush();
+}
+
+bool Layout::read_checkpoint_index(const BlockMeta& index, const BlockMeta *delta,
+                                   uint8_t version, map<bid_t, BlockMeta>& blocks)
+{
+    if (!read_index_block(index, version, blocks)) {
+        return false;
+    }
+
+    if (delta == NULL) {
+        return true;
+    }
+
+    bool legacy = version < 5;
+    Block *block;
+    if (!read_block(*delta, &block)) {
+        LOG_ERROR("read delta block error");
+        return false;
+    }
+
+    uint32_t n;
+    BlockReader delta_reader(block);
+    bool ret = (delta->crc == 0 ||
+        crc32(block->start(), block->size()) == delta->crc) &&
+        delta_reader.readUInt32(&n);
+    for (uint32_t i = 0; ret && i < n; i++) {
+        bid_t bid;
+        bool exists;
+        BlockMeta meta;
+        ret = delta_reader.readUInt64(&bid) && delta_reader.readBool(&exists);
+        if (ret && exists) {
+            ret = read_block_meta(&meta, delta_reader) &&
+                (legacy || read_block_base(&meta, delta_reader));
+            blocks[bid] = meta;
+        } else if (ret) {
+            blocks.erase(bid);
+        }
+    }
+    destroy(block);
+    if (!ret) {
+        LOG_ERROR("invalid delta block");
+        return false;
+    }
     return true;
 }
 
-bool Layout::load_2nd_superblock()
+void Layout::truncate()
+{
+    ScopedMutex lock(&mtx_);
+    if (offset_ < length_) {
+        aio_file_->truncate(offset_);
+        length_ = offset_;
+    }
+}
+
+SuperBlock* Layout::load_superblock(uint64_t offset)
 {
     Slice buffer = alloc_aligned_buffer(SUPER_BLOCK_SIZE);
     if (!buffer.size()) {
         LOG_ERROR("alloc_aligned_buffer error, size " << SUPER_BLOCK_SIZE);
-        return false;
+        return NULL;
     }
     memset((void*)buffer.data(), 0, buffer.size());
 
-    if (!read_data(SUPER_BLOCK_SIZE, buffer)) {
-        LOG_ERROR("try to read 2nd superblock error");
-        return false;
+    if (!read_data(offset, buffer)) {
+        LOG_ERROR("try to read superblock at offset " << offset << " error");
+        free_buffer(buffer);
+        return NULL;
     }
 
-    LOG_TRACE("read 2nd superblock ok");
+    SuperBlock *sb = new SuperBlock();
     Block block(buffer, 0, SUPER_BLOCK_SIZE);
     BlockReader reader(&block);
-    if (!read_superblock(reader)) {
-        LOG_ERROR("2nd superblock is invalid");
+    if (!read_superblock(reader, sb)) {
+        LOG_ERROR("superblock at offset " << offset << " is invalid");
         free_buffer(buffer);
-        return false;
+        free_superblock(sb);
+        return NULL;
     }
 
-    LOG_TRACE("load 2nd superblock ok");
+    LOG_TRACE("load superblock at offset " << offset << " ok, generation "
+        << sb->generation);
     free_buffer(buffer);
-    return true;
+    return sb;
+}
+
+void Layout::free_superblock(SuperBlock *sb)
+{
+    delete sb->index_block_meta;
+    delete sb->dict_block_meta;
+    delete sb->delta_block_meta;
+    delete sb;
 }
 
 bool Layout::flush_superblock()
@@ -415,15 +848,18 @@ bool Layout::flush_superblock()
     }
     memset((void*)buffer.data(), 0, buffer.size());
 
+    superblock_->generation ++;
+
     Block block(buffer, 0, 0);
     BlockWriter writer(&block);
     if (!write_superblock(writer)) {
         assert(false);
     }
 
-    // double write to ensure superblock is correct
+    // double write to ensure superblock is correct,
+    // the 2nd copy isn't touched until the 1st one is durable
 
-    if (!write_data(0, buffer)) {
+    if (!write_data(0, buffer) || !aio_file_->sync()) {
         LOG_ERROR("flush 1st superblock error");
         free_buffer(buffer);
         return false;
@@ -449,20 +885,202 @@ bool Layout::load_index()
 
     LOG_TRACE("read index block from offset " << meta->offset);
 
+    uint8_t version = superblock_->index_version;
+    if (version >= 6) {
+        // only the header is read, pages're read when they're needed
+        if (!read_index_header(*meta, loader_->header)) {
+            return false;
+        }
+        loader_->index = *meta;
+        loader_->entries = loader_->header.entries;
+        loader_->loading = loader_->entries > 0;
+        index_entries_ = loader_->entries;
+    } else {
+        // index without pages is loaded at once, and it's
+        // rewritten as a whole at the next checkpoint
+        map<bid_t, BlockMeta> blocks;
+        if (!read_index_block(*meta, version, blocks)) {
+            return false;
+        }
+
+        ScopedMutex block_index_lock(&block_index_mtx_);
+        for (map<bid_t, BlockMeta>::iterator it = blocks.begin();
+            it != blocks.end(); it++) {
+            block_index_[it->first] = new BlockMeta(it->second);
+        }
+        index_full_needed_ = true;
+        block_index_lock.unlock();
+        loader_->entries = blocks.size();
+        index_entries_ = blocks.size();
+    }
+
+    meta = superblock_->delta_block_meta;
+    if (meta == NULL) {
+        return true;
+    }
+
+    // the delta is read at open, checkpoints keep it below
+    // index_delta_ratio of the index
+    LOG_TRACE("read delta block from offset " << meta->offset);
+
     Block *block;
     if (!read_block(*meta, &block)) {
-        LOG_ERROR("read index block error");
+        LOG_ERROR("read delta block error");
         return false;
     }
 
-    BlockReader reader(block);
-    if (!read_index(reader)) {
-        LOG_ERROR("invalid index block");
+    if (meta->crc && crc32(block->start(), block->size()) != meta->crc) {
+        LOG_ERROR("delta block crc error");
+        destroy(block);
+        return false;
+    }
+
+    BlockReader delta_reader(block);
+    if (!read_delta(delta_reader, version < 5)) {
+        LOG_ERROR("invalid delta block");
+        destroy(block);
+        return false;
+    }
+
+    destroy(block);
+    return true;
+}
+
+bool Layout::read_index_header(const BlockMeta& index, IndexHeader& header)
+{
+    Block *block;
+    if (index.skeleton_size < 8 ||
+        !read_block(index, 0, index.skeleton_size, &block)) {
+        LOG_ERROR("read index header error");
+        return false;
+    }
+
+    if (crc32(block->start(), block->size()) != index.skeleton_crc) {
+        LOG_ERROR("index header crc error");
         destroy(block);
         return false;
     }
 
+    uint32_t pages;
+    BlockReader reader(block);
+    bool ret = reader.readUInt32(&header.entries) && reader.readUInt32(&pages) &&
+        pages == (header.entries + INDEX_PAGE_ENTRIES - 1) / INDEX_PAGE_ENTRIES &&
+        reader.remain() >= (size_t)pages * INDEX_PAGE_HEADER_SIZE;
+    if (ret) {
+        header.bids.resize(pages);
+        header.crcs.resize(pages);
+    }
+    for (uint32_t i = 0; ret && i < pages; i++) {
+        ret = reader.readUInt64(&header.bids[i]) &&
+            reader.readUInt32(&header.crcs[i]);
+    }
     destroy(block);
+    if (!ret) {
+        LOG_ERROR("invalid index header");
+        return false;
+    }
+    return true;
+}
+
+Block* Layout::read_index_pages(const BlockMeta& index, const IndexHeader& header,
+                                uint32_t first, uint32_t count)
+{
+    assert(count && first + count <= header.bids.size());
+
+    // the last page isn't padded
+    size_t start = PAGE_ROUND_UP(get_index_header_size(header.entries)) +
+        (size_t)first * INDEX_PAGE_SIZE;
+    size_t size = (size_t)(count - 1) * INDEX_PAGE_SIZE +
+        index_page_entries(header, first + count - 1) * INDEX_ENTRY_SIZE;
+    if (start + size > index.total_size) {
+        LOG_ERROR("index pages out of bounds, first " << first
+            << ", count " << count);
+        return NULL;
+    }
+
+    Block *block;
+    if (!read_block(index, start, size, &block)) {
+        LOG_ERROR("read index pages error, first " << first
+            << ", count " << count);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page = first + i;
+        uint32_t crc = crc32(block->start() + (size_t)i * INDEX_PAGE_SIZE,
+            index_page_entries(header, page) * INDEX_ENTRY_SIZE);
+        if (crc != header.crcs[page]) {
+            LOG_ERROR("index page crc error, page " << page
+                << ", expected_crc " << header.crcs[page]
+                << ", actual_crc " << crc);
+            destroy(block);
+            return NULL;
+        }
+    }
+    return block;
+}
+
+uint32_t Layout::index_page_entries(const IndexHeader& header, uint32_t page)
+{
+    uint32_t first = page * INDEX_PAGE_ENTRIES;
+    assert(first < header.entries);
+    if (header.entries - first < INDEX_PAGE_ENTRIES) {
+        return header.entries - first;
+    }
+    return INDEX_PAGE_ENTRIES;
+}
+
+bool Layout::read_index_block(const BlockMeta& index, uint8_t version,
+                              map<bid_t, BlockMeta>& blocks)
+{
+    Block *block;
+    uint32_t n;
+    IndexHeader header;
+    bool paged = version >= 6;
+    if (paged) {
+        if (!read_index_header(index, header)) {
+            return false;
+        }
+        n = header.entries;
+        if (n == 0) {
+            return true;
+        }
+        block = read_index_pages(index, header, 0, header.bids.size());
+        if (block == NULL) {
+            return false;
+        }
+    } else {
+        if (!read_block(index, &block)) {
+            LOG_ERROR("read index block error");
+            return false;
+        }
+        // index written before version 0.4 has no crc
+        if (index.crc && crc32(block->start(), block->size()) != index.crc) {
+            LOG_ERROR("index block crc error");
+            destroy(block);
+            return false;
+        }
+    }
+
+    bool legacy = version < 5;
+    BlockReader reader(block);
+    bool ret = paged || (reader.readUInt32(&n) && reader.remain() >=
+        (size_t)n * (legacy ? LEGACY_INDEX_ENTRY_SIZE : INDEX_ENTRY_SIZE));
+    for (uint32_t i = 0; ret && i < n; i++) {
+        if (paged && i % INDEX_PAGE_ENTRIES == 0) {
+            reader.seek((size_t)(i / INDEX_PAGE_ENTRIES) * INDEX_PAGE_SIZE);
+        }
+        bid_t bid;
+        BlockMeta meta;
+        ret = reader.readUInt64(&bid) && read_block_meta(&meta, reader) &&
+            (legacy || read_block_base(&meta, reader));
+        blocks[bid] = meta;
+    }
+    destroy(block);
+    if (!ret) {
+        LOG_ERROR("invalid index block");
+        return false;
+    }
     return true;
 }
 
@@ -481,63 +1099,129 @@ void Layout::flush_fly_holes(size_t fly_hole_size)
 
 bool Layout::flush_index()
 {
-    size_t size = get_index_size();
+    ScopedMutex block_index_lock(&block_index_mtx_);
+    if (superblock_->index_block_meta && !index_full_needed_ &&
+        dirty_bids_.empty()) {
+        // nothing changed since the last checkpoint
+        return true;
+    }
 
+    // the full index is rewritten once changes grow large,
+    // otherwise checkpoint costs as much as the changes
+    bool full = superblock_->index_block_meta == NULL || index_full_needed_ ||
+        dirty_bids_.size() * 100 >= index_entries_ * options_.index_delta_ratio;
+
+    // the full index cannot be written before it's loaded
+    if (loader_ && loader_->loading) {
+        full = false;
+    }
+
+    size_t size = full ? get_index_size() : get_delta_size();
     Slice buffer = alloc_aligned_buffer(size);
     if (!buffer.size()) {
         LOG_ERROR("alloc_aligned_buffer fail, size " << size);
         return false;
     }
 
+    memset((char *)buffer.data(), 0, buffer.size());
     Block block(buffer, 0, 0);
     BlockWriter writer(&block);
-    if (!write_index(writer)) {
+    if (!(full ? write_index(writer) : write_delta(writer))) {
         assert(false);
     }
-    assert(block.size() == size);
+    size = block.size();
+
+    size_t entries = block_index_.size();
+    size_t header_size = get_index_header_size(entries);
+    if (full) {
+        // changes from now on're against the new index
+        dirty_bids_.clear();
+        index_full_needed_ = false;
+    }
+    block_index_lock.unlock();
 
+    uint32_t crc = crc32(buffer.data(), size);
+    uint32_t header_crc = full ? crc32(buffer.data(), header_size) : 0;
     uint64_t offset = get_offset(buffer.size());
     if (!write_data(offset, buffer)) {
-        LOG_ERROR("flush index block error");
+        LOG_ERROR("flush " << (full ? "index" : "delta") << " block error");
         add_hole(offset, buffer.size());
         free_buffer(buffer);
+        if (full) {
+            block_index_lock.lock();
+            index_full_needed_ = true;
+        }
         return false;
     }
+    free_buffer(buffer);
 
-    LOG_TRACE("flush index block ok");
-    if (superblock_->index_block_meta) {
-        add_fly_hole(superblock_->index_block_meta->offset, 
-            PAGE_ROUND_UP(superblock_->index_block_meta->total_size));
+    LOG_TRACE("flush " << (full ? "index" : "delta") << " block ok, size " << size);
+    block_index_lock.lock();
+    if (full) {
+        replace_meta_block(superblock_->index_block_meta, offset, size, crc);
+        superblock_->index_block_meta->skeleton_size = header_size;
+        superblock_->index_block_meta->skeleton_crc = header_crc;
+        superblock_->index_version = SUPER_BLOCK_MINOR_VERSION;
+        if (superblock_->delta_block_meta) {
+            add_fly_hole(superblock_->delta_block_meta->offset,
+                PAGE_ROUND_UP(superblock_->delta_block_meta->total_size));
+            delete superblock_->delta_block_meta;
+            superblock_->delta_block_meta = NULL;
+        }
+        index_entries_ = entries;
     } else {
-        superblock_->index_block_meta = new BlockMeta();
+        replace_meta_block(superblock_->delta_block_meta, offset, size, crc);
     }
+    return true;
+}
 
-    ScopedMutex block_index_lock(&block_index_mtx_);
-    if (superblock_->index_block_meta) {
-        block_offset_index_.erase(superblock_->index_block_meta->offset);
+void Layout::replace_meta_block(BlockMeta*& meta, uint64_t offset, size_t size,
+                                uint32_t crc)
+{
+    if (meta) {
+        add_fly_hole(meta->offset, PAGE_ROUND_UP(meta->total_size));
+    } else {
+        meta = new BlockMeta();
     }
-    block_offset_index_[offset] = superblock_->index_block_meta;
-    block_index_lock.unlock();
-
-    superblock_->index_block_meta->offset = offset;
-    superblock_->index_block_meta->total_size = size;
 
-    free_buffer(buffer);
-	
-    return true;
+    meta->offset = offset;
+    meta->total_size = size;
+    meta->crc = crc;
 }
 
-bool Layout::read_superblock(BlockReader& reader)
+bool Layout::read_superblock(BlockReader& reader, SuperBlock *sb)
 {
-    if (!reader.readUInt64(&(superblock_->magic_number0))) return false;
-    if (!reader.readUInt8(&(superblock_->major_version))) return false;
-    if (!reader.readUInt8(&(superblock_->minor_version))) return false;
+    if (!reader.readUInt64(&(sb->magic_number0))) return false;
+    if (!reader.readUInt8(&(sb->major_version))) return false;
+    if (!reader.readUInt8(&(sb->minor_version))) return false;
 
     bool has_index_block_meta;
     if (!reader.readBool(&has_index_block_meta)) return false;
     if (has_index_block_meta) {
-        superblock_->index_block_meta = new BlockMeta();
-        if (!read_block_meta(superblock_->index_block_meta, reader)) return false;
+        sb->index_block_meta = new BlockMeta();
+        if (!read_block_meta(sb->index_block_meta, reader)) return false;
+    }
+
+    if (sb->minor_version >= 2) {
+        bool has_dict_block_meta;
+        if (!reader.readBool(&has_dict_block_meta)) return false;
+        if (has_dict_block_meta) {
+            sb->dict_block_meta = new BlockMeta();
+            if (!read_block_meta(sb->dict_block_meta, reader)) return false;
+        }
+    }
+
+    if (sb->minor_version >= 3) {
+        bool has_delta_block_meta;
+        if (!reader.readBool(&has_delta_block_meta)) return false;
+        if (has_delta_block_meta) {
+            sb->delta_block_meta = new BlockMeta();
+            if (!read_block_meta(sb->delta_block_meta, reader)) return false;
+        }
+    }
+
+    if (sb->minor_version >= 4) {
+        if (!reader.readUInt64(&(sb->generation))) return false;
     }
 
     uint32_t expected_crc, actual_crc;
@@ -554,6 +1238,10 @@ bool Layout::read_superblock(BlockReader& reader)
         return false;
     }
 
+    // older superblocks're upgraded when flushed, the index is
+    // written as a whole before that
+    sb->index_version = sb->minor_version;
+    sb->minor_version = SUPER_BLOCK_MINOR_VERSION;
     return true;
 }
 
@@ -570,47 +1258,138 @@ bool Layout::write_superblock(BlockWriter& writer)
         if (!writer.writeBool(false)) return false;
     }
 
+    if (superblock_->dict_block_meta) {
+        if (!writer.writeBool(true)) return false;
+        if (!write_block_meta(superblock_->dict_block_meta, writer)) return false;
+    } else {
+        if (!writer.writeBool(false)) return false;
+    }
+
+    if (superblock_->delta_block_meta) {
+        if (!writer.writeBool(true)) return false;
+        if (!write_block_meta(superblock_->delta_block_meta, writer)) return false;
+    } else {
+        if (!writer.writeBool(false)) return false;
+    }
+
+    if (!writer.writeUInt64(superblock_->generation)) return false;
+
     uint32_t crc = crc32(writer.start(), writer.pos());
     if (!writer.writeUInt32(crc)) return false;
 
     return true;
 }
 
-bool Layout::read_index(BlockReader& reader)
+size_t Layout::get_index_header_size(size_t n)
+{
+    size_t pages = (n + INDEX_PAGE_ENTRIES - 1) / INDEX_PAGE_ENTRIES;
+    return 4 + 4 + pages * INDEX_PAGE_HEADER_SIZE;  // count + pages + header of pages
+}
+
+size_t Layout::get_index_size()
+{
+    size_t n = block_index_.size();
+    size_t pages = (n + INDEX_PAGE_ENTRIES - 1) / INDEX_PAGE_ENTRIES;
+    return PAGE_ROUND_UP(get_index_header_size(n)) +  // header + pages of entries
+        pages * INDEX_PAGE_SIZE;
+}
+
+bool Layout::write_index(BlockWriter& writer)
+{
+    size_t n = block_index_.size();
+    size_t pages_start = PAGE_ROUND_UP(get_index_header_size(n));
+    std::vector<bid_t> bids;
+    std::vector<uint32_t> crcs;
+
+    // entries're written page by page after the header
+    size_t i = 0;
+    size_t page_start = pages_start;
+    for (BlockIndexType::iterator it = block_index_.begin();
+        it != block_index_.end(); it++, i++) {
+        if (i % INDEX_PAGE_ENTRIES == 0) {
+            page_start = pages_start + bids.size() * INDEX_PAGE_SIZE;
+            writer.seek(page_start);
+            bids.push_back(it->first);
+        }
+        if (!writer.writeUInt64(it->first)) return false;
+        if (!write_block_meta(it->second, writer)) return false;
+        if (!write_block_base(it->second, writer)) return false;
+        if ((i + 1) % INDEX_PAGE_ENTRIES == 0 || i + 1 == n) {
+            crcs.push_back(crc32(writer.start() + page_start,
+                writer.pos() - page_start));
+        }
+    }
+    size_t end = writer.pos();
+
+    writer.seek(0);
+    if (!writer.writeUInt32(n)) return false;
+    if (!writer.writeUInt32(bids.size())) return false;
+    for (size_t j = 0; j < bids.size(); j++) {
+        if (!writer.writeUInt64(bids[j])) return false;
+        if (!writer.writeUInt32(crcs[j])) return false;
+    }
+    if (end > writer.pos()) {
+        writer.seek(end);
+    }
+    return true;
+}
+
+bool Layout::read_delta(BlockReader& reader, bool legacy)
 {
     ScopedMutex block_index_lock(&block_index_mtx_);
-    assert(block_index_.size() == 0);
 
     uint32_t n;
     if (!reader.readUInt32(&n)) return false;
     for (uint32_t i = 0; i < n; i++ ) {
         bid_t bid;
-        BlockMeta* meta = new BlockMeta();
-        if (reader.readUInt64(&bid) && read_block_meta(meta, reader)) {
-            block_index_[bid] = meta;
-            continue;
+        bool exists;
+        if (!reader.readUInt64(&bid)) return false;
+        if (!reader.readBool(&exists)) return false;
+
+        BlockIndexType::iterator it = block_index_.find(bid);
+        if (exists) {
+            BlockMeta *meta;
+            if (it == block_index_.end()) {
+                meta = new BlockMeta();
+                block_index_[bid] = meta;
+            } else {
+                meta = it->second;
+            }
+            if (!read_block_meta(meta, reader)) return false;
+            if (!legacy && !read_block_base(meta, reader)) return false;
+        } else if (it != block_index_.end()) {
+            delete it->second;
+            block_index_.erase(it);
         }
-        delete meta;
-        return false;
+
+        // the next delta is still against the same full index
+        dirty_bids_.insert(bid);
     }
     return true;
 }
 
-size_t Layout::get_index_size()
+size_t Layout::get_delta_size()
 {
-    ScopedMutex block_index_lock(&block_index_mtx_);
-    return 4 + block_index_.size() *  // count + block meta
-        (8 + BLOCK_META_SIZE) ;   // key + value
+    return 4 + dirty_bids_.size() *  // count + changes
+        (8 + 1 + BLOCK_META_SIZE + BLOCK_BASE_SIZE);   // key + exists + value
 }
 
-bool Layout::write_index(BlockWriter& writer)
+bool Layout::write_delta(BlockWriter& writer)
 {
-    ScopedMutex block_index_lock(&block_index_mtx_);
-    if (!writer.writeUInt32(block_index_.size())) return false;
-    for(map<bid_t, BlockMeta*>::iterator it = block_index_.begin();
-        it != block_index_.end(); it++ ) {
-        if (!writer.writeUInt64(it->first)) return false;
-        if (!write_block_meta(it->second, writer)) return false;
+    if (!writer.writeUInt32(dirty_bids_.size())) return false;
+    for (set<bid_t>::iterator it = dirty_bids_.begin();
+        it != dirty_bids_.end(); it++) {
+        if (!writer.writeUInt64(*it)) return false;
+
+        // deleted blocks're written without metadata
+        BlockIndexType::iterator iit = block_index_.find(*it);
+        if (iit == block_index_.end()) {
+            if (!writer.writeBool(false)) return false;
+        } else {
+            if (!writer.writeBool(true)) return false;
+            if (!write_block_meta(iit->second, writer)) return false;
+            if (!write_block_base(iit->second, writer)) return false;
+        }
     }
     return true;
 }
@@ -622,6 +1401,9 @@ bool Layout::read_block_meta(BlockMeta* meta, BlockReader& reader)
     if (!reader.readUInt32(&(meta->total_size))) return false;
     if (!reader.readUInt32(&(meta->crc))) return false;
     if (!reader.readUInt32(&(meta->skeleton_crc))) return false;
+    meta->base_offset = 0;
+    meta->base_size = 0;
+    meta->base_crc = 0;
     return true;
 }
 
@@ -635,12 +1417,104 @@ bool Layout::write_block_meta(BlockMeta* meta, BlockWriter& writer)
     return true;
 }
 
+bool Layout::read_block_base(BlockMeta* meta, BlockReader& reader)
+{
+    if (!reader.readUInt64(&(meta->base_offset))) return false;
+    if (!reader.readUInt32(&(meta->base_size))) return false;
+    if (!reader.readUInt32(&(meta->base_crc))) return false;
+    return true;
+}
+
+bool Layout::write_block_base(BlockMeta* meta, BlockWriter& writer)
+{
+    if (!writer.writeUInt64(meta->base_offset)) return false;
+    if (!writer.writeUInt32(meta->base_size)) return false;
+    if (!writer.writeUInt32(meta->base_crc)) return false;
+    return true;
+}
+
+bool Layout::write_dict(Slice dict)
+{
+    assert(dict.size());
+
+    Slice buffer = alloc_aligned_buffer(dict.size());
+    if (!buffer.size()) {
+        LOG_ERROR("alloc_aligned_buffer fail, size " << dict.size());
+        return false;
+    }
+    memcpy((char *)buffer.data(), dict.data(), dict.size());
+    memset((char *)buffer.data() + dict.size(), 0, buffer.size() - dict.size());
+
+    uint64_t offset = get_offset(buffer.size());
+    if (!write_data(offset, buffer)) {
+        LOG_ERROR("write dictionary block error");
+        add_hole(offset, buffer.size());
+        free_buffer(buffer);
+        return false;
+    }
+    free_buffer(buffer);
+
+    if (superblock_->dict_block_meta) {
+        add_fly_hole(superblock_->dict_block_meta->offset,
+            PAGE_ROUND_UP(superblock_->dict_block_meta->total_size));
+    } else {
+        superblock_->dict_block_meta = new BlockMeta();
+    }
+
+    ScopedMutex block_index_lock(&block_index_mtx_);
+    superblock_->dict_block_meta->offset = offset;
+    superblock_->dict_block_meta->skeleton_size = 0;
+    superblock_->dict_block_meta->total_size = dict.size();
+    superblock_->dict_block_meta->crc = crc32(dict.data(), dict.size());
+    superblock_->dict_block_meta->skeleton_crc = 0;
+    return true;
+}
+
+bool Layout::read_dict(Slice& dict)
+{
+    dict = Slice();
+
+    ScopedMutex block_index_lock(&block_index_mtx_);
+    if (superblock_->dict_block_meta == NULL) {
+        return true;
+    }
+    BlockMeta meta = *superblock_->dict_block_meta;
+    block_index_lock.unlock();
+
+    Block *block;
+    if (!read_block(meta, &block)) {
+        LOG_ERROR("read dictionary block error");
+        return false;
+    }
+
+    if (crc32(block->start(), block->size()) != meta.crc) {
+        LOG_ERROR("dictionary block crc error");
+        destroy(block);
+        return false;
+    }
+
+    dict = Slice::alloc(block->size());
+    memcpy((char *)dict.data(), block->start(), block->size());
+    destroy(block);
+    return true;
+}
+
+bool Layout::get_block_offset(bid_t bid, uint64_t& offset)
+{
+    BlockMeta meta;
+    if (!get_block_meta(bid, meta)) {
+        return false;
+    }
+    offset = meta.offset;
+    return true;
+}
+
 bool Layout::get_block_meta(bid_t bid, BlockMeta& meta)
 {
     ScopedMutex lock(&block_index_mtx_);
     BlockIndexType::iterator it = block_index_.find(bid);
     if (it == block_index_.end()) {
-        return false;
+        return find_unloaded(bid, meta);
     }
     meta = *(it->second);
     return true;
@@ -653,16 +1527,19 @@ void Layout::set_block_meta(bid_t bid, const BlockMeta& meta)
     ScopedMutex lock(&block_index_mtx_);
     BlockIndexType::iterator it = block_index_.find(bid);
     if (it == block_index_.end()) {
+        BlockMeta old;
+        if (find_unloaded(bid, old)) {
+            release_extents(old, &meta);
+        }
         p = new BlockMeta();
         block_index_[bid] = p;
     } else {
         p = it->second;
-        block_offset_index_.erase(p->offset);
-        add_fly_hole(p->offset, PAGE_ROUND_UP(p->total_size));
+        release_extents(*p, &meta);
     }
 
     *p = meta;
-    block_offset_index_[meta.offset] = p;
+    dirty_bids_.insert(bid);
     lock.unlock();
 }
 
@@ -673,19 +1550,88 @@ void Layout::del_block_meta(bid_t bid)
     BlockIndexType::iterator it = block_index_.find(bid);
     if (it != block_index_.end()) {
         BlockMeta *p = it->second;
-        uint64_t offset;
-        size_t size;
-
         block_index_.erase(it);
-        offset = p->offset;
-        size = PAGE_ROUND_UP(p->total_size);
-        block_offset_index_.erase(p->offset);
+        dirty_bids_.insert(bid);
 
+        lock.unlock();
+        release_extents(*p, NULL);
         delete p;
+        return;
+    }
+
+    BlockMeta old;
+    if (find_unloaded(bid, old)) {
+        dirty_bids_.insert(bid);
 
         lock.unlock();
-        add_fly_hole(offset, size);
+        release_extents(old, NULL);
+    }
+}
+
+void Layout::release_extents(const BlockMeta& old, const BlockMeta *meta)
+{
+    bool based = meta && meta->base_size;
+    if (!(based && meta->base_offset == old.offset)) {
+        add_fly_hole(old.offset, PAGE_ROUND_UP(old.total_size));
+    }
+    if (old.base_size && !(based && meta->base_offset == old.base_offset)) {
+        add_fly_hole(old.base_offset, PAGE_ROUND_UP(old.base_size));
+    }
+}
+
+bool Layout::find_unloaded(bid_t bid, BlockMeta& meta)
+{
+    if (loader_ == NULL || !loader_->loading ||
+        dirty_bids_.find(bid) != dirty_bids_.end()) {
+        return false;
     }
+
+    // bid is inside the last page starting at or before it,
+    // pages loaded already're inside block_index_
+    const IndexHeader& header = loader_->header;
+    uint32_t page = upper_bound(header.bids.begin(), header.bids.end(), bid) -
+        header.bids.begin();
+    if (page == 0 || page - 1 < loader_->next_page) {
+        return false;
+    }
+    page --;
+
+    // the page is read under block_index_mtx_, only
+    // until the loader gets to it
+    Block *block;
+    map<uint32_t, Block*>::iterator it = loader_->pages.find(page);
+    if (it != loader_->pages.end()) {
+        block = it->second;
+    } else {
+        block = read_index_pages(loader_->index, header, page, 1);
+        if (block == NULL) {
+            return false;
+        }
+        loader_->pages[page] = block;
+    }
+
+    // binary search
+    BlockReader reader(block);
+    uint32_t first = 0;
+    uint32_t last = index_page_entries(header, page);
+    while (first < last) {
+        uint32_t mid = first + (last - first) / 2;
+        bid_t mid_bid;
+        reader.seek((size_t)mid * INDEX_ENTRY_SIZE);
+        if (!reader.readUInt64(&mid_bid)) {
+            assert(false);
+        }
+
+        if (mid_bid < bid) {
+            first = mid + 1;
+        } else if (mid_bid > bid) {
+            last = mid;
+        } else {
+            return read_block_meta(&meta, reader) &&
+                read_block_base(&meta, reader);
+        }
+    }
+    return false;
 }
 
 bool Layout::read_block(const BlockMeta& meta, Block **block)
@@ -802,50 +1748,134 @@ void Layout::print_index_info()
         << ", total size " << leaf_total_size);
 }
 
-void Layout::init_block_offset_index()
+void Layout::start_loader()
 {
+    assert(loader_);
+
     ScopedMutex block_index_lock(&block_index_mtx_);
 
-    for (BlockIndexType::iterator it = block_index_.begin(); 
+    // blocks inside the delta're loaded already
+    for (BlockIndexType::iterator it = block_index_.begin();
         it != block_index_.end(); it++ ) {
-        block_offset_index_[it->second->offset] = it->second;
+        add_extents(*it->second);
+    }
+    loader_->delta_bids = dirty_bids_;
+
+    BlockMeta *metas[3] = {superblock_->index_block_meta,
+                           superblock_->dict_block_meta,
+                           superblock_->delta_block_meta};
+    for (size_t i = 0; i < 3; i++) {
+        if (metas[i]) {
+            loader_->extents[metas[i]->offset] = PAGE_ROUND_UP(metas[i]->total_size);
+        }
     }
+    block_index_lock.unlock();
 
-    if (superblock_->index_block_meta) {
-        block_offset_index_[superblock_->index_block_meta->offset] =
-            superblock_->index_block_meta;
+    ScopedMutex lock(&mtx_);
+    loader_->end = offset_;
+    lock.unlock();
+
+    loader_->thread = new Thread(loader_main);
+    loader_->thread->start(this);
+}
+
+void Layout::add_extents(const BlockMeta& meta)
+{
+    loader_->extents[meta.offset] = PAGE_ROUND_UP(meta.total_size);
+    if (meta.base_size) {
+        loader_->extents[meta.base_offset] = PAGE_ROUND_UP(meta.base_size);
     }
 }
 
-void Layout::init_holes()
+void* Layout::loader_main(void *arg)
 {
-    ScopedMutex block_index_lock(&block_index_mtx_);
+    Layout *layout = (Layout*) arg;
+    layout->run_loader();
+    return NULL;
+}
 
-    BlockOffsetIndexType::iterator it = block_offset_index_.begin();
-    BlockOffsetIndexType::iterator prev;
-    for (; it != block_offset_index_.end(); it++ ) {
-        uint64_t last;
-        if (it == block_offset_index_.begin()) {
-            last = SUPER_BLOCK_SIZE * 2;
-        } else {
-            last = prev->second->offset + PAGE_ROUND_UP(prev->second->total_size);
+void Layout::run_loader()
+{
+    IndexLoader *loader = loader_;
+    const IndexHeader& header = loader->header;
+    uint32_t pages = header.bids.size();
+
+    uint32_t page = 0;
+    while (loader->loading && page < pages) {
+        // pages're read in runs outside of block_index_mtx_
+        uint32_t count = pages - page;
+        if (count > INDEX_LOAD_PAGES) {
+            count = INDEX_LOAD_PAGES;
+        }
+        Block *block = read_index_pages(loader->index, header, page, count);
+        if (block == NULL) {
+            // the rest is still searched page by page, holes aren't
+            // known and the full index isn't written again
+            LOG_ERROR("load index error at page " << page
+                << ", holes aren't searched");
+            return;
         }
 
-        if (it->second->offset > last) {
-            add_hole(last, it->second->offset - last);
+        // readers and writers're let in between runs
+        ScopedMutex block_index_lock(&block_index_mtx_);
+        if (loader->stop) {
+            destroy(block);
+            return;
         }
-        prev = it;
-    }
 
-    ScopedMutex lock(&mtx_);
+        BlockReader reader(block);
+        for (uint32_t i = 0; i < count; i++, page++) {
+            reader.seek((size_t)i * INDEX_PAGE_SIZE);
+            uint32_t n = index_page_entries(header, page);
+            for (uint32_t j = 0; j < n; j++) {
+                bid_t bid;
+                BlockMeta meta;
+                if (!reader.readUInt64(&bid) || !read_block_meta(&meta, reader) ||
+                    !read_block_base(&meta, reader)) {
+                    assert(false);
+                }
+
+                // the space is taken up until it's freed at the next checkpoint
+                if (loader->delta_bids.find(bid) == loader->delta_bids.end()) {
+                    add_extents(meta);
+                }
+
+                if (dirty_bids_.find(bid) == dirty_bids_.end()) {
+                    block_index_[bid] = new BlockMeta(meta);
+                }
+            }
 
-    // set file offset
-    if (block_offset_index_.size())  {
-        offset_ = block_offset_index_.rbegin()->second->offset +
-            PAGE_ROUND_UP(block_offset_index_.rbegin()->second->total_size);
-    } else {
-        offset_ = SUPER_BLOCK_SIZE * 2;
+            map<uint32_t, Block*>::iterator it = loader->pages.find(page);
+            if (it != loader->pages.end()) {
+                destroy(it->second);
+                loader->pages.erase(it);
+            }
+            loader->next_page = page + 1;
+        }
+        block_index_lock.unlock();
+        destroy(block);
+    }
+
+    // space between blocks on disk is free, blocks written
+    // after file is opened are all outside of it
+    uint64_t last = SUPER_BLOCK_SIZE * 2;
+    for (map<uint64_t, uint64_t>::iterator it = loader->extents.begin();
+        it != loader->extents.end(); it++) {
+        if (it->first > last) {
+            add_hole(last, it->first - last);
+        }
+        last = it->first + it->second;
     }
+    if (loader->end > last) {
+        add_hole(last, loader->end - last);
+    }
+    loader->extents.clear();
+
+    ScopedMutex block_index_lock(&block_index_mtx_);
+    loader->loading = false;
+    block_index_lock.unlock();
+
+    print_index_info();
 }
 
 void Layout::add_hole(uint64_t offset, size_t size)
@@ -958,34 +1988,18 @@ bool Layout::get_hole(size_t size, uint64_t& offset)
 
 Slice Layout::alloc_aligned_buffer(size_t size)
 {
-    assert(size);
-    size_t rounded_size = PAGE_ROUND_UP(size);
-
-    void *buf;
-    if (posix_memalign(&buf, PAGE_SIZE, rounded_size)) {
-        assert(false);
-    }
-
-    if (buf) {
-        assert( ((size_t)buf & (PAGE_SIZE-1)) == 0);
-        return Slice((char *)buf, rounded_size);
-    } else {
-        return Slice(); // empty
-    }
+    return buffer_pool_.alloc(size);
 }
 
 void Layout::free_buffer(Slice buffer)
 {
-    if (buffer.size()) {
-        free((char* )buffer.data()); // non-empty
-    }
+    buffer_pool_.free(buffer);
 }
 
 Block* Layout::create(size_t size)
 {
     Slice buffer = alloc_aligned_buffer(size);
     if (buffer.size()) {
-        memset((void*)buffer.data(), 0, buffer.size());
         return new Block(buffer, 0, 0);
     } else {
         return NULL;
@@ -16,6 +16,7 @@
 #include "cascadb/options.h"
 #include "sys/sys.h"
 #include "util/callback.h"
+#include "util/buffer_pool.h"
 #include "block.h"
 #include "super_block.h"
 
@@ -23,6 +24,33 @@ namespace cascadb {
 
 #define BLOCK_META_SIZE (64 + 32 + 32 + CRC_SIZE*8 + CRC_SIZE*8) / 8
 
+#define BLOCK_BASE_SIZE (64 + 32 + CRC_SIZE*8) / 8
+
+// Entries of the full index're sorted by bid and have fixed size,
+// so it can be searched in place
+#define INDEX_ENTRY_SIZE (8 + BLOCK_META_SIZE + BLOCK_BASE_SIZE)
+
+// Entries written before version 0.5 have no base extent
+#define LEGACY_INDEX_ENTRY_SIZE (8 + BLOCK_META_SIZE)
+
+// Since version 0.6 entries of the full index're laid out in pages,
+// each page starts at a page boundary and is checked by its own crc.
+// The header before them holds the first bid and crc of each page,
+// it's the skeleton of the index block, so only the header is read
+// at open and pages're read on demand
+#define INDEX_PAGE_SIZE PAGE_SIZE
+#define INDEX_PAGE_ENTRIES (INDEX_PAGE_SIZE / INDEX_ENTRY_SIZE)
+#define INDEX_PAGE_HEADER_SIZE (8 + CRC_SIZE)
+
+// Pages of index're read by the loader in runs of this number
+#define INDEX_LOAD_PAGES 64
+
+// A block can reference sub-blocks of the block it replaces rather
+// than carry them, the replaced block is kept as the base extent then.
+// Offsets of sub-blocks inside base're or-ed with this flag and
+// relative to the start of base
+#define SUBBLOCK_IN_BASE 0x80000000U
+
 // Metadata for block, stored inside index
 struct BlockMeta {
     uint64_t    offset;             // start offset in file
@@ -30,6 +58,16 @@ struct BlockMeta {
     uint32_t    total_size;         // total size in bytes
     uint32_t    crc;                // crc of block data
     uint32_t    skeleton_crc;       // crc of skeleton data
+    uint64_t    base_offset;        // start offset of base extent
+    uint32_t    base_size;          // size of base extent, 0 if none
+    uint32_t    base_crc;           // crc of base extent
+};
+
+// How a block being written references the block it replaces
+enum BlockBase {
+    kNoBase,            // sub-blocks're all inside the new block
+    kKeepBase,          // the base of the replaced block is kept
+    kReplacedAsBase,    // the replaced block becomes the base
 };
 
 // Storage layout, read blocks from file and write blocks into file
@@ -58,75 +96,200 @@ public:
 
     // Blocking read
     // Read from a relative offset from the beginning of block
-    // and get n bytes, the area should not out of bounds
+    // and get n bytes, the area should not out of bounds.
+    // The offset is relative to base if SUBBLOCK_IN_BASE is set
     Block* read(bid_t bid, uint32_t offset, uint32_t size, uint32_t subblock_crc);
 
+    // Blocking read of the whole base extent of block, sub-blocks
+    // inside it're read from there when the node is fully loaded
+    Block* read_base(bid_t bid);
+
     // Initialize a read operation
     void async_read(bid_t bid, Block** block, Callback *cb);
 
+    // Initialize a read operation on a sub block,
+    // the area is the same as the blocking version
+    void async_read(bid_t bid, uint32_t offset, uint32_t size,
+                    uint32_t subblock_crc, Block** block, Callback *cb);
+
     // Initiate a write operation
     void async_write(bid_t bid, Block* block, uint32_t skeleton_size, Callback *cb);
+
+    // Initiate a vectored write operation, blocks're written back to back
+    // as a single block, each should be padded to page except the last,
+    // and the skeleton is inside the first one. The block can reference
+    // sub-blocks of the one it replaces as told by base, the space of
+    // base isn't freed until no block references it
+    void async_write(bid_t bid, const std::vector<Block*>& blocks,
+                     uint32_t skeleton_size, BlockBase base, Callback *cb);
     
     // Delete block from index 
     void delete_block(bid_t bid);
 
+    // Blocking write of the compression dictionary, it's referenced
+    // from SuperBlock after the next flush_meta()
+    bool write_dict(Slice dict);
+
+    // Blocking read of the compression dictionary, dict is left
+    // empty if there is none, caller should destroy it otherwise
+    bool read_dict(Slice& dict);
+
+    // Get the offset of a block in file, return false if not found
+    bool get_block_offset(bid_t bid, uint64_t& offset);
+
     // Flush blocks and index out
     bool flush();
 
     // Flush meta data
     bool flush_meta();
 
+    // Copy blocks referenced by the last checkpoint into dest as a new
+    // data file, space freed since isn't reused until the copy's done.
+    // Blocks adjacent in file're read and written together
+    bool export_checkpoint(AIOFile *dest);
+
     // Truncate unused space at file end,
     // invoked inside init/flush by default
     void truncate();
 
-    // Construct a Block object
+    // Construct a Block object, its buffer isn't zeroed,
+    // padding to page is zeroed when it's written
     Block* create(size_t limit);
     
     // Destrcut a Block object
     void destroy(Block* block);
 
 protected:
-    // read and deserialize superblock
-    bool load_superblock();
+    // Read and deserialize the superblock copy at offset,
+    // return NULL if it's invalid
+    SuperBlock* load_superblock(uint64_t offset);
 
-    // read and deserialize the second superblock
-    // superblock is double written to ensure correctness
-    bool load_2nd_superblock();
+    // Delete superblock and block metadata inside it
+    void free_superblock(SuperBlock *sb);
 
-    // Flush super block (double write)
+    // Flush super block with a new generation, copies're written
+    // one after another and each is made durable before the next,
+    // so at least one of them is valid after crash
     bool flush_superblock();
 
-    // Read and deserialize the index block
+    // Read the header of the index block and apply the delta block
+    // if there is one. Pages of the index block're read on demand and
+    // searched in place until they're loaded in background, so open
+    // reads the header and the delta only. Index older than
+    // version 0.6 isn't paged, it's read whole and loaded at once
     bool load_index();
 
-    // Serialize index into the index block and write it out
+    // Start loading the index and finding holes in background
+    void start_loader();
+
+    static void* loader_main(void *arg);
+
+    // Read pages of the index block in runs and move their entries
+    // into block_index_, then add space not taken up by blocks to
+    // hole list. Holes aren't searched if a page is broken
+    void run_loader();
+
+    // Mark space of block and its base extent taken up in extents
+    // of the loader
+    void add_extents(const BlockMeta& meta);
+
+    // Search the page of index block holding bid if it's not loaded
+    // yet, entries changed since are skipped. The page is read and
+    // kept until it's loaded, block_index_mtx_ should be held
+    bool find_unloaded(bid_t bid, BlockMeta& meta);
+
+    // First bid and crc of each page of a paged index block
+    struct IndexHeader {
+        uint32_t                        entries;
+        std::vector<bid_t>              bids;
+        std::vector<uint32_t>           crcs;
+    };
+
+    // Read the header of a paged index block and check it
+    bool read_index_header(const BlockMeta& index, IndexHeader& header);
+
+    // Read pages of a paged index block from first on and check
+    // them, pages in block're INDEX_PAGE_SIZE apart
+    Block* read_index_pages(const BlockMeta& index, const IndexHeader& header,
+                            uint32_t first, uint32_t count);
+
+    // Number of entries inside a page of index
+    uint32_t index_page_entries(const IndexHeader& header, uint32_t page);
+
+    // Read all entries of an index block of the given version
+    bool read_index_block(const BlockMeta& index, uint8_t version,
+                          std::map<bid_t, BlockMeta>& blocks);
+
+    // Serialize index into the index block and write it out,
+    // only entries changed since the last full index're written
+    // into the delta block unless there're too many of them
     bool flush_index();
 
+    // Space taken up by old becomes fly holes, except the extent
+    // which is still the base of meta, meta is NULL if it's deleted
+    void release_extents(const BlockMeta& old, const BlockMeta *meta);
+
+    // Replace block of index or delta with a newly written one,
+    // the old space becomes a fly hole
+    void replace_meta_block(BlockMeta*& meta, uint64_t offset, size_t size,
+                            uint32_t crc);
+
     // Add fly holes to hole list
     void flush_fly_holes(size_t fly_hole_size);
 
+    // Read blocks referenced by the index and delta of the given
+    // version, not those in block_index_ which're possibly not
+    // checkpointed yet
+    bool read_checkpoint_index(const BlockMeta& index, const BlockMeta *delta,
+                               uint8_t version, std::map<bid_t, BlockMeta>& blocks);
+
+    // Copy blocks of a checkpoint into dest and write index
+    // and superblock of dest after them
+    bool copy_checkpoint(AIOFile *dest, const BlockMeta *index,
+                         const BlockMeta *delta, const BlockMeta *dict,
+                         uint8_t version);
+
     // Deserialize superblock from buffer
-    bool read_superblock(BlockReader& reader);
+    bool read_superblock(BlockReader& reader, SuperBlock *sb);
 
     // Serialize superblock into buffer
     bool write_superblock(BlockWriter& writer);
 
-    // Deserialize index from buffer
-    bool read_index(BlockReader& reader);
+    // Size of the header of a paged index with n entries
+    size_t get_index_header_size(size_t n);
 
-    // Calculate the size of buffer after index is serialized
+    // Calculate the size of buffer after index is serialized,
+    // block_index_mtx_ should be held
     size_t get_index_size();
 
-    // Serialize index into buffer
+    // Serialize index into buffer, pages're written after the header
+    // and the buffer should be zeroed. block_index_mtx_ should be held
     bool write_index(BlockWriter& writer);
 
+    // Deserialize changes of index and apply them
+    bool read_delta(BlockReader& reader, bool legacy);
+
+    // Calculate the size of buffer after changes of index are
+    // serialized, block_index_mtx_ should be held
+    size_t get_delta_size();
+
+    // Serialize changes of index into buffer,
+    // block_index_mtx_ should be held
+    bool write_delta(BlockWriter& writer);
+
     // Deserialize block metadata from buffer
     bool read_block_meta(BlockMeta* meta, BlockReader& reader);
 
     // Serialize block metadata into buffer
     bool write_block_meta(BlockMeta* meta, BlockWriter& writer);
 
+    // Deserialize base extent of block, entries of index and delta
+    // have it since version 0.5
+    bool read_block_base(BlockMeta* meta, BlockReader& reader);
+
+    // Serialize base extent of block
+    bool write_block_base(BlockMeta* meta, BlockWriter& writer);
+
     // Context of async read operation
     struct AsyncReadReq {
         bid_t                   bid;
@@ -134,6 +297,10 @@ protected:
         Block                   **block;
         BlockMeta               meta;
         Slice                  buffer;
+        bool                    subblock;
+        uint32_t                offset;         // relative to block start
+        uint32_t                size;
+        uint32_t                subblock_crc;
     };
 
     // called when AIOFile returns the result of async read
@@ -171,10 +338,6 @@ protected:
 
     void print_index_info();
 
-    void init_block_offset_index();
-
-    void init_holes();
-
     void add_hole(uint64_t offset, size_t size);
 
     void add_fly_hole(uint64_t offset, size_t size);
@@ -190,6 +353,9 @@ private:
     uint64_t                            length_; // file length
     Options                             options_;
 
+    // buffers of all block reads and writes
+    BufferPool                          buffer_pool_;
+
     Mutex                               mtx_;
 
     // the offset to file end
@@ -203,10 +369,23 @@ private:
     typedef std::map<bid_t, BlockMeta*> BlockIndexType;
     BlockIndexType                      block_index_;
 
-    // Auxiliary index of BlockMeta, sorted by offset in file.
-    // including BlockMeta of block index
-    typedef std::map<uint64_t, BlockMeta*> BlockOffsetIndexType;
-    BlockOffsetIndexType                block_offset_index_;
+    // Blocks written or deleted since the last full index,
+    // they're written into the delta block at checkpoints
+    std::set<bid_t>                     dirty_bids_;
+
+    // Number of entries inside the last full index
+    size_t                              index_entries_;
+
+    // Set if the last full index failed to be written,
+    // changes before it're lost from dirty_bids_
+    bool                                index_full_needed_;
+
+    // Checkpoints're taken one at a time
+    Mutex                               checkpoint_mtx_;
+
+    // Number of checkpoints being exported, fly holes aren't
+    // added to hole list until they're done
+    size_t                              pinned_;
 
     Mutex                               hole_list_mtx_;
     Mutex                               fly_hole_list_mtx_;
@@ -223,6 +402,35 @@ private:
     HoleListType                        hole_list_;
     HoleListType                        fly_hole_list_;
 
+    // Context of loading index in background
+    struct IndexLoader {
+        Thread                          *thread;
+        bool                            stop;
+
+        // set until entries of the index block're all loaded,
+        // pages before next_page're inside block_index_ already
+        bool                            loading;
+        BlockMeta                       index;
+        IndexHeader                     header;
+        uint32_t                        next_page;
+        uint32_t                        entries;
+
+        // pages read by lookups, they're dropped once loaded
+        std::map<uint32_t, Block*>      pages;
+
+        // blocks inside the delta block
+        std::set<bid_t>                 delta_bids;
+
+        // space taken up by blocks not in the index block,
+        // indexed by offset
+        std::map<uint64_t, uint64_t>    extents;
+
+        // file end when it's opened
+        uint64_t                        end;
+    };
+
+    IndexLoader                         *loader_;
+
     // the rest are statistics information
     size_t                              fly_writes_;    // todo atomic
     size_t                              fly_reads_;     // todo atomic
@@ -11,6 +11,7 @@ namespace cascadb {
 
 #define SUPER_BLOCK_SIZE        4096
 #define SUPER_BLOCK_MAGIC_NUM (0x6264616373616) // "cascadb
+#define SUPER_BLOCK_MINOR_VERSION 6
 
 class BlockMeta;
 
@@ -19,18 +20,34 @@ public:
     SuperBlock()
     {
         magic_number0 = SUPER_BLOCK_MAGIC_NUM;   // "cascadb
-        major_version = 0;                  // "version 0.1"
-        minor_version = 1;
+        major_version = 0;                  // "version 0.6"
+        minor_version = SUPER_BLOCK_MINOR_VERSION;
+        generation = 0;
+        index_version = SUPER_BLOCK_MINOR_VERSION;
 
         index_block_meta = NULL;
+        dict_block_meta = NULL;
+        delta_block_meta = NULL;
         magic_number1 = SUPER_BLOCK_MAGIC_NUM;    // "cascadb"
     }
 
     uint64_t        magic_number0;
     uint8_t         major_version;
     uint8_t         minor_version;
+    // increased each time superblock is written, the newer one of
+    // the two copies is used, since version 0.4
+    uint64_t        generation;
+    // minor version of the superblock index and delta're read
+    // from, entries have no base extent before 0.5 and the index
+    // isn't paged before 0.6. Not serialized
+    uint8_t         index_version;
 
     BlockMeta       *index_block_meta;
+    // compression dictionary of the table, since version 0.2
+    BlockMeta       *dict_block_meta;
+    // changes of block index since index_block_meta is written,
+    // since version 0.3
+    BlockMeta       *delta_block_meta;
     uint64_t        magic_number1;
 };
 
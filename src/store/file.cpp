@@ -50,4 +50,52 @@ AIOStatus AIOFile::write(uint64_t offset, Slice buf)
     req->mtx.unlock();
     delete req;
     return status;
-}
\ No newline at end of file
+}
+
+class VectoredAIORequest {
+public:
+    VectoredAIORequest() : mtx(), pending(0) {}
+
+    Mutex           mtx;
+    size_t          pending;
+    AIOStatus       status;
+    void            *context;
+    aio_callback_t  cb;
+};
+
+static void vectored_aio_handler(void *context, AIOStatus status)
+{
+    VectoredAIORequest* req = (VectoredAIORequest*) context;
+    req->mtx.lock();
+    if (!status.succ) {
+        req->status.succ = false;
+    }
+    bool done = (--req->pending == 0);
+    req->mtx.unlock();
+
+    if (done) {
+        req->cb(req->context, req->status);
+        delete req;
+    }
+}
+
+void AIOFile::async_writev(uint64_t offset, const std::vector<Slice>& bufs,
+                           void* context, aio_callback_t cb)
+{
+    VectoredAIORequest* req = new VectoredAIORequest();
+    req->status.succ = true;
+    req->context = context;
+    req->cb = cb;
+    // hold an extra count until all writes're issued,
+    // some of them may complete inline
+    req->pending = bufs.size() + 1;
+
+    for (size_t i = 0; i < bufs.size(); i++) {
+        async_write(offset, bufs[i], req, vectored_aio_handler);
+        offset += bufs[i].size();
+    }
+
+    AIOStatus status;
+    status.succ = true;
+    vectored_aio_handler(req, status);
+}
@@ -243,6 +243,19 @@ public:
         cb(context, status);
     }
 
+    void async_writev(uint64_t offset, const std::vector<Slice>& bufs,
+                      void* context, aio_callback_t cb)
+    {
+        assert(file_);
+        AIOStatus status;
+        status.succ = true;
+        for (size_t i = 0; i < bufs.size() && status.succ; i++) {
+            status.succ = file_->write(offset, bufs[i]);
+            offset += bufs[i].size();
+        }
+        cb(context, status);
+    }
+
     void truncate(uint64_t offset)
     {
         assert(file_);
@@ -12,6 +12,7 @@
 #include <sys/errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 // linux
 #ifdef HAS_LIBAIO
@@ -42,6 +43,7 @@ public:
     size_t size;
     void *context;
     aio_callback_t cb;
+    std::vector<struct iovec> iov; // vectored write only
 };
 
 // A wrapper of Linxu libaio APIs
@@ -193,6 +195,41 @@ public:
         }
     }
 
+    void async_writev(uint64_t offset, const std::vector<Slice>& bufs,
+                      void* context, aio_callback_t cb)
+    {
+        struct iocb iocb;
+        struct iocb *iocbp = &iocb;
+
+        // prepare
+        AIOTask* task = new AIOTask();
+        assert(task);
+        task->op = AIOWrite;
+        task->size = 0;
+        task->context = context;
+        task->cb = cb;
+        task->iov.resize(bufs.size());
+        for (size_t i = 0; i < bufs.size(); i++) {
+            task->iov[i].iov_base = (void *)bufs[i].data();
+            task->iov[i].iov_len = bufs[i].size();
+            task->size += bufs[i].size();
+        }
+
+        LOG_TRACE("write " << task->size << " bytes in " << bufs.size()
+            << " buffers out to " << path_ << ":" << offset);
+
+        io_prep_pwritev(iocbp, fd_, &task->iov[0], task->iov.size(), offset);
+        iocbp->data = task;
+
+        // submit
+        if (!submit(1, &iocbp)) {
+            AIOStatus status;
+            status.succ = false;
+            cb(context, status);
+            delete task;
+        }
+    }
+
     void truncate(uint64_t offset)
     {
         if (::ftruncate(fd_, offset) < 0) {
@@ -200,6 +237,15 @@ public:
         }
     }
 
+    bool sync()
+    {
+        if (::fdatasync(fd_) < 0) {
+            LOG_ERROR("sync file " << path_ << ", error " << strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
     void close()
     {
         if (!closed_) {
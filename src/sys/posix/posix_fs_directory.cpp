@@ -272,6 +272,15 @@ public:
         return;
     }
 
+    bool sync()
+    {
+        if (::fdatasync(fd_) < 0) {
+            LOG_ERROR("sync file " << path_ << ", error " << strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
     void close()
     {
         if (!closed_) {
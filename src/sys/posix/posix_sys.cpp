@@ -52,6 +52,11 @@ void Thread::join()
     }
 }
 
+bool Thread::is_current()
+{
+    return alive_ && pthread_equal(thr_, pthread_self());
+}
+
 Mutex::Mutex() {
     locked_ = false;
     pthread_call("init mutex", pthread_mutex_init(&mu_, NULL));
@@ -102,10 +107,12 @@ bool Mutex::lock_try(unsigned int millisec) {
 }
 
 void Mutex::unlock() {
+    // clear the flag while it's still held, the owner of a mutex
+    // may destroy it as soon as it's released
+    locked_ = false;
     int res = pthread_mutex_unlock(&mu_);
-    if (res == 0) {
-        locked_ = false;
-    } else {
+    if (res != 0) {
+        locked_ = true;
         throw pthread_call_exception("unlock", res);
     }
 }
@@ -269,6 +276,18 @@ extern uint64_t now_micros()
     return t.tv_sec * 1000000 + t.tv_usec;
 }
 
+extern uint64_t coarse_now_micros()
+{
+#ifdef CLOCK_MONOTONIC_COARSE
+    // served by vdso, no system call
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return now_micros();
+#endif
+}
+
 void sleep(Second sec)
 {
     ::sleep(sec);
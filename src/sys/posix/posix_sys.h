@@ -23,6 +23,8 @@ public:
     ~Thread();
     void start(void* arg);
     void join();
+    // true if it's called inside the thread
+    bool is_current();
 private:
   Thread(const Thread&);
   Thread& operator =(const Thread&);
@@ -83,6 +85,39 @@ private:
 };
 
 
+// Atomic operations, loads have acquire semantics,
+// and read-modify-write operations're full barriers
+template<typename T>
+inline T atomic_load(const T *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+// stores have release semantics
+template<typename T>
+inline void atomic_store(T *p, T v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+template<typename T>
+inline T atomic_add_fetch(T *p, T v)
+{
+    return __atomic_add_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+template<typename T>
+inline T atomic_sub_fetch(T *p, T v)
+{
+    return __atomic_sub_fetch(p, v, __ATOMIC_SEQ_CST);
+}
+
+// loads before this fence aren't reordered with those after it
+inline void acquire_fence()
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
 typedef struct timeval Time;
 typedef time_t Second;
 typedef useconds_t USecond;
@@ -92,6 +127,9 @@ extern bool operator<(const Time& t1, const Time& t2);
 extern Time now();
 extern std::ostream& operator<<(std::ostream& os, const Time& t);
 extern uint64_t now_micros();
+// cheap monotonic clock of a few milliseconds resolution,
+// for ordering and expiring rather than measuring
+extern uint64_t coarse_now_micros();
 extern void sleep(Second sec);
 extern void usleep(USecond usec);
 // t2 - t1
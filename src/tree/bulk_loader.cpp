@@ -0,0 +1,286 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/logger.h"
+#include "util/bits.h"
+#include "keycomp.h"
+#include "tree.h"
+#include "bulk_loader.h"
+
+using namespace std;
+using namespace cascadb;
+
+// writes in flight, bounds memory held by serialized nodes
+static const size_t kMaxPendingWrites = 16;
+
+TreeBulkLoader::TreeBulkLoader(Tree *tree)
+: tree_(tree),
+  leaf_(NULL),
+  cond_(&mtx_),
+  writing_(0),
+  error_(false),
+  finished_(false),
+  leaves_count_(0),
+  inners_count_(0)
+{
+}
+
+TreeBulkLoader::~TreeBulkLoader()
+{
+    wait_writes(0);
+
+    delete leaf_;
+    if (last_key_.size()) {
+        last_key_.destroy();
+    }
+    for (size_t i = 0; i < levels_.size(); i++) {
+        for (size_t j = 0; j < levels_[i].size(); j++) {
+            if (levels_[i][j].key.size()) {
+                levels_[i][j].key.destroy();
+            }
+        }
+    }
+}
+
+bool TreeBulkLoader::add(Slice key, Slice value)
+{
+    assert(!finished_);
+
+    if (last_key_.size()) {
+        if (compare_keys(tree_->options_.comparator, tree_->comparator_kind_,
+                         last_key_, key) >= 0) {
+            LOG_ERROR("bulk load keys must be in ascending order");
+            return false;
+        }
+        last_key_.destroy();
+    }
+    last_key_ = key.clone();
+
+    Record record(key.clone(), value.clone());
+
+    if (leaf_ && leaf_->records_.size() &&
+        (leaf_->records_.length() + record.size() > tree_->options_.leaf_node_page_size ||
+         leaf_->records_.size() >= tree_->options_.leaf_node_record_count)) {
+        bid_t right = next_nid(true);
+        leaf_->right_sibling_ = right;
+        bid_t left = leaf_->nid();
+        if (!flush_leaf()) {
+            record.key.destroy();
+            record.value.destroy();
+            return false;
+        }
+        leaf_ = (LeafNode*) tree_->node_factory_->new_node(right);
+        leaf_->left_sibling_ = left;
+    }
+
+    if (leaf_ == NULL) {
+        leaf_ = (LeafNode*) tree_->node_factory_->new_node(next_nid(true));
+    }
+
+    leaf_->records_.push_back(record);
+    return true;
+}
+
+bool TreeBulkLoader::finish()
+{
+    assert(!finished_);
+    finished_ = true;
+
+    if (leaf_ == NULL) {
+        // nothing loaded, the empty root is kept
+        return true;
+    }
+
+    if (!flush_leaf()) {
+        return false;
+    }
+
+    // close levels from bottom up, the last one holds the root
+    bid_t root_nid = NID_NIL;
+    size_t depth = 0;
+    for (size_t i = 0; i < levels_.size(); i++) {
+        if (i + 1 < levels_.size()) {
+            if (levels_[i].size()) {
+                Slice first = levels_[i][0].key;
+                levels_[i][0].key = Slice();
+
+                bid_t nid;
+                if (!flush_inner(i, nid)) {
+                    first.destroy();
+                    return false;
+                }
+                if (!add_child(i + 1, first, nid)) {
+                    return false;
+                }
+            }
+        } else if (i > 0 && levels_[i].size() == 1) {
+            // the only node at the level below is root
+            root_nid = levels_[i][0].nid;
+            depth = i + 1;
+        } else {
+            if (!flush_inner(i, root_nid)) {
+                return false;
+            }
+            depth = i + 2;
+        }
+    }
+
+    wait_writes(0);
+    if (error_) {
+        LOG_ERROR("bulk load write nodes error");
+        return false;
+    }
+
+    LOG_INFO("bulk load " << leaves_count_ << " leaves, "
+        << inners_count_ << " inner nodes, tree depth " << depth);
+
+    if (!tree_->publish_root(root_nid, depth)) {
+        return false;
+    }
+
+    // schema and index're written out
+    tree_->cache_->flush_table(tree_->table_name_);
+    return true;
+}
+
+bid_t TreeBulkLoader::next_nid(bool leaf)
+{
+    SchemaNode *schema = tree_->schema_;
+    schema->write_lock();
+    bid_t nid = leaf ? schema->next_leaf_node_id ++ : schema->next_inner_node_id ++;
+    schema->set_dirty(true);
+    schema->unlock();
+    return nid;
+}
+
+bool TreeBulkLoader::flush_leaf()
+{
+    assert(leaf_ && leaf_->records_.size());
+    leaf_->refresh_buckets_info();
+
+    Slice key = leaf_->buckets_info_[0].key.clone();
+    bid_t nid = leaf_->nid();
+
+    LeafNode *leaf = leaf_;
+    leaf_ = NULL;
+    if (!write_node(leaf)) {
+        key.destroy();
+        return false;
+    }
+    leaves_count_ ++;
+
+    return add_child(0, key, nid);
+}
+
+bool TreeBulkLoader::add_child(size_t level, Slice key, bid_t nid)
+{
+    if (levels_.size() == level) {
+        levels_.push_back(vector<Child>());
+    }
+
+    Child child;
+    child.key = key;
+    child.nid = nid;
+    levels_[level].push_back(child);
+
+    if (levels_[level].size() < tree_->options_.inner_node_children_number) {
+        return true;
+    }
+
+    // the smallest key in subtree goes to the level above
+    Slice first = levels_[level][0].key;
+    levels_[level][0].key = Slice();
+
+    bid_t inner;
+    if (!flush_inner(level, inner)) {
+        first.destroy();
+        return false;
+    }
+    return add_child(level + 1, first, inner);
+}
+
+bool TreeBulkLoader::flush_inner(size_t level, bid_t& nid)
+{
+    vector<Child>& children = levels_[level];
+    assert(children.size());
+
+    nid = next_nid(false);
+    InnerNode *node = (InnerNode*) tree_->node_factory_->new_node(nid);
+
+    node->bottom_ = (level == 0);
+    node->first_child_ = children[0].nid;
+    node->first_msgbuf_ = new MsgBuf(tree_->options_.comparator);
+    node->msgbufsz_ += node->first_msgbuf_->size();
+    for (size_t i = 1; i < children.size(); i++) {
+        MsgBuf *mb = new MsgBuf(tree_->options_.comparator);
+        // key is moved into pivot
+        node->pivots_.push_back(Pivot(children[i].key, children[i].nid, mb));
+        node->pivots_sz_ += node->pivot_size(children[i].key);
+        node->msgbufsz_ += mb->size();
+    }
+    node->refresh_pivot_prefixes();
+
+    if (children[0].key.size()) {
+        children[0].key.destroy();
+    }
+    children.clear();
+
+    if (!write_node(node)) {
+        return false;
+    }
+    inners_count_ ++;
+    return true;
+}
+
+bool TreeBulkLoader::write_node(DataNode *node)
+{
+    wait_writes(kMaxPendingWrites - 1);
+
+    Layout *layout = tree_->layout_;
+    size_t estimated_buffer_size = node->estimated_buffer_size();
+    Block *block = layout->create(estimated_buffer_size);
+    assert(block);
+
+    size_t skeleton_size;
+    BlockWriter writer(block);
+    if (!node->write_to(writer, skeleton_size)) {
+        LOG_ERROR("serialize node error, nid " << node->nid());
+        layout->destroy(block);
+        delete node;
+        return false;
+    }
+    assert(estimated_buffer_size >= block->size());
+    block->buffer().resize(PAGE_ROUND_UP(block->size()));
+
+    bid_t nid = node->nid();
+    delete node;
+
+    ScopedMutex lock(&mtx_);
+    writing_ ++;
+    lock.unlock();
+
+    Callback *cb = new Callback(this, &TreeBulkLoader::write_complete, block);
+    layout->async_write(nid, block, skeleton_size, cb);
+    return true;
+}
+
+void TreeBulkLoader::write_complete(Block *block, bool succ)
+{
+    tree_->layout_->destroy(block);
+
+    ScopedMutex lock(&mtx_);
+    if (!succ) {
+        error_ = true;
+    }
+    writing_ --;
+    cond_.notify_all();
+}
+
+void TreeBulkLoader::wait_writes(size_t n)
+{
+    ScopedMutex lock(&mtx_);
+    while (writing_ > n) {
+        cond_.wait();
+    }
+}
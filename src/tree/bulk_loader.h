@@ -0,0 +1,90 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef CASCADB_TREE_BULK_LOADER_H_
+#define CASCADB_TREE_BULK_LOADER_H_
+
+#include <vector>
+
+#include "cascadb/db.h"
+#include "sys/sys.h"
+#include "serialize/block.h"
+
+namespace cascadb {
+
+class Tree;
+class DataNode;
+class LeafNode;
+
+// Build a tree bottom-up from sorted records.
+// Leaves're filled up to leaf_node_page_size, and inner nodes up to
+// inner_node_children_number children, each node is written out
+// through Layout as soon as it's full, so nodes're laid out
+// sequentially in file. The new root replaces the empty one in finish().
+class TreeBulkLoader : public BulkLoader {
+public:
+    TreeBulkLoader(Tree *tree);
+
+    ~TreeBulkLoader();
+
+    bool add(Slice key, Slice value);
+
+    bool finish();
+
+private:
+    // A child collected for the inner node being built
+    struct Child {
+        Slice               key;    // smallest key in subtree
+        bid_t               nid;
+    };
+
+    // allocate a node id from schema
+    bid_t next_nid(bool leaf);
+
+    // write out the leaf being built and pass it to the level above
+    bool flush_leaf();
+
+    // build an inner node from children collected at the level,
+    // write it out and return its nid
+    bool flush_inner(size_t level, bid_t& nid);
+
+    // add a child to the inner node being built at the level,
+    // the node is flushed when it's full
+    bool add_child(size_t level, Slice key, bid_t nid);
+
+    // serialize node and initiate writing it, node is deleted
+    bool write_node(DataNode *node);
+
+    void write_complete(Block *block, bool succ);
+
+    // wait until no more than n writes're in flight
+    void wait_writes(size_t n);
+
+    Tree                            *tree_;
+
+    LeafNode                        *leaf_;
+
+    Slice                           last_key_;
+
+    // children of inner nodes being built, from bottom up
+    std::vector<std::vector<Child> > levels_;
+
+    Mutex                           mtx_;
+
+    CondVar                         cond_;
+
+    size_t                          writing_;
+
+    bool                            error_;
+
+    bool                            finished_;
+
+    size_t                          leaves_count_;
+
+    size_t                          inners_count_;
+};
+
+}
+
+#endif
@@ -0,0 +1,141 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "util/logger.h"
+#include "cascader.h"
+#include "node.h"
+
+using namespace std;
+using namespace cascadb;
+
+Cascader::Cascader(size_t threads_number)
+: threads_number_(threads_number),
+  cond_(&mtx_),
+  alive_(false)
+{
+}
+
+Cascader::~Cascader()
+{
+    stop();
+}
+
+bool Cascader::init()
+{
+    assert(!alive_);
+    alive_ = true;
+
+    for (size_t i = 0; i < threads_number_; i++) {
+        Thread *thr = new Thread(cascader_main);
+        thr->start(this);
+        threads_.push_back(thr);
+    }
+
+    LOG_INFO("start " << threads_number_ << " cascader threads");
+    return true;
+}
+
+void Cascader::stop()
+{
+    ScopedMutex lock(&mtx_);
+    if (!alive_) {
+        return;
+    }
+    alive_ = false;
+    cond_.notify_all();
+    lock.unlock();
+
+    for (size_t i = 0; i < threads_.size(); i++) {
+        threads_[i]->join();
+        delete threads_[i];
+    }
+    threads_.clear();
+
+    // buffers left're kept inside nodes, nothing is lost
+    lock.lock();
+    for (map<bid_t, InnerNode*>::iterator it = nodes_.begin();
+        it != nodes_.end(); it++) {
+        it->second->dec_ref();
+    }
+    nodes_.clear();
+}
+
+void Cascader::schedule(InnerNode *node)
+{
+    ScopedMutex lock(&mtx_);
+    if (!alive_) {
+        return;
+    }
+
+    if (nodes_.find(node->nid()) == nodes_.end()) {
+        node->inc_ref();
+        nodes_[node->nid()] = node;
+        cond_.notify();
+    }
+}
+
+size_t Cascader::pending()
+{
+    ScopedMutex lock(&mtx_);
+    return nodes_.size();
+}
+
+void* Cascader::cascader_main(void *arg)
+{
+    Cascader *cascader = (Cascader*) arg;
+    cascader->run();
+    return NULL;
+}
+
+void Cascader::run()
+{
+    while (true) {
+        InnerNode *node = pick();
+        if (node == NULL) {
+            break;
+        }
+        bid_t nid = node->nid();
+
+        node->read_lock();
+        if (node->is_dead()) {
+            node->unlock();
+        } else {
+            node->drain();
+        }
+        node->dec_ref();
+
+        ScopedMutex lock(&mtx_);
+        running_.erase(nid);
+        cond_.notify_all();
+    }
+}
+
+InnerNode* Cascader::pick()
+{
+    ScopedMutex lock(&mtx_);
+    while (alive_) {
+        // drain the biggest buffers first, skip nodes being
+        // drained by other threads
+        map<bid_t, InnerNode*>::iterator max = nodes_.end();
+        for (map<bid_t, InnerNode*>::iterator it = nodes_.begin();
+            it != nodes_.end(); it++) {
+            if (running_.find(it->first) != running_.end()) {
+                continue;
+            }
+            if (max == nodes_.end() || 
+                it->second->buffered_size() > max->second->buffered_size()) {
+                max = it;
+            }
+        }
+
+        if (max != nodes_.end()) {
+            InnerNode *node = max->second;
+            running_.insert(max->first);
+            nodes_.erase(max);
+            return node;
+        }
+        cond_.wait();
+    }
+    return NULL;
+}
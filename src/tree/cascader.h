@@ -0,0 +1,70 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef CASCADB_TREE_CASCADER_H_
+#define CASCADB_TREE_CASCADER_H_
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include "sys/sys.h"
+#include "serialize/block.h"
+
+namespace cascadb {
+
+class InnerNode;
+
+// Cascade full buffers of inner nodes in background threads.
+// Writers filling up a buffer schedule the node and return immediately,
+// cascader threads pick the node with the biggest buffers first,
+// and drain them down to children.
+class Cascader {
+public:
+    Cascader(size_t threads_number);
+
+    ~Cascader();
+
+    bool init();
+
+    // Stop all threads, nodes haven't been drained're released
+    void stop();
+
+    // Schedule a node to be cascaded later, ignored if it's
+    // already scheduled
+    void schedule(InnerNode *node);
+
+    // Number of nodes waiting to be cascaded
+    size_t pending();
+
+private:
+    static void* cascader_main(void *arg);
+
+    void run();
+
+    // pick the node holding the most buffered data,
+    // a node is drained by only one thread at a time,
+    // return NULL if cascader is stopped
+    InnerNode* pick();
+
+    size_t                          threads_number_;
+
+    std::vector<Thread*>            threads_;
+
+    Mutex                           mtx_;
+
+    CondVar                         cond_;
+
+    bool                            alive_;
+
+    // scheduled nodes, a reference is held for each node
+    std::map<bid_t, InnerNode*>     nodes_;
+
+    // nodes being drained
+    std::set<bid_t>                 running_;
+};
+
+}
+
+#endif
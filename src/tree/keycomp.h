@@ -12,34 +12,198 @@
 
 namespace cascadb {
 
+// Compare two keys inline by the comparator kind known at compile time,
+// custom comparators fall back to virtual calls
+template<ComparatorKind K>
+struct InlineCompare {
+    static int compare(const Comparator* comp, Slice s1, Slice s2)
+    {
+        return comp->compare(s1, s2);
+    }
+};
+
+template<>
+struct InlineCompare<kLexicalComparator> {
+    static int compare(const Comparator* comp, Slice s1, Slice s2)
+    {
+        return s1.compare(s2);
+    }
+};
+
+template<typename NumericType>
+inline int compare_numeric(Slice s1, Slice s2)
+{
+    assert(s1.size() == sizeof(NumericType) &&
+           s2.size() == sizeof(NumericType));
+    NumericType n1, n2;
+    memcpy(&n1, s1.data(), sizeof(NumericType));
+    memcpy(&n2, s2.data(), sizeof(NumericType));
+    return (n1 < n2) ? -1 : ((n1 > n2) ? 1 : 0);
+}
+
+template<>
+struct InlineCompare<kInt32Comparator> {
+    static int compare(const Comparator* comp, Slice s1, Slice s2)
+    {
+        return compare_numeric<int32_t>(s1, s2);
+    }
+};
+
+template<>
+struct InlineCompare<kUInt32Comparator> {
+    static int compare(const Comparator* comp, Slice s1, Slice s2)
+    {
+        return compare_numeric<uint32_t>(s1, s2);
+    }
+};
+
+template<>
+struct InlineCompare<kInt64Comparator> {
+    static int compare(const Comparator* comp, Slice s1, Slice s2)
+    {
+        return compare_numeric<int64_t>(s1, s2);
+    }
+};
+
+template<>
+struct InlineCompare<kUInt64Comparator> {
+    static int compare(const Comparator* comp, Slice s1, Slice s2)
+    {
+        return compare_numeric<uint64_t>(s1, s2);
+    }
+};
+
+// Compare two keys, dispatch on the comparator kind at runtime
+inline int compare_keys(const Comparator* comp, ComparatorKind kind,
+                        Slice s1, Slice s2)
+{
+    switch (kind) {
+    case kLexicalComparator:
+        return InlineCompare<kLexicalComparator>::compare(comp, s1, s2);
+    case kInt32Comparator:
+        return InlineCompare<kInt32Comparator>::compare(comp, s1, s2);
+    case kUInt32Comparator:
+        return InlineCompare<kUInt32Comparator>::compare(comp, s1, s2);
+    case kInt64Comparator:
+        return InlineCompare<kInt64Comparator>::compare(comp, s1, s2);
+    case kUInt64Comparator:
+        return InlineCompare<kUInt64Comparator>::compare(comp, s1, s2);
+    default:
+        return comp->compare(s1, s2);
+    }
+}
+
+// Instantiate a function template for each comparator kind,
+// so hot loops inside it're compiled with inline comparisons
+#define DISPATCH_COMPARATOR_KIND(kind, func, args)                      \
+    switch (kind) {                                                     \
+    case kLexicalComparator: func<kLexicalComparator> args; break;      \
+    case kInt32Comparator: func<kInt32Comparator> args; break;          \
+    case kUInt32Comparator: func<kUInt32Comparator> args; break;        \
+    case kInt64Comparator: func<kInt64Comparator> args; break;          \
+    case kUInt64Comparator: func<kUInt64Comparator> args; break;        \
+    default: func<kCustomComparator> args; break;                       \
+    }
+
 // Compare keys between Msg, Record, Pivot and Slice
 class KeyComp
 {
 public:
-    KeyComp(Comparator* comp) : comp_(comp) {}
+    KeyComp(Comparator* comp) : comp_(comp), kind_(comp->kind()) {}
 
     template<typename T1, typename T2>
     bool operator() (const T1& left, const T2& right)
     {
-        return comp_->compare(left.key, right.key) < 0;
+        return compare_keys(comp_, kind_, left.key, right.key) < 0;
     }
 
     template<typename T>
     bool operator() (const T& left, Slice right)
     {
-        return comp_->compare(left.key, right) < 0;
+        return compare_keys(comp_, kind_, left.key, right) < 0;
     }
 
     template<typename T>
     bool operator() (Slice left, const T& right)
     {
-        return comp_->compare(left, right.key) < 0;
+        return compare_keys(comp_, kind_, left, right.key) < 0;
     }
 
 private:
     Comparator* comp_;
+    ComparatorKind kind_;
 };
 
+// Same as KeyComp, but the comparator kind is fixed at compile time
+template<ComparatorKind K>
+class TypedKeyComp
+{
+public:
+    TypedKeyComp(Comparator* comp) : comp_(comp) {}
+
+    template<typename T1, typename T2>
+    bool operator() (const T1& left, const T2& right)
+    {
+        return InlineCompare<K>::compare(comp_, left.key, right.key) < 0;
+    }
+
+    template<typename T>
+    bool operator() (const T& left, Slice right)
+    {
+        return InlineCompare<K>::compare(comp_, left.key, right) < 0;
+    }
+
+    template<typename T>
+    bool operator() (Slice left, const T& right)
+    {
+        return InlineCompare<K>::compare(comp_, left, right.key) < 0;
+    }
+
+private:
+    Comparator* comp_;
+};
+
+// Fixed-width, order-preserving prefix of a key.
+// For lexical keys the first 8 bytes of key are packed in big-endian
+// order and padded with zeros, so comparing two prefixes as integers
+// agrees with memcmp ordering of the keys, except that equal prefixes
+// tie. Numeric keys're mapped into unsigned integers of the same order
+// and never tie unless equal.
+inline uint64_t key_prefix(Slice key, ComparatorKind kind = kLexicalComparator)
+{
+    switch (kind) {
+    case kInt32Comparator: {
+        int32_t n;
+        memcpy(&n, key.data(), sizeof(n));
+        return (uint64_t)((uint32_t)n ^ 0x80000000U);
+    }
+    case kUInt32Comparator: {
+        uint32_t n;
+        memcpy(&n, key.data(), sizeof(n));
+        return n;
+    }
+    case kInt64Comparator: {
+        int64_t n;
+        memcpy(&n, key.data(), sizeof(n));
+        return (uint64_t)n ^ 0x8000000000000000ULL;
+    }
+    case kUInt64Comparator: {
+        uint64_t n;
+        memcpy(&n, key.data(), sizeof(n));
+        return n;
+    }
+    default:
+        break;
+    }
+
+    uint64_t prefix = 0;
+    size_t n = key.size() < 8 ? key.size() : 8;
+    for (size_t i = 0; i < n; i++) {
+        prefix |= (uint64_t)(uint8_t)key[i] << (56 - 8 * i);
+    }
+    return prefix;
+}
+
 }
 
 #endif
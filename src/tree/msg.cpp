@@ -65,10 +65,12 @@ MsgBuf::~MsgBuf()
         it->destroy();
     }
     container_.clear();
+    discard_compressed();
 }
 
 void MsgBuf::write(const Msg& msg)
 {
+    modified();
     MsgBuf::Iterator it = container_.lower_bound(msg, KeyComp(comp_));
     if (it == end() || it->key != msg.key) {
         container_.insert(it, msg);
@@ -82,10 +84,17 @@ void MsgBuf::write(const Msg& msg)
 }
 
 void MsgBuf::append(MsgBuf::Iterator first, MsgBuf::Iterator last)
+{
+    modified();
+    DISPATCH_COMPARATOR_KIND(comp_->kind(), append_range, (first, last));
+}
+
+template<ComparatorKind K>
+void MsgBuf::append_range(MsgBuf::Iterator first, MsgBuf::Iterator last)
 {
     MsgBuf::Iterator it = container_.begin();
     MsgBuf::Iterator jt = first;
-    KeyComp comp(comp_);
+    TypedKeyComp<K> comp(comp_);
 
     while(jt != last) {
         it = container_.lower_bound(it, jt->key, comp);
@@ -103,6 +112,29 @@ void MsgBuf::append(MsgBuf::Iterator first, MsgBuf::Iterator last)
     }
 }
 
+void MsgBuf::split(Slice key, MsgBuf *other)
+{
+    Iterator mid = find(key);
+    if (mid == end()) {
+        return;
+    }
+    modified();
+    other->modified();
+
+    ContainerType left;
+    size_t left_size = 0;
+    for (Iterator it = begin(); it != mid; it++) {
+        left.push_back(*it);
+        left_size += it->size();
+    }
+    for (Iterator it = mid; it != end(); it++) {
+        other->container_.push_back(*it);
+        other->size_ += it->size();
+    }
+    container_.swap(left);
+    size_ = left_size;
+}
+
 MsgBuf::Iterator MsgBuf::find(Slice key)
 {
     return container_.lower_bound(key, KeyComp(comp_));
@@ -110,12 +142,14 @@ MsgBuf::Iterator MsgBuf::find(Slice key)
 
 void MsgBuf::clear()
 {
+    modified();
     container_.clear();
     size_ = 0;
 }
 
 bool MsgBuf::read_from(BlockReader& reader)
 {
+    modified();
     uint32_t cnt = 0;
     if (!reader.readUInt32(&cnt)) return false;
     // container_.resize(cnt);
@@ -142,6 +176,25 @@ bool MsgBuf::write_to(BlockWriter& writer)
     return true;
 }
 
+void MsgBuf::set_compressed(Slice compressed)
+{
+    discard_compressed();
+    compressed_ = compressed;
+}
+
+void MsgBuf::modified()
+{
+    stored_ = false;
+    discard_compressed();
+}
+
+void MsgBuf::discard_compressed()
+{
+    if (compressed_.size()) {
+        compressed_.destroy();
+    }
+}
+
 void MsgBuf::get_filter(std::string* filter)
 {
     std::vector<Slice> key_slices;
@@ -63,7 +63,7 @@ public:
 class MsgBuf {
 public:
     MsgBuf(Comparator *comp)
-    : comp_(comp), size_(0)
+    : comp_(comp), size_(0), stored_(false)
     {
     }
     
@@ -103,6 +103,10 @@ public:
     // Append range of Msg objects from another MsgBuf
     void append(Iterator first, Iterator last);
 
+    // Move messages no less than the input key into another
+    // empty MsgBuf
+    void split(Slice key, MsgBuf *other);
+
     // Find the whole buffer for the input key,
     // Return position of the first element no less than the input key,
     // aka the first element equal or bigger than the input key
@@ -132,12 +136,45 @@ public:
 
     // Get the bloom bitsets
     void  get_filter(std::string* filter);
+
+    // Compressed bytes of the buffer as it was last written out,
+    // empty once the buffer is modified
+    Slice compressed() const
+    {
+        return compressed_;
+    }
+
+    // Keep compressed bytes of the buffer, ownership is taken
+    void set_compressed(Slice compressed);
+
+    // True if the buffer is unchanged since it was read from or
+    // written into the block of node, where it's still referenced
+    bool stored() const
+    {
+        return stored_;
+    }
+
+    void set_stored()
+    {
+        stored_ = true;
+    }
     
 private:
+    // called whenever messages're modified
+    void modified();
+
+    // free compressed bytes kept
+    void discard_compressed();
+
+    template<ComparatorKind K>
+    void append_range(Iterator first, Iterator last);
+
     Comparator          *comp_;
     mutable RWLock      lock_;
     ContainerType       container_;
     size_t              size_;
+    Slice               compressed_;
+    bool                stored_;
 };
 
 }
@@ -14,6 +14,10 @@
 #include "util/crc.h"
 #include "util/bloom.h"
 
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
 using namespace std;
 using namespace cascadb;
 
@@ -53,10 +57,173 @@ bool SchemaNode::write_to(BlockWriter& writer, size_t& skeleton_size)
     return true;
 }
 
+/********************************************************
+                        DataNode
+*********************************************************/
+
+bool DataNode::parallel_compress(size_t size)
+{
+    return tree_->compress_pool_ &&
+           size >= tree_->options_.compress_parallel_threshold;
+}
+
+bool DataNode::compress_all(BlockWriter& writer, Compressor *compressor,
+                            const std::vector<Slice>& inputs,
+                            std::vector<size_t>& lengths)
+{
+    // compressed lengths're unknown until all sub-blocks're done,
+    // reserve the worst case for each and compact them afterwards
+    ParallelCompressor pc(compressor, tree_->compress_pool_);
+    std::vector<char*> outputs;
+    size_t total = 0;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        outputs.push_back(writer.addr() + total);
+        pc.add_compress(inputs[i].data(), inputs[i].size(), outputs[i]);
+        total += compressor->max_compressed_length(inputs[i].size());
+    }
+    assert(total <= writer.remain());
+
+    if (!pc.run()) {
+        return false;
+    }
+
+    lengths.resize(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+        lengths[i] = pc.compressed_length(i);
+        memmove(writer.addr(), outputs[i], lengths[i]);
+        writer.skip(lengths[i]);
+    }
+    return true;
+}
+
+bool DataNode::uncompress_all(Compressor *compressor,
+                              const std::vector<Slice>& inputs,
+                              const std::vector<Slice>& outputs)
+{
+    ParallelCompressor pc(compressor, tree_->compress_pool_);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        pc.add_uncompress(inputs[i].data(), inputs[i].size(),
+                          (char *)outputs[i].data(), outputs[i].size());
+    }
+    return pc.run();
+}
+
+BlockBase DataNode::choose_base(const std::vector<bool>& kept,
+                                const std::vector<size_t>& lengths)
+{
+    if (!stored_) {
+        return kNoBase;
+    }
+
+    size_t kept_length = 0;
+    size_t written_length = 0;
+    for (size_t i = 0; i < kept.size(); i++) {
+        if (kept[i]) {
+            kept_length += lengths[i];
+        } else {
+            written_length += lengths[i];
+        }
+    }
+    if (kept_length == 0 || kept_length <= written_length) {
+        return kNoBase;
+    }
+    return based_ ? kKeepBase : kReplacedAsBase;
+}
+
+BlockReader* DataNode::seek_subblock(BlockReader& reader, BlockReader *base,
+                                     uint32_t offset, uint32_t length)
+{
+    BlockReader *r = &reader;
+    if (offset & SUBBLOCK_IN_BASE) {
+        r = base;
+        offset &= ~SUBBLOCK_IN_BASE;
+    }
+    if (r == NULL) {
+        return NULL;
+    }
+
+    r->seek(0);
+    if ((size_t)offset + length > r->remain()) {
+        return NULL;
+    }
+    r->seek(offset);
+    return r;
+}
+
+bool DataNode::write_vectored()
+{
+    return tree_->options_.vectored_write_threshold &&
+           size() >= tree_->options_.vectored_write_threshold;
+}
+
+bool DataNode::compress_blocks(Layout *layout, Compressor *compressor,
+                               std::vector<Block*>& blocks)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        total += blocks[i]->size();
+    }
+
+    ParallelCompressor pc(compressor,
+        parallel_compress(total) ? tree_->compress_pool_ : NULL);
+    std::vector<Block*> outputs;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        Block *block = blocks[i];
+        outputs.push_back(layout->create(
+            compressor->max_compressed_length(block->size())));
+        pc.add_compress(block->start(), block->size(),
+                        (char *)outputs[i]->start());
+    }
+    bool ret = pc.run();
+
+    for (size_t i = 0; i < blocks.size(); i++) {
+        if (ret) {
+            layout->destroy(blocks[i]);
+            outputs[i]->set_size(pc.compressed_length(i));
+            blocks[i] = outputs[i];
+        } else {
+            layout->destroy(outputs[i]);
+        }
+    }
+    return ret;
+}
+
+Block* DataNode::copy_block(Layout *layout, Slice data)
+{
+    Block *block = layout->create(data.size());
+    memcpy((char *)block->start(), data.data(), data.size());
+    block->set_size(data.size());
+    return block;
+}
+
+Slice DataNode::copy_slice(Block *block)
+{
+    Slice s = Slice::alloc(block->size());
+    memcpy((char *)s.data(), block->start(), block->size());
+    return s;
+}
+
 /********************************************************
                         InnerNode
 *********************************************************/
 
+InnerNode::InnerNode(const std::string& table_name, bid_t nid, Tree *tree)
+: DataNode(table_name, nid, tree),
+  bottom_(false),
+  first_child_(NID_NIL),
+  first_msgbuf_(NULL),
+  first_msgbuf_offset_(0),
+  first_msgbuf_length_(0),
+  first_msgbuf_uncompressed_length_(0),
+  pivots_sz_(0),
+  msgcnt_(0), 
+  msgbufsz_(0)
+{
+    assert(nid >= NID_START && nid < NID_LEAF_START);
+    pivots_.reserve(tree_->options_.inner_node_children_number);
+    pivot_prefixes_.reserve(tree_->options_.inner_node_children_number);
+}
+
 InnerNode::~InnerNode()
 {
     delete first_msgbuf_;
@@ -67,6 +234,10 @@ InnerNode::~InnerNode()
         delete it->msgbuf;
     }
     pivots_.clear();
+    for (size_t i = 0; i < retired_msgbufs_.size(); i++) {
+        delete retired_msgbufs_[i];
+    }
+    retired_msgbufs_.clear();
 }
 
 void InnerNode::init_empty_root()
@@ -83,6 +254,12 @@ bool InnerNode::write(const Msg& m)
 {
     read_lock();
 
+    if (tree_->root_ != this) {
+        // root has been split or collapsed since it's picked up
+        unlock();
+        return tree_->root_write(m);
+    }
+
     if (status_ == kSkeletonLoaded) {
         load_all_msgbuf();
     }
@@ -108,29 +285,12 @@ bool InnerNode::cascade(MsgBuf *mb, InnerNode* parent){
     size_t oldcnt = mb->count();
     size_t oldsz = mb->size();
 
-    MsgBuf::Iterator rs, it, end;
-    rs = it = mb->begin(); // range start
-    end = mb->end(); // range end
-    size_t i = 0;
-    while (it != end && i < pivots_.size()) {
-        if( comp_pivot(it->key, i) < 0 ) {
-            it ++;
-        } else {
-            if (rs != it) {
-                insert_msgbuf(rs, it, i);
-                rs = it;
-            }
-            i ++;
-        }
-    }
-    if(rs != end) {
-        insert_msgbuf(rs, end, i);
-    }
+    insert_msgbuf(mb);
 
     // clear message buffer and modify parent's status
     mb->clear();
-    parent->msgcnt_ = parent->msgcnt_ + mb->count() - oldcnt;
-    parent->msgbufsz_ = parent->msgbufsz_ + mb->size() - oldsz;
+    atomic_add_fetch(&parent->msgcnt_, mb->count() - oldcnt);
+    atomic_add_fetch(&parent->msgbufsz_, mb->size() - oldsz);
 
     // unlock message buffer
     mb->unlock();
@@ -143,10 +303,67 @@ bool InnerNode::cascade(MsgBuf *mb, InnerNode* parent){
     return true;
 }
 
+bool InnerNode::write(MsgBuf *mb)
+{
+    read_lock();
+
+    if (tree_->root_ != this) {
+        unlock();
+        return tree_->root_write(mb);
+    }
+
+    if (status_ == kSkeletonLoaded) {
+        load_all_msgbuf();
+    }
+
+    mb->write_lock();
+    insert_msgbuf(mb);
+    mb->clear();
+    mb->unlock();
+
+    set_dirty(true);
+
+    maybe_cascade();
+    return true;
+}
+
 int InnerNode::comp_pivot(Slice k, int i)
 {
     assert(i >=0 && (size_t)i < pivots_.size());
-    return tree_->options_.comparator->compare(k, pivots_[i].key);
+    return compare_keys(tree_->options_.comparator, tree_->comparator_kind_,
+                        k, pivots_[i].key);
+}
+
+// Count prefixes less than, and no greater than kp.
+// Prefixes're sorted, so the results're the bounds of the range
+// of pivots sharing the same prefix with the key.
+static void prefix_range(const uint64_t *prefixes, size_t n, uint64_t kp,
+                         size_t *lo, size_t *hi)
+{
+    size_t lt = 0, le = 0;
+    size_t i = 0;
+
+#ifdef __SSE4_2__
+    // SSE compares signed integers, flip the sign bits to compare unsigned
+    const __m128i bias = _mm_set1_epi64x(0x8000000000000000LL);
+    const __m128i key = _mm_xor_si128(_mm_set1_epi64x(kp), bias);
+    for (; i + 2 <= n; i += 2) {
+        __m128i p = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i*)(prefixes + i)), bias);
+        int mlt = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(key, p)));
+        int meq = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(key, p)));
+        lt += __builtin_popcount(mlt);
+        le += __builtin_popcount(mlt | meq);
+    }
+#endif
+
+    for (; i < n; i++) {
+        lt += (prefixes[i] < kp);
+        le += (prefixes[i] <= kp);
+    }
+
+    *lo = lt;
+    *hi = le;
 }
 
 int InnerNode::find_pivot(Slice k)
@@ -163,7 +380,9 @@ int InnerNode::find_pivot(Slice k)
 
     // optimize for sequential write
     size_t size = pivots_.size();
-    if (size && tree_->options_.comparator->compare(pivots_[size-1].key, k) < 0) {
+    Comparator *comp = tree_->options_.comparator;
+    ComparatorKind kind = tree_->comparator_kind_;
+    if (size && compare_keys(comp, kind, pivots_[size-1].key, k) < 0) {
         return size;
     }
 
@@ -171,6 +390,14 @@ int InnerNode::find_pivot(Slice k)
     vector<Pivot>::iterator last = pivots_.end();
     vector<Pivot>::iterator it;
 
+    if (kind != kCustomComparator && pivot_prefixes_.size() == size) {
+        // only pivots with the same prefix need full key comparison
+        size_t lo, hi;
+        prefix_range(&pivot_prefixes_[0], size, key_prefix(k, kind), &lo, &hi);
+        first = pivots_.begin() + lo;
+        last = pivots_.begin() + hi;
+    }
+
     // binary search
     iterator_traits<vector<Pivot>::iterator>::difference_type count, step;
     count = distance(first,last);
@@ -179,7 +406,7 @@ int InnerNode::find_pivot(Slice k)
         step = count/2; 
         advance(it, step);
 
-        if (tree_->options_.comparator->compare(it->key, k) <= 0) {
+        if (compare_keys(comp, kind, it->key, k) <= 0) {
             first = ++ it;
             count -= step + 1;
         } else {
@@ -190,15 +417,67 @@ int InnerNode::find_pivot(Slice k)
     return distance(pivots_.begin(), first);
 }
 
+int InnerNode::find_pivot_optimistic(Slice k, uint64_t v)
+{
+    // capacity of pivots_ is reserved, so size is in bound even it's torn
+    size_t size = pivots_.size();
+    if (size > tree_->options_.inner_node_children_number) {
+        return -1;
+    }
+
+    Comparator *comp = tree_->options_.comparator;
+    ComparatorKind kind = tree_->comparator_kind_;
+
+    size_t first = 0;
+    size_t count = size;
+    if (kind != kCustomComparator && pivot_prefixes_.size() == size) {
+        // prefixes're plain integers, torn ones're caught by the
+        // validation of caller
+        size_t lo, hi;
+        prefix_range(&pivot_prefixes_[0], size, key_prefix(k, kind), &lo, &hi);
+        first = lo;
+        count = hi - lo;
+    }
+
+    while (count > 0) {
+        size_t step = count/2;
+        Slice pk = pivots_[first + step].key;
+        if (!validate_version(v)) {
+            return -1;
+        }
+
+        if (compare_keys(comp, kind, pk, k) <= 0) {
+            first += step + 1;
+            count -= step + 1;
+        } else {
+            count = step;
+        }
+    }
+
+    return first;
+}
+
+void InnerNode::refresh_pivot_prefixes()
+{
+    if (tree_->comparator_kind_ == kCustomComparator) {
+        return;
+    }
+
+    pivot_prefixes_.resize(pivots_.size());
+    for (size_t i = 0; i < pivots_.size(); i++) {
+        pivot_prefixes_[i] = key_prefix(pivots_[i].key, tree_->comparator_kind_);
+    }
+}
+
 MsgBuf* InnerNode::msgbuf(int idx)
 {
     assert(idx >= 0 && (size_t)idx <= pivots_.size());
 
     MsgBuf **pb = (idx == 0) ? &first_msgbuf_ : &(pivots_[idx-1].msgbuf);
-    if (*pb) {
-        return *pb;
+    MsgBuf *b = atomic_load(pb);
+    if (b) {
+        return b;
     } else {
-        assert(status_ == kSkeletonLoaded);
         load_msgbuf(idx);
         return *pb;
     }
@@ -210,10 +489,10 @@ MsgBuf* InnerNode::msgbuf(int idx, Slice& key)
 
     Slice *filter = (idx == 0) ? &first_filter_ : &pivots_[idx-1].filter;
     MsgBuf **pb = (idx == 0) ? &first_msgbuf_ : &(pivots_[idx-1].msgbuf);
-    if (*pb) {
-        return *pb;
+    MsgBuf *b = atomic_load(pb);
+    if (b) {
+        return b;
     } else {
-        assert(status_ == kSkeletonLoaded);
         // i am not in this msgbuf, don't to load msgbuf
        if (bloom_matches(key, *filter))
             load_msgbuf(idx);
@@ -253,8 +532,8 @@ void InnerNode::insert_msgbuf(const Msg& m, int idx)
 
     b->write(m);
 
-    msgcnt_ = msgcnt_ + b->count() - oldcnt;
-    msgbufsz_ = msgbufsz_ + b->size() - oldsz;
+    atomic_add_fetch(&msgcnt_, b->count() - oldcnt);
+    atomic_add_fetch(&msgbufsz_, b->size() - oldsz);
     b->unlock();
 }
 
@@ -270,11 +549,33 @@ void InnerNode::insert_msgbuf(MsgBuf::Iterator begin,
 
     b->append(begin, end);
 
-    msgcnt_ = msgcnt_ + b->count() - oldcnt;
-    msgbufsz_ = msgbufsz_ + b->size() - oldsz;
+    atomic_add_fetch(&msgcnt_, b->count() - oldcnt);
+    atomic_add_fetch(&msgbufsz_, b->size() - oldsz);
     b->unlock();
 }
 
+void InnerNode::insert_msgbuf(MsgBuf *mb)
+{
+    MsgBuf::Iterator rs, it, end;
+    rs = it = mb->begin(); // range start
+    end = mb->end(); // range end
+    size_t i = 0;
+    while (it != end && i < pivots_.size()) {
+        if( comp_pivot(it->key, i) < 0 ) {
+            it ++;
+        } else {
+            if (rs != it) {
+                insert_msgbuf(rs, it, i);
+                rs = it;
+            }
+            i ++;
+        }
+    }
+    if(rs != end) {
+        insert_msgbuf(rs, end, i);
+    }
+}
+
 int InnerNode::find_msgbuf_maxcnt()
 {
     int idx = 0, ret = 0;
@@ -309,16 +610,69 @@ int InnerNode::find_msgbuf_maxsz()
     return ret;
 }
 
+bool InnerNode::need_cascade()
+{
+    return msgcnt_ >= tree_->options_.inner_node_msg_count ||
+           size() >= tree_->options_.inner_node_page_size;
+}
+
+// limit scaled by cascade_hard_limit percent, capped on overflow
+static size_t hard_limit(size_t limit, unsigned int percent)
+{
+    if (limit > ((size_t)-1) / percent) {
+        return (size_t)-1;
+    }
+    return limit * percent / 100;
+}
+
+bool InnerNode::must_cascade()
+{
+    unsigned int percent = tree_->options_.cascade_hard_limit;
+    if (percent == 0) {
+        return true;
+    }
+    return msgcnt_ >= hard_limit(tree_->options_.inner_node_msg_count, percent) ||
+           size() >= hard_limit(tree_->options_.inner_node_page_size, percent);
+}
+
 void InnerNode::maybe_cascade()
+{
+    if (!need_cascade()) {
+        unlock();
+        return;
+    }
+
+    // leave it to cascader threads unless buffers grow too large
+    if (tree_->cascader_ && !must_cascade()) {
+        unlock();
+        tree_->cascader_->schedule(this);
+        return;
+    }
+
+    cascade_once();
+
+    // it's possible to cascade twice
+    // lock is released in child, so it's nescessarty to obtain it again
+    read_lock();
+    maybe_cascade();
+}
+
+void InnerNode::drain()
+{
+    while (need_cascade()) {
+        cascade_once();
+        read_lock();
+    }
+    unlock();
+}
+
+void InnerNode::cascade_once()
 {
     int idx = -1;
     if (msgcnt_ >= tree_->options_.inner_node_msg_count) {
         idx = find_msgbuf_maxcnt();
-    } else if (size() >= tree_->options_.inner_node_page_size) {
-        idx = find_msgbuf_maxsz();
     } else {
-        unlock();
-        return;
+        idx = find_msgbuf_maxsz();
     }
    
     assert(idx >= 0);
@@ -329,24 +683,24 @@ void InnerNode::maybe_cascade()
     if (nid == NID_NIL) {
         // cannot be inner node
         assert(bottom_);
-        node = tree_->new_leaf_node();
-        set_child(idx, node->nid());
-    } else {
-        node = tree_->load_node(nid, false);
+
+        // other threads may be cascading this node as well,
+        // create the child under write lock, and cascade next time
+        unlock();
+        write_lock();
+        if (child(idx) == NID_NIL) {
+            node = tree_->new_leaf_node();
+            set_child(idx, node->nid());
+            node->dec_ref();
+        }
+        unlock();
+        return;
     }
+
+    node = tree_->load_node(nid, false);
     assert(node);
     node->cascade(b, this);
     node->dec_ref();
-
-    // it's possible to cascade twice
-    // lock is released in child, so it's nescessarty to obtain it again
-    read_lock();
-    if (msgcnt_ >= tree_->options_.inner_node_msg_count ||
-        size() >= tree_->options_.inner_node_page_size) {
-        maybe_cascade();
-    } else {
-        unlock();
-    }
 }
 
 void InnerNode::add_pivot(Slice key, bid_t nid, std::vector<DataNode*>& path)
@@ -360,7 +714,18 @@ void InnerNode::add_pivot(Slice key, bid_t nid, std::vector<DataNode*>& path)
     vector<Pivot>::iterator it = std::lower_bound(pivots_.begin(), 
         pivots_.end(), key, KeyComp(tree_->options_.comparator));
     MsgBuf* mb = new MsgBuf(tree_->options_.comparator);
+
+    // messages may be buffered for the splitted child since it's
+    // unlocked, move those belong to the new child
+    MsgBuf* left = (it == pivots_.begin()) ? first_msgbuf_ : (it - 1)->msgbuf;
+    left->write_lock();
+    size_t oldsz = left->size();
+    left->split(key, mb);
+    msgbufsz_ = msgbufsz_ + left->size() - oldsz;
+    left->unlock();
+
     pivots_.insert(it, Pivot(key.clone(), nid, mb));
+    refresh_pivot_prefixes();
     pivots_sz_ += pivot_size(key);
     msgbufsz_ += mb->size();
     set_dirty(true);
@@ -376,6 +741,53 @@ void InnerNode::add_pivot(Slice key, bid_t nid, std::vector<DataNode*>& path)
     }
 }
 
+void InnerNode::move_msgbuf(MsgBuf *from, MsgBuf *to)
+{
+    from->write_lock();
+    to->write_lock();
+    size_t oldsz = to->size();
+    to->append(from->begin(), from->end());
+    msgbufsz_ = msgbufsz_ + to->size() - oldsz;
+    from->clear();
+    to->unlock();
+    from->unlock();
+}
+
+void InnerNode::take_msgbuf(bid_t nid, MsgBuf *from)
+{
+    if (status_ == kSkeletonLoaded) {
+        load_all_msgbuf();
+    }
+
+    MsgBuf *to = first_msgbuf_;
+    if (first_child_ != nid) {
+        vector<Pivot>::iterator it;
+        for (it = pivots_.begin(); it != pivots_.end(); it ++) {
+            if (it->child == nid) {
+                break;
+            }
+        }
+        assert(it != pivots_.end());
+        to = it->msgbuf;
+    }
+
+    from->write_lock();
+    to->write_lock();
+    size_t oldcnt = to->count();
+    size_t oldsz = to->size();
+    // newer messages in the buffer here override the older ones
+    from->append(to->begin(), to->end());
+    to->clear();
+    to->append(from->begin(), from->end());
+    from->clear();
+    msgcnt_ = msgcnt_ + to->count() - oldcnt;
+    msgbufsz_ = msgbufsz_ + to->size() - oldsz;
+    to->unlock();
+    from->unlock();
+
+    set_dirty(true);
+}
+
 void InnerNode::split(std::vector<DataNode*>& path)
 {
     assert(pivots_.size() > 1);
@@ -392,6 +804,8 @@ void InnerNode::split(std::vector<DataNode*>& path)
     ni->pivots_.resize(n1);
     std::copy(pivots_.begin() + n + 1, pivots_.end(), ni->pivots_.begin());
     pivots_.resize(n);
+    ni->refresh_pivot_prefixes();
+    refresh_pivot_prefixes();
     
     size_t pivots_sz1 = 0;
     size_t msgcnt1 = 0;
@@ -414,8 +828,6 @@ void InnerNode::split(std::vector<DataNode*>& path)
     ni->dec_ref();
 
     path.pop_back();
-    unlock();
-    dec_ref();
     
     // propagation
     if( path.size() == 0) {
@@ -430,6 +842,7 @@ void InnerNode::split(std::vector<DataNode*>& path)
         nr->pivots_.resize(1);
         MsgBuf* mb1 = new MsgBuf(tree_->options_.comparator);
         nr->pivots_[0] = Pivot(k.clone(), ni->nid_, mb1);
+        nr->refresh_pivot_prefixes();
         nr->pivots_sz_ += pivot_size(k);
         nr->msgbufsz_ += mb1->size();
         nr->set_dirty(true);
@@ -437,7 +850,15 @@ void InnerNode::split(std::vector<DataNode*>& path)
         tree_->pileup(nr);
         
         // need not do nr->dec_ref() here
+
+        // unlock after root is replaced, so readers validating
+        // this node can tell it's no longer root
+        unlock();
+        dec_ref();
     } else {
+        unlock();
+        dec_ref();
+
         // propagation
         InnerNode* parent = (InnerNode*) path.back();
         assert(parent);
@@ -456,37 +877,56 @@ void InnerNode::rm_pivot(bid_t nid, std::vector<DataNode*>& path)
     }
 
     if (first_child_ == nid) {
-        /// @todo this is true only for single thread, fix me
-        assert(first_msgbuf_->count() == 0);
         msgbufsz_ -= first_msgbuf_->size();
-        delete first_msgbuf_;
+        retired_msgbufs_.push_back(first_msgbuf_);
         
         if (pivots_.size() == 0) {
-            first_msgbuf_ = NULL;
-            dead_ = true;
-
             path.pop_back();
-            unlock();
-            dec_ref();
 
+            InnerNode* parent;
             if (path.size() == 0) {
-                // reach root
-                tree_->collapse(); 
+                // reach root, replace it before unlock
+                tree_->collapse();
+                parent = tree_->root_;
+                parent->write_lock();
             } else {
-                // propagation
-                InnerNode* parent = (InnerNode*) path.back();
+                parent = (InnerNode*) path.back();
                 assert(parent);
+            }
+
+            // messages may be buffered since the child is unlocked,
+            // hand them over to the parent before this node is retired
+            msgcnt_ -= first_msgbuf_->count();
+            parent->take_msgbuf(path.size() ? nid_ : NID_NIL, first_msgbuf_);
+            assert(first_msgbuf_->count() == 0);
+            first_msgbuf_ = NULL;
+            set_dead();
+
+            if (path.size() == 0) {
+                parent->unlock();
+                unlock();
+                dec_ref();
+            } else {
+                unlock();
+                dec_ref();
+
+                // propagation
                 parent->rm_pivot(nid_, path);
             }
             return;
         }
 
+        // messages may be buffered since the child is unlocked,
+        // hand them over to the next child
+        move_msgbuf(first_msgbuf_, pivots_[0].msgbuf);
+
         // shift pivots
         first_child_ = pivots_[0].child;
         first_msgbuf_ = pivots_[0].msgbuf;
 
         pivots_sz_ -= pivot_size(pivots_[0].key);
         pivots_.erase(pivots_.begin());
+        refresh_pivot_prefixes();
 
         // TODO adjst size
     } else {
@@ -499,13 +939,14 @@ void InnerNode::rm_pivot(bid_t nid, std::vector<DataNode*>& path)
         }
 
         assert(it != pivots_.end());
-        /// @todo this is true only for single thread, fix me
-        assert(it->msgbuf->count() == 0);
         msgbufsz_ -= it->msgbuf->size();
-        delete it->msgbuf;
+        move_msgbuf(it->msgbuf, (it == pivots_.begin()) ? 
+                    first_msgbuf_ : (it - 1)->msgbuf);
+        retired_msgbufs_.push_back(it->msgbuf);
 
         pivots_sz_ -= pivot_size(it->key);
         pivots_.erase(it);
+        refresh_pivot_prefixes();
 
         // TODO adjust size
     }
@@ -527,11 +968,16 @@ bool InnerNode::find(Slice key, Slice& value, InnerNode *parent)
 
     if (parent) {
         parent->unlock(); // lock coupling
+    } else if (tree_->root_ != this) {
+        // root has been split or collapsed since it's picked up
+        unlock();
+        return tree_->root_find(key, value);
     }
 
     int idx = find_pivot(key);
 
     MsgBuf* b = msgbuf(idx, key);
+
     // if b is NULL, means rejected by bloom filter
     if (b) {
         b->read_lock(); 
@@ -564,9 +1010,158 @@ bool InnerNode::find(Slice key, Slice& value, InnerNode *parent)
     return ret;
 }
 
-void InnerNode::lock_path(Slice key, std::vector<DataNode*>& path)
+bool InnerNode::find_optimistic(Slice key, Slice& value, 
+                                InnerNode *parent, uint64_t pv, bool& found)
 {
-    int idx = find_pivot(key);
+    uint64_t v = read_version();
+    if (v & 1) {
+        return false;
+    }
+
+    if (parent) {
+        if (!parent->validate_version(pv)) {
+            return false;
+        }
+    } else if (tree_->root_ != this) {
+        // root has been split or collapsed
+        return false;
+    }
+
+    if (is_dead()) {
+        return false;
+    }
+
+    // pivots_ is never reallocated, so it's safe to read it while
+    // being modified, results're discarded if version changed
+    int idx = find_pivot_optimistic(key, v);
+    if (idx < 0) {
+        return false;
+    }
+    MsgBuf *b = (idx == 0) ? first_msgbuf_ : pivots_[idx-1].msgbuf;
+    bid_t chidx = (idx == 0) ? first_child_ : pivots_[idx-1].child;
+    if (!validate_version(v)) {
+        return false;
+    }
+
+    // msgbuf isn't loaded yet, leave it to find()
+    if (b == NULL) {
+        return false;
+    }
+
+    // removed msgbufs're retired rather than freed,
+    // so b can be locked even it has been removed
+    b->read_lock();
+    if (!validate_version(v)) {
+        b->unlock();
+        return false;
+    }
+    MsgBuf::Iterator it = b->find(key);
+    if (it != b->end() && it->key == key ) {
+        found = false;
+        if (it->type == Put) {
+            value = it->value.clone();
+            found = true;
+        }
+        // otherwise deleted
+        b->unlock();
+        return true;
+    }
+    b->unlock();
+
+    if (chidx == NID_NIL) {
+        found = false;
+        return true;
+    }
+
+    if (!validate_version(v)) {
+        return false;
+    }
+
+    // the child is pinned before validating, it may have been
+    // removed and evicted since chidx is read
+    DataNode* ch = tree_->load_node(chidx, true);
+    if (ch == NULL) {
+        return false;
+    }
+    if (!validate_version(v) || ch->is_dead()) {
+        ch->dec_ref();
+        return false;
+    }
+
+    bool ret;
+    if (IS_LEAF(chidx)) {
+        ret = ((LeafNode*)ch)->find_optimistic(key, value, this, v, found);
+    } else {
+        ret = ((InnerNode*)ch)->find_optimistic(key, value, this, v, found);
+    }
+    ch->dec_ref();
+    return ret;
+}
+
+void InnerNode::multi_find(const std::vector<size_t>& idxs, MultiGetContext& ctx)
+{
+    // keys're sorted, those go to the same child're adjacent
+    vector<int> groups;
+    vector<vector<size_t> > group_idxs;
+
+    for (size_t i = 0; i < idxs.size(); i++) {
+        Slice key = ctx.keys[idxs[i]];
+        int idx = find_pivot(key);
+
+        MsgBuf* b = msgbuf(idx, key);
+        if (b) {
+            b->read_lock();
+            MsgBuf::Iterator it = b->find(key);
+            if (it != b->end() && it->key == key) {
+                if (it->type == Put) {
+                    ctx.values[idxs[i]] = it->value.clone();
+                    ctx.found[idxs[i]] = true;
+                }
+                // otherwise deleted
+                b->unlock();
+                continue;
+            }
+            b->unlock();
+        }
+
+        if (child(idx) == NID_NIL) {
+            assert(idx == 0); // must be the first child
+            continue;
+        }
+
+        if (groups.empty() || groups.back() != idx) {
+            groups.push_back(idx);
+            group_idxs.push_back(vector<size_t>());
+        }
+        group_idxs.back().push_back(idxs[i]);
+    }
+
+    // lock coupling, all children're locked before releasing this node
+    vector<DataNode*> children;
+    for (size_t i = 0; i < groups.size(); i++) {
+        DataNode* ch = tree_->load_node(child(groups[i]), true);
+        assert(ch);
+        ch->read_lock();
+        children.push_back(ch);
+    }
+    unlock();
+
+    for (size_t i = 0; i < children.size(); i++) {
+        if (IS_LEAF(children[i]->nid())) {
+            // lock and reference're passed to ctx
+            ctx.leaves.push_back(MultiGetLeaf());
+            ctx.leaves.back().leaf = (LeafNode*)children[i];
+            ctx.leaves.back().idxs.swap(group_idxs[i]);
+        } else {
+            ((InnerNode*)children[i])->multi_find(group_idxs[i], ctx);
+            children[i]->dec_ref();
+        }
+    }
+}
+
+void InnerNode::lock_path(Slice key, std::vector<DataNode*>& path)
+{
+    int idx = find_pivot(key);
     DataNode* ch = tree_->load_node(child(idx), false);
     assert(ch);
     ch->write_lock();
@@ -607,10 +1202,10 @@ size_t InnerNode::estimated_buffer_size()
     sz += bloom_size(first_msgbuf_->count());
     sz += pivots_sz_;
 
-    if (tree_->compressor_) {
-        sz += tree_->compressor_->max_compressed_length(first_msgbuf_->size());
+    if (tree_->inner_compressor_) {
+        sz += tree_->inner_compressor_->max_compressed_length(first_msgbuf_->size());
         for (size_t i = 0; i < pivots_.size(); i++) {
-            sz += tree_->compressor_->max_compressed_length(pivots_[i].msgbuf->size());
+            sz += tree_->inner_compressor_->max_compressed_length(pivots_[i].msgbuf->size());
             sz += bloom_size(pivots_[i].msgbuf->count());
         }
     } else {
@@ -651,6 +1246,15 @@ bool InnerNode::read_from(BlockReader& reader, bool skeleton_only)
         if (!reader.readUInt32(&(pivots_[i].crc))) return false;
         if (!reader.readSlice(pivots_[i].filter)) return false;
     }
+    refresh_pivot_prefixes();
+
+    stored_ = true;
+    based_ = (first_msgbuf_offset_ & SUBBLOCK_IN_BASE) != 0;
+    for (size_t i = 0; i < pn; i++) {
+        if (pivots_[i].offset & SUBBLOCK_IN_BASE) {
+            based_ = true;
+        }
+    }
 
     if (!skeleton_only) {
         if (!load_all_msgbuf(reader)) return false;
@@ -663,6 +1267,14 @@ bool InnerNode::read_from(BlockReader& reader, bool skeleton_only)
 
 bool InnerNode::load_msgbuf(int idx)
 {
+    // lazy load, other readers may be loading the same msgbuf
+    ScopedMutex latch(&load_mtx_);
+
+    MsgBuf **pb = (idx == 0) ? &first_msgbuf_ : &(pivots_[idx-1].msgbuf);
+    if (*pb) {
+        return true;
+    }
+
     uint32_t offset;
     uint32_t length;
     uint32_t uncompressed_length;
@@ -689,7 +1301,7 @@ bool InnerNode::load_msgbuf(int idx)
     BlockReader reader(block);
 
     Slice buffer;
-    if (tree_->compressor_) {
+    if (tree_->inner_compressor_) {
         buffer = Slice::alloc(uncompressed_length);
     }
 
@@ -710,22 +1322,11 @@ bool InnerNode::load_msgbuf(int idx)
         buffer.destroy();
     }
 
-    // lazy load, upgrade lock to write lock
-    // TODO: write a upgradable rwlock
-    unlock();
-    write_lock();
-
-    MsgBuf **pb = (idx == 0) ? &first_msgbuf_ : &(pivots_[idx-1].msgbuf);
-    if (*pb == NULL) {
-        *pb = b;
-        msgcnt_ += b->count();
-        msgbufsz_ += b->size();
-    } else {
-        delete b;
-    }
-
-    unlock();
-    read_lock();
+    b->set_stored();
+    atomic_add_fetch(&msgcnt_, b->count());
+    atomic_add_fetch(&msgbufsz_, b->size());
+    // publish after it's fully read
+    atomic_store(pb, b);
 
     tree_->layout_->destroy(block);
     return true;
@@ -733,6 +1334,13 @@ bool InnerNode::load_msgbuf(int idx)
 
 bool InnerNode::load_all_msgbuf()
 {
+    // lazy load, other readers may be loading msgbufs as well
+    ScopedMutex latch(&load_mtx_);
+    if (status_ != kSkeletonLoaded) {
+        // loaded by another thread
+        return true;
+    }
+
     Block* block = tree_->layout_->read(nid_, false);
     if (block == NULL) {
         LOG_ERROR("load all msgbuf error, cannot read " << " nid " << nid_);
@@ -740,87 +1348,163 @@ bool InnerNode::load_all_msgbuf()
     }
 
     BlockReader reader(block);
-
-    // lazy load, upgrade lock to write lock
-    // TODO: write a upgradable rwlock
-    unlock();
-    write_lock();
-
     bool ret = load_all_msgbuf(reader);
 
-    unlock();
-    read_lock();
-
     tree_->layout_->destroy(block);
     return ret;
 }
 
 bool InnerNode::load_all_msgbuf(BlockReader& reader)
 {
-    Slice buffer;
-    if (tree_->compressor_) {
-        size_t buffer_length = first_msgbuf_uncompressed_length_;
-        for (size_t i = 0; i < pivots_.size(); i++) {
-            if (buffer_length < pivots_[i].uncompressed_length) {
-                buffer_length = pivots_[i].uncompressed_length;
+    // msgbufs kept in base're read from it at once
+    Block *base = NULL;
+    size_t total = 0;
+    for (size_t i = 0; i <= pivots_.size(); i++) {
+        MsgBuf *b = (i == 0) ? first_msgbuf_ : pivots_[i-1].msgbuf;
+        uint32_t offset = (i == 0) ? first_msgbuf_offset_ : pivots_[i-1].offset;
+        total += (i == 0) ? first_msgbuf_uncompressed_length_
+                          : pivots_[i-1].uncompressed_length;
+        if (b == NULL && (offset & SUBBLOCK_IN_BASE) && base == NULL) {
+            base = tree_->layout_->read_base(nid_);
+            if (base == NULL) {
+                LOG_ERROR("read base of node error, nid " << nid_);
+                return false;
             }
         }
-
-        buffer = Slice::alloc(buffer_length);
     }
+    BlockReader *base_reader = base ? new BlockReader(base) : NULL;
 
-    if (first_msgbuf_ == NULL) {
-        reader.seek(first_msgbuf_offset_);
-        first_msgbuf_ = new MsgBuf(tree_->options_.comparator);
-        if (!read_msgbuf(reader, first_msgbuf_length_,
-                         first_msgbuf_uncompressed_length_, 
-                         first_msgbuf_, buffer)) {
-            if (buffer.size()) {
-                buffer.destroy();
+    bool ret = true;
+    if (tree_->inner_compressor_ && parallel_compress(total)) {
+        ret = load_all_msgbuf_parallel(reader, base_reader);
+    } else {
+        Slice buffer;
+        if (tree_->inner_compressor_) {
+            size_t buffer_length = first_msgbuf_uncompressed_length_;
+            for (size_t i = 0; i < pivots_.size(); i++) {
+                if (buffer_length < pivots_[i].uncompressed_length) {
+                    buffer_length = pivots_[i].uncompressed_length;
+                }
             }
-            return false;
+
+            buffer = Slice::alloc(buffer_length);
         }
-        msgcnt_ += first_msgbuf_->count();
-        msgbufsz_ += first_msgbuf_->size();
-    }
 
-    for (size_t i = 0; i < pivots_.size(); i++) {
-        if (pivots_[i].msgbuf == NULL) {
-            reader.seek(pivots_[i].offset);
-            pivots_[i].msgbuf = new MsgBuf(tree_->options_.comparator);
-            if (!read_msgbuf(reader, pivots_[i].length,
-                             pivots_[i].uncompressed_length,
-                             pivots_[i].msgbuf, buffer)) {
-                if (buffer.size()) {
-                    buffer.destroy();
-                }
-                return false;
+        for (size_t i = 0; i <= pivots_.size() && ret; i++) {
+            MsgBuf **pb = (i == 0) ? &first_msgbuf_ : &(pivots_[i-1].msgbuf);
+            if (*pb) {
+                continue;
+            }
+
+            uint32_t offset = (i == 0) ? first_msgbuf_offset_
+                                       : pivots_[i-1].offset;
+            uint32_t length = (i == 0) ? first_msgbuf_length_
+                                       : pivots_[i-1].length;
+            uint32_t uncompressed_length = (i == 0) ?
+                first_msgbuf_uncompressed_length_ :
+                pivots_[i-1].uncompressed_length;
+
+            BlockReader *r = seek_subblock(reader, base_reader, offset, length);
+            MsgBuf *b = new MsgBuf(tree_->options_.comparator);
+            if (r == NULL ||
+                !read_msgbuf(*r, length, uncompressed_length, b, buffer)) {
+                LOG_ERROR("read msgbuf error, nid " << nid_ << ", idx " << i);
+                delete b;
+                ret = false;
+                break;
             }
-            msgcnt_ += pivots_[i].msgbuf->count();
-            msgbufsz_ += pivots_[i].msgbuf->size();
+            b->set_stored();
+            atomic_add_fetch(&msgcnt_, b->count());
+            atomic_add_fetch(&msgbufsz_, b->size());
+            atomic_store(pb, b);
+        }
+
+        if (buffer.size()) {
+            buffer.destroy();
         }
     }
 
-    if (buffer.size()) {
-        buffer.destroy();
+    if (base) {
+        delete base_reader;
+        tree_->layout_->destroy(base);
+    }
+    if (!ret) {
+        return false;
     }
 
     status_ = kFullLoaded;
     return true;
 }
 
+bool InnerNode::load_all_msgbuf_parallel(BlockReader& reader, BlockReader *base)
+{
+    std::vector<size_t> idxs;
+    std::vector<Slice> inputs;
+    std::vector<Slice> outputs;
+    bool ret = true;
+    for (size_t i = 0; i <= pivots_.size(); i++) {
+        MsgBuf *b = (i == 0) ? first_msgbuf_ : pivots_[i-1].msgbuf;
+        if (b) {
+            continue;
+        }
+        uint32_t offset = (i == 0) ? first_msgbuf_offset_ : pivots_[i-1].offset;
+        uint32_t length = (i == 0) ? first_msgbuf_length_ : pivots_[i-1].length;
+        BlockReader *r = seek_subblock(reader, base, offset, length);
+        if (r == NULL) {
+            ret = false;
+            break;
+        }
+        idxs.push_back(i);
+        inputs.push_back(Slice(r->addr(), length));
+        outputs.push_back(Slice::alloc((i == 0) ?
+            first_msgbuf_uncompressed_length_ :
+            pivots_[i-1].uncompressed_length));
+    }
+
+    if (ret) {
+        ret = uncompress_all(tree_->inner_compressor_, inputs, outputs);
+    }
+    for (size_t j = 0; ret && j < idxs.size(); j++) {
+        size_t i = idxs[j];
+        MsgBuf **pb = (i == 0) ? &first_msgbuf_ : &(pivots_[i-1].msgbuf);
+
+        MsgBuf *b = new MsgBuf(tree_->options_.comparator);
+        Block block(outputs[j], 0, outputs[j].size());
+        BlockReader rr(&block);
+        if (!b->read_from(rr)) {
+            delete b;
+            ret = false;
+            break;
+        }
+        b->set_stored();
+        atomic_add_fetch(&msgcnt_, b->count());
+        atomic_add_fetch(&msgbufsz_, b->size());
+        atomic_store(pb, b);
+    }
+
+    for (size_t j = 0; j < outputs.size(); j++) {
+        outputs[j].destroy();
+    }
+
+    if (!ret) {
+        LOG_ERROR("load all msgbuf in parallel error, nid " << nid_);
+        return false;
+    }
+    return true;
+}
+
 bool InnerNode::read_msgbuf(BlockReader& reader,
                             size_t compressed_length, 
                             size_t uncompressed_length,
                             MsgBuf *mb, Slice buffer)
 {
-    if (tree_->compressor_) {
+    if (tree_->inner_compressor_) {
         assert(compressed_length <= reader.remain());
         assert(uncompressed_length <= buffer.size());
 
         // 1. uncompress
-        if (!tree_->compressor_->uncompress(reader.addr(),
-            compressed_length, (char *)buffer.data())) {
+        if (!tree_->inner_compressor_->uncompress(reader.addr(),
+            compressed_length, (char *)buffer.data(), buffer.size())) {
             return false;
         }
         reader.skip(compressed_length);
@@ -836,59 +1520,210 @@ bool InnerNode::read_msgbuf(BlockReader& reader,
 
 bool InnerNode::write_to(BlockWriter& writer, size_t& skeleton_size)
 {
+    tree_->install_dict();
+
     // get length of skeleton and reserve space for skeleton
     size_t skeleton_offset = writer.pos();
-    size_t skeleton_length = 1 + 4 + 8 + 4 + 4 + 4 + CRC_SIZE +
-        bloom_size(first_msgbuf_->count());
+    skeleton_size = skeleton_length();
+    if (!writer.skip(skeleton_size)) return false;
 
-    for (size_t i = 0; i < pivots_.size(); i++) {
-        skeleton_length += pivot_size(pivots_[i].key);
-        skeleton_length += bloom_size(pivots_[i].msgbuf->count());
-    }
-    if (!writer.skip(skeleton_length)) return false;
+    if (tree_->inner_compressor_ && parallel_compress(size())) {
+        if (!write_all_msgbuf_parallel(writer)) return false;
+    } else {
+        // prepare buffer if compression is enabled
+        Slice buffer;
+        if (tree_->inner_compressor_) {
+            // get buffer length to serialize msgbuf
+            size_t buffer_length = first_msgbuf_->size();
+            for (size_t i = 0; i < pivots_.size(); i++) {
+                if (pivots_[i].msgbuf->size() > buffer_length)
+                    buffer_length = pivots_[i].msgbuf->size();
+            }
 
-    // prepare buffer if compression is enabled
-    Slice buffer;
-    if (tree_->compressor_) {
-        // get buffer length to serialize msgbuf
-        size_t buffer_length = first_msgbuf_->size();
+            buffer = Slice::alloc(buffer_length);
+        }
+
+        char *mb_start;
+        // write the first msgbuf
+        mb_start = writer.addr();
+        first_msgbuf_offset_ = writer.pos();
+        if (!write_msgbuf(writer, first_msgbuf_, buffer)) return false;
+        first_msgbuf_length_ = writer.pos() - first_msgbuf_offset_;
+        first_msgbuf_uncompressed_length_ = first_msgbuf_->size();
+        first_msgbuf_crc_ = crc32(mb_start, first_msgbuf_length_);
+
+        // write rest msgbufs
         for (size_t i = 0; i < pivots_.size(); i++) {
-            if (pivots_[i].msgbuf->size() > buffer_length)
-                buffer_length = pivots_[i].msgbuf->size();
+            mb_start = writer.addr();
+            pivots_[i].offset = writer.pos();
+            if (!write_msgbuf(writer, pivots_[i].msgbuf, buffer)) return false;
+            pivots_[i].length = writer.pos() - pivots_[i].offset;
+            pivots_[i].uncompressed_length = pivots_[i].msgbuf->size();
+            pivots_[i].crc = crc32(mb_start, pivots_[i].length);
         }
 
-        buffer = Slice::alloc(buffer_length);
+        if (buffer.size()) {
+            buffer.destroy();
+        }
     }
 
-    char *mb_start;
-    // write the first msgbuf
-    mb_start = writer.addr();
-    first_msgbuf_offset_ = writer.pos();
-    if (!write_msgbuf(writer, first_msgbuf_, buffer)) return false;
-    first_msgbuf_length_ = writer.pos() - first_msgbuf_offset_;
-    first_msgbuf_uncompressed_length_ = first_msgbuf_->size();
-    first_msgbuf_crc_ = crc32(mb_start, first_msgbuf_length_);
+    size_t last_offset = writer.pos();
+
+    // seek to the head and write index
+    writer.seek(skeleton_offset);
+    if (!write_skeleton(writer)) return false;
 
-    // write rest msgbufs
+    writer.seek(last_offset);
+
+    first_msgbuf_->set_stored();
+    for (size_t i = 0; i < pivots_.size(); i++) {
+        pivots_[i].msgbuf->set_stored();
+    }
+    stored_ = true;
+    based_ = false;
+    return true;
+}
+
+bool InnerNode::write_to(Layout *layout, std::vector<Block*>& blocks,
+                         size_t& skeleton_size, BlockBase& base)
+{
+    tree_->install_dict();
+
+    std::vector<MsgBuf*> mbs;
+    std::vector<uint32_t*> offsets;
+    std::vector<uint32_t*> lengths;
+    std::vector<uint32_t*> crcs;
+    mbs.push_back(first_msgbuf_);
+    offsets.push_back(&first_msgbuf_offset_);
+    lengths.push_back(&first_msgbuf_length_);
+    crcs.push_back(&first_msgbuf_crc_);
+    for (size_t i = 0; i < pivots_.size(); i++) {
+        mbs.push_back(pivots_[i].msgbuf);
+        offsets.push_back(&pivots_[i].offset);
+        lengths.push_back(&pivots_[i].length);
+        crcs.push_back(&pivots_[i].crc);
+    }
+
+    // msgbufs unchanged since they were stored're left where they're
+    // on disk if they outweigh the others
+    std::vector<bool> kept;
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < mbs.size(); i++) {
+        kept.push_back(mbs[i]->stored() &&
+            (!based_ || (*offsets[i] & SUBBLOCK_IN_BASE)));
+        sizes.push_back(mbs[i]->size());
+    }
+    base = choose_base(kept, sizes);
+    if (base == kNoBase) {
+        kept.assign(mbs.size(), false);
+    }
+
+    // serialize each msgbuf into its own block, msgbufs unchanged
+    // since they were compressed last time're copied out
+    std::vector<Block*> subblocks(mbs.size(), (Block*)NULL);
+    std::vector<Block*> dirty;
+    std::vector<size_t> dirty_idxs;
+    bool ret = true;
+    for (size_t i = 0; i < mbs.size() && ret; i++) {
+        if (kept[i]) {
+            continue;
+        }
+        Slice compressed = mbs[i]->compressed();
+        if (compressed.size()) {
+            subblocks[i] = copy_block(layout, compressed);
+            continue;
+        }
+        Block *block = layout->create(mbs[i]->size());
+        subblocks[i] = block;
+        dirty.push_back(block);
+        dirty_idxs.push_back(i);
+        BlockWriter wr(block);
+        ret = mbs[i]->write_to(wr);
+    }
+    if (ret && tree_->inner_compressor_) {
+        ret = compress_blocks(layout, tree_->inner_compressor_, dirty);
+    }
+    if (ret && tree_->inner_compressor_) {
+        for (size_t i = 0; i < dirty.size(); i++) {
+            subblocks[dirty_idxs[i]] = dirty[i];
+            if (tree_->options_.keep_compressed_subblocks) {
+                mbs[dirty_idxs[i]]->set_compressed(copy_slice(dirty[i]));
+            }
+        }
+    }
+    if (!ret) {
+        LOG_ERROR("serialize msgbufs error, nid " << nid_);
+        for (size_t i = 0; i < subblocks.size(); i++) {
+            if (subblocks[i]) {
+                layout->destroy(subblocks[i]);
+            }
+        }
+        return false;
+    }
+
+    // msgbufs written're laid out from the page following skeleton,
+    // the kept ones're referenced in base
+    skeleton_size = skeleton_length();
+    size_t offset = PAGE_ROUND_UP(skeleton_size);
+
+    first_msgbuf_uncompressed_length_ = first_msgbuf_->size();
     for (size_t i = 0; i < pivots_.size(); i++) {
-        mb_start = writer.addr();
-        pivots_[i].offset = writer.pos();
-        if (!write_msgbuf(writer, pivots_[i].msgbuf, buffer)) return false;
-        pivots_[i].length = writer.pos() - pivots_[i].offset;
         pivots_[i].uncompressed_length = pivots_[i].msgbuf->size();
-        pivots_[i].crc = crc32(mb_start, pivots_[i].length);
+    }
+    for (size_t i = 0; i < mbs.size(); i++) {
+        if (kept[i]) {
+            *offsets[i] |= SUBBLOCK_IN_BASE;
+            continue;
+        }
+        Block *block = subblocks[i];
+        *offsets[i] = offset;
+        *lengths[i] = block->size();
+        *crcs[i] = crc32(block->start(), block->size());
+        offset += PAGE_ROUND_UP(block->size());
+    }
+
+    Block *skeleton = layout->create(skeleton_size);
+    BlockWriter writer(skeleton);
+    if (!write_skeleton(writer)) {
+        LOG_ERROR("write skeleton error, nid " << nid_);
+        layout->destroy(skeleton);
+        for (size_t i = 0; i < subblocks.size(); i++) {
+            if (subblocks[i]) {
+                layout->destroy(subblocks[i]);
+            }
+        }
+        return false;
     }
 
-    if (buffer.size()) {
-        buffer.destroy();
+    blocks.push_back(skeleton);
+    for (size_t i = 0; i < subblocks.size(); i++) {
+        if (subblocks[i]) {
+            blocks.push_back(subblocks[i]);
+        }
     }
 
-    size_t last_offset = writer.pos();
+    for (size_t i = 0; i < mbs.size(); i++) {
+        mbs[i]->set_stored();
+    }
+    stored_ = true;
+    based_ = (base != kNoBase);
+    return true;
+}
 
-    // seek to the head and write index
-    writer.seek(skeleton_offset);
+size_t InnerNode::skeleton_length()
+{
+    size_t length = 1 + 4 + 8 + 4 + 4 + 4 + CRC_SIZE +
+        bloom_size(first_msgbuf_->count());
 
+    for (size_t i = 0; i < pivots_.size(); i++) {
+        length += pivot_size(pivots_[i].key);
+        length += bloom_size(pivots_[i].msgbuf->count());
+    }
+    return length;
+}
 
+bool InnerNode::write_skeleton(BlockWriter& writer)
+{
     if (!writer.writeBool(bottom_)) return false;
     if (!writer.writeUInt32(pivots_.size())) return false;
 
@@ -919,25 +1754,23 @@ bool InnerNode::write_to(BlockWriter& writer, size_t& skeleton_size)
         filter.clear();
     }
 
-    writer.seek(last_offset);
-    skeleton_size = skeleton_length;
     return true;
 }
 
 bool InnerNode::write_msgbuf(BlockWriter& writer, MsgBuf *mb, Slice buffer)
 {
-    if (tree_->compressor_) {
+    if (tree_->inner_compressor_) {
         // 1. write to buffer
         Block block(buffer, 0, 0);
         BlockWriter wr(&block);
         if (!mb->write_to(wr)) return false;
 
         // 2. compress
-        assert(tree_->compressor_->max_compressed_length(block.size()) <=
+        assert(tree_->inner_compressor_->max_compressed_length(block.size()) <=
             writer.remain());
 
         size_t compressed_length;
-        if (!tree_->compressor_->compress(buffer.data(), block.size(),
+        if (!tree_->inner_compressor_->compress(buffer.data(), block.size(),
              writer.addr(), &compressed_length)) {
             LOG_ERROR("compress msgbuf error, nid " << nid_);
             return false;
@@ -952,6 +1785,61 @@ bool InnerNode::write_msgbuf(BlockWriter& writer, MsgBuf *mb, Slice buffer)
     }
 }
 
+bool InnerNode::write_all_msgbuf_parallel(BlockWriter& writer)
+{
+    std::vector<MsgBuf*> mbs;
+    mbs.push_back(first_msgbuf_);
+    for (size_t i = 0; i < pivots_.size(); i++) {
+        mbs.push_back(pivots_[i].msgbuf);
+    }
+
+    // serialize msgbufs, they're compressed in parallel
+    std::vector<Slice> buffers;
+    std::vector<Slice> inputs;
+    bool ret = true;
+    for (size_t i = 0; i < mbs.size(); i++) {
+        buffers.push_back(Slice::alloc(mbs[i]->size()));
+        Block block(buffers[i], 0, 0);
+        BlockWriter wr(&block);
+        if (!mbs[i]->write_to(wr)) {
+            ret = false;
+            break;
+        }
+        inputs.push_back(Slice(buffers[i].data(), block.size()));
+    }
+
+    size_t offset = writer.pos();
+    std::vector<size_t> lengths;
+    if (ret) {
+        ret = compress_all(writer, tree_->inner_compressor_, inputs, lengths);
+    }
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        buffers[i].destroy();
+    }
+
+    if (!ret) {
+        LOG_ERROR("compress msgbuf in parallel error, nid " << nid_);
+        return false;
+    }
+
+    const char *start = writer.start();
+    first_msgbuf_offset_ = offset;
+    first_msgbuf_length_ = lengths[0];
+    first_msgbuf_uncompressed_length_ = first_msgbuf_->size();
+    first_msgbuf_crc_ = crc32(start + offset, lengths[0]);
+    offset += lengths[0];
+
+    for (size_t i = 0; i < pivots_.size(); i++) {
+        pivots_[i].offset = offset;
+        pivots_[i].length = lengths[i+1];
+        pivots_[i].uncompressed_length = pivots_[i].msgbuf->size();
+        pivots_[i].crc = crc32(start + offset, lengths[i+1]);
+        offset += lengths[i+1];
+    }
+    return true;
+}
+
 /********************************************************
                         LeafNode
 *********************************************************/
@@ -998,46 +1886,20 @@ bool LeafNode::cascade(MsgBuf *mb, InnerNode* parent)
     size_t oldcnt = mb->count();
     size_t oldsz = mb->size();
 
+    // already cascaded by another thread
+    if (oldcnt == 0) {
+        mb->unlock();
+        parent->unlock();
+        unlock();
+        return true;
+    }
+
     Slice anchor = mb->begin()->key.clone();
 
     // merge message buffer into leaf
     RecordBuckets res(tree_->options_.leaf_node_bucket_size);
 
-    MsgBuf::Iterator it = mb->begin();
-    RecordBuckets::Iterator jt = records_.get_iterator();
-    while (it != mb->end() && jt.valid()) {
-        int n = tree_->options_.comparator->compare(it->key, jt.record().key);
-        if (n < 0) {
-            if (it->type == Put) {
-                res.push_back(to_record(*it));
-            } else {
-                // just throw deletion to non-exist record
-                it->destroy();
-            }
-            it ++;
-        } else if (n > 0) {
-            res.push_back(jt.record());
-            jt.next();
-        } else {
-            if (it->type == Put) {
-                res.push_back(to_record(*it));
-            }
-            // old record is deleted
-            it ++;
-            jt.record().key.destroy();
-            jt.record().value.destroy();
-            jt.next();
-        }
-    }
-    for (; it != mb->end(); it++) {
-        if (it->type == Put) {
-            res.push_back(to_record(*it));
-        }
-    }
-    while(jt.valid()) {
-        res.push_back(jt.record());
-        jt.next();
-    }
+    DISPATCH_COMPARATOR_KIND(tree_->comparator_kind_, merge_msgbuf, (mb, res));
     records_.swap(res);
 
     refresh_buckets_info();
@@ -1045,8 +1907,8 @@ bool LeafNode::cascade(MsgBuf *mb, InnerNode* parent)
 
     // clear message buffer
     mb->clear();
-    parent->msgcnt_ = parent->msgcnt_ + mb->count() - oldcnt;
-    parent->msgbufsz_ = parent->msgbufsz_ + mb->size() - oldsz;
+    atomic_add_fetch(&parent->msgcnt_, mb->count() - oldcnt);
+    atomic_add_fetch(&parent->msgbufsz_, mb->size() - oldsz);
 
     // unlock message buffer
     mb->unlock();
@@ -1067,6 +1929,75 @@ bool LeafNode::cascade(MsgBuf *mb, InnerNode* parent)
     return true;
 }
 
+template<ComparatorKind K>
+void LeafNode::merge_msgbuf(MsgBuf *mb, RecordBuckets& res)
+{
+    Comparator *comp = tree_->options_.comparator;
+    MsgBuf::Iterator it = mb->begin();
+    size_t n = records_.buckets_number();
+    for (size_t i = 0; i < n; i++) {
+        RecordBucket *bucket = records_.bucket(i);
+        // messages less than the first key of the next bucket
+        // fall into this bucket
+        Slice *limit = (i + 1 < n) ? &(records_.bucket(i+1)->front().key) : NULL;
+        bool touched = it != mb->end() && (limit == NULL ||
+            InlineCompare<K>::compare(comp, it->key, *limit) < 0);
+
+        // untouched buckets're moved as a whole to keep their compressed
+        // bytes and where they're on disk, unless they're small enough
+        // to be merged into neighbours
+        if (!touched &&
+            (records_.compressed(i).size() || records_.stored(i)) &&
+            records_.bucket_length(i) * 2 >= records_.max_bucket_length()) {
+            res.move_bucket(records_, i);
+            continue;
+        }
+
+        RecordBucket::iterator jt = bucket->begin();
+        while (it != mb->end() && jt != bucket->end()) {
+            int c = InlineCompare<K>::compare(comp, it->key, jt->key);
+            if (c < 0) {
+                if (it->type == Put) {
+                    res.push_back(to_record(*it));
+                } else {
+                    // just throw deletion to non-exist record
+                    it->destroy();
+                }
+                it ++;
+            } else if (c > 0) {
+                res.push_back(*jt);
+                jt ++;
+            } else {
+                if (it->type == Put) {
+                    res.push_back(to_record(*it));
+                }
+                // old record is deleted
+                it ++;
+                jt->key.destroy();
+                jt->value.destroy();
+                jt ++;
+            }
+        }
+        for (; jt != bucket->end(); jt++) {
+            res.push_back(*jt);
+        }
+        while (it != mb->end() && (limit == NULL ||
+            InlineCompare<K>::compare(comp, it->key, *limit) < 0)) {
+            if (it->type == Put) {
+                res.push_back(to_record(*it));
+            } else {
+                it->destroy();
+            }
+            it ++;
+        }
+    }
+    for (; it != mb->end(); it++) {
+        if (it->type == Put) {
+            res.push_back(to_record(*it));
+        }
+    }
+}
+
 Record LeafNode::to_record(const Msg& m)
 {
     assert(m.type == Put);
@@ -1114,6 +2045,10 @@ void LeafNode::split(Slice anchor)
         LeafNode *rl = (LeafNode*)tree_->load_node(right_sibling_, false);
         assert(rl);
         rl->write_lock();
+        // sibling is rewritten as a whole
+        if (rl->status_ == kSkeletonLoaded) {
+            rl->load_all_buckets();
+        }
         rl->left_sibling_ = nl->nid_;
         rl->set_dirty(true);
         rl->unlock();
@@ -1170,6 +2105,10 @@ void LeafNode::merge(Slice anchor)
         LeafNode *ll = (LeafNode*)tree_->load_node(left_sibling_, false);
         assert(ll);
         ll->write_lock();
+        // sibling is rewritten as a whole
+        if (ll->status_ == kSkeletonLoaded) {
+            ll->load_all_buckets();
+        }
         ll->right_sibling_ = right_sibling_;
         ll->set_dirty(true);
         ll->unlock();
@@ -1179,12 +2118,16 @@ void LeafNode::merge(Slice anchor)
         LeafNode *rl = (LeafNode*)tree_->load_node(right_sibling_, false);
         assert(rl);
         rl->write_lock();
+        // sibling is rewritten as a whole
+        if (rl->status_ == kSkeletonLoaded) {
+            rl->load_all_buckets();
+        }
         rl->left_sibling_ = left_sibling_;
         rl->set_dirty(true);
         rl->unlock();
         rl->dec_ref();
     }
-    dead_ = true;
+    set_dead();
     balancing_ = false;
 
     path.pop_back();
@@ -1204,39 +2147,128 @@ bool LeafNode::find(Slice key, Slice& value, InnerNode *parent)
 
     parent->unlock();
 
-    size_t idx = 0;
-    for (; idx < buckets_info_.size(); idx ++) {
-        if (tree_->options_.comparator->compare(key, buckets_info_[idx].key) < 0) {
-            break;
-        }
-    }
+    return find_in_buckets(key, value);
+}
 
-    if (idx == 0) {
+bool LeafNode::find_optimistic(Slice key, Slice& value, 
+                               InnerNode *parent, uint64_t pv, bool& found)
+{
+    assert(parent);
+    read_lock();
+
+    if (!parent->validate_version(pv)) {
         unlock();
         return false;
     }
 
-    RecordBucket *bucket = records_.bucket(idx - 1);
+    found = find_in_buckets(key, value);
+    return true;
+}
+
+bool LeafNode::find_in_buckets(Slice key, Slice& value)
+{
+    bool ret = search_buckets(key, value);
+    unlock();
+    return ret;
+}
+
+bool LeafNode::search_buckets(Slice key, Slice& value)
+{
+    int idx = find_bucket(key);
+    if (idx < 0) {
+        return false;
+    }
+
+    RecordBucket *bucket = records_.bucket(idx);
     if (bucket == NULL) {
-        if (!load_bucket(idx - 1)) {
-            LOG_ERROR("load bucket error nid " << nid_ << ", bucket " << (idx-1));
-            unlock();
+        if (!load_bucket(idx)) {
+            LOG_ERROR("load bucket error nid " << nid_ << ", bucket " << idx);
             return false;
         }
-        bucket = records_.bucket(idx - 1);
+        bucket = records_.bucket(idx);
         assert(bucket);
     } 
 
-    bool ret = false;
     vector<Record>::iterator it = lower_bound(
         bucket->begin(), bucket->end(), key, KeyComp(tree_->options_.comparator));
     if (it != bucket->end() && it->key == key) {
-        ret = true;
         value = it->value.clone();
+        return true;
+    }
+    return false;
+}
+
+int LeafNode::find_bucket(Slice key)
+{
+    size_t idx = 0;
+    for (; idx < buckets_info_.size(); idx ++) {
+        if (compare_keys(tree_->options_.comparator, tree_->comparator_kind_,
+                         key, buckets_info_[idx].key) < 0) {
+            break;
+        }
+    }
+    return (int)idx - 1;
+}
+
+void LeafNode::missing_buckets(const std::vector<size_t>& idxs,
+                               MultiGetContext& ctx,
+                               std::vector<BucketRead>& reads)
+{
+    size_t last = buckets_info_.size();
+    for (size_t i = 0; i < idxs.size(); i++) {
+        int idx = find_bucket(ctx.keys[idxs[i]]);
+        if (idx < 0 || records_.bucket(idx)) {
+            continue;
+        }
+        // keys're sorted, so're buckets
+        if ((size_t)idx == last) {
+            continue;
+        }
+        last = idx;
+
+        BucketRead read;
+        read.ctx = &ctx;
+        read.leaf = this;
+        read.bucket = idx;
+        read.offset = buckets_info_[idx].offset;
+        read.length = buckets_info_[idx].length;
+        read.crc = buckets_info_[idx].crc;
+        read.block = NULL;
+        read.succ = false;
+        reads.push_back(read);
+    }
+}
+
+void LeafNode::async_read_bucket(BucketRead *read, Callback *cb)
+{
+    tree_->layout_->async_read(nid_, read->offset, read->length,
+                               read->crc, &read->block, cb);
+}
+
+bool LeafNode::install_bucket(size_t idx, Block *block)
+{
+    assert(idx < buckets_info_.size());
+
+    // other readers may have loaded it meanwhile
+    ScopedMutex latch(&load_mtx_);
+    if (records_.bucket(idx)) {
+        tree_->layout_->destroy(block);
+        return true;
     }
+    return install_bucket_locked(idx, block);
+}
 
+void LeafNode::multi_find_in_buckets(const std::vector<size_t>& idxs,
+                                     MultiGetContext& ctx)
+{
+    for (size_t i = 0; i < idxs.size(); i++) {
+        Slice value;
+        if (search_buckets(ctx.keys[idxs[i]], value)) {
+            ctx.values[idxs[i]] = value;
+            ctx.found[idxs[i]] = true;
+        }
+    }
     unlock();
-    return ret;
 }
 
 void LeafNode::lock_path(Slice key, std::vector<DataNode*>& path)
@@ -1251,9 +2283,9 @@ size_t LeafNode::size()
 size_t LeafNode::estimated_buffer_size()
 {
     size_t length = 8 + 8 + buckets_info_size_;
-    if (tree_->compressor_) { 
+    if (tree_->leaf_compressor_) { 
         for (size_t i = 0; i < records_.buckets_number(); i++) {
-            length += tree_->compressor_->max_compressed_length(records_.bucket_length(i));
+            length += tree_->leaf_compressor_->max_compressed_length(records_.bucket_length(i));
         }
     } else {
         length += records_.length();
@@ -1283,70 +2315,225 @@ bool LeafNode::read_from(BlockReader& reader, bool skeleton_only)
 bool LeafNode::write_to(BlockWriter& writer, size_t& skeleton_size)
 {
     assert(status_ == kNew || status_ == kFullLoaded);
+    tree_->install_dict();
 
     size_t skeleton_pos = writer.pos();
     skeleton_size = 8 + 8 + buckets_info_size_;
     if (!writer.skip(skeleton_size)) return false;
 
-    Slice buffer;
-    if (tree_->compressor_) {
-        size_t buffer_length = 0;
-        for (size_t i = 0; i < records_.buckets_number(); i++) {
-            if (buffer_length < records_.bucket_length(i)) {
-                buffer_length = records_.bucket_length(i);
+    assert(records_.buckets_number() == buckets_info_.size());
+    if (tree_->leaf_compressor_ && parallel_compress(size())) {
+        if (!write_all_buckets_parallel(writer)) return false;
+    } else {
+        Slice buffer;
+        if (tree_->leaf_compressor_) {
+            size_t buffer_length = 0;
+            for (size_t i = 0; i < records_.buckets_number(); i++) {
+                if (buffer_length < records_.bucket_length(i)) {
+                    buffer_length = records_.bucket_length(i);
+                }
+            }
+            buffer = Slice::alloc(buffer_length);
+        }
+
+        for (size_t i = 0; i < records_.buckets_number(); i++ ) {
+            RecordBucket* bucket = records_.bucket(i);
+            char *bkt_buffer = writer.addr();
+
+            buckets_info_[i].offset = writer.pos();
+            if (!write_bucket(writer, bucket, buffer)) {
+                if (buffer.size()) {
+                    buffer.destroy();
+                }
+                return false;
             }
+            buckets_info_[i].length = writer.pos() - buckets_info_[i].offset;
+            buckets_info_[i].uncompressed_length = records_.bucket_length(i);
+            buckets_info_[i].crc = crc32(bkt_buffer, buckets_info_[i].length);
+        }
+
+        if (buffer.size()) {
+            buffer.destroy();
         }
-        buffer = Slice::alloc(buffer_length);
     }
+    size_t last_pos = writer.pos();
 
-    assert(records_.buckets_number() == buckets_info_.size());
-    for (size_t i = 0; i < records_.buckets_number(); i++ ) {
-        RecordBucket* bucket = records_.bucket(i);
-	char *bkt_buffer = writer.addr();
+    writer.seek(skeleton_pos);
+    if (!write_skeleton(writer)) return false;
+    writer.seek(last_pos);
+
+    set_all_stored();
+    based_ = false;
+    return true;
+}
 
-        buckets_info_[i].offset = writer.pos();
-        if (!write_bucket(writer, bucket, buffer)) {
-            if (buffer.size()) {
-                buffer.destroy();
+bool LeafNode::write_to(Layout *layout, std::vector<Block*>& blocks,
+                        size_t& skeleton_size, BlockBase& base)
+{
+    assert(status_ == kNew || status_ == kFullLoaded);
+    tree_->install_dict();
+    assert(records_.buckets_number() == buckets_info_.size());
+    size_t n = records_.buckets_number();
+
+    // buckets unchanged since they were stored're left where they're
+    // on disk if they outweigh the others
+    std::vector<bool> kept;
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < n; i++) {
+        uint32_t offset, length, crc;
+        records_.get_stored(i, offset, length, crc);
+        kept.push_back(records_.stored(i) &&
+            (!based_ || (offset & SUBBLOCK_IN_BASE)));
+        sizes.push_back(records_.bucket_length(i));
+    }
+    base = choose_base(kept, sizes);
+    if (base == kNoBase) {
+        kept.assign(n, false);
+    }
+
+    // serialize each bucket into its own block, buckets unchanged
+    // since they were compressed last time're copied out
+    std::vector<Block*> subblocks(n, (Block*)NULL);
+    std::vector<Block*> dirty;
+    std::vector<size_t> dirty_idxs;
+    bool ret = true;
+    for (size_t i = 0; i < n && ret; i++) {
+        if (kept[i]) {
+            continue;
+        }
+        Slice compressed = records_.compressed(i);
+        if (compressed.size()) {
+            subblocks[i] = copy_block(layout, compressed);
+            continue;
+        }
+        Block *block = layout->create(records_.bucket_length(i));
+        subblocks[i] = block;
+        dirty.push_back(block);
+        dirty_idxs.push_back(i);
+        BlockWriter wr(block);
+        ret = write_bucket(wr, records_.bucket(i));
+    }
+    if (ret && tree_->leaf_compressor_) {
+        ret = compress_blocks(layout, tree_->leaf_compressor_, dirty);
+    }
+    if (ret && tree_->leaf_compressor_) {
+        for (size_t i = 0; i < dirty.size(); i++) {
+            subblocks[dirty_idxs[i]] = dirty[i];
+            if (tree_->options_.keep_compressed_subblocks) {
+                records_.set_compressed(dirty_idxs[i], copy_slice(dirty[i]));
             }
-            return false;
         }
-        buckets_info_[i].length = writer.pos() - buckets_info_[i].offset;
+    }
+    if (!ret) {
+        LOG_ERROR("serialize buckets error, nid " << nid_);
+        for (size_t i = 0; i < subblocks.size(); i++) {
+            if (subblocks[i]) {
+                layout->destroy(subblocks[i]);
+            }
+        }
+        return false;
+    }
+
+    // buckets written're laid out from the page following skeleton,
+    // the kept ones're referenced in base
+    skeleton_size = 8 + 8 + buckets_info_size_;
+    size_t offset = PAGE_ROUND_UP(skeleton_size);
+    for (size_t i = 0; i < n; i++) {
         buckets_info_[i].uncompressed_length = records_.bucket_length(i);
-        buckets_info_[i].crc = crc32(bkt_buffer, buckets_info_[i].length);
+        if (kept[i]) {
+            records_.get_stored(i, buckets_info_[i].offset,
+                buckets_info_[i].length, buckets_info_[i].crc);
+            buckets_info_[i].offset |= SUBBLOCK_IN_BASE;
+            continue;
+        }
+        Block *block = subblocks[i];
+        buckets_info_[i].offset = offset;
+        buckets_info_[i].length = block->size();
+        buckets_info_[i].crc = crc32(block->start(), block->size());
+        offset += PAGE_ROUND_UP(block->size());
+    }
+
+    Block *skeleton = layout->create(skeleton_size);
+    BlockWriter writer(skeleton);
+    if (!write_skeleton(writer)) {
+        layout->destroy(skeleton);
+        for (size_t i = 0; i < subblocks.size(); i++) {
+            if (subblocks[i]) {
+                layout->destroy(subblocks[i]);
+            }
+        }
+        return false;
     }
-    size_t last_pos = writer.pos();
 
-    if (buffer.size()) {
-        buffer.destroy();
+    blocks.push_back(skeleton);
+    for (size_t i = 0; i < subblocks.size(); i++) {
+        if (subblocks[i]) {
+            blocks.push_back(subblocks[i]);
+        }
     }
 
-    writer.seek(skeleton_pos);
-    if (!writer.writeUInt64(left_sibling_)) return false;
-    if (!writer.writeUInt64(right_sibling_)) return false;
+    set_all_stored();
+    based_ = (base != kNoBase);
+    return true;
+}
 
-    if (!write_buckets_info(writer)) {
-        LOG_ERROR("write buckets info error, nid " << nid_);
+bool LeafNode::write_all_buckets_parallel(BlockWriter& writer)
+{
+    // serialize buckets, they're compressed in parallel
+    std::vector<Slice> buffers;
+    std::vector<Slice> inputs;
+    bool ret = true;
+    for (size_t i = 0; i < records_.buckets_number(); i++) {
+        buffers.push_back(Slice::alloc(records_.bucket_length(i)));
+        Block block(buffers[i], 0, 0);
+        BlockWriter wr(&block);
+        if (!write_bucket(wr, records_.bucket(i))) {
+            ret = false;
+            break;
+        }
+        inputs.push_back(Slice(buffers[i].data(), block.size()));
+    }
+
+    size_t offset = writer.pos();
+    std::vector<size_t> lengths;
+    if (ret) {
+        ret = compress_all(writer, tree_->leaf_compressor_, inputs, lengths);
+    }
+
+    for (size_t i = 0; i < buffers.size(); i++) {
+        buffers[i].destroy();
+    }
+
+    if (!ret) {
+        LOG_ERROR("compress buckets in parallel error, nid " << nid_);
         return false;
     }
-    writer.seek(last_pos);
+
+    const char *start = writer.start();
+    for (size_t i = 0; i < records_.buckets_number(); i++) {
+        buckets_info_[i].offset = offset;
+        buckets_info_[i].length = lengths[i];
+        buckets_info_[i].uncompressed_length = records_.bucket_length(i);
+        buckets_info_[i].crc = crc32(start + offset, lengths[i]);
+        offset += lengths[i];
+    }
     return true;
 }
 
 bool LeafNode::write_bucket(BlockWriter& writer, RecordBucket *bucket, Slice buffer)
 {
-    if (tree_->compressor_) {
+    if (tree_->leaf_compressor_) {
         // 1. write to buffer
         Block block(buffer, 0, 0);
         BlockWriter wr(&block);
         if (!write_bucket(wr, bucket)) return false;
 
         // 2. compress
-        assert(tree_->compressor_->max_compressed_length(block.size()) <=
+        assert(tree_->leaf_compressor_->max_compressed_length(block.size()) <=
             writer.remain());
 
         size_t compressed_length;
-        if (!tree_->compressor_->compress(buffer.data(), block.size(),
+        if (!tree_->leaf_compressor_->compress(buffer.data(), block.size(),
              writer.addr(), &compressed_length)) {
             LOG_ERROR("compress msgbuf error, nid " << nid_);
             return false;
@@ -1398,6 +2585,15 @@ void LeafNode::refresh_buckets_info()
     }
 }
 
+void LeafNode::set_all_stored()
+{
+    for (size_t i = 0; i < buckets_info_.size(); i++) {
+        records_.set_stored(i, buckets_info_[i].offset,
+            buckets_info_[i].length, buckets_info_[i].crc);
+    }
+    stored_ = true;
+}
+
 bool LeafNode::read_buckets_info(BlockReader& reader)
 {
     uint32_t nbuckets;
@@ -1421,6 +2617,14 @@ bool LeafNode::read_buckets_info(BlockReader& reader)
     // init buckets number
     records_.set_buckets_number(nbuckets);
 
+    stored_ = true;
+    based_ = false;
+    for (size_t i = 0; i < nbuckets; i++) {
+        if (buckets_info_[i].offset & SUBBLOCK_IN_BASE) {
+            based_ = true;
+        }
+    }
+
     status_ = kSkeletonLoaded;
     return true;
 }
@@ -1438,15 +2642,30 @@ bool LeafNode::write_buckets_info(BlockWriter& writer)
     return true;
 }
 
+bool LeafNode::write_skeleton(BlockWriter& writer)
+{
+    if (!writer.writeUInt64(left_sibling_)) return false;
+    if (!writer.writeUInt64(right_sibling_)) return false;
+
+    if (!write_buckets_info(writer)) {
+        LOG_ERROR("write buckets info error, nid " << nid_);
+        return false;
+    }
+    return true;
+}
+
 bool LeafNode::load_bucket(size_t idx)
 {
-    assert(status_ != kFullLoaded);
     assert(idx < buckets_info_.size());
-    assert(records_.bucket(idx) == NULL);
+
+    // lazy load, other readers may be loading the same bucket
+    ScopedMutex latch(&load_mtx_);
+    if (records_.bucket(idx)) {
+        return true;
+    }
 
     uint32_t offset = buckets_info_[idx].offset;
     uint32_t length = buckets_info_[idx].length;
-    uint32_t uncompressed_length = buckets_info_[idx].uncompressed_length;
     uint32_t expected_crc = buckets_info_[idx].crc;
 
     Block* block = tree_->layout_->read(nid_, offset, length, expected_crc);
@@ -1456,6 +2675,11 @@ bool LeafNode::load_bucket(size_t idx)
         return false;
     }
 
+    return install_bucket_locked(idx, block);
+}
+
+bool LeafNode::install_bucket_locked(size_t idx, Block *block)
+{
     BlockReader reader(block);
 
     RecordBucket *bucket = new RecordBucket();
@@ -1465,11 +2689,12 @@ bool LeafNode::load_bucket(size_t idx)
     }
 
     Slice buffer;
-    if (tree_->compressor_) {
-        buffer = Slice::alloc(uncompressed_length);
+    if (tree_->leaf_compressor_) {
+        buffer = Slice::alloc(buckets_info_[idx].uncompressed_length);
     }
 
-    if (!read_bucket(reader, length, uncompressed_length, bucket, buffer)) {
+    if (!read_bucket(reader, buckets_info_[idx].length,
+                     buckets_info_[idx].uncompressed_length, bucket, buffer)) {
         if (buffer.size()) {
             buffer.destroy();
         }
@@ -1482,21 +2707,11 @@ bool LeafNode::load_bucket(size_t idx)
         buffer.destroy();
     }
 
-    // this operation must be inside read lock
-
-    // lazy load, upgrade lock to write lock
-    // TODO: write a upgradable rwlock
-    unlock();
-    write_lock();
-    if (records_.bucket(idx) == NULL) {
-        records_.set_bucket(idx, bucket);
-    } else {
-        // it's possible another read thread loading 
-        // the same block at the same time
-        delete bucket;
-    }
-    unlock();
-    read_lock();
+    // inside read lock and load_mtx_, other readers see the bucket
+    // once it's published as a whole
+    records_.set_stored(idx, buckets_info_[idx].offset,
+        buckets_info_[idx].length, buckets_info_[idx].crc);
+    records_.set_bucket(idx, bucket);
 
     tree_->layout_->destroy(block);
     return true;
@@ -1526,43 +2741,129 @@ bool LeafNode::load_all_buckets()
 
 bool LeafNode::load_all_buckets(BlockReader& reader)
 {
-    Slice buffer;
-    if (tree_->compressor_) {
-        size_t buffer_length = 0;
-        for (size_t i = 0; i < buckets_info_.size(); i++ ) {
-            if (buffer_length < buckets_info_[i].uncompressed_length) {
-                buffer_length = buckets_info_[i].uncompressed_length;
+    // buckets kept in base're read from it at once
+    Block *base = NULL;
+    size_t total = 0;
+    for (size_t i = 0; i < buckets_info_.size(); i++ ) {
+        total += buckets_info_[i].uncompressed_length;
+        if (records_.bucket(i) == NULL && base == NULL &&
+            (buckets_info_[i].offset & SUBBLOCK_IN_BASE)) {
+            base = tree_->layout_->read_base(nid_);
+            if (base == NULL) {
+                LOG_ERROR("read base of node error, nid " << nid_);
+                return false;
             }
         }
-        buffer = Slice::alloc(buffer_length);
     }
+    BlockReader *base_reader = base ? new BlockReader(base) : NULL;
 
     bool ret = true;
-    for (size_t i = 0; i < buckets_info_.size(); i++) {
-        reader.seek(buckets_info_[i].offset);
+    if (tree_->leaf_compressor_ && parallel_compress(total)) {
+        ret = load_all_buckets_parallel(reader, base_reader);
+    } else {
+        Slice buffer;
+        if (tree_->leaf_compressor_) {
+            size_t buffer_length = 0;
+            for (size_t i = 0; i < buckets_info_.size(); i++ ) {
+                if (buffer_length < buckets_info_[i].uncompressed_length) {
+                    buffer_length = buckets_info_[i].uncompressed_length;
+                }
+            }
+            buffer = Slice::alloc(buffer_length);
+        }
 
-        RecordBucket *bucket = new RecordBucket();
-        if (bucket == NULL) {
+        for (size_t i = 0; i < buckets_info_.size(); i++) {
+            if (records_.bucket(i)) {
+                // loaded by reader
+                continue;
+            }
+            BlockReader *r = seek_subblock(reader, base_reader,
+                buckets_info_[i].offset, buckets_info_[i].length);
+            if (r == NULL) {
+                ret = false;
+                break;
+            }
+
+            RecordBucket *bucket = new RecordBucket();
+            if (bucket == NULL) {
+                ret = false;
+                break;
+            }
+
+            if (!read_bucket(*r, buckets_info_[i].length,
+                             buckets_info_[i].uncompressed_length,
+                             bucket, buffer)) {
+                ret = false;
+                delete bucket;
+                break;
+            }
+
+            records_.set_stored(i, buckets_info_[i].offset,
+                buckets_info_[i].length, buckets_info_[i].crc);
+            records_.set_bucket(i, bucket);
+        }
+
+        if (buffer.size()) {
+            buffer.destroy();
+        }
+    }
+
+    if (base) {
+        delete base_reader;
+        tree_->layout_->destroy(base);
+    }
+
+    status_ = kFullLoaded;
+    return ret;
+}
+
+bool LeafNode::load_all_buckets_parallel(BlockReader& reader, BlockReader *base)
+{
+    std::vector<size_t> idxs;
+    std::vector<Slice> inputs;
+    std::vector<Slice> outputs;
+    bool ret = true;
+    for (size_t i = 0; i < buckets_info_.size(); i++) {
+        if (records_.bucket(i)) {
+            // loaded by reader
+            continue;
+        }
+        BlockReader *r = seek_subblock(reader, base,
+            buckets_info_[i].offset, buckets_info_[i].length);
+        if (r == NULL) {
             ret = false;
             break;
         }
+        idxs.push_back(i);
+        inputs.push_back(Slice(r->addr(), buckets_info_[i].length));
+        outputs.push_back(Slice::alloc(buckets_info_[i].uncompressed_length));
+    }
 
-        if (!read_bucket(reader, buckets_info_[i].length, 
-                         buckets_info_[i].uncompressed_length,
-                         bucket, buffer)) {
-            ret = false;
+    if (ret) {
+        ret = uncompress_all(tree_->leaf_compressor_, inputs, outputs);
+    }
+    for (size_t j = 0; ret && j < idxs.size(); j++) {
+        size_t i = idxs[j];
+        RecordBucket *bucket = new RecordBucket();
+        Block block(outputs[j], 0, buckets_info_[i].uncompressed_length);
+        BlockReader rr(&block);
+        if (!read_bucket(rr, bucket)) {
             delete bucket;
+            ret = false;
             break;
         }
-
+        records_.set_stored(i, buckets_info_[i].offset,
+            buckets_info_[i].length, buckets_info_[i].crc);
         records_.set_bucket(i, bucket);
     }
 
-    if (buffer.size()) {
-        buffer.destroy();
+    for (size_t j = 0; j < outputs.size(); j++) {
+        outputs[j].destroy();
     }
 
-    status_ = kFullLoaded;
+    if (!ret) {
+        LOG_ERROR("load all buckets in parallel error, nid " << nid_);
+    }
     return ret;
 }
 
@@ -1571,14 +2872,14 @@ bool LeafNode::read_bucket(BlockReader& reader,
                            size_t uncompressed_length,
                            RecordBucket *bucket, Slice buffer)
 {
-    if (tree_->compressor_) {
+    if (tree_->leaf_compressor_) {
         // 1. uncompress
         assert(compressed_length <= reader.remain());
         assert(uncompressed_length <= buffer.size());
 
         // 1. uncompress
-        if (!tree_->compressor_->uncompress(reader.addr(),
-            compressed_length, (char *)buffer.data())) {
+        if (!tree_->leaf_compressor_->uncompress(reader.addr(),
+            compressed_length, (char *)buffer.data(), buffer.size())) {
             return false;
         }
         reader.skip(compressed_length);
@@ -23,6 +23,7 @@ namespace cascadb {
 #define IS_LEAF(nid)        ((nid) >= NID_LEAF_START)
 
 class Tree;
+class Compressor;
 
 class Pivot {
 public:
@@ -57,16 +58,37 @@ public:
         dirty_ = false;
         dead_ = false;
         flushing_ = false;
+        hot_ = false;
         
+        first_write_timestamp_ = 0;
+        last_used_timestamp_ = 0;
+
         refcnt_ = 0;
         pincnt_ = 0;
+
+        version_ = 0;
+        write_locked_ = false;
+        image_skeleton_ = false;
+        image_size_ = 0;
     }
     
-    virtual ~Node() {}
+    virtual ~Node()
+    {
+        if (image_.size()) {
+            image_.destroy();
+        }
+    }
     
     // size of node in memory
     virtual size_t size() = 0;
 
+    // memory taken by node in cache, image included, cache_limit
+    // is applied to it
+    size_t cached_size()
+    {
+        return size() + image_size();
+    }
+
     // size of node after serialization
     virtual size_t estimated_buffer_size() = 0;
 
@@ -74,6 +96,51 @@ public:
 
     virtual bool write_to(BlockWriter& writer, size_t& skeleton_size) = 0;
 
+    // true if node should be serialized by the vectored write_to
+    virtual bool write_vectored() { return false; }
+
+    // Serialize into page aligned blocks created from layout, the skeleton
+    // is in the first one and sub-blocks follow, each in its own block,
+    // they're written out by a vectored Layout::async_write. Sub-blocks
+    // unchanged since the node was last written can be left out and
+    // referenced where they're on disk, as told by base
+    virtual bool write_to(Layout *layout, std::vector<Block*>& blocks,
+                          size_t& skeleton_size, BlockBase& base) { return false; }
+
+    // true if nothing is left on disk to be loaded lazily,
+    // it's required to serialize a node
+    virtual bool is_fully_loaded() { return true; }
+
+    // Bytes of the block node's the same as, kept by cache when they're
+    // read from or written to disk, so that the image of a node being
+    // evicted needn't be serialized again. skeleton is set if they're
+    // the skeleton only. Node takes the ownership
+    void set_image(Slice image, bool skeleton)
+    {
+        if (image_.size()) {
+            image_.destroy();
+        }
+        image_ = image;
+        image_skeleton_ = skeleton;
+        atomic_store(&image_size_, image.size());
+    }
+
+    // Hand the image over to caller, it's empty if there is not any
+    Slice release_image(bool& skeleton)
+    {
+        Slice image = image_;
+        skeleton = image_skeleton_;
+        image_ = Slice();
+        atomic_store(&image_size_, (size_t)0);
+        return image;
+    }
+
+    // Bytes of image, see cached_size()
+    size_t image_size()
+    {
+        return atomic_load(&image_size_);
+    }
+
     /***************************
          setter and getters
     ****************************/
@@ -90,53 +157,61 @@ public:
 
     void set_dirty(bool dirty)
     {
-        ScopedMutex lock(&mtx_);
-        if (!dirty_ && dirty) {
-            first_write_timestamp_ = now();
+        if (!dirty) {
+            atomic_store(&dirty_, false);
+        } else if (!atomic_load(&dirty_)) {
+            // timestamp's stored before the flag is published, so that
+            // whoever sees the flag sees the timestamp as well
+            atomic_store(&first_write_timestamp_, coarse_now_micros());
+            atomic_store(&dirty_, true);
         }
-        dirty_ = dirty;
     }
     
     bool is_dirty()
     {
-        ScopedMutex lock(&mtx_);
-        return dirty_;
+        return atomic_load(&dirty_);
     }
     
     void set_dead()
     {
-        ScopedMutex lock(&mtx_);
-        dead_ = true;
+        atomic_store(&dead_, true);
     }
     
     bool is_dead()
     {
-        ScopedMutex lock(&mtx_);
-        return dead_;
+        return atomic_load(&dead_);
     }
     
     void set_flushing(bool flushing)
     {
-        ScopedMutex lock(&mtx_);
-        flushing_ = flushing;
+        atomic_store(&flushing_, flushing);
     }
     
     bool is_flushing()
     {
-        ScopedMutex lock(&mtx_);
-        return flushing_;
+        return atomic_load(&flushing_);
+    }
+
+    // set by cache's eviction policy
+    void set_hot(bool hot)
+    {
+        atomic_store(&hot_, hot);
+    }
+
+    bool is_hot()
+    {
+        return atomic_load(&hot_);
     }
     
-    Time get_first_write_timestamp()
+    // timestamps're in microseconds of coarse_now_micros()
+    uint64_t get_first_write_timestamp()
     {
-        ScopedMutex lock(&mtx_);
-        return first_write_timestamp_;
+        return atomic_load(&first_write_timestamp_);
     }
     
-    Time get_last_used_timestamp()
+    uint64_t get_last_used_timestamp()
     {
-        ScopedMutex lock(&mtx_);
-        return last_used_timestamp_;
+        return atomic_load(&last_used_timestamp_);
     }
     
     /***************************
@@ -145,41 +220,37 @@ public:
     
     void inc_ref()
     {
-        ScopedMutex lock(&mtx_);
-        refcnt_ ++;
+        atomic_add_fetch(&refcnt_, 1);
     }
     
     void dec_ref()
     {
-        ScopedMutex lock(&mtx_);
-        refcnt_ --;
-        assert(refcnt_ >= 0);
-        last_used_timestamp_ = now();
+        atomic_store(&last_used_timestamp_, coarse_now_micros());
+        int refcnt = atomic_sub_fetch(&refcnt_, 1);
+        assert(refcnt >= 0);
+        (void) refcnt;
     }
     
     int ref()
     {
-        ScopedMutex lock(&mtx_);
-        return refcnt_;
+        return atomic_load(&refcnt_);
     }
     
     void inc_pin()
     {
-        ScopedMutex lock(&mtx_);
-        pincnt_ ++;
+        atomic_add_fetch(&pincnt_, 1);
     }
     
     void dec_pin()
     {
-        ScopedMutex lock(&mtx_);
-        pincnt_ --;
-        assert(pincnt_ >= 0);
+        int pincnt = atomic_sub_fetch(&pincnt_, 1);
+        assert(pincnt >= 0);
+        (void) pincnt;
     }
     
     int pin()
     {
-        ScopedMutex lock(&mtx_);
-        return pincnt_;
+        return atomic_load(&pincnt_);
     }
     
     // Read lock is locked when:
@@ -202,25 +273,50 @@ public:
     void write_lock()
     {
         lock_.write_lock();
+        write_locked_ = true;
+        atomic_add_fetch(&version_, (uint64_t)1);
     }
 
     bool try_write_lock()
     {
-        return lock_.try_write_lock();
+        if (lock_.try_write_lock()) {
+            write_locked_ = true;
+            atomic_add_fetch(&version_, (uint64_t)1);
+            return true;
+        }
+        return false;
     }
     
     void unlock()
     {
+        if (write_locked_) {
+            write_locked_ = false;
+            atomic_add_fetch(&version_, (uint64_t)1);
+        }
         lock_.unlock();
     }
+
+    // Version is increased when write lock is obtained and again
+    // before it's released, so it's odd while node is being modified.
+    // Readers can read a node without locking and validate the version
+    // afterwards.
+    uint64_t read_version()
+    {
+        return atomic_load(&version_);
+    }
+
+    // true if node is not modified since version v is read
+    bool validate_version(uint64_t v)
+    {
+        acquire_fence();
+        return (v & 1) == 0 && atomic_load(&version_) == v;
+    }
     
 protected:
     std::string     table_name_;
     bid_t           nid_;
 
-    // TODO: use atomic
-    Mutex           mtx_;
-        
+    // flags and countings're accessed atomically
     bool            dirty_;
     bool            dead_;
 
@@ -228,11 +324,14 @@ protected:
     // written out concurrently
     bool            flushing_;
 
+    // hot nodes're evicted after others, see TwoQueuePolicy
+    bool            hot_;
+
     // the order of dirty nodes be flushed out
-    Time            first_write_timestamp_;
+    uint64_t        first_write_timestamp_;
 
     // the order of clean nodes be evicted
-    Time            last_used_timestamp_;
+    uint64_t        last_used_timestamp_;
     
     // reference counting, node can be destructed only
     // when this count reaches 0
@@ -244,6 +343,22 @@ protected:
 
     // latch
     RWLock          lock_;
+
+    // see read_version()
+    uint64_t        version_;
+
+    // load latch, serializes lazy loads by threads holding read lock,
+    // so lock_ needn't be upgraded and parts're loaded only once
+    Mutex           load_mtx_;
+
+    // set by the writer holding lock_
+    bool            write_locked_;
+
+    // see set_image()
+    Slice           image_;
+    bool            image_skeleton_;
+    // read by cache while node's locked by others
+    size_t          image_size_;
 };
 
 class SchemaNode : public Node {
@@ -279,11 +394,15 @@ enum NodeStatus {
 };
 
 class InnerNode;
+class LeafNode;
+struct MultiGetContext;
+struct BucketRead;
 
 class DataNode : public Node {
 public:
     DataNode(const std::string& table_name, bid_t nid, Tree *tree)
-    : Node(table_name, nid), tree_(tree), status_(kNew)
+    : Node(table_name, nid), tree_(tree), status_(kNew),
+      stored_(false), based_(false)
     {
     }
 
@@ -297,30 +416,71 @@ public:
     
     virtual void lock_path(Slice key, std::vector<DataNode*>& path) = 0;
 
+    bool is_fully_loaded()
+    {
+        return status_ == kNew || status_ == kFullLoaded;
+    }
+
+    // true if node reaches vectored_write_threshold
+    bool write_vectored();
+
 protected:
+    // true if sub-blocks of a node this large're compressed
+    // and uncompressed on the tree's compress pool
+    bool parallel_compress(size_t size);
+
+    // Compress serialized sub-blocks in parallel, they're laid out
+    // one after another from writer's position, lengths of compressed
+    // sub-blocks're returned
+    bool compress_all(BlockWriter& writer, Compressor *compressor,
+                      const std::vector<Slice>& inputs,
+                      std::vector<size_t>& lengths);
+
+    // Compress serialized sub-blocks, each block is replaced by a new
+    // one created from layout holding the compressed data. Blocks're
+    // left as they're on failure
+    bool compress_blocks(Layout *layout, Compressor *compressor,
+                         std::vector<Block*>& blocks);
+
+    // Block created from layout holding a copy of data
+    Block* copy_block(Layout *layout, Slice data);
+
+    // Slice holding a copy of data in block
+    Slice copy_slice(Block *block);
+
+    // Uncompress sub-blocks into outputs in parallel
+    bool uncompress_all(Compressor *compressor,
+                        const std::vector<Slice>& inputs,
+                        const std::vector<Slice>& outputs);
+
+    // Choose how the next block references the one on disk. Sub-blocks
+    // kept're those stored inside the base, or inside the block if it
+    // has no base, they're referenced only while they outweigh the
+    // sub-blocks to be written, so at most about half of the space
+    // referenced is wasted. Lengths're uncompressed ones
+    BlockBase choose_base(const std::vector<bool>& kept,
+                          const std::vector<size_t>& lengths);
+
+    // Position reader of the block read, or of its base if offset is
+    // flagged with SUBBLOCK_IN_BASE, at a sub-block and return it.
+    // NULL if the sub-block is out of bounds
+    BlockReader* seek_subblock(BlockReader& reader, BlockReader *base,
+                               uint32_t offset, uint32_t length);
+
     Tree            *tree_;
 
     NodeStatus      status_;
-};
 
-class LeafNode;
+    // set once node has a block on disk, read from or written into
+    bool            stored_;
+
+    // set if the block references sub-blocks inside its base extent
+    bool            based_;
+};
 
 class InnerNode : public DataNode {
 public:
-    InnerNode(const std::string& table_name, bid_t nid, Tree *tree)
-    : DataNode(table_name, nid, tree),
-      bottom_(false),
-      first_child_(NID_NIL),
-      first_msgbuf_(NULL),
-      first_msgbuf_offset_(0),
-      first_msgbuf_length_(0),
-      first_msgbuf_uncompressed_length_(0),
-      pivots_sz_(0),
-      msgcnt_(0), 
-      msgbufsz_(0)
-    {
-        assert(nid >= NID_START && nid < NID_LEAF_START);
-    }
+    InnerNode(const std::string& table_name, bid_t nid, Tree *tree);
     
     virtual ~InnerNode();
 
@@ -337,33 +497,80 @@ public:
         return write(Msg(Del, key.clone()));
     }
 
+    // write a batch of messages into root, they're moved out of mb
+    bool write(MsgBuf *mb);
+
     virtual bool cascade(MsgBuf *mb, InnerNode* parent);
     
     virtual bool find(Slice key, Slice& value, InnerNode* parent);
+
+    // Find without locking inner nodes, versions're validated instead.
+    // Parent's version pv is validated after this node's version is read,
+    // returns false if a conflict is detected and caller should retry
+    // with find()
+    bool find_optimistic(Slice key, Slice& value, 
+                         InnerNode *parent, uint64_t pv, bool& found);
+
+    // Find a batch of keys, idxs index into ctx.keys and're sorted.
+    // Keys resolved by buffers're filled into ctx, leaves reached're
+    // read locked and collected into ctx.leaves with their keys.
+    // Read lock is held by caller and released on return
+    void multi_find(const std::vector<size_t>& idxs, MultiGetContext& ctx);
     
     void add_pivot(Slice key, bid_t nid, std::vector<DataNode*>& path);
     
     void rm_pivot(bid_t nid, std::vector<DataNode*>& path);
 
+    // move all messages to the buffer of a neighbour child
+    void move_msgbuf(MsgBuf *from, MsgBuf *to);
+
+    // take over messages of a retired child's buffer into the buffer
+    // for the child, messages already buffered here're newer and kept
+    void take_msgbuf(bid_t nid, MsgBuf *from);
+
     size_t pivot_size(Slice key);
     size_t bloom_size(int n);
     
     size_t size();
 
+    // size of buffered messages, can be read without lock
+    size_t buffered_size()
+    {
+        return atomic_load(&msgbufsz_);
+    }
+
     size_t estimated_buffer_size();
     
     bool read_from(BlockReader& reader, bool skeleton_only);
     
     bool write_to(BlockWriter& writer, size_t& skeleton_size);
 
+    bool write_to(Layout *layout, std::vector<Block*>& blocks,
+                  size_t& skeleton_size, BlockBase& base);
+
     void lock_path(Slice key, std::vector<DataNode*>& path);
+
+    // cascade buffers until they're below the limits,
+    // called by cascader threads with read lock held,
+    // lock is released on return
+    void drain();
     
 protected:
     friend class LeafNode;
+    friend class Tree;
+    friend class TreeBulkLoader;
 
     bool write(const Msg& m);
     int comp_pivot(Slice k, int i);
     int find_pivot(Slice k);
+
+    // find_pivot() without locking, each pivot key's copied and version v
+    // validated before comparing, so torn keys're never compared.
+    // Returns -1 if node has been modified since v
+    int find_pivot_optimistic(Slice k, uint64_t v);
+
+    // rebuild pivot_prefixes_ after pivots_ is modified
+    void refresh_pivot_prefixes();
     
     MsgBuf* msgbuf(int idx);
     MsgBuf* msgbuf(int idx, Slice& key);
@@ -373,23 +580,49 @@ protected:
     
     void insert_msgbuf(const Msg& m, int idx);
     void insert_msgbuf(MsgBuf::Iterator begin, MsgBuf::Iterator end, int idx);
+
+    // split sorted messages by pivots and insert them
+    void insert_msgbuf(MsgBuf *mb);
     
     int find_msgbuf_maxcnt();
     int find_msgbuf_maxsz();
 
+    // true if buffers exceed inner_node_msg_count or inner_node_page_size
+    bool need_cascade();
+
+    // true if buffers exceed the limits scaled by cascade_hard_limit
+    bool must_cascade();
+
+    // cascade buffers inline or schedule it to cascader,
+    // lock is released on return
     void maybe_cascade();
+
+    // cascade the largest buffer into child once,
+    // lock is released on return
+    void cascade_once();
     
     void split(std::vector<DataNode*>& path);
 
+    // lazy load with either read or write lock held
     bool load_msgbuf(int idx);
     bool load_all_msgbuf();
     bool load_all_msgbuf(BlockReader& reader);
+    // uncompress msgbufs on the compress pool then deserialize them,
+    // base reads the block's base, NULL if it isn't needed
+    bool load_all_msgbuf_parallel(BlockReader& reader, BlockReader *base);
     bool read_msgbuf(BlockReader& reader, 
                      size_t compressed_length,
                      size_t uncompressed_length,
                      MsgBuf *mb, Slice buffer);
 
     bool write_msgbuf(BlockWriter& writer, MsgBuf *mb, Slice buffer);
+    // serialize all msgbufs then compress them on the compress pool
+    bool write_all_msgbuf_parallel(BlockWriter& writer);
+
+    // length of pivots and msgbuf indexes
+    size_t skeleton_length();
+    // write pivots and msgbuf indexes, msgbufs should be written already
+    bool write_skeleton(BlockWriter& writer);
 
     // true if children're leaf nodes
     bool bottom_;
@@ -402,11 +635,22 @@ protected:
     uint32_t first_msgbuf_uncompressed_length_;
     uint32_t first_msgbuf_crc_;
     
+    // capacity is reserved for inner_node_children_number pivots,
+    // so optimistic readers never see it reallocated
     std::vector<Pivot> pivots_;
 
+    // key prefixes of pivots_ stored contiguously,
+    // searched before comparing full keys, see key_prefix()
+    std::vector<uint64_t> pivot_prefixes_;
+
     size_t pivots_sz_; 
+    // updated atomically by writers holding read lock
     size_t msgcnt_;
     size_t msgbufsz_;
+
+    // msgbufs of removed pivots, optimistic readers may still
+    // refer to them, freed when node is destructed
+    std::vector<MsgBuf*> retired_msgbufs_;
 };
 
 class LeafNode : public DataNode { 
@@ -418,6 +662,11 @@ public:
     virtual bool cascade(MsgBuf *mb, InnerNode* parent);
     
     virtual bool find(Slice key, Slice& value, InnerNode* parent);
+
+    // Find after parent's version pv is validated,
+    // returns false if parent has been modified
+    bool find_optimistic(Slice key, Slice& value, 
+                         InnerNode *parent, uint64_t pv, bool& found);
     
     size_t size();
     
@@ -427,10 +676,51 @@ public:
     
     bool write_to(BlockWriter& writer, size_t& skeleton_size);
 
+    bool write_to(Layout *layout, std::vector<Block*>& blocks,
+                  size_t& skeleton_size, BlockBase& base);
+
     void lock_path(Slice key, std::vector<DataNode*>& path);
+
+    // Buckets needed by keys of a multi get but not loaded yet,
+    // where they're on disk is recorded, called with read lock held
+    void missing_buckets(const std::vector<size_t>& idxs,
+                         MultiGetContext& ctx,
+                         std::vector<BucketRead>& reads);
+
+    // Initiate reading a bucket where it's recorded, called without
+    // lock, the read fails if leaf has been written meanwhile
+    void async_read_bucket(BucketRead *read, Callback *cb);
+
+    // Deserialize a bucket read asynchronously and set it,
+    // block is destroyed, called with read lock held
+    bool install_bucket(size_t idx, Block *block);
+
+    // Find keys of a multi get with read lock held,
+    // lock is released on return
+    void multi_find_in_buckets(const std::vector<size_t>& idxs,
+                               MultiGetContext& ctx);
     
 protected:
+    friend class TreeBulkLoader;
+
+    // search records with read lock held, lock is released on return
+    bool find_in_buckets(Slice key, Slice& value);
+
+    // search records with read lock held
+    bool search_buckets(Slice key, Slice& value);
+
+    // index of the bucket may contain key, -1 if none
+    int find_bucket(Slice key);
+
+    // deserialize a bucket from block and set it,
+    // load latch is held, block is destroyed
+    bool install_bucket_locked(size_t idx, Block *block);
+
     Record to_record(const Msg& msg);
+
+    // Merge messages into records, the result is stored in res
+    template<ComparatorKind K>
+    void merge_msgbuf(MsgBuf *mb, RecordBuckets& res);
   
     void split(Slice anchor);
     
@@ -438,12 +728,19 @@ protected:
     
     // refresh buckets_info_ after buckets_ is modified
     void refresh_buckets_info();
+    // buckets're where buckets_info_ tells after the node is written
+    void set_all_stored();
     bool read_buckets_info(BlockReader& reader);
     bool write_buckets_info(BlockWriter& writer);
+    // write siblings and buckets info, buckets should be written already
+    bool write_skeleton(BlockWriter& writer);
 
     bool load_bucket(size_t idx);
     bool load_all_buckets();
     bool load_all_buckets(BlockReader& reader);
+    // uncompress buckets on the compress pool then deserialize them,
+    // base reads the block's base, NULL if it isn't needed
+    bool load_all_buckets_parallel(BlockReader& reader, BlockReader *base);
     bool read_bucket(BlockReader& reader, 
                      size_t compressed_length,
                      size_t uncompressed_length,
@@ -453,6 +750,8 @@ protected:
 
     bool write_bucket(BlockWriter& writer, RecordBucket *bucket, Slice buffer);
     bool write_bucket(BlockWriter& writer, RecordBucket *bucket);
+    // serialize all buckets then compress them on the compress pool
+    bool write_all_buckets_parallel(BlockWriter& writer);
 
 private:
     // either spliting or merging to get tree balanced
@@ -479,6 +778,46 @@ private:
 
 };
 
+// Keys of a multi get reaching a leaf
+struct MultiGetLeaf {
+    LeafNode                    *leaf;      // read locked, referenced
+    std::vector<size_t>         idxs;       // sorted indexes of keys
+    uint64_t                    version;    // when it's unlocked for reads
+};
+
+// A bucket read issued by a multi get
+struct BucketRead {
+    MultiGetContext             *ctx;
+    LeafNode                    *leaf;
+    size_t                      bucket;
+    uint32_t                    offset;     // inside block of leaf
+    uint32_t                    length;
+    uint32_t                    crc;
+    Block                       *block;
+    bool                        succ;
+};
+
+// State of a multi get, see Tree::multi_get()
+struct MultiGetContext {
+    MultiGetContext(const std::vector<Slice>& k,
+                    std::vector<Slice>& v,
+                    std::vector<bool>& f)
+    : keys(k), values(v), found(f), cond(&mtx), pending(0)
+    {
+    }
+
+    const std::vector<Slice>    &keys;
+    std::vector<Slice>          &values;
+    std::vector<bool>           &found;
+
+    std::vector<MultiGetLeaf>   leaves;
+
+    // bucket reads in flight
+    Mutex                       mtx;
+    CondVar                     cond;
+    size_t                      pending;
+};
+
 
 
 }
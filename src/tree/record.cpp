@@ -33,7 +33,37 @@ RecordBuckets::~RecordBuckets()
 {
     for (size_t i = 0; i < buckets_.size(); i++) {
         delete buckets_[i].bucket;
+        if (buckets_[i].compressed.size()) {
+            buckets_[i].compressed.destroy();
+        }
+    }
+}
+
+void RecordBuckets::set_compressed(size_t index, Slice compressed)
+{
+    assert(index < buckets_.size());
+    if (buckets_[index].compressed.size()) {
+        buckets_[index].compressed.destroy();
     }
+    buckets_[index].compressed = compressed;
+}
+
+void RecordBuckets::set_stored(size_t index, uint32_t offset, uint32_t length,
+                               uint32_t crc)
+{
+    assert(index < buckets_.size());
+    buckets_[index].stored_offset = offset;
+    buckets_[index].stored_length = length;
+    buckets_[index].stored_crc = crc;
+}
+
+void RecordBuckets::get_stored(size_t index, uint32_t& offset, uint32_t& length,
+                               uint32_t& crc)
+{
+    assert(index < buckets_.size());
+    offset = buckets_[index].stored_offset;
+    length = buckets_[index].stored_length;
+    crc = buckets_[index].stored_crc;
 }
 
 void RecordBuckets::push_back(Record record)
@@ -45,11 +75,16 @@ void RecordBuckets::push_back(Record record)
         RecordBucketInfo info;
         info.bucket = bucket;
         info.length = 4;
+        info.stored_offset = 0;
+        info.stored_length = 0;
+        info.stored_crc = 0;
         buckets_.push_back(info);
         last_bucket_length_ = info.length;
         length_ += info.length;
     } else {
         bucket = buckets_.back().bucket;
+        assert(buckets_.back().compressed.size() == 0);
+        buckets_.back().stored_length = 0;
     }
 
     bucket->push_back(record);
@@ -60,6 +95,21 @@ void RecordBuckets::push_back(Record record)
     size_ ++;
 }
 
+void RecordBuckets::move_bucket(RecordBuckets &other, size_t index)
+{
+    assert(index < other.buckets_.size());
+    RecordBucketInfo info = other.buckets_[index];
+    assert(info.bucket);
+    other.buckets_[index].bucket = NULL;
+    other.buckets_[index].compressed = Slice();
+
+    buckets_.push_back(info);
+    // the bucket is full for push_back()
+    last_bucket_length_ = max_bucket_length_;
+    length_ += info.length;
+    size_ += info.bucket->size();
+}
+
 void RecordBuckets::swap(RecordBuckets &other)
 {
     buckets_.swap(other.buckets_);
@@ -82,6 +132,8 @@ Slice RecordBuckets::split(RecordBuckets &other)
         dst->resize(src->size() - n);
         std::copy(src->begin() + n, src->end(), dst->begin());
         src->resize(n);
+        set_compressed(0, Slice());
+        set_stored(0, 0, 0, 0);
 
         buckets_[0].length = 4;
         for (size_t i = 0; i < src->size(); i++) {
@@ -98,6 +150,7 @@ Slice RecordBuckets::split(RecordBuckets &other)
         other.set_buckets_number(buckets_.size() - n);
         for (size_t i = n; i < buckets_.size(); i++ ) {
             other.set_bucket(i-n, buckets_[i].bucket);
+            other.buckets_[i-n].compressed = buckets_[i].compressed;
         }
         buckets_.resize(n);
 
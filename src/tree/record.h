@@ -10,6 +10,7 @@
 #include <stdexcept>
 
 #include "cascadb/slice.h"
+#include "sys/sys.h"
 #include "serialize/block.h"
 
 namespace cascadb {
@@ -99,10 +100,12 @@ public:
         buckets_.resize(buckets_number);
     }
 
+    // Buckets're loaded lazily by readers holding the read lock of
+    // node, so the pointer is published and read atomically
     RecordBucket* bucket(size_t index)
     {
         assert(index < buckets_.size());
-        return buckets_[index].bucket;
+        return atomic_load(&buckets_[index].bucket);
     }
 
     size_t bucket_length(size_t index)
@@ -116,24 +119,56 @@ public:
         assert(index < buckets_.size());
 
         assert(buckets_[index].bucket == NULL);
-        buckets_[index].bucket = bucket;
 
-        buckets_[index].length = 4;
+        size_t length = 4;
         for (size_t i = 0; i < bucket->size(); i++) {
-            buckets_[index].length += (*bucket)[i].size();
+            length += (*bucket)[i].size();
         }
-        
-        length_ += buckets_[index].length;
-        size_ += buckets_[index].bucket->size();
+        buckets_[index].length = length;
+        atomic_store(&buckets_[index].bucket, bucket);
+
+        atomic_add_fetch(&length_, length);
+        atomic_add_fetch(&size_, bucket->size());
+    }
+
+    // Compressed bytes of a bucket as it was last written out,
+    // empty if the bucket has been modified since
+    Slice compressed(size_t index)
+    {
+        assert(index < buckets_.size());
+        return buckets_[index].compressed;
+    }
+
+    // Keep compressed bytes of a bucket, ownership is taken
+    void set_compressed(size_t index, Slice compressed);
+
+    // True if a bucket is unchanged since it was read from or
+    // written into the block of node, where it's still referenced
+    bool stored(size_t index)
+    {
+        assert(index < buckets_.size());
+        return buckets_[index].stored_length != 0;
     }
 
+    // Location of a bucket inside the block of node, it moves along
+    // with the bucket and is dropped once the bucket is modified
+    void set_stored(size_t index, uint32_t offset, uint32_t length, uint32_t crc);
+
+    void get_stored(size_t index, uint32_t& offset, uint32_t& length, uint32_t& crc);
+
     Iterator get_iterator() { return Iterator(this); }
 
     void push_back(Record record);
 
-    inline size_t length() { return length_; }
+    // Move a bucket of other to the end as a whole, it keeps its
+    // compressed bytes, records pushed later go into a new bucket
+    void move_bucket(RecordBuckets &other, size_t index);
+
+    inline size_t max_bucket_length() { return max_bucket_length_; }
+
+    inline size_t length() { return atomic_load(&length_); }
 
-    inline size_t size() { return size_; }
+    inline size_t size() { return atomic_load(&size_); }
 
     // for writing test purpose only
     inline Record& operator[](size_t idx) {
@@ -158,6 +193,10 @@ private:
     struct RecordBucketInfo {
         RecordBucket    *bucket;
         size_t          length;
+        Slice           compressed;
+        uint32_t        stored_offset;
+        uint32_t        stored_length;  // 0 if not stored
+        uint32_t        stored_crc;
     };
 
     std::vector<RecordBucketInfo> buckets_;
@@ -3,15 +3,35 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <vector>
+#include <algorithm>
 
 #include "util/logger.h"
+#include "util/crc.h"
+#include "keycomp.h"
 #include "tree.h"
+#include "bulk_loader.h"
 
 using namespace std;
 using namespace cascadb;
 
+// optimistic reads're retried before falling back to lock coupling
+static const int kOptimisticReadRetries = 3;
+
 Tree::~Tree()
 {
+    if (root_) {
+        merge_staging();
+    }
+    for (size_t i = 0; i < staging_.size(); i++) {
+        delete staging_[i];
+    }
+
+    // stop cascading before nodes're released
+    if (cascader_) {
+        cascader_->stop();
+        delete cascader_;
+    }
+
     if (root_) {
         root_->dec_ref();
     }
@@ -24,7 +44,14 @@ Tree::~Tree()
 
     delete node_factory_;
 
-    delete compressor_;
+    // nodes flushed above may still compress on the pool
+    if (compress_pool_) {
+        compress_pool_->stop();
+        delete compress_pool_;
+    }
+
+    delete inner_compressor_;
+    delete leaf_compressor_;
 }
 
 bool Tree::init()
@@ -34,7 +61,46 @@ bool Tree::init()
         return false;
     }
 
-    compressor_ = new Compressor(options_.compress);
+    comparator_kind_ = options_.comparator->kind();
+
+    if (options_.compress == kInheritCompress) {
+        LOG_ERROR("compress can't be kInheritCompress");
+        return false;
+    }
+    Compress inner = options_.inner_node_compress != kInheritCompress ?
+                     options_.inner_node_compress : options_.compress;
+    Compress leaf = options_.leaf_node_compress != kInheritCompress ?
+                    options_.leaf_node_compress : options_.compress;
+    inner_compressor_ = new Compressor(inner, options_.compress_level,
+                                       options_.compress_bypass_ratio);
+    leaf_compressor_ = new Compressor(leaf, options_.compress_level,
+                                      options_.compress_bypass_ratio);
+
+    Slice dict;
+    if (!layout_->read_dict(dict)) {
+        LOG_ERROR("read compression dictionary error");
+        return false;
+    }
+    if (dict.size()) {
+        bool ok = inner_compressor_->set_dict(dict) &&
+                  leaf_compressor_->set_dict(dict);
+        dict.destroy();
+        if (!ok) {
+            return false;
+        }
+    } else if (options_.compress_dict_size) {
+        inner_compressor_->train_dict(options_.compress_dict_size);
+        leaf_compressor_->train_dict(options_.compress_dict_size);
+        dict_installed_ = false;
+    }
+
+    if (options_.compress_threads > 0) {
+        compress_pool_ = new WorkerPool(options_.compress_threads);
+        if (!compress_pool_->init()) {
+            LOG_ERROR("init compress pool error");
+            return false;
+        }
+    }
     node_factory_ = new TreeNodeFactory(this);
     if (!cache_->add_table(table_name_, node_factory_, layout_))  {
         LOG_ERROR("init table in cache error");
@@ -68,30 +134,247 @@ bool Tree::init()
     }
 
     assert(root_);
+
+    for (size_t i = 0; i < options_.root_staging_buffers; i++) {
+        staging_.push_back(new StagingBuffer(options_.comparator));
+    }
+
+    if (options_.cascade_threads > 0) {
+        cascader_ = new Cascader(options_.cascade_threads);
+        if (!cascader_->init()) {
+            LOG_ERROR("init cascader error");
+            return false;
+        }
+    }
     return true;
 }
 
 bool Tree::put(Slice key, Slice value)
+{
+    Msg m(Put, key.clone(), value.clone());
+    if (staging_.size()) {
+        return write(m);
+    }
+    return root_write(m);
+}
+
+bool Tree::del(Slice key)
+{
+    Msg m(Del, key.clone());
+    if (staging_.size()) {
+        return write(m);
+    }
+    return root_write(m);
+}
+
+bool Tree::get(Slice key, Slice& value)
+{
+    // messages in staging buffers're newer than any in tree
+    if (staging_.size()) {
+        StagingBuffer *sb = staging_buffer(key);
+        ScopedMutex lock(&sb->mtx);
+        MsgBuf::Iterator it = sb->msgbuf.find(key);
+        if (it != sb->msgbuf.end() && it->key == key) {
+            if (it->type == Put) {
+                value = it->value.clone();
+                return true;
+            }
+            // otherwise deleted
+            return false;
+        }
+    }
+
+    if (options_.optimistic_read) {
+        for (int i = 0; i < kOptimisticReadRetries; i++) {
+            assert(root_);
+            InnerNode *root = root_;
+            root->inc_ref();
+            bool found;
+            bool succ = root->find_optimistic(key, value, NULL, 0, found);
+            root->dec_ref();
+            if (succ) {
+                return found;
+            }
+        }
+        // too many conflicts, fall back to lock coupling
+    }
+
+    return root_find(key, value);
+}
+
+namespace {
+
+// order indexes by the keys they refer to
+class KeyIndexComp {
+public:
+    KeyIndexComp(const vector<Slice>& keys, Comparator *comp, ComparatorKind kind)
+    : keys_(keys), comp_(comp), kind_(kind)
+    {
+    }
+
+    bool operator() (size_t left, size_t right)
+    {
+        return compare_keys(comp_, kind_, keys_[left], keys_[right]) < 0;
+    }
+
+private:
+    const vector<Slice>&    keys_;
+    Comparator              *comp_;
+    ComparatorKind          kind_;
+};
+
+}
+
+size_t Tree::multi_get(const vector<Slice>& keys,
+                       vector<Slice>& values,
+                       vector<bool>& found)
+{
+    values.assign(keys.size(), Slice());
+    found.assign(keys.size(), false);
+
+    vector<size_t> idxs;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (staging_.size()) {
+            StagingBuffer *sb = staging_buffer(keys[i]);
+            ScopedMutex lock(&sb->mtx);
+            MsgBuf::Iterator it = sb->msgbuf.find(keys[i]);
+            if (it != sb->msgbuf.end() && it->key == keys[i]) {
+                if (it->type == Put) {
+                    values[i] = it->value.clone();
+                    found[i] = true;
+                }
+                continue;
+            }
+        }
+        idxs.push_back(i);
+    }
+
+    MultiGetContext ctx(keys, values, found);
+
+    if (idxs.size()) {
+        // sorted keys share the path as long as possible
+        sort(idxs.begin(), idxs.end(),
+             KeyIndexComp(keys, options_.comparator, comparator_kind_));
+
+        InnerNode *root;
+        while (true) {
+            // root may be replaced before it's locked
+            root = root_;
+            root->inc_ref();
+            root->read_lock();
+            if (root == root_) {
+                break;
+            }
+            root->unlock();
+            root->dec_ref();
+        }
+        root->multi_find(idxs, ctx);
+        root->dec_ref();
+    }
+
+    // issue reads of buckets missing in all leaves at once, leaves're
+    // unlocked while they're read, and revalidated afterwards
+    vector<BucketRead> reads;
+    for (size_t i = 0; i < ctx.leaves.size(); i++) {
+        ctx.leaves[i].leaf->missing_buckets(ctx.leaves[i].idxs, ctx, reads);
+    }
+
+    if (reads.size()) {
+        for (size_t i = 0; i < ctx.leaves.size(); i++) {
+            LeafNode *leaf = ctx.leaves[i].leaf;
+            ctx.leaves[i].version = leaf->read_version();
+            leaf->unlock();
+        }
+
+        ctx.pending = reads.size();
+        for (size_t i = 0; i < reads.size(); i++) {
+            Callback *cb = new Callback(this, &Tree::bucket_read_complete, &reads[i]);
+            reads[i].leaf->async_read_bucket(&reads[i], cb);
+        }
+
+        ScopedMutex lock(&ctx.mtx);
+        while (ctx.pending) {
+            ctx.cond.wait();
+        }
+        lock.unlock();
+    }
+
+    size_t r = 0;
+    for (size_t i = 0; i < ctx.leaves.size(); i++) {
+        LeafNode *leaf = ctx.leaves[i].leaf;
+        bool valid = true;
+        if (reads.size()) {
+            leaf->read_lock();
+            valid = leaf->read_version() == ctx.leaves[i].version &&
+                    !leaf->is_dead();
+        }
+
+        // reads're in the order of leaves
+        for (; r < reads.size() && reads[r].leaf == leaf; r++) {
+            if (!reads[r].succ) {
+                // retried by blocking reads in lookups
+                continue;
+            }
+            if (valid) {
+                leaf->install_bucket(reads[r].bucket, reads[r].block);
+            } else {
+                layout_->destroy(reads[r].block);
+            }
+        }
+
+        if (valid) {
+            leaf->multi_find_in_buckets(ctx.leaves[i].idxs, ctx);
+        } else {
+            // written, split or merged meanwhile, keys may have
+            // moved to other leaves
+            leaf->unlock();
+            const vector<size_t>& idxs = ctx.leaves[i].idxs;
+            for (size_t j = 0; j < idxs.size(); j++) {
+                found[idxs[j]] = root_find(keys[idxs[j]], values[idxs[j]]);
+            }
+        }
+        leaf->dec_ref();
+    }
+
+    size_t n = 0;
+    for (size_t i = 0; i < found.size(); i++) {
+        if (found[i]) {
+            n ++;
+        }
+    }
+    return n;
+}
+
+void Tree::bucket_read_complete(BucketRead *read, bool succ)
+{
+    read->succ = succ;
+
+    ScopedMutex lock(&read->ctx->mtx);
+    read->ctx->pending --;
+    read->ctx->cond.notify();
+}
+
+bool Tree::root_write(const Msg& m)
 {
     assert(root_);
     InnerNode *root = root_;
     root->inc_ref();
-    bool ret = root->put(key, value);
+    bool ret = root->write(m);
     root->dec_ref();
     return ret;
 }
 
-bool Tree::del(Slice key)
+bool Tree::root_write(MsgBuf *mb)
 {
     assert(root_);
     InnerNode *root = root_;
     root->inc_ref();
-    bool ret = root->del(key);
+    bool ret = root->write(mb);
     root->dec_ref();
     return ret;
 }
 
-bool Tree::get(Slice key, Slice& value)
+bool Tree::root_find(Slice key, Slice& value)
 {
     assert(root_);
     InnerNode *root = root_;
@@ -101,6 +384,41 @@ bool Tree::get(Slice key, Slice& value)
     return ret;
 }
 
+void Tree::merge_staging()
+{
+    for (size_t i = 0; i < staging_.size(); i++) {
+        StagingBuffer *sb = staging_[i];
+        ScopedMutex lock(&sb->mtx);
+        if (sb->msgbuf.count()) {
+            merge_staging(sb);
+        }
+    }
+}
+
+Tree::StagingBuffer* Tree::staging_buffer(Slice key)
+{
+    assert(staging_.size());
+    return staging_[crc32(key.data(), key.size()) % staging_.size()];
+}
+
+bool Tree::write(const Msg& m)
+{
+    // the same key always goes into the same staging buffer,
+    // so the order of writes to a key is kept
+    StagingBuffer *sb = staging_buffer(m.key);
+    ScopedMutex lock(&sb->mtx);
+    sb->msgbuf.write(m);
+    if (sb->msgbuf.size() >= options_.root_staging_buffer_size) {
+        merge_staging(sb);
+    }
+    return true;
+}
+
+void Tree::merge_staging(StagingBuffer *sb)
+{
+    root_write(&sb->msgbuf);
+}
+
 InnerNode* Tree::new_inner_node()
 {
     schema_->write_lock();
@@ -163,12 +481,159 @@ void Tree::collapse()
     schema_->unlock();
 }
 
+BulkLoader* Tree::new_bulk_loader()
+{
+    bool empty = true;
+    for (size_t i = 0; i < staging_.size(); i++) {
+        ScopedMutex lock(&staging_[i]->mtx);
+        if (staging_[i]->msgbuf.count()) {
+            empty = false;
+        }
+    }
+
+    root_->read_lock();
+    if (root_->first_child_ != NID_NIL || root_->msgcnt_) {
+        empty = false;
+    }
+    root_->unlock();
+
+    if (!empty) {
+        LOG_ERROR("bulk load table " << table_name_ << " error, table isn't empty");
+        return NULL;
+    }
+    return new TreeBulkLoader(this);
+}
+
+void Tree::install_dict()
+{
+    ScopedMutex lock(&dict_mtx_);
+    if (dict_installed_) {
+        return;
+    }
+
+    std::string dict;
+    if (!leaf_compressor_->trained_dict(dict) &&
+        !inner_compressor_->trained_dict(dict)) {
+        return;
+    }
+    dict_installed_ = true;
+
+    // blocks compressed with the dictionary're referenced by index
+    // flushed with or after the superblock referring to it
+    if (!layout_->write_dict(Slice(dict))) {
+        LOG_ERROR("write compression dictionary error, table " << table_name_);
+        return;
+    }
+    inner_compressor_->set_dict(Slice(dict));
+    leaf_compressor_->set_dict(Slice(dict));
+    LOG_INFO("install compression dictionary of " << dict.size()
+        << " bytes, table " << table_name_);
+}
+
+CompressStats Tree::inner_compress_stats()
+{
+    return inner_compressor_->stats();
+}
+
+CompressStats Tree::leaf_compress_stats()
+{
+    return leaf_compressor_->stats();
+}
+
+void Tree::debug_print(std::ostream& out)
+{
+    CompressStats stats[2] = {inner_compress_stats(), leaf_compress_stats()};
+    const char *names[2] = {"inner nodes", "leaves"};
+
+    out << "### Dump Tree " << table_name_ << " ###" << endl;
+    for (size_t i = 0; i < 2; i++) {
+        out << "Compress " << names[i] << " "
+            << stats[i].blocks << " blocks, "
+            << stats[i].input_bytes << " -> "
+            << stats[i].output_bytes << " bytes ("
+            << stats[i].ratio() << "%), "
+            << stats[i].bypassed << " bypassed, "
+            << stats[i].skipped << " skipped, "
+            << stats[i].parallel << " parallel, "
+            << stats[i].dict << " with dictionary"
+            << endl;
+    }
+}
+
+bool Tree::publish_root(bid_t nid, size_t depth)
+{
+    InnerNode *root = (InnerNode*)load_node(nid, false);
+    assert(root);
+
+    // writes may have come in since the loader was created, staging
+    // buffers're locked before root as in merge_staging()
+    for (size_t i = 0; i < staging_.size(); i++) {
+        staging_[i]->mtx.lock();
+    }
+
+    InnerNode *old = root_;
+    old->inc_ref();
+    old->write_lock();
+    while (old != root_) {
+        old->unlock();
+        old->dec_ref();
+        old = root_;
+        old->inc_ref();
+        old->write_lock();
+    }
+
+    bool empty = (old->first_child_ == NID_NIL && old->msgcnt_ == 0);
+    for (size_t i = 0; i < staging_.size(); i++) {
+        if (staging_[i]->msgbuf.count()) {
+            empty = false;
+        }
+    }
+
+    if (empty) {
+        root_ = root;
+        // the empty root is deleted in next flush
+        old->set_dead();
+    }
+    old->unlock();
+
+    for (size_t i = 0; i < staging_.size(); i++) {
+        staging_[i]->mtx.unlock();
+    }
+
+    if (!empty) {
+        LOG_ERROR("bulk load table " << table_name_
+            << " error, table has been written meanwhile");
+        old->dec_ref();
+        root->dec_ref();
+        return false;
+    }
+
+    // once by the tree and once above
+    old->dec_ref();
+    old->dec_ref();
+
+    schema_->write_lock();
+    schema_->root_node_id = nid;
+    schema_->tree_depth = depth;
+    schema_->set_dirty(true);
+    schema_->unlock();
+    return true;
+}
+
 void Tree::lock_path(Slice key, std::vector<DataNode*>& path)
 {
     assert(root_);
     InnerNode *root = root_;
     root->inc_ref();
     root->write_lock();
+    while (root != root_) {
+        // root has been split or collapsed since it's picked up
+        root->unlock();
+        root->dec_ref();
+        root = root_;
+        root->inc_ref();
+        root->write_lock();
+    }
     path.push_back(root);
     root->lock_path(key, path);
 }
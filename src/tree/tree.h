@@ -8,14 +8,18 @@
 #include <assert.h>
 #include <string>
 #include <map>
+#include <vector>
 
 #include "cascadb/slice.h"
 #include "cascadb/comparator.h"
 #include "cascadb/options.h"
+#include "cascadb/db.h"
 #include "sys/sys.h"
 #include "cache/cache.h"
 #include "util/compressor.h"
+#include "util/worker_pool.h"
 #include "node.h"
+#include "cascader.h"
 
 namespace cascadb {
 
@@ -46,9 +50,14 @@ public:
       cache_(cache),
       layout_(layout),
       node_factory_(NULL),
-      compressor_(NULL),
+      inner_compressor_(NULL),
+      leaf_compressor_(NULL),
+      compress_pool_(NULL),
+      dict_installed_(true),
       schema_(NULL),
-      root_(NULL)
+      root_(NULL),
+      cascader_(NULL),
+      comparator_kind_(kCustomComparator)
     {
     }
     
@@ -62,9 +71,30 @@ public:
 
     bool get(Slice key, Slice& value);
 
+    // Find a batch of keys in a single descent, buckets missing in
+    // all leaves reached're read in parallel, see DB::multi_get()
+    size_t multi_get(const std::vector<Slice>& keys,
+                     std::vector<Slice>& values,
+                     std::vector<bool>& found);
+
+    // Merge all staging buffers into root
+    void merge_staging();
+
+    // Create a loader building the tree from sorted records,
+    // return NULL unless the tree is empty
+    BulkLoader* new_bulk_loader();
+
+    // Compression statistics of inner nodes and leaves
+    CompressStats inner_compress_stats();
+    CompressStats leaf_compress_stats();
+
+    void debug_print(std::ostream& out);
+
 private:
+    friend class DataNode;
     friend class InnerNode;
     friend class LeafNode;
+    friend class TreeBulkLoader;
 
     InnerNode* new_inner_node();
     
@@ -73,13 +103,42 @@ private:
     DataNode* load_node(bid_t nid, bool skeleton_only);
     
     InnerNode* root() { return root_; }
+
+    // Write or find from current root, root may be replaced after it's
+    // picked up and before it's locked, if so nodes call these to retry
+    bool root_write(const Msg& m);
+
+    bool root_write(MsgBuf *mb);
+
+    bool root_find(Slice key, Slice& value);
+
+    // called when a bucket read issued by multi_get() completes
+    void bucket_read_complete(BucketRead *read, bool succ);
     
     void pileup(InnerNode *root);
     
     void collapse();
 
+    // replace the empty root with a tree built by bulk loader,
+    // fail if the table has been written since the loader was created
+    bool publish_root(bid_t nid, size_t depth);
+
     void lock_path(Slice key, std::vector<DataNode*>& path);
 
+    class StagingBuffer {
+    public:
+        StagingBuffer(Comparator *comp) : msgbuf(comp) {}
+        Mutex       mtx;
+        MsgBuf      msgbuf;
+    };
+
+    StagingBuffer* staging_buffer(Slice key);
+
+    bool write(const Msg& m);
+
+    // merge messages into root, mutex of the staging buffer is held
+    void merge_staging(StagingBuffer *sb);
+
     class TreeNodeFactory : public NodeFactory {
     public:
         TreeNodeFactory(Tree *tree);
@@ -98,11 +157,36 @@ private:
 
     TreeNodeFactory *node_factory_;
 
-    Compressor      *compressor_;
+    // compress buffers of inner nodes and buckets of leaves
+    Compressor      *inner_compressor_;
+
+    Compressor      *leaf_compressor_;
+
+    // NULL if compress_threads is 0
+    WorkerPool      *compress_pool_;
+
+    // Write the dictionary trained by compressors out and start
+    // using it, called before nodes're serialized
+    void install_dict();
+
+    Mutex           dict_mtx_;
+
+    // false while compressors're training a dictionary
+    bool            dict_installed_;
 
     SchemaNode      *schema_;
 
     InnerNode       *root_;
+
+    // NULL if cascade_threads is 0
+    Cascader        *cascader_;
+
+    // empty if root_staging_buffers is 0
+    std::vector<StagingBuffer*> staging_;
+
+    // cached Comparator::kind(), keys can be compared inline
+    // and pivots can be searched by key prefixes unless it's custom
+    ComparatorKind  comparator_kind_;
 };
 
 }
@@ -0,0 +1,136 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "logger.h"
+#include "bits.h"
+#include "buffer_pool.h"
+
+using namespace std;
+using namespace cascadb;
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+BufferPool::BufferPool(size_t limit, bool huge_pages)
+: limit_(limit),
+  huge_pages_(huge_pages),
+  cached_(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    for (map<size_t, vector<char*> >::iterator it = free_.begin();
+        it != free_.end(); it++) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+            ::free(it->second[i]);
+        }
+    }
+    free_.clear();
+
+    // buffers still in use're left to their users
+    if (used_.size()) {
+        LOG_WARN(used_.size() << " io buffers're still in use");
+    }
+}
+
+size_t BufferPool::class_size(size_t size)
+{
+    size = PAGE_ROUND_UP(size);
+    if (size <= PAGE_SIZE * 4) {
+        return size;
+    }
+
+    size_t step = 1;
+    while ((step << 1) <= size) {
+        step <<= 1;
+    }
+    step >>= 2;
+    return (size + step - 1) / step * step;
+}
+
+char* BufferPool::allocate(size_t size)
+{
+    size_t align = PAGE_SIZE;
+    if (huge_pages_ && size >= HUGE_PAGE_SIZE) {
+        align = HUGE_PAGE_SIZE;
+    }
+
+    void *buf;
+    if (posix_memalign(&buf, align, size)) {
+        return NULL;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (align == HUGE_PAGE_SIZE) {
+        madvise(buf, size, MADV_HUGEPAGE);
+    }
+#endif
+    return (char *)buf;
+}
+
+Slice BufferPool::alloc(size_t size)
+{
+    assert(size);
+    size_t cls = class_size(size);
+
+    ScopedMutex lock(&mtx_);
+    char *buf = NULL;
+    map<size_t, vector<char*> >::iterator it = free_.find(cls);
+    if (it != free_.end() && it->second.size()) {
+        buf = it->second.back();
+        it->second.pop_back();
+        cached_ -= cls;
+    }
+    lock.unlock();
+
+    if (buf == NULL) {
+        buf = allocate(cls);
+        if (buf == NULL) {
+            LOG_ERROR("allocate io buffer error, size " << cls);
+            return Slice();
+        }
+    }
+    assert(((size_t)buf & (PAGE_SIZE-1)) == 0);
+
+    lock.lock();
+    used_[buf] = cls;
+    return Slice(buf, PAGE_ROUND_UP(size));
+}
+
+void BufferPool::free(Slice buffer)
+{
+    if (buffer.size() == 0) {
+        return;
+    }
+    char *buf = (char *)buffer.data();
+
+    ScopedMutex lock(&mtx_);
+    map<const char*, size_t>::iterator it = used_.find(buf);
+    if (it == used_.end()) {
+        // allocated by another pool
+        lock.unlock();
+        ::free(buf);
+        return;
+    }
+    size_t cls = it->second;
+    used_.erase(it);
+
+    if (cached_ + cls <= limit_) {
+        free_[cls].push_back(buf);
+        cached_ += cls;
+        return;
+    }
+    lock.unlock();
+
+    ::free(buf);
+}
+
+size_t BufferPool::cached()
+{
+    ScopedMutex lock(&mtx_);
+    return cached_;
+}
@@ -0,0 +1,62 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef CASCADB_UTIL_BUFFER_POOL_H_
+#define CASCADB_UTIL_BUFFER_POOL_H_
+
+#include <map>
+#include <vector>
+
+#include "cascadb/slice.h"
+#include "sys/sys.h"
+
+namespace cascadb {
+
+// Recycle page aligned buffers for block I/O.
+// Buffers're allocated in size classes, a class above 4 pages is a
+// multiple of a quarter of the largest power of two below it, so at
+// most 25% of a buffer is wasted. Freed buffers're kept for reuse
+// until they take up limit bytes, and they aren't zeroed.
+class BufferPool {
+public:
+    // Buffers no smaller than a huge page're advised to be backed
+    // by transparent huge pages if huge_pages is set
+    BufferPool(size_t limit, bool huge_pages);
+
+    ~BufferPool();
+
+    // Get a buffer of size bytes rounded up to pages,
+    // return an empty Slice if out of memory
+    Slice alloc(size_t size);
+
+    // Return a buffer, it may have been shrunk,
+    // buffers allocated by other pools're freed at once
+    void free(Slice buffer);
+
+    // Bytes of free buffers kept in pool
+    size_t cached();
+
+private:
+    static size_t class_size(size_t size);
+
+    char* allocate(size_t size);
+
+    Mutex                                       mtx_;
+
+    size_t                                      limit_;
+
+    bool                                        huge_pages_;
+
+    size_t                                      cached_;
+
+    // free buffers indexed by size class
+    std::map<size_t, std::vector<char*> >       free_;
+
+    // size classes of buffers handed out
+    std::map<const char*, size_t>               used_;
+};
+
+}
+
+#endif
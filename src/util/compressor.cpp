@@ -6,6 +6,222 @@ using namespace cascadb;
 
 #include "quicklz.h"
 #include "snappy.h"
+#include "lz4.h"
+#include "zstd.h"
+#include "zdict.h"
+
+// LZ4 blocks don't record their length, it's kept after the method tag
+#define LZ4_HEADER_SIZE 4
+
+// after so many incompressible blocks in a row, blocks're stored raw,
+// except one out of COMPRESS_SAMPLE_INTERVAL blocks is tried
+#define COMPRESS_SKIP_THRESHOLD 8
+#define COMPRESS_SAMPLE_INTERVAL 16
+
+// samples collected to train a dictionary, in times of dictionary size
+#define DICT_SAMPLE_RATIO 100
+
+static void encode_uint32(char *buf, uint32_t v)
+{
+    buf[0] = v & 0xff;
+    buf[1] = (v >> 8) & 0xff;
+    buf[2] = (v >> 16) & 0xff;
+    buf[3] = (v >> 24) & 0xff;
+}
+
+static uint32_t decode_uint32(const char *buf)
+{
+    return ((uint32_t)(unsigned char)buf[0])
+        | ((uint32_t)(unsigned char)buf[1] << 8)
+        | ((uint32_t)(unsigned char)buf[2] << 16)
+        | ((uint32_t)(unsigned char)buf[3] << 24);
+}
+
+Compressor::~Compressor()
+{
+    delete trainer_;
+
+    for (size_t i = 0; i < qscs_.size(); i++) {
+        free(qscs_[i]);
+    }
+    for (size_t i = 0; i < qsds_.size(); i++) {
+        free(qsds_[i]);
+    }
+    for (size_t i = 0; i < cctxs_.size(); i++) {
+        ZSTD_freeCCtx(cctxs_[i]);
+    }
+    for (size_t i = 0; i < dctxs_.size(); i++) {
+        ZSTD_freeDCtx(dctxs_[i]);
+    }
+    ZSTD_freeCDict(cdict_);
+    ZSTD_freeDDict(ddict_);
+}
+
+qlz_state_compress* Compressor::get_qsc()
+{
+    ScopedMutex lock(&mtx_);
+    if (qscs_.empty()) {
+        return (qlz_state_compress*)calloc(1, sizeof(qlz_state_compress));
+    }
+    qlz_state_compress *qsc = qscs_.back();
+    qscs_.pop_back();
+    return qsc;
+}
+
+void Compressor::put_qsc(qlz_state_compress *qsc)
+{
+    ScopedMutex lock(&mtx_);
+    qscs_.push_back(qsc);
+}
+
+qlz_state_decompress* Compressor::get_qsd()
+{
+    ScopedMutex lock(&mtx_);
+    if (qsds_.empty()) {
+        return (qlz_state_decompress*)calloc(1, sizeof(qlz_state_decompress));
+    }
+    qlz_state_decompress *qsd = qsds_.back();
+    qsds_.pop_back();
+    return qsd;
+}
+
+void Compressor::put_qsd(qlz_state_decompress *qsd)
+{
+    ScopedMutex lock(&mtx_);
+    qsds_.push_back(qsd);
+}
+
+ZSTD_CCtx* Compressor::get_cctx(ZSTD_CDict **cdict)
+{
+    ScopedMutex lock(&mtx_);
+    *cdict = cdict_;
+    if (cctxs_.empty()) {
+        return ZSTD_createCCtx();
+    }
+    ZSTD_CCtx *cctx = cctxs_.back();
+    cctxs_.pop_back();
+    return cctx;
+}
+
+void Compressor::put_cctx(ZSTD_CCtx *cctx)
+{
+    ScopedMutex lock(&mtx_);
+    cctxs_.push_back(cctx);
+}
+
+ZSTD_DCtx* Compressor::get_dctx(ZSTD_DDict **ddict)
+{
+    ScopedMutex lock(&mtx_);
+    *ddict = ddict_;
+    if (dctxs_.empty()) {
+        return ZSTD_createDCtx();
+    }
+    ZSTD_DCtx *dctx = dctxs_.back();
+    dctxs_.pop_back();
+    return dctx;
+}
+
+void Compressor::put_dctx(ZSTD_DCtx *dctx)
+{
+    ScopedMutex lock(&mtx_);
+    dctxs_.push_back(dctx);
+}
+
+void Compressor::train_dict(size_t dict_size)
+{
+    ScopedMutex lock(&mtx_);
+    if (cdict_ == NULL) {
+        dict_size_ = dict_size;
+    }
+}
+
+void Compressor::add_sample(const char *buf, size_t size)
+{
+    ScopedMutex lock(&mtx_);
+    if (dict_size_ == 0) {
+        return;
+    }
+    samples_.append(buf, size);
+    sample_sizes_.push_back(size);
+    if (samples_.size() < dict_size_ * DICT_SAMPLE_RATIO) {
+        return;
+    }
+
+    // train only once and in background, as it takes far longer than
+    // compressing a block, blocks're compressed without dictionary
+    // until it's set
+    train_size_ = dict_size_;
+    train_samples_.swap(samples_);
+    train_sizes_.swap(sample_sizes_);
+    dict_size_ = 0;
+    trainer_ = new Thread(train_main);
+    trainer_->start(this);
+}
+
+void* Compressor::train_main(void *arg)
+{
+    ((Compressor*) arg)->train();
+    return NULL;
+}
+
+void Compressor::train()
+{
+    std::string dict(train_size_, 0);
+    size_t n = ZDICT_trainFromBuffer(&dict[0], train_size_,
+                                     train_samples_.data(), &train_sizes_[0],
+                                     train_sizes_.size());
+    if (ZDICT_isError(n)) {
+        LOG_ERROR("train dictionary error " << ZDICT_getErrorName(n)
+            << ", " << train_sizes_.size() << " samples");
+        return;
+    }
+    dict.resize(n);
+    LOG_INFO("train dictionary of " << n << " bytes from "
+        << train_sizes_.size() << " samples");
+
+    ScopedMutex lock(&mtx_);
+    if (cdict_ == NULL) {
+        trained_.swap(dict);
+    }
+}
+
+bool Compressor::trained_dict(std::string& dict)
+{
+    ScopedMutex lock(&mtx_);
+    if (trained_.empty()) {
+        return false;
+    }
+    dict.swap(trained_);
+    trained_.clear();
+    return true;
+}
+
+bool Compressor::set_dict(Slice dict)
+{
+    ZSTD_CDict *cdict = ZSTD_createCDict(dict.data(), dict.size(), level_);
+    ZSTD_DDict *ddict = ZSTD_createDDict(dict.data(), dict.size());
+    if (cdict == NULL || ddict == NULL) {
+        LOG_ERROR("load dictionary error, size " << dict.size());
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        return false;
+    }
+
+    // contexts in use may still refer to the old one, it's set only once
+    ScopedMutex lock(&mtx_);
+    if (cdict_) {
+        ZSTD_freeCDict(cdict);
+        ZSTD_freeDDict(ddict);
+        return false;
+    }
+    cdict_ = cdict;
+    ddict_ = ddict;
+    dict_size_ = 0;
+    samples_.clear();
+    sample_sizes_.clear();
+    trained_.clear();
+    return true;
+}
 
 size_t Compressor::max_compressed_length(size_t size)
 {
@@ -21,6 +237,12 @@ size_t Compressor::max_compressed_length(size_t size)
         case kQuicklzCompress:
            s = size + 400 + 1;
            break;
+        case kZstdCompress:
+           s = ZSTD_compressBound(size) + 1;
+           break;
+        case kLZ4Compress:
+           s = LZ4_compressBound(size) + LZ4_HEADER_SIZE + 1;
+           break;
         default: 
            break;
     }
@@ -29,14 +251,100 @@ size_t Compressor::max_compressed_length(size_t size)
 }
 
 bool Compressor::compress(const char *ibuf, size_t size, char *obuf, size_t *sp)
+{
+    if (size == 0)
+        return false;
+
+    if (method_ == kNoCompress || bypass_ratio_ == 0) {
+        if (method_ == kZstdCompress) {
+            add_sample(ibuf, size);
+        }
+        if (!compress_with(method_, ibuf, size, obuf, sp)) {
+            return false;
+        }
+        record_block(size, *sp, true, false);
+        return true;
+    }
+
+    if (method_ == kZstdCompress) {
+        add_sample(ibuf, size);
+    }
+
+    if (skip_block()) {
+        compress_with(kNoCompress, ibuf, size, obuf, sp);
+        record_block(size, *sp, false, false);
+        return true;
+    }
+
+    if (!compress_with(method_, ibuf, size, obuf, sp)) {
+        return false;
+    }
+
+    // obuf's large enough to hold the raw block for all methods
+    if ((*sp - 1) * 100 >= size * bypass_ratio_) {
+        compress_with(kNoCompress, ibuf, size, obuf, sp);
+        record_block(size, *sp, true, true);
+        return true;
+    }
+
+    record_block(size, *sp, true, false);
+    return true;
+}
+
+bool Compressor::skip_block()
+{
+    ScopedMutex lock(&mtx_);
+    if (incompressible_ < COMPRESS_SKIP_THRESHOLD) {
+        return false;
+    }
+    sampled_ ++;
+    if (sampled_ >= COMPRESS_SAMPLE_INTERVAL) {
+        sampled_ = 0;
+        return false;
+    }
+    return true;
+}
+
+void Compressor::record_block(size_t size, size_t olen,
+                              bool tried, bool bypassed)
+{
+    ScopedMutex lock(&mtx_);
+    stats_.blocks ++;
+    stats_.input_bytes += size;
+    stats_.output_bytes += olen;
+    if (!tried) {
+        stats_.skipped ++;
+    } else if (bypassed) {
+        stats_.bypassed ++;
+        incompressible_ ++;
+    } else {
+        incompressible_ = 0;
+        sampled_ = 0;
+        if (method_ == kZstdCompress && cdict_) {
+            stats_.dict ++;
+        }
+    }
+}
+
+CompressStats Compressor::stats()
+{
+    ScopedMutex lock(&mtx_);
+    return stats_;
+}
+
+void Compressor::record_parallel()
+{
+    ScopedMutex lock(&mtx_);
+    stats_.parallel ++;
+}
+
+bool Compressor::compress_with(enum Compress method, const char *ibuf,
+                               size_t size, char *obuf, size_t *sp)
 {
     size_t olen;
     bool b= false;
 
-    if (size == 0)
-        return b;
-
-    switch (method_) {
+    switch (method) {
         case kNoCompress:
             obuf[0] = kNoCompress;
             memcpy(obuf + 1, ibuf, size);
@@ -52,13 +360,54 @@ bool Compressor::compress(const char *ibuf, size_t size, char *obuf, size_t *sp)
             b = true;
             break;
 
-        case kQuicklzCompress:
+        case kQuicklzCompress: {
             obuf[0] = kQuicklzCompress;
-            olen = qlz_compress(ibuf, obuf + 1, size, qsc_);
+            qlz_state_compress *qsc = get_qsc();
+            olen = qlz_compress(ibuf, obuf + 1, size, qsc);
+            put_qsc(qsc);
+            *sp = olen + 1;
+
+            b = true;
+            break;
+        }
+
+        case kZstdCompress: {
+            obuf[0] = kZstdCompress;
+            // contexts're pooled, nodes're compressed by several threads
+            ZSTD_CDict *cdict;
+            ZSTD_CCtx *cctx = get_cctx(&cdict);
+            if (cdict) {
+                olen = ZSTD_compress_usingCDict(cctx, obuf + 1,
+                    ZSTD_compressBound(size), ibuf, size, cdict);
+            } else {
+                olen = ZSTD_compressCCtx(cctx, obuf + 1,
+                    ZSTD_compressBound(size), ibuf, size, level_);
+            }
+            put_cctx(cctx);
+            if (ZSTD_isError(olen)) {
+                LOG_ERROR("zstd compress error " << ZSTD_getErrorName(olen));
+                break;
+            }
             *sp = olen + 1;
 
             b = true;
             break;
+        }
+
+        case kLZ4Compress: {
+            obuf[0] = kLZ4Compress;
+            encode_uint32(obuf + 1, size);
+            int n = LZ4_compress_default(ibuf, obuf + 1 + LZ4_HEADER_SIZE,
+                                         size, LZ4_compressBound(size));
+            if (n <= 0) {
+                LOG_ERROR("lz4 compress error");
+                break;
+            }
+            *sp = n + LZ4_HEADER_SIZE + 1;
+
+            b = true;
+            break;
+        }
 
         default: 
             LOG_ERROR("no compress method support");
@@ -68,20 +417,34 @@ bool Compressor::compress(const char *ibuf, size_t size, char *obuf, size_t *sp)
     return b;
 }
 
-bool Compressor::uncompress(const char *ibuf, size_t size, char *obuf)
+bool Compressor::uncompress(const char *ibuf, size_t size,
+                            char *obuf, size_t osize)
 {
     bool b = false;
 
     if (size == 0)
         return b;
 
+    // lengths recorded in headers're checked against osize,
+    // a corrupt block must not overrun obuf
     switch (ibuf[0] & 0xF) {
         case kNoCompress:
+            if (size - 1 > osize) {
+                LOG_ERROR("uncompress error, block length " << size - 1
+                    << " exceeds buffer length " << osize);
+                break;
+            }
             memcpy(obuf, ibuf + 1, size - 1);
 
             b = true;
             break;
-        case kSnappyCompress:
+        case kSnappyCompress: {
+            size_t n;
+            if (!snappy::GetUncompressedLength(ibuf + 1, size - 1, &n) ||
+                n > osize) {
+                LOG_ERROR("snappy uncompress error, bad length");
+                break;
+            }
             if (!snappy::RawUncompress(ibuf + 1, size - 1, obuf)) {
                 LOG_ERROR("snappy uncompress error");
                 break;
@@ -89,13 +452,78 @@ bool Compressor::uncompress(const char *ibuf, size_t size, char *obuf)
 
             b = true;
             break;
-        case kQuicklzCompress:
-            if (size > 0) {
-                qlz_decompress(ibuf + 1, obuf, qsd_);
+        }
+        case kQuicklzCompress: {
+            // header is 9 bytes long if the long flag is set, otherwise 3
+            if (size < 4 || size - 1 < ((ibuf[1] & 2) ? 9U : 3U) ||
+                qlz_size_compressed(ibuf + 1) > size - 1 ||
+                qlz_size_decompressed(ibuf + 1) > osize) {
+                LOG_ERROR("quicklz uncompress error, bad length");
+                break;
+            }
+            qlz_state_decompress *qsd = get_qsd();
+            qlz_decompress(ibuf + 1, obuf, qsd);
+            put_qsd(qsd);
+
+            b = true;
+            break;
+        }
+        case kZstdCompress: {
+            // frames record their content size
+            unsigned long long n = ZSTD_getFrameContentSize(ibuf + 1, size - 1);
+            if (n == ZSTD_CONTENTSIZE_ERROR || n == ZSTD_CONTENTSIZE_UNKNOWN) {
+                LOG_ERROR("zstd uncompress error, bad frame header");
+                break;
+            }
+            if (n > osize) {
+                LOG_ERROR("zstd uncompress error, content size " << n
+                    << " exceeds buffer length " << osize);
+                break;
+            }
+            size_t r;
+            if (ZSTD_getDictID_fromFrame(ibuf + 1, size - 1)) {
+                ZSTD_DDict *ddict;
+                ZSTD_DCtx *dctx = get_dctx(&ddict);
+                if (ddict == NULL) {
+                    put_dctx(dctx);
+                    LOG_ERROR("zstd uncompress error, no dictionary");
+                    break;
+                }
+                r = ZSTD_decompress_usingDDict(dctx, obuf, n, ibuf + 1,
+                                               size - 1, ddict);
+                put_dctx(dctx);
+            } else {
+                r = ZSTD_decompress(obuf, n, ibuf + 1, size - 1);
+            }
+            if (ZSTD_isError(r) || r != n) {
+                LOG_ERROR("zstd uncompress error");
+                break;
             }
 
             b = true;
             break;
+        }
+
+        case kLZ4Compress: {
+            if (size < LZ4_HEADER_SIZE + 1) {
+                LOG_ERROR("lz4 uncompress error, block too short");
+                break;
+            }
+            uint32_t n = decode_uint32(ibuf + 1);
+            if (n > osize || n > LZ4_MAX_INPUT_SIZE) {
+                LOG_ERROR("lz4 uncompress error, block length " << n
+                    << " exceeds buffer length " << osize);
+                break;
+            }
+            if (LZ4_decompress_safe(ibuf + 1 + LZ4_HEADER_SIZE, obuf,
+                                    size - LZ4_HEADER_SIZE - 1, n) != (int)n) {
+                LOG_ERROR("lz4 uncompress error");
+                break;
+            }
+
+            b = true;
+            break;
+        }
 
         default: 
             LOG_ERROR("no compress method support");
@@ -104,3 +532,111 @@ bool Compressor::uncompress(const char *ibuf, size_t size, char *obuf)
 
     return b;
 }
+
+ParallelCompressor::ParallelCompressor(Compressor *compressor,
+                                       WorkerPool *pool)
+: compressor_(compressor),
+  pool_(pool),
+  cond_(&mtx_),
+  pending_(0)
+{
+}
+
+ParallelCompressor::~ParallelCompressor()
+{
+    assert(pending_ == 0);
+}
+
+void ParallelCompressor::add_compress(const char *ibuf, size_t size,
+                                      char *obuf)
+{
+    Task task;
+    task.compress = true;
+    task.ibuf = ibuf;
+    task.size = size;
+    task.obuf = obuf;
+    task.olen = 0;
+    task.succ = false;
+    tasks_.push_back(task);
+}
+
+void ParallelCompressor::add_uncompress(const char *ibuf, size_t size,
+                                        char *obuf, size_t osize)
+{
+    Task task;
+    task.compress = false;
+    task.ibuf = ibuf;
+    task.size = size;
+    task.obuf = obuf;
+    task.olen = osize;
+    task.succ = false;
+    tasks_.push_back(task);
+}
+
+bool ParallelCompressor::run()
+{
+    if (tasks_.empty()) {
+        return true;
+    }
+
+    if (pool_ == NULL) {
+        for (size_t i = 0; i < tasks_.size(); i++) {
+            exec(&tasks_[i]);
+        }
+        return succeeded();
+    }
+
+    mtx_.lock();
+    pending_ = tasks_.size() - 1;
+    mtx_.unlock();
+
+    for (size_t i = 1; i < tasks_.size(); i++) {
+        pool_->submit(i, new Callback(this, &ParallelCompressor::exec_task,
+                                      &tasks_[i]));
+    }
+    exec(&tasks_[0]);
+
+    ScopedMutex lock(&mtx_);
+    while (pending_) {
+        cond_.wait();
+    }
+    lock.unlock();
+
+    return succeeded();
+}
+
+bool ParallelCompressor::succeeded()
+{
+    for (size_t i = 0; i < tasks_.size(); i++) {
+        if (!tasks_[i].succ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ParallelCompressor::exec(Task *task)
+{
+    if (task->compress) {
+        task->succ = compressor_->compress(task->ibuf, task->size,
+                                           task->obuf, &task->olen);
+    } else {
+        task->succ = compressor_->uncompress(task->ibuf, task->size,
+                                             task->obuf, task->olen);
+    }
+}
+
+void ParallelCompressor::exec_task(Task *task, bool)
+{
+    exec(task);
+    if (task->compress) {
+        compressor_->record_parallel();
+    }
+
+    ScopedMutex lock(&mtx_);
+    assert(pending_ > 0);
+    pending_--;
+    if (pending_ == 0) {
+        cond_.notify();
+    }
+}
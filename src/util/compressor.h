@@ -2,37 +2,210 @@
 #define CASCADB_UTIL_COMPRESSOR_H_
 
 #include "cascadb/options.h"
+#include "cascadb/slice.h"
 #include <snappy.h>
 #include <quicklz.h>
+#include <lz4.h>
+#include <zstd.h>
+#include <string>
+#include <vector>
+
+#include "sys/sys.h"
+#include "worker_pool.h"
 
 namespace cascadb {
 
-class Compressor {
-public:
-    Compressor(enum Compress method): method_(method)
+// Statistics of blocks passed through Compressor::compress()
+struct CompressStats {
+    CompressStats()
+    : blocks(0), input_bytes(0), output_bytes(0),
+      bypassed(0), skipped(0), parallel(0), dict(0)
     {
-        qsc_ = (qlz_state_compress*)calloc(1, sizeof(*qsc_));
-        qsd_ = (qlz_state_decompress*)calloc(1, sizeof(*qsd_));
     }
 
-    ~Compressor()
+    // output size in percentage of input size
+    double ratio() const
     {
-        free(qsc_);
-        free(qsd_);
+        return input_bytes ? output_bytes * 100.0 / input_bytes : 0;
     }
 
+    uint64_t    blocks;
+    uint64_t    input_bytes;
+    uint64_t    output_bytes;
+    // compressed but stored raw for poor ratio
+    uint64_t    bypassed;
+    // stored raw without trying, see compress()
+    uint64_t    skipped;
+    // compressed by threads of a pool, see ParallelCompressor
+    uint64_t    parallel;
+    // compressed with the dictionary, see set_dict()
+    uint64_t    dict;
+};
+
+class Compressor {
+public:
+    // level is used by kZstdCompress only.
+    // Blocks not shrinking below bypass_ratio percent of their size
+    // are stored raw, 0 to always keep the compressed output
+    Compressor(enum Compress method, int level = 0,
+               unsigned int bypass_ratio = 0)
+    : method_(method), level_(level), bypass_ratio_(bypass_ratio),
+      incompressible_(0), sampled_(0),
+      dict_size_(0), trainer_(NULL), cdict_(NULL), ddict_(NULL)
+    {
+    }
+
+    ~Compressor();
+
     size_t max_compressed_length(size_t size);
 
+    // Blocks're tagged with the method they're compressed by,
+    // they're tagged with kNoCompress if bypassed. After a run of
+    // incompressible blocks, only one block out of a sampling interval
+    // is tried until a block compresses well again
     bool compress(const char *ibuf, size_t size, char *obuf, size_t *sp);
 
-    // obuf should be larger than uncompressed length
-    bool uncompress(const char *ibuf, size_t size, char *obuf);
+    // obuf is osize bytes long, blocks uncompressed to more than
+    // osize bytes're rejected
+    bool uncompress(const char *ibuf, size_t size, char *obuf, size_t osize);
+
+    CompressStats stats();
+
+    // Count a block compressed by a thread of a pool, see ParallelCompressor
+    void record_parallel();
+
+    // Collect blocks compressed by kZstdCompress as samples, and train
+    // a dictionary of dict_size bytes in background once there're enough
+    // of them. The dictionary isn't used until it's passed to set_dict()
+    void train_dict(size_t dict_size);
+
+    // Take the dictionary trained, return false if it isn't ready
+    bool trained_dict(std::string& dict);
+
+    // Compress kZstdCompress blocks with dict, blocks referring to it
+    // can be uncompressed afterwards, training is stopped
+    bool set_dict(Slice dict);
 
 private:
+    bool compress_with(enum Compress method, const char *ibuf, size_t size,
+                       char *obuf, size_t *sp);
+
+    // true if the block should be stored raw without trying
+    bool skip_block();
+
+    // update stats and the run of incompressible blocks
+    void record_block(size_t size, size_t olen, bool tried, bool bypassed);
+
+    // quicklz keeps scratch state, each call takes its own from
+    // the free lists so a compressor can be shared among threads
+    qlz_state_compress* get_qsc();
+    void put_qsc(qlz_state_compress *qsc);
+    qlz_state_decompress* get_qsd();
+    void put_qsd(qlz_state_decompress *qsd);
+
+    // zstd contexts're reused for dictionary compression the same way
+    ZSTD_CCtx* get_cctx(ZSTD_CDict **cdict);
+    void put_cctx(ZSTD_CCtx *cctx);
+    ZSTD_DCtx* get_dctx(ZSTD_DDict **ddict);
+    void put_dctx(ZSTD_DCtx *dctx);
+
+    // keep a sample for training, the trainer is started if enough
+    void add_sample(const char *buf, size_t size);
+
+    static void* train_main(void *arg);
+
+    // train the dictionary from samples handed over to the trainer
+    void train();
+
     enum Compress method_;
-    qlz_state_compress *qsc_;
-    qlz_state_decompress *qsd_;
+    int level_;
+    unsigned int bypass_ratio_;
+
+    Mutex mtx_;
+    // number of incompressible blocks in a row
+    size_t incompressible_;
+    // number of blocks since the last sample
+    size_t sampled_;
+    CompressStats stats_;
+    std::vector<qlz_state_compress*> qscs_;
+    std::vector<qlz_state_decompress*> qsds_;
+
+    // 0 unless training
+    size_t dict_size_;
+    std::string samples_;
+    std::vector<size_t> sample_sizes_;
+    std::string trained_;
+
+    // training runs once, it's joined when compressor is destroyed
+    Thread *trainer_;
+    size_t train_size_;
+    std::string train_samples_;
+    std::vector<size_t> train_sizes_;
+
+    ZSTD_CDict *cdict_;
+    ZSTD_DDict *ddict_;
+    std::vector<ZSTD_CCtx*> cctxs_;
+    std::vector<ZSTD_DCtx*> dctxs_;
 };
+
+// Compress or uncompress a batch of independent buffers in parallel.
+// Tasks're spread among threads of the pool, the caller runs the first
+// one by itself and waits for the rest. All tasks're run by the caller
+// if pool is NULL.
+class ParallelCompressor {
+public:
+    ParallelCompressor(Compressor *compressor, WorkerPool *pool);
+
+    ~ParallelCompressor();
+
+    // obuf should be at least max_compressed_length(size) long
+    void add_compress(const char *ibuf, size_t size, char *obuf);
+
+    // obuf is osize bytes long, see Compressor::uncompress()
+    void add_uncompress(const char *ibuf, size_t size, char *obuf,
+                        size_t osize);
+
+    // Run all tasks added, return false if any of them fails
+    bool run();
+
+    // Length of output of the idx-th compress task
+    size_t compressed_length(size_t idx)
+    {
+        assert(idx < tasks_.size());
+        return tasks_[idx].olen;
+    }
+
+private:
+    struct Task {
+        bool        compress;
+        const char  *ibuf;
+        size_t      size;
+        char        *obuf;
+        // length of output of compress, or capacity of obuf for uncompress
+        size_t      olen;
+        bool        succ;
+    };
+
+    void exec(Task *task);
+
+    void exec_task(Task *task, bool);
+
+    // true if all tasks succeeded
+    bool succeeded();
+
+    Compressor          *compressor_;
+
+    WorkerPool          *pool_;
+
+    std::vector<Task>   tasks_;
+
+    Mutex               mtx_;
+
+    CondVar             cond_;
+
+    size_t              pending_;
+};
+
 }
 
 #endif
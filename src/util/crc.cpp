@@ -273,13 +273,18 @@ static const uint32_t table3_[256] = {
 };
 
 uint32_t cascadb::crc32(const char *buf, uint32_t n)
+{
+    return crc32_extend(0xfffffffu, buf, n);
+}
+
+uint32_t cascadb::crc32_extend(uint32_t crc, const char *buf, uint32_t n)
 {
     const char *p = buf;
     const char *e = buf + n;
-    uint32_t l = 0xfffffffu;
+    uint32_t l = crc;
 
 #define STEP1 do {                                                      \
-    int c = (l & 0xff) ^ *p++;                                          \
+    int c = (l & 0xff) ^ (uint8_t)*p++;                                 \
     l = table0_[c] ^ (l >> 8);                                          \
 } while (0)
 #define STEP4 do {                                                      \
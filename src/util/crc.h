@@ -11,6 +11,10 @@
 #define CRC_SIZE (4)
 namespace cascadb {
     uint32_t crc32(const char *buf, uint32_t n);
+
+    // Continue crc of the preceding data with buf, so
+    // crc32_extend(crc32(a), b) equals crc32 of a and b concatenated
+    uint32_t crc32_extend(uint32_t crc, const char *buf, uint32_t n);
 }
 
 #endif
@@ -0,0 +1,188 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include <set>
+
+#include "logger.h"
+#include "worker_pool.h"
+
+using namespace std;
+using namespace cascadb;
+
+WorkerPool::WorkerPool(size_t threads_number, size_t queue_limit)
+: threads_number_(threads_number),
+  queue_limit_(queue_limit),
+  cond_(&mtx_),
+  space_cond_(&mtx_),
+  alive_(false),
+  queued_(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+bool WorkerPool::init()
+{
+    assert(workers_.empty());
+
+    ScopedMutex lock(&mtx_);
+    alive_ = threads_number_ > 0;
+    for (size_t i = 0; i < threads_number_; i++) {
+        Worker *worker = new Worker();
+        worker->pool = this;
+        worker->thread = new Thread(worker_main);
+        workers_.push_back(worker);
+    }
+    lock.unlock();
+
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i]->thread->start(workers_[i]);
+    }
+
+    LOG_INFO("start " << threads_number_ << " worker threads");
+    return true;
+}
+
+void WorkerPool::stop()
+{
+    ScopedMutex lock(&mtx_);
+    alive_ = false;
+    cond_.notify_all();
+    space_cond_.notify_all();
+    lock.unlock();
+
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i]->thread->join();
+        delete workers_[i]->thread;
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < workers_.size(); i++) {
+        assert(workers_[i]->tasks.empty());
+        delete workers_[i];
+    }
+    workers_.clear();
+}
+
+void WorkerPool::submit(size_t hint, Callback *task)
+{
+    ScopedMutex lock(&mtx_);
+    if (alive_) {
+        Worker *worker = workers_[hint % workers_.size()];
+        while (alive_ && queue_limit_ && worker->tasks.size() >= queue_limit_
+                && !is_worker_thread()) {
+            space_cond_.wait();
+        }
+        if (alive_) {
+            Task t;
+            t.hint = hint;
+            t.cb = task;
+            worker->tasks.push_back(t);
+            queued_ ++;
+            // any idle thread may take it
+            cond_.notify_all();
+            return;
+        }
+    }
+    lock.unlock();
+
+    task->exec(true);
+    delete task;
+}
+
+size_t WorkerPool::pending()
+{
+    ScopedMutex lock(&mtx_);
+    return queued_;
+}
+
+void* WorkerPool::worker_main(void *arg)
+{
+    Worker *worker = (Worker*) arg;
+    worker->pool->run(worker);
+    return NULL;
+}
+
+void WorkerPool::run(Worker *worker)
+{
+    ScopedMutex lock(&mtx_);
+    while (true) {
+        Task task;
+        if (!pick(worker, task)) {
+            if (!alive_ && worker->tasks.empty()) {
+                break;
+            }
+            cond_.wait();
+            continue;
+        }
+
+        queued_ --;
+        worker->running = true;
+        worker->running_hint = task.hint;
+        space_cond_.notify_all();
+        lock.unlock();
+
+        task.cb->exec(true);
+        delete task.cb;
+
+        lock.lock();
+        worker->running = false;
+        if (queued_) {
+            // tasks of the same hint may be waiting for it
+            cond_.notify_all();
+        }
+    }
+}
+
+bool WorkerPool::pick(Worker *worker, Task& task)
+{
+    if (take(worker, task)) {
+        return true;
+    }
+    for (size_t i = 0; i < workers_.size(); i++) {
+        if (workers_[i] != worker && take(workers_[i], task)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkerPool::take(Worker *from, Task& task)
+{
+    // tasks of a hint're all in the same queue
+    set<size_t> hints;
+    for (deque<Task>::iterator it = from->tasks.begin();
+         it != from->tasks.end(); it++) {
+        if (hints.find(it->hint) == hints.end() && !is_running(it->hint)) {
+            task = *it;
+            from->tasks.erase(it);
+            return true;
+        }
+        hints.insert(it->hint);
+    }
+    return false;
+}
+
+bool WorkerPool::is_running(size_t hint)
+{
+    for (size_t i = 0; i < workers_.size(); i++) {
+        if (workers_[i]->running && workers_[i]->running_hint == hint) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WorkerPool::is_worker_thread()
+{
+    for (size_t i = 0; i < workers_.size(); i++) {
+        if (workers_[i]->thread->is_current()) {
+            return true;
+        }
+    }
+    return false;
+}
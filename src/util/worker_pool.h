@@ -0,0 +1,96 @@
+// Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#ifndef CASCADB_UTIL_WORKER_POOL_H_
+#define CASCADB_UTIL_WORKER_POOL_H_
+
+#include <deque>
+#include <vector>
+
+#include "sys/sys.h"
+#include "callback.h"
+
+namespace cascadb {
+
+// A fixed number of threads running submitted tasks.
+// Each thread has its own queue, tasks submitted with the same hint
+// go to the same queue, and they're executed one at a time in order.
+// A thread with nothing to do takes tasks queued for others, as long as
+// no earlier task of the same hint is queued or running, so that a task
+// blocked doesn't hold up tasks of other hints queued behind it.
+class WorkerPool {
+public:
+    // queue_limit is the maximum number of tasks queued for each
+    // thread, 0 for no limit
+    WorkerPool(size_t threads_number, size_t queue_limit = 0);
+
+    ~WorkerPool();
+
+    bool init();
+
+    // Stop all threads after tasks queued're finished
+    void stop();
+
+    // Queue a task, it's executed with true and deleted afterwards.
+    // Caller is blocked while the queue is full, unless it's a thread
+    // of the pool, which'd wait for itself otherwise.
+    // If the pool isn't running, the task is executed inline
+    void submit(size_t hint, Callback *task);
+
+    // Number of tasks waiting to be executed
+    size_t pending();
+
+private:
+    struct Task {
+        size_t                  hint;
+        Callback                *cb;
+    };
+
+    struct Worker {
+        Worker() : pool(NULL), running(false), running_hint(0), thread(NULL) {}
+
+        WorkerPool              *pool;
+        std::deque<Task>        tasks;
+        bool                    running;
+        size_t                  running_hint;
+        Thread                  *thread;
+    };
+
+    static void* worker_main(void *arg);
+
+    void run(Worker *worker);
+
+    // Pick a task runnable from the queue of worker,
+    // or from others if there is not any
+    bool pick(Worker *worker, Task& task);
+
+    bool take(Worker *from, Task& task);
+
+    bool is_running(size_t hint);
+
+    bool is_worker_thread();
+
+    size_t                      threads_number_;
+
+    size_t                      queue_limit_;
+
+    // protects all the state below and queues of workers
+    Mutex                       mtx_;
+
+    // signaled when tasks're queued or finished
+    CondVar                     cond_;
+
+    // signaled when tasks're taken off queues
+    CondVar                     space_cond_;
+
+    bool                        alive_;
+
+    size_t                      queued_;
+
+    std::vector<Worker*>        workers_;
+};
+
+}
+
+#endif
@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include "util/bits.h"
+#include "util/buffer_pool.h"
+
+using namespace cascadb;
+using namespace std;
+
+TEST(BufferPool, alloc) {
+    BufferPool pool(1 << 20, false);
+
+    Slice b1 = pool.alloc(100);
+    ASSERT_EQ((size_t)PAGE_SIZE, b1.size());
+    EXPECT_EQ(0U, (size_t)b1.data() & (PAGE_SIZE - 1));
+
+    Slice b2 = pool.alloc(PAGE_SIZE * 5 + 1);
+    EXPECT_EQ((size_t)PAGE_SIZE * 6, b2.size());
+    EXPECT_EQ(0U, (size_t)b2.data() & (PAGE_SIZE - 1));
+
+    pool.free(b1);
+    EXPECT_EQ((size_t)PAGE_SIZE, pool.cached());
+
+    // buffers're reused within the same size class
+    Slice b3 = pool.alloc(PAGE_SIZE);
+    EXPECT_EQ(b1.data(), b3.data());
+    EXPECT_EQ(0U, pool.cached());
+
+    // shrunk buffers go back to the class they're allocated from
+    const char *p2 = b2.data();
+    b2.resize(PAGE_SIZE);
+    pool.free(b2);
+    Slice b4 = pool.alloc(PAGE_SIZE * 6 - 100);
+    EXPECT_EQ(p2, b4.data());
+
+    pool.free(b3);
+    pool.free(b4);
+}
+
+TEST(BufferPool, limit) {
+    BufferPool pool(PAGE_SIZE * 2, false);
+
+    Slice b1 = pool.alloc(PAGE_SIZE);
+    Slice b2 = pool.alloc(PAGE_SIZE);
+    Slice b3 = pool.alloc(PAGE_SIZE);
+    pool.free(b1);
+    pool.free(b2);
+    pool.free(b3);
+    EXPECT_EQ((size_t)PAGE_SIZE * 2, pool.cached());
+
+    BufferPool nopool(0, true);
+    Slice b4 = nopool.alloc(4 << 20);
+    EXPECT_EQ((size_t)4 << 20, b4.size());
+    nopool.free(b4);
+    EXPECT_EQ(0U, nopool.cached());
+}
@@ -1,5 +1,8 @@
 #include <gtest/gtest.h>
 
+#define private public
+#define protected public
+
 #include "cascadb/options.h"
 #include "sys/sys.h"
 #include "store/ram_directory.h"
@@ -103,4 +106,145 @@ TEST(Cache, read_and_write) {
     delete layout;
     delete file;
     delete dir;
-}
\ No newline at end of file
+}
+
+TEST(Cache, two_queue_policy) {
+    TwoQueuePolicy policy(2);
+
+    // leaves read only once're evicted and remembered
+    FakeNode *l1 = new FakeNode("t1", NID_LEAF_START);
+    policy.on_insert(l1);
+    EXPECT_FALSE(l1->is_hot());
+    policy.on_evict(l1);
+    delete l1;
+
+    // loaded again, promoted
+    l1 = new FakeNode("t1", NID_LEAF_START);
+    policy.on_insert(l1);
+    EXPECT_TRUE(l1->is_hot());
+
+    // ghost queue is bounded
+    for (bid_t nid = NID_LEAF_START + 1; nid < NID_LEAF_START + 4; nid++) {
+        FakeNode node("t1", nid);
+        policy.on_insert(&node);
+        policy.on_evict(&node);
+    }
+    FakeNode l2("t1", NID_LEAF_START + 1);
+    policy.on_insert(&l2);
+    EXPECT_FALSE(l2.is_hot());
+
+    FakeNode i1("t1", NID_START);
+    FakeNode schema("t1", NID_SCHEMA);
+    vector<Node*> nodes;
+    nodes.push_back(&schema);
+    nodes.push_back(l1);
+    nodes.push_back(&i1);
+    nodes.push_back(&l2);
+    policy.sort(nodes);
+
+    EXPECT_EQ(&l2, nodes[0]);
+    EXPECT_EQ(&i1, nodes[1]);
+    EXPECT_EQ(l1, nodes[2]);
+    EXPECT_EQ(&schema, nodes[3]);
+
+    delete l1;
+}
+
+TEST(Cache, secondary) {
+    Options opts;
+    // nodes take 4096 bytes, and their images as much
+    opts.cache_limit = 8192 * 100;
+    opts.cache_evict_ratio = 50;
+    opts.cache_secondary_limit = 4096 * 1000;
+
+    Directory *dir = new RAMDirectory();
+    AIOFile *file = dir->open_aio_file("cache_test");
+    Layout *layout = new Layout(file, 0, opts);
+    layout->init(true);
+
+    // flusher isn't started, nodes're clean and evicted explicitly
+    Cache *cache = new Cache(opts);
+
+    NodeFactory *factory = new FakeNodeFactory("t1");
+    cache->add_table("t1", factory, layout);
+
+    vector<Node*> nodes;
+    for (int i = 0; i < 100; i++) {
+        FakeNode *node = new FakeNode("t1", i);
+        node->data = i;
+        node->set_dirty(true);
+        cache->put("t1", i, node);
+        node->dec_ref();
+        nodes.push_back(node);
+    }
+    // nodes keep the blocks written as their images
+    cache->flush_table("t1");
+    for (size_t i = 0; i < nodes.size(); i++) {
+        while (nodes[i]->is_flushing()) {
+            cascadb::usleep(1000);
+        }
+    }
+    cache->evict();
+    EXPECT_EQ(8192U * 50, cache->size_);
+    EXPECT_EQ(4096U * 50, cache->secondary_->size());
+
+    // image of a block moved since is dropped
+    Slice stale = Slice::alloc(4096);
+    cache->secondary_->put("t1", 1000, stale, 1, false);
+    Slice data;
+    bool skeleton;
+    EXPECT_FALSE(cache->secondary_->take("t1", 1000, 2, data, skeleton));
+    EXPECT_EQ(4096U * 50, cache->secondary_->size());
+
+    // served by images kept rather than layout
+    for (int i = 0; i < 100; i++) {
+        Node *node = cache->get("t1", i, false);
+        ASSERT_TRUE(node != NULL);
+        EXPECT_EQ((uint64_t)i, ((FakeNode*)node)->data);
+        node->dec_ref();
+    }
+    EXPECT_EQ(50U, cache->secondary_->hits());
+    EXPECT_EQ(0U, cache->secondary_->size());
+
+    cache->del_table("t1", false);
+
+    delete cache;
+    delete factory;
+    delete layout;
+    delete file;
+    delete dir;
+}
+
+TEST(Cache, throttle) {
+    Options opts;
+    opts.cache_limit = 4096 * 100;
+    opts.cache_dirty_high_watermark = 30;
+    opts.cache_dirty_stall_watermark = 60;
+    opts.cache_write_delay_max = 1000;
+
+    // flusher isn't started, so dirty size is only changed here
+    Cache *cache = new Cache(opts);
+
+    cache->dirty_size_ = 4096 * 20;
+    cache->throttle();
+    WriteStallStats stats = cache->write_stall_stats();
+    EXPECT_EQ(0U, stats.delayed_count);
+    EXPECT_EQ(0U, stats.stopped_count);
+
+    // half way between watermarks
+    cache->dirty_size_ = 4096 * 45;
+    cache->throttle();
+    stats = cache->write_stall_stats();
+    EXPECT_EQ(1U, stats.delayed_count);
+    EXPECT_EQ(500U, stats.delayed_us);
+    EXPECT_EQ(0U, stats.stopped_count);
+
+    // beyond stall watermark, returns immediately since cache isn't alive
+    cache->dirty_size_ = 4096 * 70;
+    cache->throttle();
+    stats = cache->write_stall_stats();
+    EXPECT_EQ(1U, stats.delayed_count);
+    EXPECT_EQ(1U, stats.stopped_count);
+
+    delete cache;
+}
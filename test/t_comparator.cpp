@@ -20,3 +20,44 @@ TEST(Comparator, numeric) {
     a = 200;
     EXPECT_TRUE(comp.compare(Slice((char *)&a, sizeof(a)), Slice((char *)&b, sizeof(b))) > 0);
 }
+
+TEST(Comparator, numeric_overflow) {
+    NumericComparator<int64_t> comp;
+    int64_t a = -(1LL << 62), b = (1LL << 62);
+    EXPECT_TRUE(comp.compare(Slice((char *)&a, sizeof(a)), Slice((char *)&b, sizeof(b))) < 0);
+    EXPECT_TRUE(comp.compare(Slice((char *)&b, sizeof(b)), Slice((char *)&a, sizeof(a))) > 0);
+
+    NumericComparator<uint64_t> ucomp;
+    uint64_t c = 1, d = 0xffffffffffffffffULL;
+    EXPECT_TRUE(ucomp.compare(Slice((char *)&c, sizeof(c)), Slice((char *)&d, sizeof(d))) < 0);
+}
+
+TEST(Comparator, kind) {
+    EXPECT_EQ(kLexicalComparator, LexicalComparator().kind());
+    EXPECT_EQ(kInt32Comparator, NumericComparator<int32_t>().kind());
+    EXPECT_EQ(kUInt32Comparator, NumericComparator<uint32_t>().kind());
+    EXPECT_EQ(kInt64Comparator, NumericComparator<int64_t>().kind());
+    EXPECT_EQ(kUInt64Comparator, NumericComparator<uint64_t>().kind());
+    EXPECT_EQ(kCustomComparator, NumericComparator<double>().kind());
+}
+
+class ReverseComparator : public LexicalComparator {
+public:
+    int compare(const Slice & s1, const Slice & s2) const
+    {
+        return s2.compare(s1);
+    }
+};
+
+class ReverseUInt64Comparator : public NumericComparator<uint64_t> {
+public:
+    int compare(const Slice & s1, const Slice & s2) const
+    {
+        return NumericComparator<uint64_t>::compare(s2, s1);
+    }
+};
+
+TEST(Comparator, subclass_kind) {
+    EXPECT_EQ(kCustomComparator, ReverseComparator().kind());
+    EXPECT_EQ(kCustomComparator, ReverseUInt64Comparator().kind());
+}
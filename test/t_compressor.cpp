@@ -18,7 +18,7 @@ TEST(Compressor, NoCompressMethod) {
     EXPECT_TRUE(len1 == (strlen(text) + 1));
 
     char *str2 = new char[strlen(text)];
-    EXPECT_TRUE(compressor->uncompress(str1, len1, str2));
+    EXPECT_TRUE(compressor->uncompress(str1, len1, str2, strlen(text)));
 
     EXPECT_TRUE(strncmp(text, str2, strlen(text)) == 0);
 
@@ -36,7 +36,7 @@ TEST(Compressor, SnappyCompressMethod) {
     EXPECT_NE(len1, strlen(text) + 1);
 
     char *str2 = new char[strlen(text)];
-    EXPECT_TRUE(compressor->uncompress(str1, len1, str2));
+    EXPECT_TRUE(compressor->uncompress(str1, len1, str2, strlen(text)));
     EXPECT_TRUE(strncmp(text, str2, strlen(text)) == 0);
 
     delete str1;
@@ -55,7 +55,7 @@ TEST(Compressor, QuicklzCompressMethod) {
     EXPECT_TRUE(compressor->compress(text, strlen(text), str1, &len1));
 
     char *str2 = new char[strlen(text)];
-    EXPECT_TRUE(compressor->uncompress(str1, len1, str2));
+    EXPECT_TRUE(compressor->uncompress(str1, len1, str2, strlen(text)));
     EXPECT_TRUE(strncmp(text, str2, strlen(text)) == 0);
 
     delete str1;
@@ -63,6 +63,161 @@ TEST(Compressor, QuicklzCompressMethod) {
     delete compressor;
 }
 
+TEST(Compressor, ZstdCompressMethod) {
+    Compressor *compressor = new Compressor(kZstdCompress, 3);
+
+    size_t len1;
+    char* str1 = new char[compressor->max_compressed_length(strlen(text))];
+    EXPECT_TRUE(compressor->compress(text, strlen(text), str1, &len1));
+
+    char *str2 = new char[strlen(text)];
+    EXPECT_TRUE(compressor->uncompress(str1, len1, str2, strlen(text)));
+    EXPECT_TRUE(strncmp(text, str2, strlen(text)) == 0);
+
+    delete[] str1;
+    delete[] str2;
+    delete compressor;
+}
+
+TEST(Compressor, LZ4CompressMethod) {
+    Compressor *compressor = new Compressor(kLZ4Compress);
+
+    size_t len1;
+    char* str1 = new char[compressor->max_compressed_length(strlen(text))];
+    EXPECT_TRUE(compressor->compress(text, strlen(text), str1, &len1));
+    EXPECT_EQ(kLZ4Compress, str1[0]);
+
+    char *str2 = new char[strlen(text)];
+    EXPECT_TRUE(compressor->uncompress(str1, len1, str2, strlen(text)));
+    EXPECT_TRUE(strncmp(text, str2, strlen(text)) == 0);
+
+    // truncated blocks're rejected
+    EXPECT_FALSE(compressor->uncompress(str1, len1 - 1, str2, strlen(text)));
+
+    delete[] str1;
+    delete[] str2;
+    delete compressor;
+}
+
+TEST(Compressor, LZ4Sizes) {
+    // blocks shorter than the minimal match, and lengths around
+    // the 15 and 255 bytes steps of the block format
+    size_t sizes[] = {1, 5, 12, 13, 14, 15, 19, 270, 271, 4096, 65537};
+    Compressor compressor(kLZ4Compress);
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        size_t size = sizes[s];
+        string buf;
+        for (size_t i = 0; i < size; i++) {
+            buf.push_back((i % 64 < 40) ? "abc"[i % 3] : (char)(rand() % 256));
+        }
+
+        char *str1 = new char[compressor.max_compressed_length(size)];
+        size_t len1;
+        EXPECT_TRUE(compressor.compress(buf.data(), size, str1, &len1));
+
+        char *str2 = new char[size + 1];
+        EXPECT_TRUE(compressor.uncompress(str1, len1, str2, size))
+            << "size " << size;
+        EXPECT_EQ(buf, string(str2, size)) << "size " << size;
+
+        delete[] str1;
+        delete[] str2;
+    }
+}
+
+TEST(Compressor, LZ4ReferenceBlock) {
+    // 1000 'a' followed by text repeated 3 times,
+    // compressed by the reference liblz4 1.9.4, LZ4_compress_default()
+    const char block[] =
+        "\x1f\x61\x01\x00\xff\xff\xff\xd7\xff\x50\x59\x65"
+        "\x74\x20\x61\x6e\x6f\x74\x68\x65\x72\x20\x77\x72"
+        "\x69\x74\x65\x2d\x6f\x70\x74\x69\x6d\x69\x7a\x65"
+        "\x64\x20\x73\x74\x6f\x72\x61\x67\x65\x20\x65\x6e"
+        "\x67\x69\x6e\x65\x2c\x20\x75\x73\x69\x6e\x67\x20"
+        "\x62\x75\x66\x66\x65\x72\x65\x64\x20\x42\x2d\x74"
+        "\x72\x65\x65\x20\x61\x6c\x67\x6f\x72\x69\x74\x68"
+        "\x6d\x20\x69\x6e\x73\x70\x69\x72\x65\x64\x20\x62"
+        "\x79\x20\x54\x6f\x6b\x75\x44\x42\x2e\x5f\x00\xa6"
+        "\x50\x6b\x75\x44\x42\x2e";
+    size_t block_len = sizeof(block) - 1;
+    ASSERT_EQ(114U, block_len);
+
+    string expected(1000, 'a');
+    for (int i = 0; i < 3; i++) {
+        expected.append(text);
+    }
+    size_t size = expected.size();
+
+    // method tag and length header, then the raw LZ4 block
+    char *str1 = new char[1 + 4 + block_len];
+    str1[0] = kLZ4Compress;
+    str1[1] = size & 0xff;
+    str1[2] = (size >> 8) & 0xff;
+    str1[3] = (size >> 16) & 0xff;
+    str1[4] = (size >> 24) & 0xff;
+    memcpy(str1 + 5, block, block_len);
+
+    Compressor compressor(kLZ4Compress);
+    char *str2 = new char[size];
+    EXPECT_TRUE(compressor.uncompress(str1, 5 + block_len, str2, size));
+    EXPECT_EQ(expected, string(str2, size));
+
+    // an offset reaching before the start of the output is rejected
+    str1[5 + 3] = 0x02;
+    EXPECT_FALSE(compressor.uncompress(str1, 5 + block_len, str2, size));
+
+    delete[] str1;
+    delete[] str2;
+}
+
+TEST(Compressor, OutputCapacity) {
+    // lengths in headers beyond the output buffer're rejected
+    Compress methods[] = {kNoCompress, kSnappyCompress,
+                          kQuicklzCompress, kZstdCompress, kLZ4Compress};
+    size_t tlen = strlen(text);
+    for (size_t m = 0; m < sizeof(methods)/sizeof(methods[0]); m++) {
+        Compressor compressor(methods[m], 3);
+        char *str1 = new char[compressor.max_compressed_length(tlen)];
+        size_t len1;
+        EXPECT_TRUE(compressor.compress(text, tlen, str1, &len1));
+
+        char *str2 = new char[tlen];
+        EXPECT_FALSE(compressor.uncompress(str1, len1, str2, tlen - 1))
+            << "method " << methods[m];
+        EXPECT_TRUE(compressor.uncompress(str1, len1, str2, tlen))
+            << "method " << methods[m];
+
+        delete[] str1;
+        delete[] str2;
+    }
+}
+
+TEST(Compressor, LargeBuffer) {
+    // repeated records with random parts, like buckets in leaves
+    size_t size = 256 * 1024;
+    char *buf = new char[size];
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = (i % 100 < 60) ? "record-"[i % 7] : (char)(rand() % 256);
+    }
+
+    Compress methods[] = {kSnappyCompress, kZstdCompress, kLZ4Compress};
+    for (size_t m = 0; m < sizeof(methods)/sizeof(methods[0]); m++) {
+        Compressor compressor(methods[m], 3);
+        char *str1 = new char[compressor.max_compressed_length(size)];
+        size_t len1;
+        EXPECT_TRUE(compressor.compress(buf, size, str1, &len1));
+        EXPECT_LT(len1, size) << "method " << methods[m];
+
+        char *str2 = new char[size];
+        EXPECT_TRUE(compressor.uncompress(str1, len1, str2, size));
+        EXPECT_EQ(0, memcmp(buf, str2, size)) << "method " << methods[m];
+
+        delete[] str1;
+        delete[] str2;
+    }
+
+    delete[] buf;
+}
 
 /*
  * In this case, the uncompress will use the origin compress method, 
@@ -80,14 +235,14 @@ TEST(Compressor, MixCompressMethod) {
     // decompress with no compress
     Compressor *compressor2 = new Compressor(kNoCompress);
     char *str2 = new char[strlen(text)];
-    EXPECT_TRUE(compressor2->uncompress(str1, len1, str2));
+    EXPECT_TRUE(compressor2->uncompress(str1, len1, str2, strlen(text)));
     EXPECT_TRUE(strncmp(text, str2, strlen(text)) == 0);
 
 
     // decompress with quicklz
     Compressor *compressor3 = new Compressor(kQuicklzCompress);
     char *str3 = new char[strlen(text)];
-    EXPECT_TRUE(compressor3->uncompress(str1, len1, str3));
+    EXPECT_TRUE(compressor3->uncompress(str1, len1, str3, strlen(text)));
     EXPECT_TRUE(strncmp(text, str3, strlen(text)) == 0);
 
     delete str1;
@@ -97,3 +252,138 @@ TEST(Compressor, MixCompressMethod) {
     delete compressor2;
     delete compressor3;
 }
+
+TEST(Compressor, Parallel) {
+    Compressor *compressor = new Compressor(kQuicklzCompress);
+    WorkerPool *pool = new WorkerPool(4);
+    ASSERT_TRUE(pool->init());
+
+    const size_t n = 16;
+    size_t tlen = strlen(text);
+    size_t max_len = compressor->max_compressed_length(tlen);
+    char *cbuf = new char[n * max_len];
+    char *ubuf = new char[n * tlen];
+
+    ParallelCompressor pc1(compressor, pool);
+    for (size_t i = 0; i < n; i++) {
+        pc1.add_compress(text, tlen, cbuf + i * max_len);
+    }
+    EXPECT_TRUE(pc1.run());
+
+    ParallelCompressor pc2(compressor, pool);
+    for (size_t i = 0; i < n; i++) {
+        pc2.add_uncompress(cbuf + i * max_len, pc1.compressed_length(i),
+                           ubuf + i * tlen, tlen);
+    }
+    EXPECT_TRUE(pc2.run());
+
+    for (size_t i = 0; i < n; i++) {
+        EXPECT_TRUE(strncmp(text, ubuf + i * tlen, tlen) == 0);
+    }
+
+    delete[] cbuf;
+    delete[] ubuf;
+    delete pool;
+    delete compressor;
+}
+
+TEST(Compressor, Bypass) {
+    Compressor *compressor = new Compressor(kSnappyCompress, 0, 90);
+
+    const size_t size = 4096;
+    char *random = new char[size];
+    srand(0);
+    for (size_t i = 0; i < size; i++) {
+        random[i] = rand() & 0xff;
+    }
+
+    size_t len;
+    char *obuf = new char[compressor->max_compressed_length(size)];
+    char *ubuf = new char[size];
+
+    // stored raw, tagged with kNoCompress
+    EXPECT_TRUE(compressor->compress(random, size, obuf, &len));
+    EXPECT_EQ(size + 1, len);
+    EXPECT_EQ(kNoCompress, obuf[0]);
+    EXPECT_TRUE(compressor->uncompress(obuf, len, ubuf, size));
+    EXPECT_TRUE(memcmp(random, ubuf, size) == 0);
+
+    // stop trying after a run of incompressible blocks
+    for (size_t i = 0; i < 99; i++) {
+        EXPECT_TRUE(compressor->compress(random, size, obuf, &len));
+        EXPECT_EQ(size + 1, len);
+    }
+    CompressStats stats = compressor->stats();
+    EXPECT_EQ(100U, stats.blocks);
+    EXPECT_EQ(100U, stats.bypassed + stats.skipped);
+    EXPECT_GT(stats.skipped, 80U);
+    EXPECT_EQ(100 * (size + 1), stats.output_bytes);
+
+    // compressible blocks're found by samples
+    char *zeros = new char[size];
+    memset(zeros, 0, size);
+    for (size_t i = 0; i < 16; i++) {
+        EXPECT_TRUE(compressor->compress(zeros, size, obuf, &len));
+    }
+    EXPECT_EQ(kSnappyCompress, obuf[0]);
+    EXPECT_LT(len, size / 10);
+    EXPECT_TRUE(compressor->uncompress(obuf, len, ubuf, size));
+    EXPECT_TRUE(memcmp(zeros, ubuf, size) == 0);
+
+    delete[] random;
+    delete[] zeros;
+    delete[] obuf;
+    delete[] ubuf;
+    delete compressor;
+}
+
+TEST(Compressor, ZstdDictionary) {
+    Compressor *compressor = new Compressor(kZstdCompress, 3);
+    compressor->train_dict(1024);
+
+    // small blocks sharing most of their content
+    std::vector<string> blocks;
+    for (size_t i = 0; i < 2000; i++) {
+        char buf[128];
+        sprintf(buf, "{\"id\": %lu, \"name\": \"user%lu\", "
+                "\"email\": \"user%lu@example.com\"}", i, i * 7, i * 13);
+        blocks.push_back(buf);
+    }
+
+    size_t max_len = compressor->max_compressed_length(128);
+    char *obuf = new char[max_len];
+    size_t len;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        EXPECT_TRUE(compressor->compress(blocks[i].data(), blocks[i].size(),
+                                         obuf, &len));
+    }
+
+    // trained in background
+    string dict;
+    for (int i = 0; i < 10000 && !compressor->trained_dict(dict); i++) {
+        cascadb::usleep(1000);
+    }
+    ASSERT_FALSE(dict.empty());
+    EXPECT_LE(dict.size(), 1024U);
+
+    size_t plain_len;
+    EXPECT_TRUE(compressor->compress(blocks[0].data(), blocks[0].size(),
+                                     obuf, &plain_len));
+
+    EXPECT_TRUE(compressor->set_dict(Slice(dict)));
+    EXPECT_TRUE(compressor->compress(blocks[0].data(), blocks[0].size(),
+                                     obuf, &len));
+    EXPECT_LT(len, plain_len);
+
+    // blocks referring to the dictionary need it to be uncompressed
+    char ubuf[128];
+    Compressor *other = new Compressor(kZstdCompress);
+    EXPECT_FALSE(other->uncompress(obuf, len, ubuf, sizeof(ubuf)));
+    EXPECT_TRUE(other->set_dict(Slice(dict)));
+    EXPECT_TRUE(other->uncompress(obuf, len, ubuf, sizeof(ubuf)));
+    EXPECT_EQ(blocks[0], string(ubuf, blocks[0].size()));
+
+    delete[] obuf;
+    delete other;
+    delete compressor;
+}
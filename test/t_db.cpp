@@ -1,12 +1,91 @@
 #include <iostream>
+#include <sstream>
 
 #include <gtest/gtest.h>
 
 #include "cascadb/db.h"
+#include "sys/sys.h"
 
 using namespace std;
 using namespace cascadb;
 
+// the number followed by label in the line of debug_print starting
+// with prefix, e.g. debug_stat(db, "Secondary cache", " hits")
+static uint64_t debug_stat(DB *db, const string& prefix, const string& label)
+{
+    ostringstream out;
+    db->debug_print(out);
+    istringstream in(out.str());
+    string line;
+    while (getline(in, line)) {
+        if (line.compare(0, prefix.size(), prefix) != 0) {
+            continue;
+        }
+        size_t end = line.find(label, prefix.size());
+        if (end == string::npos) {
+            return 0;
+        }
+        size_t start = end;
+        while (start > 0 && isdigit(line[start - 1])) {
+            start --;
+        }
+        return strtoull(line.c_str() + start, NULL, 10);
+    }
+    return 0;
+}
+
+// Options most tests start from: a ram directory, numeric keys,
+// and nodes small enough that some thousands of records build a tree
+// of a few levels
+static Options test_options(size_t page_size, size_t children)
+{
+    Options opts;
+    opts.dir = create_ram_directory();
+    opts.comparator = new NumericComparator<uint64_t>();
+    opts.inner_node_page_size = page_size;
+    opts.inner_node_children_number = children;
+    opts.leaf_node_page_size = page_size;
+    opts.leaf_node_bucket_size = 512;
+    return opts;
+}
+
+static void destroy_options(Options& opts)
+{
+    delete opts.dir;
+    delete opts.comparator;
+}
+
+// value of key i, delta tells values of rewrites apart
+static string numbered_value(uint64_t i, uint64_t delta = 0)
+{
+    char buf[32];
+    sprintf(buf, "%lu", i + delta);
+    return buf;
+}
+
+// put keys in [begin, end) with their numbered values
+static void put_numbered(DB *db, uint64_t begin, uint64_t end,
+                         uint64_t delta = 0)
+{
+    for (uint64_t i = begin; i < end; i++) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, numbered_value(i, delta)))
+            << "put key " << i << " error";
+    }
+}
+
+// check keys in [begin, end) have their numbered values
+static void check_numbered(DB *db, uint64_t begin, uint64_t end,
+                           uint64_t delta = 0)
+{
+    for (uint64_t i = begin; i < end; i++) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        string value;
+        ASSERT_TRUE(db->get(key, value)) << "get key " << i << " error";
+        ASSERT_EQ(numbered_value(i, delta), value) << "get key " << i;
+    }
+}
+
 TEST(DB, put) {
     Options opts;
     opts.dir = create_ram_directory();
@@ -110,6 +189,604 @@ TEST(DB, batch_write) {
     delete opts.comparator;
 }
 
+TEST(DB, background_cascade) {
+    Options opts = test_options(4 * 1024, 64);
+    opts.cache_limit = 32 * 1024;
+    opts.cascade_threads = 2;
+    opts.compress = kSnappyCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000));
+    ASSERT_NO_FATAL_FAILURE(check_numbered(db, 0, 20000));
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, staging_buffers) {
+    Options opts = test_options(4 * 1024, 64);
+    opts.cache_limit = 32 * 1024;
+    opts.root_staging_buffers = 4;
+    opts.root_staging_buffer_size = 1024;
+    opts.compress = kSnappyCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    for (uint64_t i = 0; i < 20000; i++ ) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "old")) << "put key " << i << " error";
+    }
+
+    // overwrite or delete keys, some of them still stay in staging buffers
+    for (uint64_t i = 0; i < 20000; i++ ) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        if (i % 2) {
+            ASSERT_TRUE(db->del(key)) << "del key " << i << " error";
+        } else {
+            ASSERT_TRUE(db->put(key, "new")) << "put key " << i << " error";
+        }
+    }
+
+    for (int round = 0; round < 2; round++) {
+        for (uint64_t i = 0; i < 20000; i++ ) {
+            Slice key = Slice((char*)&i, sizeof(uint64_t));
+            string value;
+            if (i % 2) {
+                ASSERT_FALSE(db->get(key, value)) << "deleted key " << i << " found";
+            } else {
+                ASSERT_TRUE(db->get(key, value)) << "get key " << i << " error";
+                ASSERT_EQ("new", value);
+            }
+        }
+        // read again after staging buffers're merged
+        db->flush();
+    }
+
+    delete db;
+    destroy_options(opts);
+}
+
+struct ReaderContext {
+    DB          *db;
+    uint64_t    count;
+    size_t      errors;
+};
+
+static void* reader_main(void *arg)
+{
+    ReaderContext *ctx = (ReaderContext*) arg;
+    for (uint64_t i = 0; i < ctx->count; i++) {
+        // only keys written before readers started
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        string value;
+        if (!ctx->db->get(key, value) || value != "v") {
+            ctx->errors ++;
+        }
+    }
+    return NULL;
+}
+
+TEST(DB, optimistic_read) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.cache_limit = 256 * 1024;
+    opts.optimistic_read = true;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    for (uint64_t i = 0; i < 10000; i++ ) {
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "v")) << "put key " << k << " error";
+    }
+
+    ReaderContext ctx[4];
+    Thread *thrs[4];
+    for (int i = 0; i < 4; i++) {
+        ctx[i].db = db;
+        ctx[i].count = 10000;
+        ctx[i].errors = 0;
+        thrs[i] = new Thread(reader_main);
+        thrs[i]->start(&ctx[i]);
+    }
+
+    // nodes're split and cascaded while being read
+    for (uint64_t i = 0; i < 10000; i++ ) {
+        uint64_t k = i * 2 + 1;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "w")) << "put key " << k << " error";
+    }
+
+    for (int i = 0; i < 4; i++) {
+        thrs[i]->join();
+        delete thrs[i];
+        EXPECT_EQ(0U, ctx[i].errors);
+    }
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, concurrent_lazy_load) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.cache_limit = 32 * 1024;
+    opts.compress = kSnappyCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    for (uint64_t i = 0; i < 10000; i++ ) {
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "v")) << "put key " << k << " error";
+    }
+    db->flush();
+
+    // evicted nodes're reloaded as skeletons,
+    // readers load the same msgbufs and buckets
+    ReaderContext ctx[4];
+    Thread *thrs[4];
+    for (int i = 0; i < 4; i++) {
+        ctx[i].db = db;
+        ctx[i].count = 10000;
+        ctx[i].errors = 0;
+        thrs[i] = new Thread(reader_main);
+        thrs[i]->start(&ctx[i]);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        thrs[i]->join();
+        delete thrs[i];
+        EXPECT_EQ(0U, ctx[i].errors);
+    }
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, multi_get) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.cache_limit = 32 * 1024;
+    opts.compress = kSnappyCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    for (uint64_t i = 0; i < 10000; i++ ) {
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "v")) << "put key " << k << " error";
+    }
+    delete db;
+
+    // nodes're loaded as skeletons after reopen,
+    // buckets're read in parallel
+    db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    // buffered messages shadow records in leaves
+    for (uint64_t i = 0; i < 10000; i += 10) {
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->del(key)) << "del key " << k << " error";
+    }
+
+    // unsorted, with keys never written
+    vector<uint64_t> ks;
+    for (uint64_t i = 0; i < 4000; i++) {
+        ks.push_back((i * 7919) % 20000);
+    }
+    vector<Slice> keys;
+    for (size_t i = 0; i < ks.size(); i++) {
+        keys.push_back(Slice((char*)&ks[i], sizeof(uint64_t)));
+    }
+
+    vector<Slice> values;
+    vector<bool> found;
+    size_t n = db->multi_get(keys, values, found);
+    ASSERT_EQ(keys.size(), values.size());
+    ASSERT_EQ(keys.size(), found.size());
+
+    size_t expected = 0;
+    for (size_t i = 0; i < ks.size(); i++) {
+        bool exists = (ks[i] % 2 == 0) && (ks[i] % 20 != 0);
+        EXPECT_EQ(exists, found[i]) << "key " << ks[i];
+        if (found[i]) {
+            EXPECT_EQ("v", values[i]);
+            values[i].destroy();
+            expected ++;
+        }
+    }
+    EXPECT_EQ(expected, n);
+
+    delete db;
+    destroy_options(opts);
+}
+
+struct AsyncContext {
+    AsyncContext() : cond(&mtx), pending(0), found(0), errors(0) {}
+
+    Mutex       mtx;
+    CondVar     cond;
+    size_t      pending;
+    size_t      found;
+    size_t      errors;
+};
+
+static void async_write_done(void *context, bool succ)
+{
+    AsyncContext *ctx = (AsyncContext*) context;
+    ScopedMutex lock(&ctx->mtx);
+    if (!succ) {
+        ctx->errors ++;
+    }
+    ctx->pending --;
+    ctx->cond.notify();
+}
+
+static void async_get_done(void *context, bool found, Slice value)
+{
+    AsyncContext *ctx = (AsyncContext*) context;
+    ScopedMutex lock(&ctx->mtx);
+    if (found) {
+        if (value != "v") {
+            ctx->errors ++;
+        }
+        value.destroy();
+        ctx->found ++;
+    }
+    ctx->pending --;
+    ctx->cond.notify();
+}
+
+static void async_wait(AsyncContext *ctx)
+{
+    ScopedMutex lock(&ctx->mtx);
+    while (ctx->pending) {
+        ctx->cond.wait();
+    }
+}
+
+TEST(DB, async) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.cache_limit = 32 * 1024;
+    opts.async_threads = 4;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    AsyncContext ctx;
+    ctx.pending = 10000 + 1000;
+    for (uint64_t i = 0; i < 10000; i++ ) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        db->async_put(key, "v", async_write_done, &ctx);
+    }
+    // deletes're ordered after puts of the same keys
+    for (uint64_t i = 0; i < 10000; i += 10) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        db->async_del(key, async_write_done, &ctx);
+    }
+    async_wait(&ctx);
+    EXPECT_EQ(0U, ctx.errors);
+
+    ctx.pending = 10000;
+    for (uint64_t i = 0; i < 10000; i++ ) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        db->async_get(key, async_get_done, &ctx);
+    }
+    async_wait(&ctx);
+    EXPECT_EQ(0U, ctx.errors);
+    EXPECT_EQ(9000U, ctx.found);
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, bulk_load) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.cache_limit = 64 * 1024;
+    opts.compress = kSnappyCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    BulkLoader *loader = db->new_bulk_loader();
+    ASSERT_TRUE(loader != NULL);
+    for (uint64_t i = 0; i < 20000; i++ ) {
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(loader->add(key, "v")) << "add key " << k << " error";
+    }
+    uint64_t k0 = 0;
+    EXPECT_FALSE(loader->add(Slice((char*)&k0, sizeof(uint64_t)), "v"));
+    ASSERT_TRUE(loader->finish());
+    delete loader;
+
+    // only an empty database can be loaded
+    EXPECT_TRUE(db->new_bulk_loader() == NULL);
+
+    // the tree built takes writes as usual
+    for (uint64_t i = 0; i < 20000; i += 10) {
+        uint64_t k = i * 2 + 1;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "v")) << "put key " << k << " error";
+    }
+    delete db;
+
+    db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    for (uint64_t k = 0; k < 40000; k++ ) {
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        string value;
+        bool exists = (k % 2 == 0) || (k % 20 == 1);
+        ASSERT_EQ(exists, db->get(key, value)) << "get key " << k;
+        if (exists) {
+            EXPECT_EQ("v", value);
+        }
+    }
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, bulk_load_written) {
+    // writes into root directly, or through staging buffers
+    size_t stagings[] = {0, 4};
+    for (size_t n = 0; n < 2; n++) {
+        Options opts = test_options(4 * 1024, 8);
+        opts.root_staging_buffers = stagings[n];
+
+        DB *db = DB::open("test_db", opts);
+        ASSERT_TRUE(db != NULL);
+
+        BulkLoader *loader = db->new_bulk_loader();
+        ASSERT_TRUE(loader != NULL);
+        for (uint64_t k = 0; k < 20000; k += 2) {
+            Slice key = Slice((char*)&k, sizeof(uint64_t));
+            ASSERT_TRUE(loader->add(key, "v"));
+        }
+
+        uint64_t k1 = 1;
+        ASSERT_TRUE(db->put(Slice((char*)&k1, sizeof(uint64_t)), "w"));
+
+        // the loaded tree would hide the record written
+        EXPECT_FALSE(loader->finish());
+        delete loader;
+
+        string value;
+        EXPECT_TRUE(db->get(Slice((char*)&k1, sizeof(uint64_t)), value));
+        EXPECT_EQ("w", value);
+        uint64_t k0 = 0;
+        EXPECT_FALSE(db->get(Slice((char*)&k0, sizeof(uint64_t)), value));
+
+        delete db;
+        destroy_options(opts);
+    }
+}
+
+TEST(DB, mixed_compress) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.inner_node_compress = kLZ4Compress;
+    opts.leaf_node_compress = kZstdCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 10000));
+    db->flush();
+
+    // both levels're compressed, by their own codecs
+    EXPECT_GT(debug_stat(db, "Compress inner nodes", " blocks"), 0U);
+    EXPECT_GT(debug_stat(db, "Compress leaves", " blocks"), 0U);
+    delete db;
+
+    // blocks're read by the method they're tagged with
+    opts.inner_node_compress = kInheritCompress;
+    opts.leaf_node_compress = kInheritCompress;
+    opts.compress = kSnappyCompress;
+    db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    ASSERT_NO_FATAL_FAILURE(check_numbered(db, 0, 10000));
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, parallel_compress) {
+    Options opts = test_options(16 * 1024, 8);
+    opts.compress = kZstdCompress;
+    opts.compress_threads = 4;
+    opts.compress_parallel_threshold = 4 * 1024;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000));
+    db->flush();
+
+    // sub-blocks of large nodes're compressed by the pool
+    EXPECT_GT(debug_stat(db, "Compress leaves", " parallel"), 0U);
+    delete db;
+
+    // nodes written in parallel can be loaded either way
+    for (int pass = 0; pass < 2; pass++) {
+        opts.compress_threads = pass ? 0 : 4;
+        db = DB::open("test_db", opts);
+        ASSERT_TRUE(db != NULL);
+        ASSERT_NO_FATAL_FAILURE(check_numbered(db, 0, 20000));
+        // cascading loads whole leaves
+        ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000));
+        db->flush();
+        if (pass) {
+            EXPECT_EQ(0U, debug_stat(db, "Compress leaves", " parallel"));
+        }
+        delete db;
+    }
+
+    destroy_options(opts);
+}
+
+TEST(DB, vectored_write) {
+    Options opts = test_options(16 * 1024, 8);
+
+    // written from one buffer at first, then rewritten vectored
+    for (int pass = 0; pass < 3; pass++) {
+        opts.compress = pass == 2 ? kNoCompress : kSnappyCompress;
+        opts.vectored_write_threshold = pass ? 1 : 0;
+        DB *db = DB::open("test_db", opts);
+        ASSERT_TRUE(db != NULL);
+        ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000, pass));
+        db->flush();
+
+        EXPECT_GT(debug_stat(db, "Written", " nodes"), 0U);
+        if (pass) {
+            EXPECT_GT(debug_stat(db, "Written", " vectored"), 0U);
+        } else {
+            EXPECT_EQ(0U, debug_stat(db, "Written", " vectored"));
+        }
+        delete db;
+
+        db = DB::open("test_db", opts);
+        ASSERT_TRUE(db != NULL);
+        ASSERT_NO_FATAL_FAILURE(check_numbered(db, 0, 20000, pass));
+        delete db;
+    }
+
+    destroy_options(opts);
+}
+
+TEST(DB, compress_bypass) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.compress = kSnappyCompress;
+
+    // values look like already compressed data
+    srand(0);
+    std::vector<string> values;
+    for (uint64_t i = 0; i < 2000; i++) {
+        string v;
+        for (size_t j = 0; j < 64; j++) {
+            v.push_back(rand() & 0xff);
+        }
+        values.push_back(v);
+    }
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    for (uint64_t i = 0; i < values.size(); i++ ) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, values[i])) << "put key " << i << " error";
+    }
+    db->flush();
+
+    // leaves're stored raw
+    EXPECT_GT(debug_stat(db, "Compress leaves", " bypassed") +
+              debug_stat(db, "Compress leaves", " skipped"), 0U);
+    delete db;
+
+    db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    for (uint64_t i = 0; i < values.size(); i++ ) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        string value;
+        ASSERT_TRUE(db->get(key, value)) << "get key " << i << " error";
+        EXPECT_EQ(values[i], value);
+    }
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, compress_dict) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.compress = kZstdCompress;
+    opts.compress_dict_size = 1024;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000));
+    db->flush();
+
+    // trained in background, and installed by nodes written afterwards
+    for (int i = 0; i < 100 &&
+         debug_stat(db, "Compress leaves", " with dictionary") == 0; i++) {
+        cascadb::usleep(10000);
+        ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 2000));
+        db->flush();
+    }
+    EXPECT_GT(debug_stat(db, "Compress leaves", " with dictionary"), 0U);
+    delete db;
+
+    // the dictionary is loaded from data file
+    opts.compress_dict_size = 0;
+    db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    ASSERT_NO_FATAL_FAILURE(check_numbered(db, 0, 20000));
+
+    // and nodes written afterwards're compressed with it
+    ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000, 1));
+    db->flush();
+    EXPECT_GT(debug_stat(db, "Compress leaves", " with dictionary"), 0U);
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, secondary_cache) {
+    Options opts = test_options(4 * 1024, 64);
+    opts.cache_limit = 32 * 1024;
+    opts.cache_secondary_limit = 1024 * 1024;
+    opts.compress = kSnappyCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000));
+
+    // only clean nodes're evicted, with their images, wait for
+    // the flusher to evict them
+    db->flush();
+    for (int i = 0; i < 100 &&
+         debug_stat(db, "Secondary cache", " bytes") == 0; i++) {
+        cascadb::usleep(10000);
+    }
+    EXPECT_GT(debug_stat(db, "Secondary cache", " bytes"), 0U);
+
+    // twice, nodes evicted at the first pass're read from images
+    for (int pass = 0; pass < 2; pass++) {
+        ASSERT_NO_FATAL_FAILURE(check_numbered(db, 0, 20000));
+    }
+    EXPECT_GT(debug_stat(db, "Secondary cache", " hits"), 0U);
+
+    delete db;
+    destroy_options(opts);
+}
+
+TEST(DB, warmup) {
+    Options opts = test_options(4 * 1024, 64);
+    opts.cache_warmup = true;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+    ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 10000));
+    delete db;
+    EXPECT_TRUE(opts.dir->file_exists("test_db.hot"));
+
+    db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    // wait for nodes to be prefetched, more than schema and root
+    for (int i = 0; i < 100 && debug_stat(db, "Total", " nodes") <= 2; i++) {
+        cascadb::usleep(10000);
+    }
+    EXPECT_GT(debug_stat(db, "Total", " nodes"), 2U);
+
+    ASSERT_NO_FATAL_FAILURE(check_numbered(db, 0, 10000));
+
+    delete db;
+    destroy_options(opts);
+}
+
 TEST(DB, batch_delete) {
     Options opts;
     opts.dir = create_ram_directory();
@@ -161,3 +838,173 @@ TEST(DB, batch_delete) {
     delete opts.dir;
     delete opts.comparator;
 }
+
+TEST(DB, keep_compressed_subblocks) {
+    uint64_t blocks[2];
+    uint64_t based[2];
+    for (int keep = 0; keep < 2; keep++) {
+        Options opts = test_options(16 * 1024, 8);
+        opts.leaf_node_page_size = 64 * 1024;
+        opts.compress = kSnappyCompress;
+        opts.vectored_write_threshold = 1;
+        opts.keep_compressed_subblocks = keep;
+
+        DB *db = DB::open("test_db", opts);
+        ASSERT_TRUE(db != NULL);
+        ASSERT_NO_FATAL_FAILURE(put_numbered(db, 0, 20000));
+        db->flush();
+        uint64_t loaded = debug_stat(db, "Compress leaves", " blocks");
+
+        // each round touches a few buckets of some leaves
+        for (uint64_t round = 0; round < 10; round++) {
+            ASSERT_NO_FATAL_FAILURE(put_numbered(db, round * 2000,
+                                                 round * 2000 + 100, round));
+            db->flush();
+        }
+        blocks[keep] = debug_stat(db, "Compress leaves", " blocks") - loaded;
+        based[keep] = debug_stat(db, "Written", " with base");
+        delete db;
+
+        db = DB::open("test_db", opts);
+        ASSERT_TRUE(db != NULL);
+        for (uint64_t round = 0; round < 10; round++) {
+            ASSERT_NO_FATAL_FAILURE(check_numbered(db, round * 2000,
+                                                   round * 2000 + 100, round));
+            ASSERT_NO_FATAL_FAILURE(check_numbered(db, round * 2000 + 100,
+                                                   round * 2000 + 2000));
+        }
+        delete db;
+        destroy_options(opts);
+    }
+
+    // unchanged buckets're referenced where they're on disk, the
+    // others're copied out rather than compressed again if they're kept
+    EXPECT_GT(based[0], 0U);
+    EXPECT_GT(based[1], 0U);
+    EXPECT_LE(blocks[1], blocks[0]);
+}
+
+struct WriterContext {
+    DB          *db;
+    uint64_t    count;
+    size_t      errors;
+};
+
+static void* writer_main(void *arg)
+{
+    WriterContext *ctx = (WriterContext*) arg;
+    for (uint64_t i = 0; i < ctx->count; i++) {
+        uint64_t k = i * 2 + 1;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        if (!ctx->db->put(key, "w")) {
+            ctx->errors ++;
+        }
+    }
+    return NULL;
+}
+
+TEST(DB, checkpoint) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.cache_limit = 256 * 1024;
+    opts.compress = kSnappyCompress;
+    opts.checkpoint_rate = 4 << 20;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    for (uint64_t i = 0; i < 20000; i++ ) {
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "v")) << "put key " << k << " error";
+    }
+
+    // writes go on while the checkpoint is copied
+    WriterContext ctx;
+    ctx.db = db;
+    ctx.count = 20000;
+    ctx.errors = 0;
+    Thread thr(writer_main);
+    thr.start(&ctx);
+
+    Directory *backup = create_ram_directory();
+    EXPECT_FALSE(db->checkpoint(opts.dir));
+    ASSERT_TRUE(db->checkpoint(backup));
+
+    thr.join();
+    EXPECT_EQ(0U, ctx.errors);
+    delete db;
+
+    Options backup_opts = opts;
+    backup_opts.dir = backup;
+    db = DB::open("test_db", backup_opts);
+    ASSERT_TRUE(db != NULL);
+    for (uint64_t i = 0; i < 40000; i++ ) {
+        Slice key = Slice((char*)&i, sizeof(uint64_t));
+        string value;
+        if (i % 2 == 0) {
+            ASSERT_TRUE(db->get(key, value)) << "get key " << i << " error";
+            EXPECT_EQ("v", value);
+        } else if (db->get(key, value)) {
+            // written after the checkpoint started or not
+            EXPECT_EQ("w", value);
+        }
+    }
+    delete db;
+
+    delete backup;
+    destroy_options(opts);
+}
+
+TEST(DB, concurrent_multi_get) {
+    Options opts = test_options(4 * 1024, 8);
+    opts.cache_limit = 64 * 1024;
+    opts.compress = kSnappyCompress;
+
+    DB *db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    for (uint64_t i = 0; i < 10000; i++ ) {
+        uint64_t k = i * 2;
+        Slice key = Slice((char*)&k, sizeof(uint64_t));
+        ASSERT_TRUE(db->put(key, "v")) << "put key " << k << " error";
+    }
+    delete db;
+
+    db = DB::open("test_db", opts);
+    ASSERT_TRUE(db != NULL);
+
+    // leaves're written and split while their buckets're being read
+    WriterContext ctx;
+    ctx.db = db;
+    ctx.count = 10000;
+    ctx.errors = 0;
+    Thread thr(writer_main);
+    thr.start(&ctx);
+
+    vector<uint64_t> ks;
+    for (uint64_t i = 0; i < 1000; i++) {
+        ks.push_back(i * 20);
+    }
+    vector<Slice> keys;
+    for (size_t i = 0; i < ks.size(); i++) {
+        keys.push_back(Slice((char*)&ks[i], sizeof(uint64_t)));
+    }
+
+    for (int round = 0; round < 20; round++) {
+        vector<Slice> values;
+        vector<bool> found;
+        EXPECT_EQ(keys.size(), db->multi_get(keys, values, found));
+        for (size_t i = 0; i < values.size(); i++) {
+            if (found[i]) {
+                EXPECT_EQ("v", values[i]);
+                values[i].destroy();
+            }
+        }
+    }
+
+    thr.join();
+    EXPECT_EQ(0U, ctx.errors);
+
+    delete db;
+    destroy_options(opts);
+}
@@ -23,3 +23,43 @@ TEST(Query, compare)
     EXPECT_TRUE(comp(Record("a", "1"), Msg(Put, "b", "1")));
     EXPECT_FALSE(comp(Msg(Put, "b", "1"), Record("a", "1")));
 }
+
+TEST(Query, key_prefix)
+{
+    EXPECT_EQ(0U, key_prefix(Slice()));
+    EXPECT_EQ(0x6100000000000000ULL, key_prefix(Slice("a")));
+    EXPECT_EQ(0x6162636465666768ULL, key_prefix(Slice("abcdefghij")));
+
+    // order preserving
+    EXPECT_TRUE(key_prefix(Slice("a")) < key_prefix(Slice("b")));
+    EXPECT_TRUE(key_prefix(Slice("ab")) < key_prefix(Slice("b")));
+    EXPECT_TRUE(key_prefix(Slice("\x7f")) < key_prefix(Slice("\x80")));
+
+    // ties
+    EXPECT_EQ(key_prefix(Slice("abcdefgh1")), key_prefix(Slice("abcdefgh2")));
+    EXPECT_EQ(key_prefix(Slice("a")), key_prefix(Slice("a\0", 2)));
+}
+
+TEST(Query, compare_keys)
+{
+    NumericComparator<int32_t> c;
+    int32_t a = -5, b = 3;
+    Slice sa((char *)&a, sizeof(a)), sb((char *)&b, sizeof(b));
+
+    EXPECT_TRUE(compare_keys(&c, c.kind(), sa, sb) < 0);
+    EXPECT_TRUE(compare_keys(&c, c.kind(), sb, sa) > 0);
+    EXPECT_EQ(0, compare_keys(&c, c.kind(), sa, sa));
+    // fallback to virtual call gives the same result
+    EXPECT_TRUE(compare_keys(&c, kCustomComparator, sa, sb) < 0);
+
+    // numeric prefixes never tie
+    EXPECT_TRUE(key_prefix(sa, c.kind()) < key_prefix(sb, c.kind()));
+
+    KeyComp comp(&c);
+    EXPECT_TRUE(comp(sa, Record(sb, sb)));
+    EXPECT_FALSE(comp(sb, Record(sa, sa)));
+
+    TypedKeyComp<kInt32Comparator> tcomp(&c);
+    EXPECT_TRUE(tcomp(sa, Record(sb, sb)));
+    EXPECT_FALSE(tcomp(sb, Record(sa, sa)));
+}
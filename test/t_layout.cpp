@@ -2,9 +2,13 @@
 #include <gtest/gtest.h>
 #include <stdlib.h>
 
+#define private public
+#define protected public
+
 #include "sys/sys.h"
 #include "store/ram_directory.h"
 #include "serialize/layout.h"
+#include "util/crc.h"
 
 using namespace std;
 using namespace cascadb;
@@ -142,9 +146,9 @@ TEST_F(LayoutTest, async_read)
 
     OpenLayout(opts, false);
     AsyncRead();
-    CloseLayout();
-
+    // blocks're freed while a layout is alive
     ClearWriteBufs();
+    CloseLayout();
 }
 
 TEST_F(LayoutTest, blocking_read)
@@ -157,9 +161,9 @@ TEST_F(LayoutTest, blocking_read)
     
     OpenLayout(opts, false);
     BlockingRead();
-    CloseLayout();
-
+    // blocks're freed while a layout is alive
     ClearWriteBufs();
+    CloseLayout();
 }
 
 TEST_F(LayoutTest, async_read_compress)
@@ -173,9 +177,9 @@ TEST_F(LayoutTest, async_read_compress)
 
     OpenLayout(opts, false);
     AsyncRead();
-    CloseLayout();
-
+    // blocks're freed while a layout is alive
     ClearWriteBufs();
+    CloseLayout();
 }
 
 TEST_F(LayoutTest, blocking_read_compress)
@@ -189,9 +193,9 @@ TEST_F(LayoutTest, blocking_read_compress)
     
     OpenLayout(opts, false);
     BlockingRead();
-    CloseLayout();
-
+    // blocks're freed while a layout is alive
     ClearWriteBufs();
+    CloseLayout();
 }
 
 TEST_F(LayoutTest, update)
@@ -204,9 +208,9 @@ TEST_F(LayoutTest, update)
 
     OpenLayout(opts, false);
     AsyncRead();
-    CloseLayout();
-
+    // blocks're freed while a layout is alive
     ClearWriteBufs();
+    CloseLayout();
 
     OpenLayout(opts, false);
     Write();    // update all records
@@ -214,9 +218,9 @@ TEST_F(LayoutTest, update)
 
     OpenLayout(opts, false);
     AsyncRead();
-    CloseLayout();
-
+    // blocks're freed while a layout is alive
     ClearWriteBufs();
+    CloseLayout();
 
     uint64_t len1 = GetLength();
 
@@ -228,3 +232,395 @@ TEST_F(LayoutTest, update)
 
     EXPECT_TRUE(len2 > len1 * 0.9 && len2 < len1 * 1.1); // fragment collection should works
 }
+
+TEST_F(LayoutTest, vectored_write)
+{
+    Options opts;
+    OpenLayout(opts, true);
+
+    // skeleton and two sub-blocks, each sub-block starts at a page
+    size_t sizes[3] = {100, PAGE_SIZE + 1, 5000};
+    results.clear();
+    vector<Block*> blocks[10];
+    for (int i = 0; i < 10; i++) {
+        for (int j = 0; j < 3; j++) {
+            Block *block = layout->create(sizes[j]);
+            BlockWriter writer(block);
+            for (size_t k = 0; k < sizes[j]; k++) {
+                writer.writeUInt8((i + j) & 0xff);
+            }
+            blocks[i].push_back(block);
+        }
+        Callback *cb = new Callback((LayoutTest*)this, &LayoutTest::callback, (bid_t)i);
+        layout->async_write(i, blocks[i], sizes[0], kNoBase, cb);
+    }
+    while(results.size() != 10) cascadb::usleep(10000); // 10ms
+
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(results[i]);
+
+        Block *block = layout->read(i, false);
+        ASSERT_TRUE(block != NULL);
+        ASSERT_EQ(PAGE_SIZE * 3 + sizes[2], block->size());
+        size_t offset = 0;
+        for (int j = 0; j < 3; j++) {
+            ASSERT_EQ(0, memcmp(blocks[i][j]->start(),
+                                block->start() + offset, sizes[j]));
+            offset += PAGE_ROUND_UP(sizes[j]);
+        }
+        layout->destroy(block);
+
+        // sub-block read by its offset
+        Block *sub = layout->read(i, PAGE_SIZE * 3, sizes[2],
+                                  crc32(blocks[i][2]->start(), sizes[2]));
+        ASSERT_TRUE(sub != NULL);
+        ASSERT_EQ(0, memcmp(blocks[i][2]->start(), sub->start(), sizes[2]));
+        layout->destroy(sub);
+
+        for (int j = 0; j < 3; j++) {
+            layout->destroy(blocks[i][j]);
+        }
+    }
+    CloseLayout();
+
+    OpenLayout(opts, false);
+    Block *block = layout->read(0, true);
+    ASSERT_TRUE(block != NULL);
+    ASSERT_EQ(sizes[0], block->size());
+    layout->destroy(block);
+    CloseLayout();
+}
+
+TEST_F(LayoutTest, index_delta)
+{
+    Options opts;
+    opts.index_delta_ratio = 50;
+
+    OpenLayout(opts, true);
+    Write();
+    CloseLayout();
+
+    // a few blocks're rewritten or deleted at each checkpoint,
+    // changes pile up in the delta until a full index is written
+    for (int round = 0; round < 20; round++) {
+        OpenLayout(opts, false);
+        results.clear();
+        for (int i = round * 50; i < round * 50 + 40; i++) {
+            layout->destroy(write_bufs[i]);
+            write_bufs[i] = layout->create(100);
+            BlockWriter writer(write_bufs[i]);
+            for (size_t j = 0; j < 100; j++) {
+                writer.writeUInt8((i + round) & 0xff);
+            }
+            Callback *cb = new Callback((LayoutTest*)this, &LayoutTest::callback, (bid_t)i);
+            layout->async_write(i, write_bufs[i], 100, cb);
+        }
+        while(results.size() != 40) cascadb::usleep(10000); // 10ms
+        for (int i = round * 50 + 40; i < round * 50 + 50; i++) {
+            layout->delete_block(i);
+        }
+        ASSERT_TRUE(layout->flush_meta());
+        CloseLayout();
+    }
+
+    OpenLayout(opts, false);
+    for (int i = 0; i < 1000; i++) {
+        Block *block = layout->read(i, false);
+        if (i % 50 >= 40) {
+            ASSERT_TRUE(block == NULL);
+            continue;
+        }
+        ASSERT_TRUE(block != NULL);
+        ASSERT_EQ(write_bufs[i]->size(), block->size());
+        ASSERT_EQ(0, memcmp(write_bufs[i]->start(), block->start(), block->size()));
+        layout->destroy(block);
+    }
+    ClearWriteBufs();
+    CloseLayout();
+}
+
+TEST_F(LayoutTest, base_extent)
+{
+    Options opts;
+    OpenLayout(opts, true);
+
+    // skeleton and two sub-blocks, then the second sub-block is
+    // rewritten while the first one is left in base
+    bid_t bid = 5000;
+    size_t sizes[3] = {100, 5000, 3000};
+    vector<Block*> blocks;
+    for (int j = 0; j < 3; j++) {
+        Block *block = layout->create(sizes[j]);
+        BlockWriter writer(block);
+        for (size_t k = 0; k < sizes[j]; k++) {
+            writer.writeUInt8(j + 1);
+        }
+        blocks.push_back(block);
+    }
+    vector<Block*> update(blocks.begin(), blocks.begin() + 1);
+    update.push_back(blocks[2]);
+
+    results.clear();
+    Callback *cb = new Callback((LayoutTest*)this, &LayoutTest::callback, bid);
+    layout->async_write(bid, blocks, sizes[0], kNoBase, cb);
+    while(results.size() != 1) cascadb::usleep(10000); // 10ms
+    ASSERT_TRUE(results[bid]);
+    BlockMeta old;
+    ASSERT_TRUE(layout->get_block_meta(bid, old));
+
+    // base must be the block replaced
+    results.clear();
+    cb = new Callback((LayoutTest*)this, &LayoutTest::callback, bid);
+    layout->async_write(bid, update, sizes[0], kKeepBase, cb);
+    while(results.size() != 1) cascadb::usleep(10000); // 10ms
+    ASSERT_FALSE(results[bid]);
+
+    results.clear();
+    cb = new Callback((LayoutTest*)this, &LayoutTest::callback, bid);
+    layout->async_write(bid, update, sizes[0], kReplacedAsBase, cb);
+    while(results.size() != 1) cascadb::usleep(10000); // 10ms
+    ASSERT_TRUE(results[bid]);
+    BlockMeta meta;
+    ASSERT_TRUE(layout->get_block_meta(bid, meta));
+    EXPECT_EQ(old.offset, meta.base_offset);
+    EXPECT_EQ(old.total_size, meta.base_size);
+    EXPECT_EQ(PAGE_SIZE + sizes[2], meta.total_size);
+
+    uint32_t crc = crc32(blocks[1]->start(), sizes[1]);
+    for (int round = 0; round < 3; round++) {
+        Block *block = layout->read(bid, PAGE_SIZE | SUBBLOCK_IN_BASE,
+                                    sizes[1], crc);
+        ASSERT_TRUE(block != NULL);
+        ASSERT_EQ(0, memcmp(blocks[1]->start(), block->start(), sizes[1]));
+        layout->destroy(block);
+
+        block = layout->read_base(bid);
+        ASSERT_TRUE(block != NULL);
+        ASSERT_EQ(old.total_size, block->size());
+        ASSERT_EQ(0, memcmp(blocks[2]->start(),
+                            block->start() + PAGE_SIZE + PAGE_ROUND_UP(sizes[1]),
+                            sizes[2]));
+        layout->destroy(block);
+
+        // base isn't given to other blocks, neither after the
+        // checkpoint nor once holes're found again when reopened
+        if (round == 2) {
+            break;
+        }
+        ClearWriteBufs();
+        if (round == 0) {
+            ASSERT_TRUE(layout->flush());
+        } else {
+            CloseLayout();
+            OpenLayout(opts, false);
+            if (layout->loader_ && layout->loader_->thread) {
+                layout->loader_->thread->join();
+            }
+        }
+        Write();
+    }
+
+    // base is freed once it isn't referenced
+    results.clear();
+    cb = new Callback((LayoutTest*)this, &LayoutTest::callback, bid);
+    layout->async_write(bid, blocks, sizes[0], kNoBase, cb);
+    while(results.size() != 1) cascadb::usleep(10000); // 10ms
+    ASSERT_TRUE(results[bid]);
+    ASSERT_TRUE(layout->read_base(bid) == NULL);
+    bool freed = false;
+    for (Layout::HoleListType::iterator it = layout->fly_hole_list_.begin();
+        it != layout->fly_hole_list_.end(); it++) {
+        if (it->offset == old.offset &&
+            it->size == PAGE_ROUND_UP(old.total_size)) {
+            freed = true;
+        }
+    }
+    EXPECT_TRUE(freed);
+
+    for (int j = 0; j < 3; j++) {
+        layout->destroy(blocks[j]);
+    }
+    ClearWriteBufs();
+    CloseLayout();
+}
+
+TEST_F(LayoutTest, background_load)
+{
+    Options opts;
+
+    OpenLayout(opts, true);
+    Write();
+    CloseLayout();
+
+    uint64_t len1 = 0;
+    // blocks're read, written and deleted right after open,
+    // while the index may be loaded in background
+    for (int round = 0; round < 5; round++) {
+        OpenLayout(opts, false);
+        for (int i = 0; i < 1000; i++) {
+            Block *block = layout->read(i, false);
+            // deleted in the last round
+            if (round && i >= 890 + round * 10 && i < 900 + round * 10) {
+                ASSERT_TRUE(block == NULL);
+                continue;
+            }
+            ASSERT_TRUE(block != NULL);
+            ASSERT_EQ(0, memcmp(write_bufs[i]->start(), block->start(), block->size()));
+            layout->destroy(block);
+        }
+        ClearWriteBufs();
+        Write();
+        for (int i = 900 + round * 10; i < 900 + round * 10 + 10; i++) {
+            layout->delete_block(i);
+        }
+        CloseLayout();
+        if (round == 0) {
+            len1 = GetLength();
+        }
+    }
+
+    OpenLayout(opts, false);
+    for (int i = 0; i < 1000; i++) {
+        Block *block = layout->read(i, false);
+        if (i >= 940 && i < 950) {
+            ASSERT_TRUE(block == NULL);
+            continue;
+        }
+        ASSERT_TRUE(block != NULL);
+        ASSERT_EQ(write_bufs[i]->size(), block->size());
+        ASSERT_EQ(0, memcmp(write_bufs[i]->start(), block->start(), block->size()));
+        layout->destroy(block);
+    }
+    ClearWriteBufs();
+    CloseLayout();
+
+    // holes found in background're reused
+    EXPECT_LT(GetLength(), len1 * 1.1);
+}
+
+TEST_F(LayoutTest, superblock_generation)
+{
+    Options opts;
+
+    OpenLayout(opts, true);
+    Write();
+    CloseLayout();
+
+    Slice old_copy = Slice::alloc(SUPER_BLOCK_SIZE);
+    ASSERT_TRUE(file->read(0, old_copy).succ);
+
+    OpenLayout(opts, false);
+    ClearWriteBufs();
+    Write();    // update all records
+    CloseLayout();
+
+    // the 1st copy is left behind as if crashed while it's written,
+    // the newer 2nd copy should be picked up
+    ASSERT_TRUE(file->write(0, old_copy).succ);
+    OpenLayout(opts, false);
+    BlockingRead();
+    CloseLayout();
+
+    // the 1st copy is broken, the 2nd one is used
+    memset((char *)old_copy.data(), 0, SUPER_BLOCK_SIZE);
+    ASSERT_TRUE(file->write(0, old_copy).succ);
+    OpenLayout(opts, false);
+    BlockingRead();
+    ClearWriteBufs();
+    CloseLayout();
+
+    old_copy.destroy();
+}
+
+TEST_F(LayoutTest, broken_index)
+{
+    Options opts;
+
+    OpenLayout(opts, true);
+    Write();
+    CloseLayout();
+
+    OpenLayout(opts, false);
+    ClearWriteBufs();
+    Write();
+    ASSERT_TRUE(layout->flush());
+    SuperBlock *sb0 = layout->load_superblock(0);
+    SuperBlock *sb1 = layout->load_superblock(SUPER_BLOCK_SIZE);
+    ASSERT_TRUE(sb0 && sb1);
+    SuperBlock *newer = (sb0->generation > sb1->generation) ? sb0 : sb1;
+    ASSERT_TRUE(newer->index_block_meta);
+    uint64_t offset = newer->index_block_meta->offset;
+    layout->free_superblock(sb0);
+    layout->free_superblock(sb1);
+    ClearWriteBufs();
+    delete layout;
+
+    // index of the newer superblock is broken, the older one
+    // mustn't be used since its blocks may be overwritten
+    Slice page = Slice::alloc(PAGE_SIZE);
+    ASSERT_TRUE(file->read(offset, page).succ);
+    memset((char *)page.data(), 0xff, PAGE_SIZE);
+    ASSERT_TRUE(file->write(offset, page).succ);
+    page.destroy();
+
+    layout = new Layout(file, dir->file_length("layout_test"), opts);
+    EXPECT_FALSE(layout->init(false));
+    delete layout;
+}
+
+TEST_F(LayoutTest, index_pages)
+{
+    Options opts;
+
+    OpenLayout(opts, true);
+    Write();
+    CloseLayout();
+
+    OpenLayout(opts, false);
+    if (layout->loader_->thread) {
+        layout->loader_->thread->join();
+    }
+    BlockMeta index = *layout->superblock_->index_block_meta;
+    size_t pages = (1000 + INDEX_PAGE_ENTRIES - 1) / INDEX_PAGE_ENTRIES;
+    ASSERT_EQ(pages, layout->loader_->header.bids.size());
+    delete layout;
+
+    // a broken page is found when it's read, not at open
+    size_t broken = 5;
+    uint64_t offset = index.offset + PAGE_ROUND_UP(index.skeleton_size) +
+        broken * INDEX_PAGE_SIZE;
+    Slice page = Slice::alloc(PAGE_SIZE);
+    ASSERT_TRUE(file->read(offset, page).succ);
+    memset((char *)page.data(), 0xff, 64);
+    ASSERT_TRUE(file->write(offset, page).succ);
+    page.destroy();
+
+    OpenLayout(opts, false);
+    if (layout->loader_->thread) {
+        layout->loader_->thread->join();
+    }
+    EXPECT_TRUE(layout->loader_->loading);
+
+    // entries're searched page by page
+    for (int i = 0; i < 1000; i++) {
+        Block *block = layout->read(i, false);
+        if (i / INDEX_PAGE_ENTRIES == broken) {
+            ASSERT_TRUE(block == NULL);
+            continue;
+        }
+        ASSERT_TRUE(block != NULL);
+        ASSERT_EQ(write_bufs[i]->size(), block->size());
+        ASSERT_EQ(0, memcmp(write_bufs[i]->start(), block->start(), block->size()));
+        layout->destroy(block);
+    }
+    EXPECT_EQ(pages - 1, layout->loader_->pages.size());
+
+    // the full index isn't written while it isn't loaded
+    layout->delete_block(0);
+    ASSERT_TRUE(layout->flush());
+    EXPECT_EQ(index.offset, layout->superblock_->index_block_meta->offset);
+    EXPECT_TRUE(layout->superblock_->delta_block_meta != NULL);
+
+    ClearWriteBufs();
+    CloseLayout();
+}
@@ -89,6 +89,33 @@ TEST(MsgBuf, append)
     CHK_MSG(mb1.get(3), Del, "c", Slice());
 }
 
+TEST(MsgBuf, append_numeric)
+{
+    NumericComparator<uint64_t> comp;
+    MsgBuf mb1(&comp);
+    MsgBuf mb2(&comp);
+
+    // would overflow if compared by subtraction
+    uint64_t keys[] = {0xffffffffffffff00ULL, 1, 0x8000000000000000ULL, 2};
+    for (size_t i = 0; i < 4; i++) {
+        Slice k((char *)&keys[i], sizeof(uint64_t));
+        if (i % 2) {
+            PUT(mb1, k, "1");
+        } else {
+            PUT(mb2, k, "2");
+        }
+    }
+
+    mb1.append(mb2.begin(), mb2.end());
+    mb2.clear();
+
+    EXPECT_EQ(4U, mb1.count());
+    uint64_t expected[] = {1, 2, 0x8000000000000000ULL, 0xffffffffffffff00ULL};
+    for (size_t i = 0; i < 4; i++) {
+        EXPECT_EQ(Slice((char *)&expected[i], sizeof(uint64_t)), mb1.get(i).key);
+    }
+}
+
 TEST(MsgBuf, find)
 {
     LexicalComparator comp;
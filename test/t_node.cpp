@@ -204,6 +204,34 @@ TEST(Tree, bootstrap)
     delete opts.comparator;
 }
 
+TEST(Tree, node_compress)
+{
+    Options opts;
+    opts.comparator = new LexicalComparator();
+    opts.compress = kSnappyCompress;
+    // inner nodes stay uncompressed, leaves inherit compress
+    opts.inner_node_compress = kNoCompress;
+
+    Directory *dir = new RAMDirectory();
+    AIOFile *file = dir->open_aio_file("tree_test");
+    Layout *layout = new Layout(file, 0, opts);
+    ASSERT_TRUE(layout->init(true));
+    Cache *cache = new Cache(opts);
+    ASSERT_TRUE(cache->init());
+    Tree *tree = new Tree("", opts, cache, layout);
+    ASSERT_TRUE(tree->init());
+
+    EXPECT_EQ(kNoCompress, tree->inner_compressor_->method_);
+    EXPECT_EQ(kSnappyCompress, tree->leaf_compressor_->method_);
+
+    delete tree;
+    delete cache;
+    delete layout;
+    delete file;
+    delete dir;
+    delete opts.comparator;
+}
+
 TEST(InnerNode, serialize)
 {
     Options opts;
@@ -272,6 +300,55 @@ TEST(InnerNode, serialize)
     delete opts.comparator;
 }
 
+TEST(InnerNode, find_pivot)
+{
+    Options opts;
+    opts.comparator = new LexicalComparator();
+
+    Directory *dir = new RAMDirectory();
+    AIOFile *file = dir->open_aio_file("tree_test");
+    Layout *layout = new Layout(file, 0, opts);
+    ASSERT_TRUE(layout->init(true));
+    Cache *cache = new Cache(opts);
+    ASSERT_TRUE(cache->init());
+    Tree *tree = new Tree("", opts, cache, layout);
+    ASSERT_TRUE(tree->init());
+    EXPECT_EQ(kLexicalComparator, tree->comparator_kind_);
+
+    // pivots share prefixes with each other
+    const char *keys[] = {"b", "b\x01", "bbbbbbbb", "bbbbbbbb1",
+        "bbbbbbbb2", "bbbbbbbc", "c", "d\xff"};
+    size_t n = sizeof(keys)/sizeof(keys[0]);
+
+    InnerNode n1("", NID_START, tree);
+    n1.pivots_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        n1.pivots_[i].key = Slice(keys[i]).clone();
+        n1.pivots_[i].msgbuf = NULL;
+    }
+    n1.refresh_pivot_prefixes();
+    EXPECT_EQ(n, n1.pivot_prefixes_.size());
+
+    const char *queries[] = {"", "a", "b", "b\x01", "b\x02", "bb",
+        "bbbbbbbb", "bbbbbbbb0", "bbbbbbbb1", "bbbbbbbb15", "bbbbbbbb3",
+        "bbbbbbbc", "bbbbbbbc0", "c", "d", "d\xff", "e"};
+    for (size_t i = 0; i < sizeof(queries)/sizeof(queries[0]); i++) {
+        Slice q(queries[i]);
+        int expected = 0;
+        while ((size_t)expected < n && Slice(keys[expected]).compare(q) <= 0) {
+            expected ++;
+        }
+        EXPECT_EQ(expected, n1.find_pivot(q)) << "query " << queries[i];
+    }
+
+    delete tree;
+    delete cache;
+    delete layout;
+    delete file;
+    delete dir;
+    delete opts.comparator;
+}
+
 /*
 TEST(Leaf, serialize)
 {
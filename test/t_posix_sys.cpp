@@ -144,3 +144,35 @@ TEST(RWLock, rdlock) {
     thr1.join();
     thr2.join();
 }
+
+TEST(Time, coarse) {
+    uint64_t t1 = coarse_now_micros();
+    cascadb::usleep(100000); // 100 ms
+    uint64_t t2 = coarse_now_micros();
+
+    // sleep may oversleep on a busy host, only the lower bound is
+    // reliable, minus the coarse clock's resolution
+    EXPECT_GE(t2 - t1, 90000U);
+}
+
+int count5;
+void *body5(void* arg)
+{
+    for (int i = 0; i < 100000; i++) {
+        atomic_add_fetch(&count5, 1);
+    }
+    return NULL;
+}
+
+TEST(Atomic, add) {
+    Thread thr1(body5);
+    Thread thr2(body5);
+    count5 = 0;
+
+    thr1.start(NULL);
+    thr2.start(NULL);
+    thr1.join();
+    thr2.join();
+
+    EXPECT_EQ(200000, atomic_load(&count5));
+}
@@ -0,0 +1,137 @@
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "util/worker_pool.h"
+
+using namespace std;
+using namespace cascadb;
+
+class Recorder {
+public:
+    void record(int v, bool succ) {
+        ScopedMutex lock(&mtx);
+        values.push_back(v);
+    }
+
+    Mutex       mtx;
+    vector<int> values;
+};
+
+TEST(WorkerPool, ordered) {
+    Recorder r;
+    WorkerPool pool(4);
+    ASSERT_TRUE(pool.init());
+
+    // same hint, same thread
+    for (int i = 0; i < 1000; i++) {
+        pool.submit(7, new Callback(&r, &Recorder::record, i));
+    }
+    pool.stop();
+
+    ASSERT_EQ(1000U, r.values.size());
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(i, r.values[i]);
+    }
+}
+
+TEST(WorkerPool, inline) {
+    Recorder r;
+    WorkerPool pool(0);
+    ASSERT_TRUE(pool.init());
+
+    pool.submit(0, new Callback(&r, &Recorder::record, 1));
+    ASSERT_EQ(1U, r.values.size());
+    EXPECT_EQ(0U, pool.pending());
+}
+
+class Blocker {
+public:
+    Blocker() : cond(&mtx), blocked(true) {}
+
+    void block(int v, bool succ) {
+        ScopedMutex lock(&mtx);
+        while (blocked) {
+            cond.wait();
+        }
+    }
+
+    void release() {
+        ScopedMutex lock(&mtx);
+        blocked = false;
+        cond.notify_all();
+    }
+
+    Mutex       mtx;
+    CondVar     cond;
+    bool        blocked;
+};
+
+TEST(WorkerPool, steal) {
+    Recorder r;
+    Blocker b;
+    WorkerPool pool(4);
+    ASSERT_TRUE(pool.init());
+
+    // queued to the thread blocked, but taken by others,
+    // except those of the same hint
+    pool.submit(0, new Callback(&b, &Blocker::block, 0));
+    pool.submit(0, new Callback(&r, &Recorder::record, 0));
+    for (int i = 1; i <= 10; i++) {
+        pool.submit(i * 4, new Callback(&r, &Recorder::record, i));
+    }
+    size_t n = 0;
+    for (int i = 0; i < 1000 && n < 10; i++) {
+        cascadb::usleep(1000);
+        ScopedMutex lock(&r.mtx);
+        n = r.values.size();
+    }
+    EXPECT_EQ(10U, n);
+    EXPECT_EQ(1U, pool.pending());
+
+    b.release();
+    pool.stop();
+    ASSERT_EQ(11U, r.values.size());
+    EXPECT_EQ(0, r.values.back());
+}
+
+struct SubmitContext {
+    WorkerPool  *pool;
+    Recorder    *recorder;
+};
+
+static void* submit_main(void *arg)
+{
+    SubmitContext *ctx = (SubmitContext*) arg;
+    ctx->pool->submit(0, new Callback(ctx->recorder, &Recorder::record, 2));
+    return NULL;
+}
+
+TEST(WorkerPool, bounded) {
+    Recorder r;
+    Blocker b;
+    WorkerPool pool(1, 1);
+    ASSERT_TRUE(pool.init());
+
+    pool.submit(0, new Callback(&b, &Blocker::block, 0));
+    while (pool.pending()) {
+        cascadb::usleep(1000);
+    }
+    pool.submit(0, new Callback(&r, &Recorder::record, 1));
+
+    // queue is full, blocked until the task queued is taken
+    SubmitContext ctx;
+    ctx.pool = &pool;
+    ctx.recorder = &r;
+    Thread thr(submit_main);
+    thr.start(&ctx);
+    cascadb::usleep(10000);
+    EXPECT_EQ(1U, pool.pending());
+
+    b.release();
+    thr.join();
+    pool.stop();
+    ASSERT_EQ(2U, r.values.size());
+    EXPECT_EQ(1, r.values[0]);
+    EXPECT_EQ(2, r.values[1]);
+}
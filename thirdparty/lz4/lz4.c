@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * LZ4 block format codec, see lz4.h.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz4.h"
+
+#define MINMATCH        4
+#define LASTLITERALS    5       /* the last 5 bytes're always literals */
+#define MFLIMIT         12      /* the last match starts 12 bytes before end */
+#define MAX_DISTANCE    65535
+#define ML_BITS         4
+#define ML_MASK         ((1U << ML_BITS) - 1)
+#define RUN_MASK        ((1U << (8 - ML_BITS)) - 1)
+#define HASH_LOG        12
+#define SKIP_TRIGGER    6       /* step grows every 64 bytes without match */
+
+static uint32_t read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - HASH_LOG);
+}
+
+static uint8_t* write_length(uint8_t* op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+int LZ4_compressBound(int inputSize)
+{
+    return LZ4_COMPRESSBOUND(inputSize);
+}
+
+int LZ4_compress_default(const char* src, char* dst, int srcSize, int dstCapacity)
+{
+    const uint8_t* const base = (const uint8_t*)src;
+    const uint8_t* const iend = base + srcSize;
+    const uint8_t* const mflimit = iend - MFLIMIT;
+    const uint8_t* const matchlimit = iend - LASTLITERALS;
+    const uint8_t* ip = base;
+    const uint8_t* anchor = base;
+    uint8_t* op = (uint8_t*)dst;
+    uint32_t table[1 << HASH_LOG];
+    size_t litlen;
+
+    if (srcSize < 0 || srcSize > LZ4_MAX_INPUT_SIZE) return 0;
+    if (dstCapacity < LZ4_compressBound(srcSize)) return 0;
+
+    memset(table, 0, sizeof(table));
+
+    if (srcSize >= MFLIMIT + 1) {
+        unsigned attempts = 1U << SKIP_TRIGGER;
+
+        while (ip < mflimit) {
+            uint32_t sequence = read32(ip);
+            uint32_t h = hash32(sequence);
+            const uint8_t* ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+
+            if (ref < ip && ip - ref <= MAX_DISTANCE && read32(ref) == sequence) {
+                const uint8_t* mp = ip + MINMATCH;
+                const uint8_t* rp = ref + MINMATCH;
+                uint8_t* token;
+                size_t mlen;
+
+                /* extend backwards over literals */
+                while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                    ip--;
+                    ref--;
+                }
+
+                while (mp < matchlimit && *mp == *rp) {
+                    mp++;
+                    rp++;
+                }
+
+                litlen = (size_t)(ip - anchor);
+                mlen = (size_t)(mp - ip) - MINMATCH;
+
+                token = op++;
+                if (litlen >= RUN_MASK) {
+                    *token = (uint8_t)(RUN_MASK << ML_BITS);
+                    op = write_length(op, litlen - RUN_MASK);
+                } else {
+                    *token = (uint8_t)(litlen << ML_BITS);
+                }
+                memcpy(op, anchor, litlen);
+                op += litlen;
+
+                *op++ = (uint8_t)(ip - ref);
+                *op++ = (uint8_t)((ip - ref) >> 8);
+
+                if (mlen >= ML_MASK) {
+                    *token |= ML_MASK;
+                    op = write_length(op, mlen - ML_MASK);
+                } else {
+                    *token |= (uint8_t)mlen;
+                }
+
+                /* remember a position inside the match */
+                if (mp - 2 < mflimit) {
+                    table[hash32(read32(mp - 2))] = (uint32_t)(mp - 2 - base);
+                }
+
+                ip = mp;
+                anchor = ip;
+                attempts = 1U << SKIP_TRIGGER;
+                continue;
+            }
+
+            ip += attempts++ >> SKIP_TRIGGER;
+        }
+    }
+
+    /* last literals */
+    litlen = (size_t)(iend - anchor);
+    if (litlen >= RUN_MASK) {
+        *op++ = (uint8_t)(RUN_MASK << ML_BITS);
+        op = write_length(op, litlen - RUN_MASK);
+    } else {
+        *op++ = (uint8_t)(litlen << ML_BITS);
+    }
+    memcpy(op, anchor, litlen);
+    op += litlen;
+
+    return (int)(op - (uint8_t*)dst);
+}
+
+int LZ4_decompress_safe(const char* src, char* dst, int compressedSize, int dstCapacity)
+{
+    const uint8_t* ip = (const uint8_t*)src;
+    const uint8_t* const iend = ip + compressedSize;
+    uint8_t* op = (uint8_t*)dst;
+    uint8_t* const oend = op + dstCapacity;
+
+    if (compressedSize <= 0 || dstCapacity < 0) return -1;
+
+    while (1) {
+        unsigned token;
+        size_t len;
+        size_t offset;
+        const uint8_t* match;
+
+        if (ip >= iend) return -1;
+        token = *ip++;
+
+        /* literals */
+        len = token >> ML_BITS;
+        if (len == RUN_MASK) {
+            unsigned s;
+            do {
+                if (ip >= iend) return -1;
+                s = *ip++;
+                len += s;
+            } while (s == 255);
+        }
+        if (len > (size_t)(iend - ip) || len > (size_t)(oend - op)) return -1;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+
+        /* the last sequence has literals only */
+        if (ip == iend) break;
+
+        /* match */
+        if (iend - ip < 2) return -1;
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t*)dst)) return -1;
+
+        len = token & ML_MASK;
+        if (len == ML_MASK) {
+            unsigned s;
+            do {
+                if (ip >= iend) return -1;
+                s = *ip++;
+                len += s;
+            } while (s == 255);
+        }
+        len += MINMATCH;
+        if (len > (size_t)(oend - op)) return -1;
+
+        match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        } else {
+            /* overlapped, repeats the pattern */
+            while (len--) {
+                *op++ = *match++;
+            }
+        }
+    }
+
+    return (int)(op - (uint8_t*)dst);
+}
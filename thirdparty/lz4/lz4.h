@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2013 The CascaDB Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file. See the AUTHORS file for names of contributors.
+ */
+
+/*
+ * LZ4 block format codec.
+ *
+ * A compact implementation of the LZ4 block format as specified in
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md,
+ * blocks're interchangeable with the reference implementation,
+ * the functions declared here're a subset of its lz4.h with the same
+ * signatures, semantics and include guard, so upstream lz4.c/lz4.h
+ * drop in unchanged.
+ */
+
+#ifndef LZ4_H_2983827168210
+#define LZ4_H_2983827168210
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LZ4_MAX_INPUT_SIZE        0x7E000000   /* 2 113 929 216 bytes */
+
+#define LZ4_COMPRESSBOUND(isize)  ((unsigned)(isize) > (unsigned)LZ4_MAX_INPUT_SIZE ? \
+                                   0 : (isize) + ((isize)/255) + 16)
+
+/*
+ * Maximum size of compressed output in worst case,
+ * 0 if input size is too large
+ */
+int LZ4_compressBound(int inputSize);
+
+/*
+ * Compress srcSize bytes from src into dst, which must hold at least
+ * dstCapacity bytes.
+ * Return the number of bytes written into dst, or 0 if compression fails,
+ * compression always succeeds if dstCapacity >= LZ4_compressBound(srcSize)
+ */
+int LZ4_compress_default(const char* src, char* dst, int srcSize, int dstCapacity);
+
+/*
+ * Decompress a block of compressedSize bytes into dst, which holds
+ * at most dstCapacity bytes, never writes outside dst and never reads
+ * outside src even if the block is malformed.
+ * Return the number of bytes decompressed, or a negative value if
+ * the block is malformed or dst is too small
+ */
+int LZ4_decompress_safe(const char* src, char* dst, int compressedSize, int dstCapacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif